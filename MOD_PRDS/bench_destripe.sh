@@ -0,0 +1,235 @@
+#!/bin/bash
+# Copyright (c) 2011, Brian Case
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+
+###############################################################################
+## @brief benchmark modis_destripe over synthetic striped granules
+##
+## @details
+## generates a synthetic striped MOD021KM and MOD02HKM granule and the same
+## granules without the stripes with mkstripe (once, kept in the work dir),
+## using the destriping configuration in the data dir, and runs
+## modis_destripe -of over each serially (the reference run) and with
+## threads.  the threaded output must have the same data as the reference
+## output (stripestat compares the bands, the files are not byte identical
+## since the threads write the hdf chunks in the order they finish).
+## -r also runs a reference modis_destripe binary (eg. a build of the
+## previous release, which may not have -of: it destripes a copy of the
+## granule in place) and reports its time and residual stripe.
+##
+## for each destriped band the destripe time (modis_destripe -verbose), the
+## peak memory of the run and the residual stripe (stripestat, the RMS of the
+## detector mean differences to the scene in DN) before and after
+## destriping are reported.  results are printed as a table and written to
+## <workdir>/bench_destripe.csv.  the exit status is 1 if a run fails, the
+## threaded output differs or a residual stripe is over -s (default 3 DN)
+##
+## usage: bench_destripe.sh [-b bindir] [-w workdir] [-D datadir]
+##                          [-n nscan] [-R resolutions] [-j threads]
+##                          [-r reference modis_destripe]
+##                          [-s max residual stripe] [-x "extra options"]
+##
+###############################################################################
+
+bindir="."
+workdir="bench"
+datadir=""
+nscan=""
+resolutions="1km 500m"
+threads=4
+refdestripe=""
+maxstripe=3
+extra=""
+
+while getopts "b:w:D:n:R:j:r:s:x:h" opt
+do
+    case $opt in
+        b) bindir="$OPTARG" ;;
+        w) workdir="$OPTARG" ;;
+        D) datadir="$OPTARG" ;;
+        n) nscan="$OPTARG" ;;
+        R) resolutions="$OPTARG" ;;
+        j) threads="$OPTARG" ;;
+        r) refdestripe="$OPTARG" ;;
+        s) maxstripe="$OPTARG" ;;
+        x) extra="$OPTARG" ;;
+        *) sed -n '/^## usage/,/^##$/p' "$0" | sed 's/^## //' ; exit 1 ;;
+    esac
+done
+
+mkstripe="${bindir}/mkstripe"
+stripestat="${bindir}/stripestat"
+destripe="${bindir}/modis_destripe"
+
+for prog in "$mkstripe" "$stripestat" "$destripe" $refdestripe
+do
+    if [ ! -x "$prog" ]
+    then
+        echo "bench_destripe: $prog not found, run make first" >&2
+        exit 1
+    fi
+done
+
+## mkstripe and modis_destripe read the configuration from here
+if [ -n "$datadir" ]
+then
+    export MOD_PRDS_DATA_DIR="$datadir"
+fi
+
+mkdir -p "$workdir" || exit 1
+
+###############################################################################
+## @brief run modis_destripe over a benchmark granule
+##
+## @param prog      the modis_destripe binary
+## @param in        the granule to destripe
+## @param log       the file to write the -verbose output to
+## @param ...       modis_destripe options
+##
+## @retval stdout   the wall time in seconds
+##
+###############################################################################
+
+run_destripe () {
+    local prog="$1"
+    local in="$2"
+    local log="$3"
+    shift 3
+    local t0 t1
+
+    t0=$(date +%s.%N)
+    "$prog" "$in" -terra "-$res" "$@" $extra -verbose > "$log" 2>&1 ||
+        return 1
+    t1=$(date +%s.%N)
+
+    awk "BEGIN { printf \"%.3f\", $t1 - $t0 }"
+}
+
+###############################################################################
+## @brief residual stripe of each band of a granule
+##
+## @param file      the granule
+##
+## @retval stdout   lines of band number and residual stripe
+##
+###############################################################################
+
+band_stripes () {
+    "$stripestat" "$truth" "$1" | awk '$2 == "band" { print $3, $5 }'
+}
+
+id="A2026001.0000"
+nscan=${nscan:-203}
+
+csv="${workdir}/bench_destripe.csv"
+echo "resolution,variant,band,destripe_s,wall_s,peak_kb,stripe_in,stripe_out" > "$csv"
+
+printf "%-5s %-10s %4s %10s %8s %10s %9s %9s\n" \
+       res variant band "destripe(s)" "wall(s)" "peak(kB)" stripeIn stripeOut
+
+status=0
+
+for res in $resolutions
+do
+    case $res in
+        1km)  type="MOD021KM" ; mopts="" ;;
+        500m) type="MOD02HKM" ; mopts="-500m" ;;
+        *)    echo "bench_destripe: unknown resolution $res" >&2 ; exit 1 ;;
+    esac
+
+    granule="${workdir}/${type}.${id}.hdf"
+    truth="${workdir}/${type}.${id}.truth.hdf"
+
+    ## the granule is kept between runs, unless it was made with other options
+    args="$mopts -nscan=$nscan -id=$id"
+    if [ ! -f "$granule" ] || [ ! -f "$truth" ] ||
+       [ "$(cat "${workdir}/${type}.args" 2> /dev/null)" != "$args" ]
+    then
+        "$mkstripe" $args "$workdir" > /dev/null || exit 1
+        echo "$args" > "${workdir}/${type}.args"
+    fi
+
+    instripes=$(band_stripes "$granule")
+
+    variants="reference threads"
+    if [ -n "$refdestripe" ]
+    then
+        variants="$variants refbin"
+    fi
+
+    ref="${workdir}/ref.hdf"
+    log="${workdir}/destripe.log"
+
+    for variant in $variants
+    do
+        prog="$destripe"
+        out="${workdir}/out.hdf"
+        case $variant in
+            reference) vopts="-threads=1" ; out="$ref" ;;
+            threads)   vopts="-threads=$threads" ;;
+            refbin)    vopts="" ; prog="$refdestripe" ;;
+        esac
+
+        rm -f "$out"
+        if [ "$variant" == "refbin" ]
+        then
+            cp "$granule" "$out" || exit 1
+            wall=$(run_destripe "$prog" "$out" "$log")
+        else
+            wall=$(run_destripe "$prog" "$granule" "$log" -of="$out" $vopts)
+        fi
+        if [ $? -ne 0 ]
+        then
+            printf "%-5s %-10s %s\n" $res $variant "FAILED"
+            echo "$res,$variant,,,,,," >> "$csv"
+            status=1
+            continue
+        fi
+
+        if [ "$variant" == "threads" ] &&
+           ! "$stripestat" "$truth" "$out" "$ref" > /dev/null
+        then
+            printf "%-5s %-10s %s\n" $res $variant "output differs from the reference run"
+            status=1
+        fi
+
+        peak=$(sed -n 's/^peak memory \([0-9-]*\) kB$/\1/p' "$log")
+        outstripes=$(band_stripes "$out")
+
+        while read band instripe
+        do
+            time=$(sed -n "s/^band $band destriped in \([0-9.]*\) s\$/\1/p" "$log")
+            outstripe=$(echo "$outstripes" | awk -v b=$band '$1 == b { print $2 }')
+            if [ -z "$outstripe" ] ||
+               awk "BEGIN { exit !($outstripe > $maxstripe) }"
+            then
+                status=1
+            fi
+
+            printf "%-5s %-10s %4s %10s %8.3f %10s %9s %9s\n" $res $variant \
+                   $band "${time:--}" $wall "${peak:--}" $instripe "${outstripe:--}"
+            echo "$res,$variant,$band,$time,$wall,$peak,$instripe,$outstripe" >> "$csv"
+        done <<< "$instripes"
+    done
+
+    rm -f "${workdir}/out.hdf" "$ref" "$log"
+done
+
+exit $status
@@ -0,0 +1,428 @@
+/*************************************************************************
+Description:
+
+  Generate a synthetic striped MODIS L1B granule (MOD021KM or MOD02HKM,
+  MYD with -aqua) and the same granule without the stripes, for
+  benchmarking modis_destripe and measuring how much striping it leaves.
+
+Notes:
+
+  1. The bands are the SDSs modis_destripe reads (EV_250_Aggr1km_RefSB,
+     EV_500_Aggr1km_RefSB, EV_1KM_RefSB and EV_1KM_Emissive for 1km,
+     EV_250_Aggr500_RefSB and EV_500_RefSB for 500m), and the mirror side
+     of each scan is in the "Mirror Side" field of the "Level 1B Swath
+     Metadata" vdata.  The mirror sides alternate, starting with -mirror.
+  2. The scene is a smooth field with brighter "cloud" patches and pixel
+     noise.  Each detector of each mirror side gets a gain and offset
+     stripe, uniform within -gain percent and -offset DN; the reference
+     detector of a band in the destriping configuration gets none on both
+     mirror sides, so a destriped band should match the scene.  The
+     detectors flagged bad in the configuration get noise instead of the
+     scene.  A small fraction of the pixels (-bad) are saturated in both
+     files.
+  3. The configuration is read from MOD_PRDS_DATA_DIR (or the
+     MOD_PRDS_DATA_DIR environment variable) like modis_destripe does, or
+     from -config.
+  4. The striped granule is written to <type>.<granule id>.hdf and the scene
+     to <type>.<granule id>.truth.hdf.  Each SDS of the truth file has the
+     attributes stripestat reads: band_numbers, destriped (1 for the bands
+     in the configuration), bad_detectors, stripe_gains and stripe_offsets
+     (by band, mirror side and detector), and the file has lines_per_scan.
+  5. The stripes and the scene come from a hash of -seed and the position,
+     so a granule is the same on every platform.
+
+Revision history:
+
+  Version 1.0   10/26   Original Development
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mfhdf.h"
+
+#define NFRAME_1KM      1354            /* 1 km frames per scan */
+#define NSCAN_DEFAULT   203             /* scans per 5 minute granule */
+#define MAXSTRIP        20              /* detectors per scan at 500m */
+#define MAXBANDS        36
+#define MAXSDSBANDS     16
+
+#define DATA_FILL       65535           /* L1B _FillValue */
+#define DATA_SATURATED  65533           /* L1B saturated, -3 as int16 */
+#define DATA_MAX        32767           /* largest valid L1B DN */
+
+/* L1B SDSs and the band of each of their bands (13lo/hi and 14lo/hi are
+   bands 13 and 14) */
+
+typedef struct {
+    const char *name;
+    int nband;
+    int band[MAXSDSBANDS];
+} L1B_SDS;
+
+static const L1B_SDS sds_1km[] = {
+    {"EV_250_Aggr1km_RefSB", 2, {1, 2}},
+    {"EV_500_Aggr1km_RefSB", 5, {3, 4, 5, 6, 7}},
+    {"EV_1KM_RefSB", 15, {8, 9, 10, 11, 12, 13, 13, 14, 14, 15, 16, 17, 18,
+                          19, 26}},
+    {"EV_1KM_Emissive", 16, {20, 21, 22, 23, 24, 25, 27, 28, 29, 30, 31, 32,
+                             33, 34, 35, 36}},
+    {NULL, 0, {0}}
+};
+
+static const L1B_SDS sds_500m[] = {
+    {"EV_250_Aggr500_RefSB", 2, {1, 2}},
+    {"EV_500_RefSB", 5, {3, 4, 5, 6, 7}},
+    {NULL, 0, {0}}
+};
+
+/* Destriping configuration of a band */
+
+typedef struct {
+    int destriped;
+    int ref;                    /* reference detector */
+    int bad[MAXSTRIP];
+} BAND_CONFIG;
+
+/* What the granule is made of */
+
+typedef struct {
+    int stripsize;
+    int nsamp;
+    int nscan;
+    int mirror0;
+    double gain_pct;
+    double offset_dn;
+    double bad_pct;
+    unsigned seed;
+    BAND_CONFIG config[MAXBANDS + 1];
+} GRANULE;
+
+static void usage(void)
+{
+    printf("\n");
+    printf("Usage: mkstripe [-aqua] [-500m] [-nscan=<scans>] [-gain=<percent>]\n");
+    printf("                [-offset=<DN>] [-bad=<percent>] [-mirror=0|1]\n");
+    printf("                [-seed=<n>] [-id=<granule id>] [-config=<file>]\n");
+    printf("                <output directory>\n");
+    printf("\n");
+    printf("Writes MOD021KM.<id>.hdf (MYD with -aqua, 02HKM with -500m), id\n");
+    printf("A2026001.0000 by default, and MOD021KM.<id>.truth.hdf without the\n");
+    printf("stripes to the output directory.\n");
+    printf("\n");
+}
+
+static void fatal(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mkstripe: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+}
+
+/* Hash of the seed and up to four integers to [0, 1) */
+static double hash(unsigned seed, int a, int b, int c, int d)
+{
+    unsigned h = seed * 0x9e3779b9u;
+
+    h ^= (unsigned)a * 73856093u;
+    h = (h ^ (h >> 15)) * 0x5bd1e995u;
+    h ^= (unsigned)b * 19349663u;
+    h = (h ^ (h >> 13)) * 0x5bd1e995u;
+    h ^= (unsigned)c * 83492791u;
+    h = (h ^ (h >> 15)) * 0x5bd1e995u;
+    h ^= (unsigned)d * 2654435761u;
+    h = (h ^ (h >> 13)) * 0x5bd1e995u;
+    h ^= h >> 15;
+    return (h >> 8) / 16777216.0;
+}
+
+/* Read the destriping configuration: a header line, then lines of band,
+   reference detector and a 0 (good) or 1 (bad) per detector */
+static void read_config(const char *file_name, GRANULE *g)
+{
+    char line[256], *p;
+    int band, ref, used, idet;
+    FILE *fp;
+
+    if ((fp = fopen(file_name, "r")) == NULL)
+        fatal("can't open", file_name);
+
+    if (fgets(line, sizeof(line), fp) == NULL)
+        fatal("can't read", file_name);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%d, %d%n", &band, &ref, &used) != 2)
+            continue;
+        if (band < 1 || band > MAXBANDS || ref < 0 || ref >= g->stripsize)
+            fatal("invalid band in", file_name);
+
+        g->config[band].destriped = 1;
+        g->config[band].ref = ref;
+        p = line + used;
+        for (idet = 0; idet < g->stripsize; idet++) {
+            if (sscanf(p, " ,%d%n", &g->config[band].bad[idet], &used) != 1)
+                fatal("invalid detector list in", file_name);
+            p += used;
+        }
+    }
+
+    fclose(fp);
+}
+
+/* Scene DN of a band at a pixel, from 1 km coordinates */
+static double scene(const GRANULE *g, int band, double y, double x,
+                    int line, int samp)
+{
+    double v, cloud;
+
+    v = 2500.0 + 150.0 * band +
+        1200.0 * sin(x * 0.0045 + band) * cos(y * 0.0061) +
+        500.0 * cos(x * 0.021 + y * 0.017);
+    cloud = sin(x * 0.013 + 1.0) * cos(y * 0.011 + band * 0.1);
+    if (cloud > 0.55)
+        v += 9000.0 * (cloud - 0.55);
+    v += 80.0 * (hash(g->seed, band, line, samp, 1) - 0.5);
+    return v;
+}
+
+/* Gain and offset stripe of a detector */
+static void stripe(const GRANULE *g, int band, int mirror, int idet,
+                   double *gain, double *offset)
+{
+    if (g->config[band].destriped && idet == g->config[band].ref) {
+        *gain = 1.0;
+        *offset = 0.0;
+        return;
+    }
+    *gain = 1.0 + g->gain_pct / 100.0 *
+            (2.0 * hash(g->seed, band, mirror, idet, 2) - 1.0);
+    *offset = g->offset_dn * (2.0 * hash(g->seed, band, mirror, idet, 3) - 1.0);
+}
+
+static uint16 to_dn(double v)
+{
+    if (v < 0.0)
+        return 0;
+    if (v > DATA_MAX)
+        return DATA_SATURATED;
+    return (uint16)(v + 0.5);
+}
+
+/* Write an SDS to the striped and the truth file, a scan at a time */
+static void write_sds(int32 sd_id, int32 truth_id, const L1B_SDS *sds,
+                      const GRANULE *g)
+{
+    int32 sds_id, tsds_id, dims[3], start[3], edges[3];
+    int32 bands[MAXSDSBANDS];
+    int8 destriped[MAXSDSBANDS], bad[MAXSDSBANDS * MAXSTRIP];
+    float32 gains[MAXSDSBANDS * 2 * MAXSTRIP], offsets[MAXSDSBANDS * 2 * MAXSTRIP];
+    uint16 *buf, *tbuf, fill = DATA_FILL;
+    int ires = g->stripsize / 10, nline = g->stripsize, nsamp = g->nsamp;
+    int iscan, il, is, ib, band, mirror, k;
+    double gain, offset, v;
+    size_t idx;
+
+    dims[0] = sds->nband;
+    dims[1] = g->nscan * nline;
+    dims[2] = nsamp;
+    if ((sds_id = SDcreate(sd_id, (char *)sds->name, DFNT_UINT16, 3, dims)) == FAIL ||
+        (tsds_id = SDcreate(truth_id, (char *)sds->name, DFNT_UINT16, 3, dims)) == FAIL)
+        fatal("can't create SDS", sds->name);
+    SDsetfillvalue(sds_id, &fill);
+    SDsetfillvalue(tsds_id, &fill);
+
+    for (ib = 0; ib < sds->nband; ib++) {
+        band = sds->band[ib];
+        bands[ib] = band;
+        destriped[ib] = (int8)g->config[band].destriped;
+        for (il = 0; il < MAXSTRIP; il++)
+            bad[ib * MAXSTRIP + il] = (int8)(il < nline && g->config[band].bad[il]);
+        for (mirror = 0; mirror < 2; mirror++) {
+            for (il = 0; il < MAXSTRIP; il++) {
+                k = (ib * 2 + mirror) * MAXSTRIP + il;
+                stripe(g, band, mirror, il, &gain, &offset);
+                gains[k] = (float32)gain;
+                offsets[k] = (float32)offset;
+            }
+        }
+    }
+    SDsetattr(tsds_id, "band_numbers", DFNT_INT32, sds->nband, bands);
+    SDsetattr(tsds_id, "destriped", DFNT_INT8, sds->nband, destriped);
+    SDsetattr(tsds_id, "bad_detectors", DFNT_INT8, sds->nband * MAXSTRIP, bad);
+    SDsetattr(tsds_id, "stripe_gains", DFNT_FLOAT32, sds->nband * 2 * MAXSTRIP,
+              gains);
+    SDsetattr(tsds_id, "stripe_offsets", DFNT_FLOAT32,
+              sds->nband * 2 * MAXSTRIP, offsets);
+
+    buf = (uint16 *)malloc((size_t)sds->nband * nline * nsamp * sizeof(uint16));
+    tbuf = (uint16 *)malloc((size_t)sds->nband * nline * nsamp * sizeof(uint16));
+    if (buf == NULL || tbuf == NULL)
+        fatal("allocating scan buffers", NULL);
+
+    for (iscan = 0; iscan < g->nscan; iscan++) {
+        mirror = (iscan + g->mirror0) % 2;
+        for (ib = 0; ib < sds->nband; ib++) {
+            band = sds->band[ib];
+            for (il = 0; il < nline; il++) {
+                int line = iscan * nline + il;
+                stripe(g, band, mirror, il, &gain, &offset);
+                for (is = 0; is < nsamp; is++) {
+                    idx = ((size_t)ib * nline + il) * nsamp + is;
+                    if (hash(g->seed, band, line, is, 4) * 100.0 < g->bad_pct) {
+                        buf[idx] = tbuf[idx] = DATA_SATURATED;
+                        continue;
+                    }
+                    v = scene(g, band, (line + 0.5) / ires,
+                              (is + 0.5) / ires, line, is);
+                    tbuf[idx] = to_dn(v);
+                    if (g->config[band].bad[il])
+                        v = 0.3 * v + 2000.0 * hash(g->seed, band, line, is, 5);
+                    else
+                        v = v * gain + offset;
+                    buf[idx] = to_dn(v);
+                }
+            }
+        }
+
+        start[0] = 0;            start[1] = iscan * nline;  start[2] = 0;
+        edges[0] = sds->nband;   edges[1] = nline;          edges[2] = nsamp;
+        if (SDwritedata(sds_id, start, NULL, edges, buf) == FAIL ||
+            SDwritedata(tsds_id, start, NULL, edges, tbuf) == FAIL)
+            fatal("writing SDS", sds->name);
+    }
+
+    free(buf);
+    free(tbuf);
+    SDendaccess(sds_id);
+    SDendaccess(tsds_id);
+}
+
+/* Write the mirror side of each scan to the Level 1B Swath Metadata */
+static void write_mirror(const char *file_name, const GRANULE *g)
+{
+    int32 file_id, vdata_id, *rec;
+    int iscan;
+
+    if ((file_id = Hopen((char *)file_name, DFACC_RDWR, 0)) == FAIL)
+        fatal("can't open", file_name);
+    Vstart(file_id);
+
+    if ((vdata_id = VSattach(file_id, -1, "w")) == FAIL)
+        fatal("can't create the swath metadata in", file_name);
+    VSsetname(vdata_id, "Level 1B Swath Metadata");
+    if (VSfdefine(vdata_id, "Scan Number", DFNT_INT32, 1) == FAIL ||
+        VSfdefine(vdata_id, "Mirror Side", DFNT_INT32, 1) == FAIL ||
+        VSsetfields(vdata_id, "Scan Number,Mirror Side") == FAIL)
+        fatal("can't define the swath metadata in", file_name);
+
+    if ((rec = (int32 *)malloc(g->nscan * 2 * sizeof(int32))) == NULL)
+        fatal("allocating the swath metadata", NULL);
+    for (iscan = 0; iscan < g->nscan; iscan++) {
+        rec[2 * iscan] = iscan + 1;
+        rec[2 * iscan + 1] = (iscan + g->mirror0) % 2;
+    }
+    if (VSwrite(vdata_id, (uint8 *)rec, g->nscan, FULL_INTERLACE) != g->nscan)
+        fatal("writing the swath metadata to", file_name);
+    free(rec);
+
+    VSdetach(vdata_id);
+    Vend(file_id);
+    Hclose(file_id);
+}
+
+int main(int argc, char *argv[])
+{
+    char *dir = NULL, *config = NULL, *val, *datadir, file_name[1024],
+         truth_name[1024], id[256] = "A2026001.0000";
+    const char *platform = "MOD", *type = "021KM";
+    const L1B_SDS *sds = sds_1km;
+    int32 sd_id, truth_id, lines_per_scan;
+    int iarg, isds;
+    GRANULE g;
+
+    memset(&g, 0, sizeof(g));
+    g.stripsize = 10;
+    g.nsamp = NFRAME_1KM;
+    g.nscan = NSCAN_DEFAULT;
+    g.gain_pct = 3.0;
+    g.offset_dn = 40.0;
+    g.bad_pct = 0.1;
+    g.seed = 1;
+
+    for (iarg = 1; iarg < argc; iarg++) {
+        val = strchr(argv[iarg], '=');
+        if (val != NULL) val++;
+        if (strcmp(argv[iarg], "-aqua") == 0)
+            platform = "MYD";
+        else if (strcmp(argv[iarg], "-500m") == 0) {
+            type = "02HKM";
+            sds = sds_500m;
+            g.stripsize = 20;
+            g.nsamp = 2 * NFRAME_1KM;
+        }
+        else if (strncmp(argv[iarg], "-nscan=", 7) == 0)
+            g.nscan = atoi(val);
+        else if (strncmp(argv[iarg], "-gain=", 6) == 0)
+            g.gain_pct = atof(val);
+        else if (strncmp(argv[iarg], "-offset=", 8) == 0)
+            g.offset_dn = atof(val);
+        else if (strncmp(argv[iarg], "-bad=", 5) == 0)
+            g.bad_pct = atof(val);
+        else if (strncmp(argv[iarg], "-mirror=", 8) == 0)
+            g.mirror0 = atoi(val);
+        else if (strncmp(argv[iarg], "-seed=", 6) == 0)
+            g.seed = (unsigned)strtoul(val, NULL, 10);
+        else if (strncmp(argv[iarg], "-id=", 4) == 0) {
+            strncpy(id, val, sizeof(id) - 1);
+            id[sizeof(id) - 1] = '\0';
+        }
+        else if (strncmp(argv[iarg], "-config=", 8) == 0)
+            config = val;
+        else if (argv[iarg][0] == '-') {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        else
+            dir = argv[iarg];
+    }
+
+    if (dir == NULL || g.nscan < 2 || g.gain_pct < 0.0 || g.offset_dn < 0.0 ||
+        g.bad_pct < 0.0 || g.bad_pct > 100.0 ||
+        (g.mirror0 != 0 && g.mirror0 != 1)) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (config == NULL) {
+        if ((datadir = getenv("MOD_PRDS_DATA_DIR")) == NULL)
+            datadir = MOD_PRDS_DATA_DIR;
+        sprintf(file_name, "%s/%s%s_destripe_config.dat", datadir, platform,
+                type);
+        read_config(file_name, &g);
+    }
+    else
+        read_config(config, &g);
+
+    sprintf(file_name, "%s/%s%s.%s.hdf", dir, platform, type, id);
+    sprintf(truth_name, "%s/%s%s.%s.truth.hdf", dir, platform, type, id);
+    printf("mkstripe: writing %s (%d scans)\n", file_name, g.nscan);
+
+    if ((sd_id = SDstart(file_name, DFACC_CREATE)) == FAIL)
+        fatal("can't create", file_name);
+    if ((truth_id = SDstart(truth_name, DFACC_CREATE)) == FAIL)
+        fatal("can't create", truth_name);
+
+    lines_per_scan = g.stripsize;
+    SDsetattr(truth_id, "lines_per_scan", DFNT_INT32, 1, &lines_per_scan);
+
+    for (isds = 0; sds[isds].name != NULL; isds++)
+        write_sds(sd_id, truth_id, sds + isds, &g);
+
+    SDend(sd_id);
+    SDend(truth_id);
+
+    write_mirror(file_name, &g);
+
+    exit(EXIT_SUCCESS);
+}
@@ -36,6 +36,13 @@
 ******************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include "hdf.h"
 #include "mfhdf.h"
 #include "df.h"
@@ -61,6 +68,12 @@
 
 #define rcsid "$Id: hdf_destripe_new.f90,v 1.8 2004/06/24 14:25:27 gumley Exp $"
 
+#define MAXTHREADS 64
+
+#define OVERLAY_DEFLATE_LEVEL 1    /* -of output compression */
+
+#define STATS_WINDOW_HOURS 24.0    /* default -statswindow */
+
 
 /******************************************************************************
  macros to print hdf errors
@@ -127,6 +140,67 @@ note: this can be used on the left or right side of assignment
 
 #define get2darray(array, x, y, width)    array[ (x) + (y) * (width) ]
 
+/******************************************************************************
+ a band to destripe
+
+******************************************************************************/
+
+typedef struct {
+    int band;                       /* band number */
+    int32 sds_index;                /* index of the band's SDS */
+    int32 out_index;                /* index of the SDS to write the band to */
+    int32 ref_det;                  /* reference detector */
+    int32 start[MAX_VAR_DIMS];      /* the band in the SDS */
+    int32 edge[MAX_VAR_DIMS];
+} DESTRIPE_BAND;
+
+/******************************************************************************
+ what the bands of the granule have in common, read only when destriping
+
+******************************************************************************/
+
+typedef struct {
+    int32 nPixel;
+    int32 nScan;
+    int32 stripsize;
+    int32 *mirror_side;
+    int *band_data;
+    char *statsdir;                 /* -stats directory, NULL for none */
+    char *statsname;                /* statistics file prefix, eg MOD021KM */
+    double statswindow;             /* seconds */
+    double time;                    /* granule time, seconds since 1970 */
+    int verbose;                    /* print the time of each band */
+} DESTRIPE_GRANULE;
+
+/******************************************************************************
+ worker pool for -threads: the main thread does all the HDF reads and writes,
+ each worker destripes one band at a time in its own buffer pair
+
+******************************************************************************/
+
+#define WORKER_IDLE  0             /* no band, the main thread may read one */
+#define WORKER_READY 1             /* band read, to be destriped */
+#define WORKER_DONE  2             /* band destriped, to be written */
+
+typedef struct DESTRIPE_POOL DESTRIPE_POOL;
+
+typedef struct {
+    DESTRIPE_POOL *pool;
+    pthread_t thread;
+    int16 *buffer;
+    int16 *destripe;
+    DESTRIPE_BAND *band;
+    int state;
+    int errflag;
+} DESTRIPE_WORKER;
+
+struct DESTRIPE_POOL {
+    DESTRIPE_GRANULE *granule;
+    int quit;
+    pthread_mutex_t lock;           /* protects the worker states and quit */
+    pthread_cond_t cond;            /* signaled when a worker state changes */
+};
+
 /******************************************************************************
  prototypes;
  
@@ -136,6 +210,12 @@ int get_band_config(char *pathname, int32 stripsize, int nBands, int *band_data,
 
 int get_modis_mirror( char *in_file, int32 *mirror_side );
 
+double get_granule_time( char *in_file );
+
+double wall_time( void );
+
+long peak_memory( void );
+
 int32 get_sds_index (int32 hdfid, int band, int bDo1k);
 
 int setdims (int32 sds_id, int32 sub_sds, int32 *start, int32 *stride, int32 *edge);
@@ -143,12 +223,34 @@ int setdims (int32 sds_id, int32 sub_sds, int32 *start, int32 *stride, int32 *ed
 void rep_bad_det( int band, int32 nPixel, int32 nScan, int32 stripsize,
                   int *band_data, int16 *image);
 
+int read_band (int32 hdfid, DESTRIPE_BAND *band, int16 *buffer);
+
+int destripe_band (DESTRIPE_GRANULE *granule, DESTRIPE_BAND *band,
+                   int16 *buffer, int16 *destripe);
+
+void write_band (int32 outid, DESTRIPE_BAND *band, int16 *destripe);
+
+void copy_band (int32 hdfid, int32 outid, DESTRIPE_BAND *band, int16 *buffer);
+
+int destripe_pool (int32 hdfid, int32 outid, DESTRIPE_GRANULE *granule,
+                   DESTRIPE_BAND *bands, int nDestripe, int nthreads,
+                   int32 num_lines);
+
+int copy_attributes (int32 from_id, int32 to_id, int32 nattr);
+
+int32 create_overlay_sds (int32 hdfid, int32 outid, int32 sds_index,
+                          DESTRIPE_BAND *bands, int nDestripe);
+
+int32 open_overlay (char *out_file, int32 hdfid, DESTRIPE_BAND *bands,
+                    int nDestripe);
+
 
 
 void usage(char *app) {
 
     fprintf (stderr, "Usage:\n");
-    fprintf (stderr, "    %s <infile.hdf> <-terra | -aqua> <-1km | -500m>\n", app);
+    fprintf (stderr, "    %s <infile.hdf> <-terra | -aqua> <-1km | -500m> [-threads=<n>]\n"
+                     "        [-of=<outfile.hdf>] [-stats=<dir> [-statswindow=<hours>]] [-verbose]\n", app);
 
     exit (EXIT_FAILURE);
 
@@ -159,11 +261,28 @@ void usage(char *app) {
 main to Destripe a MODIS L1B 1KM HDF file.
 
 @param argc     2
-@param argv     appname <infile.hdf> <-terra | -aqua> <-1km | -500m>\n""
+@param argv     appname <infile.hdf> <-terra | -aqua> <-1km | -500m> [-threads=<n>] [-of=<outfile.hdf>] [-stats=<dir> [-statswindow=<hours>]] [-verbose]\n""
 
 @return EXIT_SUCCESS or EXIT_FAILURE
 
-NOTE: The input file is ireversibly modified
+NOTE: The input file is ireversibly modified, unless -of=<outfile.hdf> is
+given: the input file is then opened read only and the destriped SDSs are
+written to the output file, see open_overlay().
+
+With -threads=<n> the bands are destriped by n worker threads, see
+destripe_pool().
+
+With -stats=<dir> the detector histograms of each band are added to a
+statistics file in dir covering the granules of the last -statswindow hours
+(default 24), and the bands are destriped with the EDFs of these statistics
+once they cover enough granules, see modis_edf_stats.c.  The directory must
+exist.
+
+With -verbose the destriping time of each band and the peak memory are
+printed, for bench_destripe.sh.
+
+The configuration files are read from MOD_PRDS_DATA_DIR, or from the
+directory in the MOD_PRDS_DATA_DIR environment variable if it is set.
 
 fixme: all arguments but the input file can be derived from the input file.
 ASSOCIATEDPLATFORMSHORTNAME seems to contain Aqua or Terra,
@@ -182,7 +301,12 @@ int main (int argc, char *argv[]) {
     int bDo500 = 0;
     int bDoterra = 0;
     int bDoaqua = 0;
+    int nthreads = 1;
     char *in_file = NULL;
+    char *out_file = NULL;
+    char *statsdir = NULL;
+    double statswindow = STATS_WINDOW_HOURS;
+    int verbose = 0;
     
     if ( argc < 3)
         usage(argv[0]);
@@ -199,6 +323,26 @@ int main (int argc, char *argv[]) {
             bDoterra = 1;
         else if ( ! strcasecmp(argv[arg], "-aqua") )
             bDoaqua = 1;
+        else if ( ! strcasecmp(argv[arg], "-verbose") )
+            verbose = 1;
+        else if ( ! strncasecmp(argv[arg], "-threads=", 9) ) {
+            nthreads = atoi(argv[arg] + 9);
+            if (nthreads < 1 || nthreads > MAXTHREADS) {
+                fprintf(stderr, "Invalid number of threads (1-%d).\n", MAXTHREADS);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if ( ! strncasecmp(argv[arg], "-of=", 4) )
+            out_file = argv[arg] + 4;
+        else if ( ! strncasecmp(argv[arg], "-stats=", 7) )
+            statsdir = argv[arg] + 7;
+        else if ( ! strncasecmp(argv[arg], "-statswindow=", 13) ) {
+            statswindow = atof(argv[arg] + 13);
+            if (statswindow <= 0) {
+                fprintf(stderr, "Invalid statistics window.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
         else if ( *(argv[arg]) == '-' )
             fprintf(stderr, "Warning: unrecognised switch %s\n", argv[arg] );
         else
@@ -234,9 +378,9 @@ int main (int argc, char *argv[]) {
 
     /***** open the hdf file *****/
     
-    int32 hdfid, sds_id, attid;
+    int32 hdfid, outid, sds_id, attid;
     
-    hdfid = SDstart(in_file, DFACC_RDWR);
+    hdfid = SDstart(in_file, out_file ? DFACC_READ : DFACC_RDWR);
     if (hdfid == FAIL) {
         fprintf(stderr, "Error opening MODIS L1B 1KM input file %s\n", in_file);
         HDFERROR("");
@@ -330,7 +474,11 @@ int main (int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    size_t need = snprintf (NULL, 0, "%s/%s", MOD_PRDS_DATA_DIR, configfile);
+    char *datadir = getenv ("MOD_PRDS_DATA_DIR");
+    if (!datadir)
+        datadir = MOD_PRDS_DATA_DIR;
+
+    size_t need = snprintf (NULL, 0, "%s/%s", datadir, configfile);
     char *config = malloc ((need + 1) * sizeof (char));
     if (!config) {
         fprintf(stderr,"Error alocateing memmory for destriping configuration filename.\n");
@@ -340,7 +488,7 @@ int main (int argc, char *argv[]) {
         free(band_data);
         exit(EXIT_FAILURE);
     }
-    sprintf (config, "%s/%s", MOD_PRDS_DATA_DIR, configfile);
+    sprintf (config, "%s/%s", datadir, configfile);
 
     if ( 0 > get_band_config(config, stripsize, nBands, band_data, header) ) {
         fprintf(stderr,"Error reading MODIS destriping configuration file.\n");
@@ -356,13 +504,20 @@ int main (int argc, char *argv[]) {
     
     int band_loop, band;
 
-    int32 ref_det;
-    int errflag = 0;
-    int det_index, min_diff, i, det_diff, rep_index;
+    /***** List the bands to be destriped *****/
+
+    DESTRIPE_BAND *bands = malloc(nBands * sizeof(DESTRIPE_BAND));
+    if (!bands) {
+        fprintf(stderr, "Error allocating memory for the band list.\n");
+        free(destripe);
+        free(buffer);
+        free(mirror_side);
+        free(band_data);
+        exit(EXIT_FAILURE);
+    }
+
+    int nDestripe = 0;
 
-     
-    /***** Loop over each band to be destriped *****/
-    
     for ( band_loop = 1 ; band_loop <= nBands ; band_loop++) {
 
         /***** Get band number *****/
@@ -377,78 +532,109 @@ int main (int argc, char *argv[]) {
         if (sds_index == FAIL)
             continue;
         
-        /***** get the sds_id for the band *****/
+        bands[nDestripe].band = band;
+        bands[nDestripe].sds_index = sds_index;
+        bands[nDestripe].out_index = sds_index;
 
-        sds_id = SDselect(hdfid, sds_index);
-        if (sds_id == FAIL) {
-            fprintf(stderr, "Warning: failed to find the sds_id for band %i \n",
-                    band);
-            HDFWARN("");
-            continue;
-        }
+        /***** Get reference detector for this band *****/
         
-        /***** Get band index in SDS array for this band *****/
+        bands[nDestripe].ref_det = get2darray( band_data, 1, band_loop - 1, (stripsize + 2));
+        nDestripe++;
+    }
 
-        //start[0] = get_band_index(band);
+    /***** open the output file, or write the bands back to the input file *****/
+
+    outid = hdfid;
+    if (out_file) {
+        outid = open_overlay (out_file, hdfid, bands, nDestripe);
+        if (outid == FAIL) {
+            fprintf(stderr, "Error creating output file %s\n", out_file);
+            free(destripe);
+            free(buffer);
+            free(bands);
+            free(mirror_side);
+            free(band_data);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-        int32 start[MAX_VAR_DIMS] = {0};
-        int32 stride[MAX_VAR_DIMS] = {0};
-        int32 edge[MAX_VAR_DIMS] = {0};
-        
-        setdims (sds_id, get_band_index(band), start, stride, edge);
+    char statsname[16];
+    sprintf(statsname, "%s%s", bDoaqua ? "MYD" : "MOD", bDo1k ? "021KM" : "02HKM");
 
-        /***** Read the input image for this band *****/
-        
-        intn retn;
-        retn = SDreaddata(sds_id, start, stride, edge, (VOIDP)buffer);
-        
-        if (retn == FAIL) {
-            fprintf(stderr,
-                    "Warning: failed to read data for band %i sds index %i sds dim %i\n",
-                    band, sds_index, start[2] );
-            HDFWARN("");
-            SDendaccess(sds_id);
-            continue;
-        }
-        
-        /***** Get reference detector for this band *****/
-        
-        ref_det = get2darray( band_data, 1, band_loop - 1, (stripsize + 2));
-          
-        /***** Compute destriped image *****/
-        
-        errflag = modis_edf_destripe( nPixel, nScan, stripsize,
-                            ref_det, mirror_side,
-                            buffer, destripe);
+    DESTRIPE_GRANULE granule = { nPixel, nScan, stripsize, mirror_side, band_data,
+                                 statsdir, statsname, statswindow * 3600.0,
+                                 statsdir ? get_granule_time(in_file) : 0.0,
+                                 verbose };
 
+    /***** Loop over each band to be destriped *****/
+    
+    if (nthreads > 1 && nDestripe > 1) {
+        if (nthreads > nDestripe)
+            nthreads = nDestripe;
 
-        if (errflag != 0) {
-            fprintf(stderr, "Could not destripe band %d\n", band);
-            SDendaccess(sds_id);
-            continue;
+        /***** the pool allocates its own buffers *****/
+
+        free(destripe);
+        free(buffer);
+        destripe = buffer = NULL;
+
+        if ( 0 > destripe_pool (hdfid, outid, &granule, bands, nDestripe,
+                                nthreads, num_lines) )
+        {
+            fprintf(stderr, "Error starting the destriping threads.\n");
+            free(bands);
+            free(mirror_side);
+            free(band_data);
+            exit(EXIT_FAILURE);
         }
+    }
 
-        /***** Replace bad detectors with nearest good neighbor *****/
+    else {
+        int iBand;
+        for ( iBand = 0 ; iBand < nDestripe ; iBand++) {
 
-        rep_bad_det( band, nPixel, nScan, stripsize, band_data, destripe);
-            
-        /***** write the destriped image for this band *****/
+            /***** Read the input image for this band *****/
             
-        SDwritedata(sds_id, start, NULL, edge, destripe);
+            if ( 0 > read_band (hdfid, bands + iBand, buffer) ) {
+                if (outid != hdfid)
+                    copy_band (hdfid, outid, bands + iBand, buffer);
+                continue;
+            }
+
+            /***** Compute destriped image, the output file gets the input
+                   image if it fails *****/
             
-        SDendaccess(sds_id);
+            if ( 0 > destripe_band (&granule, bands + iBand, buffer, destripe) ) {
+                if (outid != hdfid)
+                    write_band (outid, bands + iBand, buffer);
+                continue;
+            }
+
+            /***** write the destriped image for this band *****/
+                
+            write_band (outid, bands + iBand, destripe);
+        }
     }
     
+    free(bands);
+
     /***** Write a new global attribute to show this file is destriped *****/
     
-    SDsetattr(hdfid, "UW_DESTRIPE", DFNT_CHAR8, strlen(rcsid), rcsid);
+    SDsetattr(outid, "UW_DESTRIPE", DFNT_CHAR8, strlen(rcsid), rcsid);
 
     /***** Write a new global attribute to record destriping configuration *****/
     
-    SDsetattr(hdfid, "UW_DESTRIPE_CONFIG", DFNT_CHAR8, strlen(header), header);
+    SDsetattr(outid, "UW_DESTRIPE_CONFIG", DFNT_CHAR8, strlen(header), header);
 
-    /***** Close the input file *****/
+    /***** Close the output and the input file *****/
     
+    if (outid != hdfid && SDend(outid) == FAIL) {
+        fprintf(stderr, "Error writing output file %s\n", out_file);
+        HDFWARN("");
+        SDend(hdfid);
+        exit(EXIT_FAILURE);
+    }
+
     SDend(hdfid);
 
     /***** Deallocate the input and destriped image arrays *****/
@@ -459,6 +645,9 @@ int main (int argc, char *argv[]) {
     free(mirror_side);
     free(band_data);
         
+    if (verbose)
+        printf("peak memory %ld kB\n", peak_memory());
+
     /***** Print progress message to logfile *****/
     
     //write(errtext, '(''Successfully destriped MODIS L1B 1KM file: '', a)') in_file
@@ -538,6 +727,88 @@ int get_modis_mirror( char *in_file, int32 *mirror_side ) {
     return 0;
 }
 
+/****************************************************************************//**
+
+Get the time of a granule from the name of a MODIS l1b HDF file
+
+@param in_file      Name of the MODIS l1b HDF file, eg MOD021KM.A2026291.1030.006.hdf
+
+@return the time of the granule in seconds since 1970, the current time if
+        the file name has no .AYYYYDDD.HHMM
+
+the time is only compared to other granule times, so it is taken as local
+time without daylight saving
+
+******************************************************************************/
+
+double get_granule_time( char *in_file ) {
+
+    char *p;
+    
+    for (p = strstr(in_file, ".A"); p ; p = strstr(p + 1, ".A")) {
+        int i;
+
+        for (i = 2; i < 14 && (i == 9 || isdigit((unsigned char) p[i])); i++);
+        if (i < 14 || p[9] != '.')
+            continue;
+
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        sscanf(p + 2, "%4d%3d.%2d%2d", &tm.tm_year, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min);
+        tm.tm_year -= 1900;
+        tm.tm_isdst = 0;
+
+        return (double) mktime(&tm);
+    }
+
+    fprintf(stderr, "Warning: no granule time in %s, using the current time\n",
+            in_file);
+
+    return (double) time(NULL);
+}
+
+/****************************************************************************//**
+
+Get the wall clock time
+
+@return the time in seconds
+
+******************************************************************************/
+
+double wall_time( void ) {
+
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + (double) tv.tv_usec * 1.0e-6;
+}
+
+/****************************************************************************//**
+
+Get the peak resident set size of the program
+
+@return the peak resident set size in kB, -1 if not available
+
+ru_maxrss is in kB on Linux but in bytes on Mac OS X
+
+******************************************************************************/
+
+long peak_memory( void ) {
+
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+
+#ifdef __APPLE__
+    return (long) (usage.ru_maxrss / 1024);
+#else
+    return (long) usage.ru_maxrss;
+#endif
+}
+
 /******************************************************************************
 
 Read MODIS destriping band configuration file
@@ -589,9 +860,9 @@ int get_band_config(char *pathname, int32 stripsize, int nBands, int *band_data,
     
     while (fgets (buf, 99, fp ) && *buf ) {
         
-        int row;
+        int row = 0;
         sscanf(buf, "%d", &row);
-        if (row >= nBands)
+        if (row < 1 || row > nBands)
             continue;
         row--;
 
@@ -808,4 +1079,594 @@ void rep_bad_det( int band, int32 nPixel, int32 nScan, int32 stripsize,
             }
         }
     }
-}
\ No newline at end of file
+}
+
+/****************************************************************************//**
+
+read the input image for a band
+
+@param hdfid    hdf id to read data from
+@param band     the band to read, its start and edge are set
+@param buffer   pointer to the image to read the band into
+
+@return 0 on success, -1 on failure
+
+******************************************************************************/
+
+int read_band (int32 hdfid, DESTRIPE_BAND *band, int16 *buffer)
+{
+    int32 stride[MAX_VAR_DIMS] = {0};
+
+    /***** get the sds_id for the band *****/
+
+    int32 sds_id = SDselect(hdfid, band->sds_index);
+    if (sds_id == FAIL) {
+        fprintf(stderr, "Warning: failed to find the sds_id for band %i \n",
+                band->band);
+        HDFWARN("");
+        return -1;
+    }
+    
+    /***** Get band index in SDS array for this band *****/
+
+    memset(band->start, 0, sizeof(band->start));
+    memset(band->edge, 0, sizeof(band->edge));
+
+    setdims (sds_id, get_band_index(band->band), band->start, stride, band->edge);
+
+    /***** Read the input image for this band *****/
+    
+    intn retn;
+    retn = SDreaddata(sds_id, band->start, stride, band->edge, (VOIDP)buffer);
+    
+    if (retn == FAIL) {
+        fprintf(stderr,
+                "Warning: failed to read data for band %i sds index %i sds dim %i\n",
+                band->band, band->sds_index, band->start[2] );
+        HDFWARN("");
+        SDendaccess(sds_id);
+        return -1;
+    }
+
+    SDendaccess(sds_id);
+
+    return 0;
+}
+
+/****************************************************************************//**
+
+destripe a band and replace its bad detectors with the nearest good neighbor
+
+@param granule  the granule the band is from
+@param band     the band
+@param buffer   pointer to the input image
+@param destripe pointer to the image to store the output in
+
+@return 0 on success, -1 on failure
+
+this does not call the HDF library, so it can be called by several threads;
+each band has its own statistics file
+
+******************************************************************************/
+
+int destripe_band (DESTRIPE_GRANULE *granule, DESTRIPE_BAND *band,
+                   int16 *buffer, int16 *destripe)
+{
+    EDF_STATS *stats = NULL;
+    double start = granule->verbose ? wall_time() : 0.0;
+
+    /***** open the statistics of the band *****/
+
+    if (granule->statsdir) {
+        char name[32];
+        sprintf(name, "%s_b%02d", granule->statsname, band->band);
+
+        stats = edf_stats_open( granule->statsdir, name, granule->stripsize,
+                                granule->statswindow, granule->time );
+        if (!stats)
+            fprintf(stderr, "Warning: no statistics for band %d\n", band->band);
+    }
+
+    /***** Compute destriped image *****/
+    
+    int errflag = modis_edf_destripe( granule->nPixel, granule->nScan,
+                                      granule->stripsize, band->ref_det,
+                                      granule->mirror_side, stats,
+                                      buffer, destripe);
+
+    if (stats) {
+        if (errflag == 0 && 0 > edf_stats_save(stats))
+            fprintf(stderr, "Warning: could not save the statistics of band %d\n",
+                    band->band);
+        edf_stats_close(stats);
+    }
+
+    if (errflag != 0) {
+        fprintf(stderr, "Could not destripe band %d\n", band->band);
+        return -1;
+    }
+
+    /***** Replace bad detectors with nearest good neighbor *****/
+
+    rep_bad_det( band->band, granule->nPixel, granule->nScan,
+                 granule->stripsize, granule->band_data, destripe);
+
+    if (granule->verbose)
+        printf("band %d destriped in %.3f s\n", band->band, wall_time() - start);
+
+    return 0;
+}
+
+/****************************************************************************//**
+
+write the destriped image for a band
+
+@param outid    hdf id to write data to, the input file or the -of file
+@param band     the band, as set by read_band()
+@param destripe pointer to the destriped image
+
+@return nothing
+
+******************************************************************************/
+
+void write_band (int32 outid, DESTRIPE_BAND *band, int16 *destripe)
+{
+
+    int32 sds_id = SDselect(outid, band->out_index);
+    if (sds_id == FAIL) {
+        fprintf(stderr, "Warning: failed to find the sds_id for band %i \n",
+                band->band);
+        HDFWARN("");
+        return;
+    }
+
+    SDwritedata(sds_id, band->start, NULL, band->edge, destripe);
+        
+    SDendaccess(sds_id);
+}
+
+/****************************************************************************//**
+
+copy the input image of a band to the -of file
+
+@param hdfid    hdf id of the input file
+@param outid    hdf id of the -of file
+@param band     the band
+@param buffer   pointer to a buffer for the image of the band
+
+@return nothing
+
+used when read_band() fails, so the band is copied as create_overlay_sds()
+copies the bands that are not destriped instead of being left as fill
+
+******************************************************************************/
+
+void copy_band (int32 hdfid, int32 outid, DESTRIPE_BAND *band, int16 *buffer)
+{
+    char sds_name[MAX_NC_NAME];
+    int32 rank, dimsizes[MAX_VAR_DIMS], data_type, num_attrs;
+    int32 start[MAX_VAR_DIMS] = {0};
+    int32 edge[MAX_VAR_DIMS];
+    int32 out_sds_id = FAIL;
+    int ok = 0;
+
+    int32 sds_id = SDselect(hdfid, band->sds_index);
+    if (sds_id != FAIL &&
+        SDgetinfo(sds_id, sds_name, &rank, dimsizes, &data_type, &num_attrs) != FAIL &&
+        rank == 3 && DFKNTsize(data_type) == sizeof(int16))
+    {
+        start[0] = get_band_index(band->band);
+        edge[0] = 1;
+        edge[1] = dimsizes[1];
+        edge[2] = dimsizes[2];
+
+        out_sds_id = SDselect(outid, band->out_index);
+        ok = out_sds_id != FAIL &&
+             SDreaddata(sds_id, start, NULL, edge, buffer) != FAIL &&
+             SDwritedata(out_sds_id, start, NULL, edge, buffer) != FAIL;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Warning: could not copy band %i to the output file, "
+                "it is left as fill\n", band->band);
+        HDFWARN("");
+    }
+
+    if (out_sds_id != FAIL)
+        SDendaccess(out_sds_id);
+    if (sds_id != FAIL)
+        SDendaccess(sds_id);
+}
+
+/****************************************************************************//**
+
+destripe thread: destripe the bands the main thread reads into this
+worker's buffer
+
+@param arg      pointer to the worker
+
+@return NULL
+
+******************************************************************************/
+
+void *destripe_worker (void *arg)
+{
+    DESTRIPE_WORKER *w = arg;
+    DESTRIPE_POOL *pool = w->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (w->state != WORKER_READY && !pool->quit)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (w->state != WORKER_READY)
+            break;
+        pthread_mutex_unlock(&pool->lock);
+
+        int errflag = destripe_band (pool->granule, w->band, w->buffer, w->destripe);
+
+        pthread_mutex_lock(&pool->lock);
+        w->errflag = errflag;
+        w->state = WORKER_DONE;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/****************************************************************************//**
+
+destripe the bands with a pool of worker threads
+
+@param hdfid        hdf id to read data from
+@param outid        hdf id to write data to
+@param granule      the granule the bands are from
+@param bands        the bands to destripe
+@param nDestripe    number of bands to destripe
+@param nthreads     number of worker threads
+@param num_lines    number of lines of a band
+
+@return 0 on success, -1 if the pool can't be started
+
+The calling thread is the I/O thread: it reads a band into the buffer pair
+of an idle worker, and writes a band from the buffer pair of a worker that
+is done, so the HDF library is only called by one thread at a time.  The
+bands are written as they are done, not in order; the output is the same.
+
+******************************************************************************/
+
+int destripe_pool (int32 hdfid, int32 outid, DESTRIPE_GRANULE *granule,
+                   DESTRIPE_BAND *bands, int nDestripe, int nthreads,
+                   int32 num_lines)
+{
+    DESTRIPE_POOL pool;
+    DESTRIPE_WORKER worker[MAXTHREADS];
+    size_t size = (size_t) granule->nPixel * num_lines * sizeof (int16);
+    int it, nStarted = 0;
+    int status = 0;
+
+    pool.granule = granule;
+    pool.quit = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    /***** Allocate a buffer pair and start each worker *****/
+
+    for (it = 0; it < nthreads; it++) {
+        DESTRIPE_WORKER *w = worker + it;
+        w->pool = &pool;
+        w->band = NULL;
+        w->state = WORKER_IDLE;
+        w->errflag = 0;
+        w->buffer = malloc(size);
+        w->destripe = malloc(size);
+        if (!w->buffer || !w->destripe) {
+            fprintf(stderr, "Error allocating memory for thread buffers.\n");
+            free(w->buffer);
+            free(w->destripe);
+            status = -1;
+            break;
+        }
+        if (pthread_create(&w->thread, NULL, destripe_worker, w)) {
+            free(w->buffer);
+            free(w->destripe);
+            status = -1;
+            break;
+        }
+        nStarted++;
+    }
+
+    /***** Read bands into idle workers and write the done ones *****/
+
+    int next = 0, nBusy = 0;
+
+    while (status == 0 && (next < nDestripe || nBusy > 0)) {
+        DESTRIPE_WORKER *w = NULL;
+
+        pthread_mutex_lock(&pool.lock);
+        for (;;) {
+            for (it = 0; it < nStarted; it++) {
+                if (worker[it].state == WORKER_DONE ||
+                    (worker[it].state == WORKER_IDLE && next < nDestripe))
+                {
+                    w = worker + it;
+                    break;
+                }
+            }
+            if (w)
+                break;
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        /***** write the destriped image of a worker that is done *****/
+
+        if (w->state == WORKER_DONE) {
+            if (w->errflag == 0)
+                write_band (outid, w->band, w->destripe);
+            else if (outid != hdfid)
+                write_band (outid, w->band, w->buffer);
+            w->state = WORKER_IDLE;
+            nBusy--;
+            continue;
+        }
+
+        /***** read the next band for an idle worker *****/
+
+        w->band = bands + next++;
+        if ( 0 > read_band (hdfid, w->band, w->buffer) ) {
+            if (outid != hdfid)
+                copy_band (hdfid, outid, w->band, w->buffer);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        w->state = WORKER_READY;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+        nBusy++;
+    }
+
+    /***** Stop the workers *****/
+
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (it = 0; it < nStarted; it++) {
+        pthread_join(worker[it].thread, NULL);
+        free(worker[it].buffer);
+        free(worker[it].destripe);
+    }
+
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    return status;
+}
+
+/****************************************************************************//**
+
+copy the attributes of a file or an SDS
+
+@param from_id  hdf id of the file or sds to copy the attributes from
+@param to_id    hdf id of the file or sds to copy the attributes to
+@param nattr    number of attributes
+
+@return 0 on success, -1 on failure
+
+the fill value of an SDS is not copied, it is set with SDsetfillvalue()
+
+******************************************************************************/
+
+int copy_attributes (int32 from_id, int32 to_id, int32 nattr)
+{
+    char name[MAX_NC_NAME];
+    int32 type, count;
+    int32 iAttr;
+
+    for (iAttr = 0; iAttr < nattr; iAttr++) {
+        if (SDattrinfo(from_id, iAttr, name, &type, &count) == FAIL)
+            return -1;
+
+        if (!strcmp(name, "_FillValue"))
+            continue;
+
+        void *value = malloc(count * DFKNTsize(type));
+        if (!value)
+            return -1;
+
+        if (SDreadattr(from_id, iAttr, value) == FAIL ||
+            SDsetattr(to_id, name, type, count, value) == FAIL)
+        {
+            free(value);
+            return -1;
+        }
+        free(value);
+    }
+
+    return 0;
+}
+
+/****************************************************************************//**
+
+create an SDS of the input file in the output file
+
+@param hdfid        hdf id of the input file
+@param outid        hdf id of the output file
+@param sds_index    index of the SDS in the input file
+@param bands        the bands to destripe
+@param nDestripe    number of bands to destripe
+
+@return index of the SDS in the output file, FAIL on failure
+
+The SDS gets the name, type, dimensions, dimension names and attributes of
+the input SDS, and is chunked by band.  The bands of the SDS that are not
+destriped are copied, the destriped ones are left to write_band().
+
+******************************************************************************/
+
+int32 create_overlay_sds (int32 hdfid, int32 outid, int32 sds_index,
+                          DESTRIPE_BAND *bands, int nDestripe)
+{
+    char sds_name[MAX_NC_NAME], dim_name[MAX_NC_NAME];
+    int32 rank, dimsizes[MAX_VAR_DIMS], data_type, num_attrs;
+    int32 dim_size, dim_type, dim_nattr;
+    int32 start[MAX_VAR_DIMS] = {0};
+    int32 edge[MAX_VAR_DIMS];
+    HDF_CHUNK_DEF chunk_def;
+    int32 out_index = FAIL;
+    char fill[16];
+    void *buffer;
+    int iDim, iBand;
+    
+    int32 sds_id = SDselect(hdfid, sds_index);
+    if (sds_id == FAIL)
+        return FAIL;
+
+    if (SDgetinfo(sds_id, sds_name, &rank, dimsizes, &data_type, &num_attrs) == FAIL
+        || rank != 3)
+    {
+        SDendaccess(sds_id);
+        return FAIL;
+    }
+
+    int32 out_sds_id = SDcreate(outid, sds_name, data_type, rank, dimsizes);
+    if (out_sds_id == FAIL) {
+        SDendaccess(sds_id);
+        return FAIL;
+    }
+
+    /***** dimension names and attributes *****/
+
+    for (iDim = 0; iDim < rank; iDim++) {
+        if (SDdiminfo(SDgetdimid(sds_id, iDim), dim_name, &dim_size, &dim_type,
+                      &dim_nattr) == FAIL ||
+            SDsetdimname(SDgetdimid(out_sds_id, iDim), dim_name) == FAIL)
+        {
+            goto cleanup;
+        }
+    }
+
+    if (0 > copy_attributes (sds_id, out_sds_id, num_attrs))
+        goto cleanup;
+
+    if (SDgetfillvalue(sds_id, fill) == SUCCEED &&
+        SDsetfillvalue(out_sds_id, fill) == FAIL)
+    {
+        goto cleanup;
+    }
+
+    /***** one chunk per band *****/
+
+    edge[0] = chunk_def.comp.chunk_lengths[0] = 1;
+    edge[1] = chunk_def.comp.chunk_lengths[1] = dimsizes[1];
+    edge[2] = chunk_def.comp.chunk_lengths[2] = dimsizes[2];
+    chunk_def.comp.comp_type = COMP_CODE_DEFLATE;
+    chunk_def.comp.cinfo.deflate.level = OVERLAY_DEFLATE_LEVEL;
+    if (SDsetchunk(out_sds_id, chunk_def, HDF_CHUNK | HDF_COMP) == FAIL)
+        goto cleanup;
+
+    /***** copy the bands that are not destriped *****/
+
+    buffer = malloc((size_t) dimsizes[1] * dimsizes[2] * DFKNTsize(data_type));
+    if (!buffer)
+        goto cleanup;
+
+    for (start[0] = 0; start[0] < dimsizes[0]; start[0]++) {
+        for (iBand = 0; iBand < nDestripe; iBand++) {
+            if (bands[iBand].sds_index == sds_index &&
+                get_band_index(bands[iBand].band) == start[0])
+            {
+                break;
+            }
+        }
+        if (iBand < nDestripe)
+            continue;
+
+        if (SDreaddata(sds_id, start, NULL, edge, buffer) == FAIL ||
+            SDwritedata(out_sds_id, start, NULL, edge, buffer) == FAIL)
+        {
+            free(buffer);
+            goto cleanup;
+        }
+    }
+    free(buffer);
+
+    out_index = SDnametoindex(outid, sds_name);
+
+cleanup:
+    SDendaccess(out_sds_id);
+    SDendaccess(sds_id);
+
+    return out_index;
+}
+
+/****************************************************************************//**
+
+create the output file for -of
+
+@param out_file     name of the output file, overwritten if it exists
+@param hdfid        hdf id of the input file
+@param bands        the bands to destripe, out_index is set to the index of
+                    the SDS in the output file
+@param nDestripe    number of bands to destripe
+
+@return hdf id of the output file, FAIL on failure
+
+The output file gets the global attributes of the input file and only the
+SDSs with bands to destripe; the other SDSs are not rewritten.  It is an
+overlay of the input file: its SDSs replace the SDSs of the same name of
+the input file.  crefl takes it as an extra input file (recognised by
+the UW_DESTRIPE attribute); being a complete HDF file with the metadata of
+the input file it can also be given to swath2grid with -if for the
+destriped SDSs.
+
+******************************************************************************/
+
+int32 open_overlay (char *out_file, int32 hdfid, DESTRIPE_BAND *bands,
+                    int nDestripe)
+{
+    int32 nsds, nattr;
+    int iBand, iPrev;
+    
+    int32 outid = SDstart(out_file, DFACC_CREATE);
+    if (outid == FAIL) {
+        HDFWARN("");
+        return FAIL;
+    }
+
+    if (SDfileinfo(hdfid, &nsds, &nattr) == FAIL ||
+        0 > copy_attributes (hdfid, outid, nattr))
+    {
+        HDFWARN("");
+        SDend(outid);
+        return FAIL;
+    }
+
+    for (iBand = 0; iBand < nDestripe; iBand++) {
+
+        /***** the SDS may already be created for an earlier band *****/
+
+        for (iPrev = 0; iPrev < iBand; iPrev++) {
+            if (bands[iPrev].sds_index == bands[iBand].sds_index)
+                break;
+        }
+        if (iPrev < iBand) {
+            bands[iBand].out_index = bands[iPrev].out_index;
+            continue;
+        }
+
+        bands[iBand].out_index = create_overlay_sds (hdfid, outid,
+                                                     bands[iBand].sds_index,
+                                                     bands, nDestripe);
+        if (bands[iBand].out_index == FAIL) {
+            HDFWARN("");
+            SDend(outid);
+            return FAIL;
+        }
+    }
+
+    return outid;
+}
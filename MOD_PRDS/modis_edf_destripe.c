@@ -35,32 +35,27 @@
 
 ******************************************************************************/
 #include <stdio.h>
-#include "interp.h"
+#include <stdlib.h>
+#include <stdint.h>
 #include "hdf.h"
-
-
-/******************************************************************************
-    constants
-******************************************************************************/
-
-#define MaxValSize 32768
-
-#define MaxVal 32767
+#include "modis_edf_destripe.h"
 
 /******************************************************************************
  prototypes
 ******************************************************************************/
 
-size_t modis_edf_valid (size_t n, int16 *image);
+int modis_edf_median (size_t n, int *hist);
 
-int modis_edf_median (size_t n, int16 *image);
+size_t create_edf (int32 nPixel, int32 nScan, int32 stripsize, int32 nDet,
+                   int32 *mir, EDF_STATS *stats, int16 *image, int32 *edf,
+                   int *median);
 
-int create_edf (int32 nPixel, int32 nScan, int32 stripsize, int32 nDet, int16 *image, double *edf);
+void match_edf (int32 *edf_ref, int32 *edf_det, int32 *lut);
 
-void create_lut (int32 nDet, double *edf, int32 ref_ind, int32 *lut);
+void create_lut (int32 nDet, int32 *edf, int32 ref_ind, int32 *lut);
 
 int apply_lut ( int32 nPixel, int32 nScan, int32 stripsize, int32 nDet, int32 ref_ind,
-                 int32 *lut, int16 *image, int16 *destripe);
+                 int32 *lut, int16 *image, int16 *destripe, int *median);
 
 /****************************************************************************//**
 
@@ -90,6 +85,8 @@ algorithm of Weinreb et. al.
 @param stripsize    size of a modis strip (10 for 1km, 20 for 500m)
 @param ref          referance detector
 @param mir          Pointer to the array of mirror side data
+@param stats        statistics of earlier granules for the band, updated
+                    with this one; NULL to use this granule only
 @param image        pointer to the image
 @param destripe     pointer to the image to store the output in
 
@@ -98,27 +95,26 @@ algorithm of Weinreb et. al.
 ******************************************************************************/
 
 int modis_edf_destripe( int32 nPixel, int32 nScan, int32 stripsize,
-                        int32 ref, int32 *mir,
+                        int32 ref, int32 *mir, EDF_STATS *stats,
                         int16 *image, int16 *destripe)
 {
 
     int32 nDet = stripsize * 2;
     
-    /***** Get the number of valid values in the input image *****/
-
-    size_t nValid = modis_edf_valid(nScan * stripsize * nPixel, image);
-
-    if (nValid < stripsize * nPixel)
-        return -1;
-    
-    /***** Create the EDF for each detector *****/
+    /***** Create the EDF for each detector, get the number of valid values
+           and the median of the input image *****/
  
-    double *edf = calloc( MaxValSize * nDet,  sizeof(double) );
+    int32 *edf = calloc( MaxValSize * nDet,  sizeof(int32) );
     if ( !edf ) {
         return -1;
     }
     
-    if ( 0 > create_edf (nPixel, nScan, stripsize, nDet, image, edf) ) {
+    int median_old, median_new, median_del;
+
+    size_t nValid = create_edf (nPixel, nScan, stripsize, nDet, mir, stats,
+                                image, edf, &median_old);
+
+    if (nValid < stripsize * nPixel) {
         free (edf);
         return -1;
     }
@@ -140,14 +136,12 @@ int modis_edf_destripe( int32 nPixel, int32 nScan, int32 stripsize,
     create_lut (nDet, edf, ref_ind, lut);
     free (edf);
 
-    /***** Set the output image equal to the input image *****/
-
-    memcpy(destripe, image, nScan * stripsize * nPixel * sizeof(int16));
-
-    /***** Apply the LUT to all detectors except the reference detector *****/
+    /***** Apply the LUT to all detectors except the reference detector,
+           replace bad destriped values and get the median of the
+           destriped image *****/
 
     if ( 0 > apply_lut ( nPixel, nScan, stripsize, nDet, ref_ind,
-                lut, image, destripe))
+                lut, image, destripe, &median_new))
     {
         free(lut);
         return -1;
@@ -155,24 +149,13 @@ int modis_edf_destripe( int32 nPixel, int32 nScan, int32 stripsize,
     
     free (lut);
     
-    /***** Replace bad destriped values *****/
-    int i;
-    for (i = 0; i < nScan * stripsize * nPixel ; i++) { 
-        if (destripe[i] < 0 || destripe[i] > MaxVal)
-            destripe[i] = image[i];
-    }
-
     /***** Set median value of destriped image to median value of original image *****/
 
-    int median_old, median_new, median_del;
-    
-    median_old = modis_edf_median(nScan * stripsize * nPixel, image);
-    median_new = modis_edf_median(nScan * stripsize * nPixel, destripe);
-    
+    int i;
     median_del = median_new - median_old;
     if (median_del != 0) {
         for (i = 0; i < nScan * stripsize * nPixel ; i++) {
-            if (destripe[i] >= 0 || destripe[i] <= MaxVal)
+            if (destripe[i] >= 0 && destripe[i] <= MaxVal)
                 destripe[i] = destripe[i] - median_del;
         }
     }
@@ -183,35 +166,23 @@ int modis_edf_destripe( int32 nPixel, int32 nScan, int32 stripsize,
 
 /****************************************************************************//**
 
-Compute the median of an array of MODIS 1KM scaled integers.
+Compute the median of an array of MODIS 1KM scaled integers from its
+histogram.
 
-@param n        Number of pixels in the image
-@param image    image to compute the median from
+@param n        Number of pixels in the image (valid or not)
+@param hist     histogram of the valid values of the image, MaxValSize ints
 
 @return median value
 
 ******************************************************************************/
 
-int modis_edf_median (size_t n, int16 *image) {
-
-    int hist[32767];
-    int count;
-
-    /***** Compute histogram *****/
-
-    memset(hist, 0, MaxVal * sizeof(int));
-
-    size_t i;
-    for ( i = 0; i < n; i++ ) {
-        count = image[i];
-        if (count >= 0 && count <= MaxVal)
-            (hist[count])++;
-    }
+int modis_edf_median (size_t n, int *hist) {
 
     /***** Compute cumulative sum, and return when median is found *****/
     
-    int sum = 0;
+    size_t sum = 0;
     int median = 0;
+    int i;
     for ( i = 0; i <= MaxVal; i++ ) {
         sum += hist[i];
         median = i;
@@ -222,139 +193,211 @@ int modis_edf_median (size_t n, int16 *image) {
     return median;
 }
 
-
 /****************************************************************************//**
 
-Count the number of valid values in an array of MODIS 1KM scaled integers.
+Create the EDF for each detector
 
-@param n        Number of pixels in the image
-@param image    image to compute the valid values from
+@param nPixel       number of pixels (width)
+@param nScan        number of scans in the image
+@param stripsize    size of a modis strip (10 for 1km, 20 for 500m)
+@param nDet         number of detectors (stripsize * 2)
+@param mir          Pointer to the array of mirror side data
+@param stats        statistics of earlier granules, NULL if none
+@param image        pointer to the image to read the data from
+@param edf          pointer to the edf to store the output in
+@param median       pointer to return the median of the image in
+
+@return the number of valid values in the image (0 on failure)
+
+The EDF of a detector is stored as its cumulative histogram, the number of
+valid values <= i, so element MaxVal is the number of valid values of the
+detector; divided by that it is the EDF.
 
-@return Number of valid values in the range 0 to 32767 (MaxVal) inclusive
+The histograms of all the detectors (and so of the image, for the median)
+are filled in one row-major pass over the image: row r is detector
+r % nDet, detectors stripsize to nDet - 1 being the second scan of each
+pair (the other mirror side).
+
+With an odd number of scans the last scan has no second scan, and the
+histograms of detectors stripsize to nDet - 1 count the rows of the
+second to last pair twice instead, as the per detector row lists of the
+IDL code did.
+
+With stats the histograms are added to the statistics, and once these
+cover enough granules and values the EDFs are made from them instead of
+from this granule alone, see edf_stats_ready().
 
 ******************************************************************************/
 
-size_t modis_edf_valid (size_t n, int16 *image) {
+size_t create_edf (int32 nPixel, int32 nScan, int32 stripsize, int32 nDet,
+                   int32 *mir, EDF_STATS *stats, int16 *image, int32 *edf,
+                   int *median)
+{
 
-    size_t sum = 0;
+    int *hist = calloc( (size_t) MaxValSize * (nDet + 1), sizeof(int) );
+    if ( !hist )
+        return 0;
+    
+    int *hist_all = hist + (size_t) MaxValSize * nDet;
+
+    /***** Compute the histogram for each detector *****/
 
-    /***** Compute number of valid values *****/
-    size_t i;
-    for ( i = 0; i < n ; i++) {
-        if (image[i] >= 0 && image[i] <= MaxVal)
-            sum++;
+    int32 nRow = nScan * stripsize;
+    int32 iRow;
+    for ( iRow = 0; iRow < nRow; iRow++ ) {
+        int *dethist = hist + (size_t) MaxValSize * (iRow % nDet);
+        int16 *line = image + (size_t) iRow * nPixel;
+        
+        int32 iPix;
+        for ( iPix = 0; iPix < nPixel; iPix++) {
+            int16 count = line[iPix];
+            if (count >= 0)
+                (dethist[count])++;
+        }
     }
 
-    return sum;
-}
+    /***** The image histogram is the sum of the detector histograms *****/
 
-/****************************************************************************//**
+    size_t nValid = 0;
+    int32 iDet;
+    int i;
+    for (iDet = 0; iDet < nDet; iDet++) {
+        int *dethist = hist + (size_t) MaxValSize * iDet;
+        for ( i = 0; i <= MaxVal; i++) {
+            hist_all[i] += dethist[i];
+            nValid += dethist[i];
+        }
+    }
 
-Compute row indices for a detector
+    *median = modis_edf_median(nRow * nPixel, hist_all);
 
-@param nPixel       number of pixels (width)
-@param nScan        number of scans in the image
-@param stripsize    size of a modis strip (10 for 1km, 20 for 500m)
-@param nDet         number of detectors (stripsize * 2)
-@param iDet         the detector to calc indices for
-@param row          pointer row index
+    /***** Use the statistics of this and earlier granules if there are
+           enough, a detector has about nScan / 2 rows in a granule *****/
 
-@return the number of locations in the row index
+    if ( stats && 0 == edf_stats_add (stats, hist, nDet, mir) &&
+         edf_stats_ready (stats, (size_t) (nScan / 2) * nPixel) )
+    {
+        edf_stats_edf (stats, nDet, mir, edf);
+        free (hist);
+        return nValid;
+    }
 
-******************************************************************************/
+    /***** Count the duplicated rows for an odd number of scans *****/
 
-int calc_row( int32 nPixel, int32 nScan, int32 stripsize, int32 nDet, int32 iDet, int32 *row)
-{
-    /***** Compute row indices for this detector *****/
+    if (nScan % 2 == 1 && nScan / 2 >= 2) {
+        for (iDet = stripsize; iDet < nDet; iDet++) {
+            int *dethist = hist + (size_t) MaxValSize * iDet;
+            int16 *line = image + ((size_t) (nScan / 2 - 2) * nDet + iDet) * nPixel;
+            
+            int32 iPix;
+            for ( iPix = 0; iPix < nPixel; iPix++) {
+                int16 count = line[iPix];
+                if (count >= 0)
+                    (dethist[count])++;
+            }
+        }
+    }
 
-    int32 nLoc = nScan / 2 - 1;
-    
-    int32 iLoc;
-    for (iLoc = 0; iLoc <= nLoc; iLoc++) {
-        row[iLoc] = iLoc * nDet + iDet;
+    /***** Compute the EDF for each detector *****/
+        
+    for (iDet = 0; iDet < nDet; iDet++) {
+        int *dethist = hist + (size_t) MaxValSize * iDet;
+        int sum = 0;
+        for ( i = 0; i <= MaxVal; i++) {
+            sum += dethist[i];
+            get2darray( edf, i, iDet, MaxValSize) = sum;
+        }
     }
     
-    /***** Handle an odd number of scans *****/
+    free (hist);
     
-    if (nScan % 2 == 1) {
-        nLoc = nScan / 2;
-        
-        if (iDet < stripsize)
-            row[nLoc] = row[nLoc - 1] + nDet;
-        
-        else
-            row[nLoc] = row[nLoc - 1] - nDet;\
-    }
-
-    return nLoc;
+    return nValid;
 }
 
 /****************************************************************************//**
 
-Create the EDF for each detector
+Match the EDF of a detector to the EDF of the reference detector
 
-@param nPixel       number of pixels (width)
-@param nScan        number of scans in the image
-@param stripsize    size of a modis strip (10 for 1km, 20 for 500m)
-@param nDet         number of detectors (stripsize * 2)
-@param image        pointer to the image to read the data from
-@param edf          pointer to the edf to store the output in
+@param edf_ref      pointer to the edf of the reference detector
+@param edf_det      pointer to the edf of the detector
+@param lut          pointer to the lut of the detector to store the output in
 
-@return 0 on success, -1 on failure
+@return nothing
+
+lut[i] is the value where the reference EDF, linearly interpolated between
+the values, equals the detector EDF at i, rounded as (int)(x + .5).  Both
+EDFs are monotone, so this is a merge of the two: the reference segment
+only ever moves up as i does, and the LUT takes O(MaxVal).
+
+The EDFs are compared as cumulative counts cross multiplied by the number
+of valid values of the other detector, and the LUT is computed as an
+integer fraction, so there is no rounding in the comparisons.  Inside a
+segment the LUT is its start or its end, so the only divisions are for
+extrapolation, and the LUT is only computed for the values the detector
+has, it is constant in between.  Values below the first segment of the
+reference EDF are extrapolated from it; if that segment is flat they map
+to its start.  A detector or a reference detector without valid values
+gets the identity LUT.
+
+Only the two EDFs and the LUT of the detector are used, so the LUTs of
+different detectors can be computed in parallel.
 
 ******************************************************************************/
 
-int create_edf (int32 nPixel, int32 nScan, int32 stripsize, int32 nDet, int16 *image, double *edf) {
+void match_edf (int32 *edf_ref, int32 *edf_det, int32 *lut) {
 
-    int32 *row = malloc( (nScan / 2 + 1) * sizeof(int32) );
-    if ( !row )
-        return -1;
-    
-    int32 iDet;
-    for (iDet = 0; iDet < nDet; iDet++) {
+    int64_t nref = edf_ref[MaxVal];
+    int64_t ndet = edf_det[MaxVal];
+    int i;
 
-        /***** Compute row indices for this detector *****/
-        
-        int32 nLoc = calc_row( nPixel, nScan, stripsize, nDet, iDet, row);
-    
-        /***** Compute the histogram for this detector *****/
-        
-        int hist[MaxValSize];
-        memset(hist, 0, MaxValSize * sizeof(int));
-        int ngood = 0;
-        
-        int32 iLoc;
-        for ( iLoc = 0; iLoc <= nLoc; iLoc++ ) {
-            int32 iPix;
-            for ( iPix = 0; iPix < nPixel; iPix++) {
-                int16 count = 0;
-                count = get2darray(image, iPix, row[iLoc], nPixel);
-                if (count >= 0 && count <= MaxVal) {
-                    (hist[count])++;
-                    ngood++;
-                }
-            }
+    if (nref == 0 || ndet == 0) {
+        for (i = 0; i <= MaxVal; i++)
+            lut[i] = i;
+        return;
+    }
+
+    int lo = 0;
+    int hi = 1;
+    for (i = 0; i <= MaxVal; i++) {
+
+        /***** no values i in the detector, same EDF, same LUT *****/
+
+        if (i > 0 && edf_det[i] == edf_det[i - 1]) {
+            lut[i] = lut[i - 1];
+            continue;
         }
         
-        /***** Compute the EDF for this detector *****/
+        /***** move to the reference segment the detector EDF falls in *****/
+
+        int64_t x = edf_det[i] * nref;
+        while (hi < MaxVal && x > edf_ref[hi] * ndet) {
+            lo++;
+            hi++;
+        }
         
-        int sum = 0;
-        int i;
-        for ( i = 0; i <= MaxVal; i++) {
-            sum += hist[i];
-            get2darray( edf, i, iDet, MaxValSize) = (double)sum / (double) ngood;
+        /***** interpolate, lo + num / den *****/
+
+        int64_t den = (edf_ref[hi] - edf_ref[lo]) * ndet;
+        if (den == 0) {
+            lut[i] = lo;
+            continue;
         }
+        int64_t num = x - edf_ref[lo] * ndet;
+
+        /***** inside the segment 0 < num <= den, so it rounds to lo or hi *****/
+
+        if (num >= 0)
+            lut[i] = (2 * num >= den) ? hi : lo;
+        else
+            lut[i] = (2 * (lo * den + num) + den) / (2 * den);
     }
-    
-    free (row);
-    
-    return 0;
 }
 
 /****************************************************************************//**
 
 Create the lookup table which maps each detector to the reference detector
 
+@param nDet         number of detectors (stripsize * 2)
 @param edf          pointer to the edf array
 @param ref_ind      referance detector
 @param lut          pointer to the lut array to store the output in
@@ -363,29 +406,15 @@ Create the lookup table which maps each detector to the reference detector
 
 ******************************************************************************/
 
-void create_lut (int32 nDet, double *edf, int32 ref_ind, int32 *lut) {
+void create_lut (int32 nDet, int32 *edf, int32 ref_ind, int32 *lut) {
 
-    double xtab[MaxValSize], ytab[MaxValSize];
-    double xint[MaxValSize], yint[MaxValSize];
+    int32 *edf_ref = edf + (size_t) MaxValSize * ref_ind;
 
-    int i;
-    for (i = 0; i < MaxValSize; i++) {
-        xtab[i] = get2darray( edf, i, ref_ind, MaxValSize);
-        ytab[i] = i;
-    }
-
-    int n = MaxValSize;
     int32 iDet;
     for (iDet = 0; iDet < nDet; iDet++) {
-        if (iDet != ref_ind) {
-            for (i = 0; i < MaxValSize; i++)
-                xint[i] = get2darray(edf, i, iDet, MaxValSize);
-            
-            interp(n, xtab, ytab, n, xint, yint);
-
-            for (i = 0; i < MaxValSize; i++)
-                get2darray( lut, i, iDet, MaxValSize) = (int)(yint[i] + .5);
-        }
+        if (iDet != ref_ind)
+            match_edf (edf_ref, edf + (size_t) MaxValSize * iDet,
+                       lut + (size_t) MaxValSize * iDet);
     }
 }
 
@@ -401,46 +430,51 @@ Apply the LUT to all detectors except the reference detector
 @param lut          pointer to the lut array
 @param image        pointer to the image
 @param destripe     pointer to the image to store the output in
+@param median       pointer to return the median of the destriped image in
 
 @return 0 on success, -1 on failure
 
+The image is destriped in one sequential row-major pass, row r being
+detector r % nDet as in create_edf().  Invalid input values and the
+reference detector are copied, and destriped values that are out of range
+are replaced by the input value.
+
 ******************************************************************************/
 
 int apply_lut ( int32 nPixel, int32 nScan, int32 stripsize, int32 nDet, int32 ref_ind,
-                 int32 *lut, int16 *image, int16 *destripe)
+                 int32 *lut, int16 *image, int16 *destripe, int *median)
 {
     
-    int32 *row = malloc( (nScan / 2 + 1) * sizeof(int32) );
-    if ( !row )
+    int *hist = calloc( MaxValSize, sizeof(int) );
+    if ( !hist )
         return -1;
-    
-    int32 iDet;
-    for (iDet = 0; iDet < nDet; iDet++) {
 
-        if (iDet != ref_ind) {
-
-            /***** Compute row indices for this detector *****/
+    int32 nRow = nScan * stripsize;
+    int32 iRow;
+    for ( iRow = 0; iRow < nRow; iRow++ ) {
+        int32 iDet = iRow % nDet;
+        int32 *detlut = (iDet == ref_ind) ? NULL : lut + (size_t) MaxValSize * iDet;
+        int16 *in = image + (size_t) iRow * nPixel;
+        int16 *out = destripe + (size_t) iRow * nPixel;
+        
+        int32 iPix;
+        for (iPix = 0; iPix < nPixel; iPix++) {
+            int16 pix = in[iPix];
 
-            int32 nLoc = calc_row( nPixel, nScan, stripsize, nDet, iDet, row);
-            
-            /***** Apply the LUT to valid input values *****/
-            int32 iLoc;
-            for ( iLoc = 0; iLoc <= nLoc; iLoc++ ) {
-
-                int32 iPix;
-                for (iPix = 0; iPix < nPixel; iPix++) {
-                    int16 pix = get2darray( image, iPix, row[iLoc], nPixel);
-
-                    if (pix >= 0 && pix <= MaxVal) {
-                        get2darray( destripe, iPix, row[iLoc], nPixel) = 
-                            get2darray( lut, pix, iDet, MaxValSize );
-                    }
-                }
+            if (pix >= 0 && detlut) {
+                int16 value = detlut[pix];
+                out[iPix] = (value < 0) ? pix : value;
             }
+            else
+                out[iPix] = pix;
+
+            if (out[iPix] >= 0)
+                (hist[out[iPix]])++;
         }
     }
 
-    free (row);
-    
+    *median = modis_edf_median(nRow * nPixel, hist);
+    free (hist);
+
     return 0;
 }
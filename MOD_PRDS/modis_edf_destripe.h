@@ -11,8 +11,14 @@
 #ifndef _MODIS_EDF_DESTRIPE_H
 #define _MODIS_EDF_DESTRIPE_H
 
+#include "modis_edf_stats.h"
+
+#define MaxValSize 32768
+
+#define MaxVal 32767
+
 int modis_edf_destripe( int32 npixel, int32 nscan, int32 stripsize,
-                        int32 ref, int32 *mir,
+                        int32 ref, int32 *mir, EDF_STATS *stats,
                         int16 *image, int16 *destripe );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,328 @@
+/******************************************************************************
+ Program to destripe modis data
+
+ Per band detector statistics accumulated across granules
+
+ A granule gives noisy EDFs when it is dark or mostly cloud, so the
+ detector histograms of the recent granules are kept in a statistics file
+ per band, one histogram per mirror side and detector, and the EDFs are
+ made from these once they cover enough granules.
+
+ The statistics file is a STATS_HDRSIZE byte header followed by the
+ histograms as native float, mirror side 0 detectors 0 to stripsize - 1,
+ then mirror side 1.  The histograms are a rolling window: before a granule
+ is added they are weighted down by exp(-dt / window), dt being the time
+ since the newest granule added, so a granule counts for about one window.
+ The file is written to a temporary file and renamed, so a concurrent run
+ never reads a partial file; of two runs updating the same band at the
+ same time one update is lost.
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "hdf.h"
+#include "modis_edf_destripe.h"
+
+/******************************************************************************
+    constants
+******************************************************************************/
+
+#define STATS_MAGIC "MODEDFSTATS1"
+
+#define STATS_HDRSIZE 64
+
+#define STATS_MIN_GRANULES 2.0     /* weight for the statistics to be used */
+
+/******************************************************************************
+ statistics file header
+
+******************************************************************************/
+
+typedef struct {
+    char magic[16];
+    int32 stripsize;
+    int32 nval;                     /* MaxValSize */
+    float64 time;                   /* time of the newest granule added */
+    float64 weight;                 /* number of granules, weighted down */
+} STATS_HEADER;
+
+/******************************************************************************
+ statistics of a band
+
+******************************************************************************/
+
+struct EDF_STATS {
+    char *filename;
+    int32 stripsize;
+    double window;                  /* seconds */
+    double time;                    /* time of the newest granule added */
+    double weight;                  /* number of granules, weighted down */
+    double granule_weight;          /* weight of the granule to add */
+    float *hist;                    /* [mirror side * stripsize + detector][MaxValSize] */
+};
+
+/****************************************************************************//**
+
+open the statistics of a band, and weight them down for a new granule
+
+@param dir          directory of the statistics files
+@param name         name of the statistics, eg MOD021KM_b08
+@param stripsize    size of a modis strip (10 for 1km, 20 for 500m)
+@param window       time window of the statistics in seconds
+@param time         time of the granule, seconds since 1970
+
+@return the statistics, NULL on failure
+
+The statistics start empty if the file does not exist or was written for
+another stripsize.  A granule older than the newest granule added is
+weighted down instead of the statistics.
+
+******************************************************************************/
+
+EDF_STATS *edf_stats_open( char *dir, char *name, int32 stripsize,
+                           double window, double time )
+{
+    size_t nhist = (size_t) 2 * stripsize * MaxValSize;
+    char header[STATS_HDRSIZE];
+    STATS_HEADER *hdr = (STATS_HEADER *) header;
+    FILE *fp;
+
+    EDF_STATS *stats = calloc (1, sizeof(EDF_STATS));
+    if (!stats)
+        return NULL;
+
+    stats->filename = malloc (strlen(dir) + strlen(name) + 16);
+    stats->hist = calloc (nhist, sizeof(float));
+    if (!stats->filename || !stats->hist) {
+        edf_stats_close (stats);
+        return NULL;
+    }
+    sprintf (stats->filename, "%s/%s.edfstats", dir, name);
+
+    stats->stripsize = stripsize;
+    stats->window = window;
+    stats->time = time;
+    stats->weight = 0.0;
+    stats->granule_weight = 1.0;
+
+    /***** read the statistics file, if any *****/
+
+    if ( (fp = fopen(stats->filename, "rb")) ) {
+        if ( fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+             !memcmp(hdr->magic, STATS_MAGIC, sizeof(STATS_MAGIC)) &&
+             hdr->stripsize == stripsize && hdr->nval == MaxValSize &&
+             fread(stats->hist, sizeof(float), nhist, fp) == nhist )
+        {
+            stats->time = hdr->time;
+            stats->weight = hdr->weight;
+        }
+        else {
+            fprintf(stderr, "Warning: ignoring invalid statistics file %s\n",
+                    stats->filename);
+            memset(stats->hist, 0, nhist * sizeof(float));
+        }
+        fclose(fp);
+    }
+
+    /***** weight down the older of the statistics and the granule *****/
+
+    if (time < stats->time)
+        stats->granule_weight = exp( -(stats->time - time) / window );
+    else if (time > stats->time) {
+        float decay = exp( -(time - stats->time) / window );
+        size_t i;
+        for (i = 0; i < nhist; i++)
+            stats->hist[i] *= decay;
+        stats->weight *= decay;
+        stats->time = time;
+    }
+
+    return stats;
+}
+
+/****************************************************************************//**
+
+add the detector histograms of a granule to the statistics
+
+@param stats        the statistics
+@param hist         the histograms of the granule detectors, MaxValSize ints each
+@param nDet         number of detectors (stripsize * 2)
+@param mir          Pointer to the array of mirror side data
+
+@return 0 on success, -1 if the mirror sides of the first two scans are not
+        0 and 1; nothing is added then
+
+detector d of the granule is detector d % stripsize of the mirror side of
+scan d / stripsize
+
+******************************************************************************/
+
+int edf_stats_add( EDF_STATS *stats, int *hist, int32 nDet, int32 *mir )
+{
+    int32 stripsize = stats->stripsize;
+    float weight = stats->granule_weight;
+    int32 iDet;
+    int i;
+
+    if ( nDet != 2 * stripsize || mir[0] + mir[1] != 1 ||
+         (mir[0] != 0 && mir[0] != 1) )
+    {
+        return -1;
+    }
+
+    for (iDet = 0; iDet < nDet; iDet++) {
+        int *dethist = hist + (size_t) MaxValSize * iDet;
+        float *sum = stats->hist + (size_t) MaxValSize *
+                     (mir[iDet / stripsize] * stripsize + iDet % stripsize);
+
+        for (i = 0; i < MaxValSize; i++)
+            sum[i] += weight * dethist[i];
+    }
+
+    stats->weight += weight;
+
+    return 0;
+}
+
+/****************************************************************************//**
+
+check if the statistics can be used
+
+@param stats        the statistics
+@param mincount     minimum number of values of each detector
+
+@return 1 if they cover STATS_MIN_GRANULES granules (weighted down) and each
+        detector has mincount values (weighted down), 0 otherwise
+
+******************************************************************************/
+
+int edf_stats_ready( EDF_STATS *stats, size_t mincount )
+{
+    int32 iDet;
+    int i;
+
+    if (stats->weight < STATS_MIN_GRANULES)
+        return 0;
+
+    for (iDet = 0; iDet < 2 * stats->stripsize; iDet++) {
+        float *sum = stats->hist + (size_t) MaxValSize * iDet;
+        double count = 0.0;
+
+        for (i = 0; i < MaxValSize; i++)
+            count += sum[i];
+
+        if (count < mincount)
+            return 0;
+    }
+
+    return 1;
+}
+
+/****************************************************************************//**
+
+Create the EDF for each detector of a granule from the statistics
+
+@param stats        the statistics
+@param nDet         number of detectors (stripsize * 2)
+@param mir          Pointer to the array of mirror side data
+@param edf          pointer to the edf to store the output in, as in
+                    create_edf()
+
+@return nothing
+
+The cumulative histograms are scaled to at most 2^30 to fit the int32 EDF.
+
+******************************************************************************/
+
+void edf_stats_edf( EDF_STATS *stats, int32 nDet, int32 *mir, int32 *edf )
+{
+    int32 stripsize = stats->stripsize;
+    int32 iDet;
+    int i;
+
+    for (iDet = 0; iDet < nDet; iDet++) {
+        float *sum = stats->hist + (size_t) MaxValSize *
+                     (mir[iDet / stripsize] * stripsize + iDet % stripsize);
+        int32 *detedf = edf + (size_t) MaxValSize * iDet;
+        double total = 0.0;
+
+        for (i = 0; i < MaxValSize; i++)
+            total += sum[i];
+
+        double scale = (total > 1073741824.0) ? 1073741824.0 / total : 1.0;
+
+        double cum = 0.0;
+        for (i = 0; i < MaxValSize; i++) {
+            cum += sum[i];
+            detedf[i] = (int32) (cum * scale + .5);
+        }
+    }
+}
+
+/****************************************************************************//**
+
+write the statistics file
+
+@param stats        the statistics
+
+@return 0 on success, -1 on failure
+
+******************************************************************************/
+
+int edf_stats_save( EDF_STATS *stats )
+{
+    size_t nhist = (size_t) 2 * stats->stripsize * MaxValSize;
+    char header[STATS_HDRSIZE];
+    STATS_HEADER *hdr = (STATS_HEADER *) header;
+    FILE *fp;
+    int ok;
+
+    memset(header, 0, sizeof(header));
+    memcpy(hdr->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+    hdr->stripsize = stats->stripsize;
+    hdr->nval = MaxValSize;
+    hdr->time = stats->time;
+    hdr->weight = stats->weight;
+
+    char *tmpfile = malloc (strlen(stats->filename) + 32);
+    if (!tmpfile)
+        return -1;
+    sprintf (tmpfile, "%s.%ld", stats->filename, (long) getpid());
+
+    ok = (fp = fopen(tmpfile, "wb")) != NULL &&
+         fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+         fwrite(stats->hist, sizeof(float), nhist, fp) == nhist;
+    if (fp && fclose(fp) != 0)
+        ok = 0;
+    if (ok)
+        ok = rename(tmpfile, stats->filename) == 0;
+    if (!ok && fp)
+        remove(tmpfile);
+    free(tmpfile);
+
+    return ok ? 0 : -1;
+}
+
+/****************************************************************************//**
+
+free the statistics
+
+@param stats        the statistics, may be NULL
+
+@return nothing
+
+******************************************************************************/
+
+void edf_stats_close( EDF_STATS *stats )
+{
+    if (!stats)
+        return;
+
+    free(stats->filename);
+    free(stats->hist);
+    free(stats);
+}
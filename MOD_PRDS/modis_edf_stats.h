@@ -0,0 +1,26 @@
+/******************************************************************************
+ Program to destripe modis data
+
+ Detector statistics accumulated across granules, see modis_edf_stats.c
+
+******************************************************************************/
+
+#ifndef _MODIS_EDF_STATS_H
+#define _MODIS_EDF_STATS_H
+
+typedef struct EDF_STATS EDF_STATS;
+
+EDF_STATS *edf_stats_open( char *dir, char *name, int32 stripsize,
+                           double window, double time );
+
+int edf_stats_add( EDF_STATS *stats, int *hist, int32 nDet, int32 *mir );
+
+int edf_stats_ready( EDF_STATS *stats, size_t mincount );
+
+void edf_stats_edf( EDF_STATS *stats, int32 nDet, int32 *mir, int32 *edf );
+
+int edf_stats_save( EDF_STATS *stats );
+
+void edf_stats_close( EDF_STATS *stats );
+
+#endif
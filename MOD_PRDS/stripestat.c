@@ -0,0 +1,263 @@
+/*************************************************************************
+Description:
+
+  Measure the striping left in a MODIS L1B granule made by mkstripe,
+  before or after modis_destripe, against the granule without stripes:
+  for every band in the destriping configuration, the mean difference to
+  the scene of each detector is taken, and the residual stripe is the
+  RMS of these means about their average, in DN.  Used by
+  bench_destripe.sh.
+
+Notes:
+
+  1. The detectors are told apart by scan parity and detector, as
+     modis_edf_destripe does: the mirror sides alternate, so this is the
+     detector and mirror side.
+  2. The detectors flagged bad in the configuration are left out, as are
+     pixels that are not valid (over 32767) in either file.  The average
+     of the detector means is taken out, since the destriped band is
+     shifted to the median of the striped band.
+  3. The bands are those with "destriped" set in the truth file, see
+     mkstripe.  The last line of the report is "max <residual stripe>"
+     over the bands.  The exit status is 0 if the files have the same
+     bands, 1 otherwise.
+  4. With a reference granule, every band of the SDSs in the truth file
+     is also compared value by value to the reference granule, and a
+     band that differs is reported and makes the exit status 1.  The
+     bytes of the files may differ even if the data doesn't, since HDF
+     writes the chunks in the order they are done.
+
+Revision history:
+
+  Version 1.0   10/26   Original Development
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mfhdf.h"
+
+#define MAXSTRIP        20
+#define MAXSDSBANDS     16
+#define DATA_MAX        32767
+
+static void usage(void)
+{
+    printf("\n");
+    printf("Usage: stripestat <mkstripe truth file> <granule> [<reference granule>]\n");
+    printf("\n");
+}
+
+static void fatal(const char *msg, const char *arg)
+{
+    fprintf(stderr, "stripestat: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+}
+
+/* Read an attribute of an SDS or file, -1 if it has a different type or
+   more values than n */
+static int read_attr(int32 id, const char *name, int32 type, int32 n,
+                     void *buf)
+{
+    int32 index, atype, count;
+    char aname[MAX_NC_NAME];
+
+    if ((index = SDfindattr(id, (char *)name)) == FAIL ||
+        SDattrinfo(id, index, aname, &atype, &count) == FAIL ||
+        atype != type || count > n)
+        return -1;
+    return (SDreadattr(id, index, buf) == FAIL) ? -1 : (int)count;
+}
+
+/* Residual stripe of a band: RMS about their average of the mean
+   difference to the scene of each good detector */
+static double residual_stripe(const uint16 *truth, const uint16 *data,
+                              int32 nline, int32 nsamp, int stripsize,
+                              const int8 *bad)
+{
+    double sum[2 * MAXSTRIP], mean[2 * MAXSTRIP], avg = 0.0, var = 0.0;
+    size_t count[2 * MAXSTRIP];
+    int32 il, is;
+    int idet, ndet = 0;
+
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+
+    for (il = 0; il < nline; il++) {
+        idet = il % (2 * stripsize);
+        if (bad[idet % stripsize])
+            continue;
+        for (is = 0; is < nsamp; is++) {
+            size_t i = (size_t)il * nsamp + is;
+            if (truth[i] > DATA_MAX || data[i] > DATA_MAX)
+                continue;
+            sum[idet] += (double)data[i] - (double)truth[i];
+            count[idet]++;
+        }
+    }
+
+    for (idet = 0; idet < 2 * stripsize; idet++) {
+        if (count[idet] == 0)
+            continue;
+        mean[ndet] = sum[idet] / count[idet];
+        avg += mean[ndet];
+        ndet++;
+    }
+    if (ndet == 0)
+        return 0.0;
+    avg /= ndet;
+
+    for (idet = 0; idet < ndet; idet++)
+        var += (mean[idet] - avg) * (mean[idet] - avg);
+
+    return sqrt(var / ndet);
+}
+
+/* Number of values of a band that differ between two granules */
+static size_t count_diff(const uint16 *a, const uint16 *b, int32 nline,
+                         int32 nsamp)
+{
+    size_t i, n = (size_t)nline * nsamp, ndiff = 0;
+
+    for (i = 0; i < n; i++)
+        if (a[i] != b[i])
+            ndiff++;
+    return ndiff;
+}
+
+int main(int argc, char *argv[])
+{
+    int32 truth_id, sd_id, ref_id = FAIL, nsds, nattr, index, tsds_id, sds_id;
+    int32 rsds_id = FAIL;
+    int32 rank, dims[MAX_VAR_DIMS], type, start[3], edges[3], stripsize;
+    int32 bands[MAXSDSBANDS];
+    int8 destriped[MAXSDSBANDS], bad[MAXSDSBANDS * MAXSTRIP];
+    char name[MAX_NC_NAME];
+    uint16 *tbuf, *buf, *rbuf = NULL;
+    size_t ndiff;
+    double stripe, maxstripe = 0.0;
+    int isds, ib, nband, ndestriped, status = 0;
+
+    if (argc != 3 && argc != 4) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if ((truth_id = SDstart(argv[1], DFACC_READ)) == FAIL)
+        fatal("can't open", argv[1]);
+    if ((sd_id = SDstart(argv[2], DFACC_READ)) == FAIL)
+        fatal("can't open", argv[2]);
+    if (argc == 4 && (ref_id = SDstart(argv[3], DFACC_READ)) == FAIL)
+        fatal("can't open", argv[3]);
+    if (SDfileinfo(truth_id, &nsds, &nattr) == FAIL)
+        fatal("can't get SDSs of", argv[1]);
+    if (read_attr(truth_id, "lines_per_scan", DFNT_INT32, 1, &stripsize) != 1 ||
+        stripsize < 1 || stripsize > MAXSTRIP)
+        fatal("not a mkstripe truth file:", argv[1]);
+
+    for (isds = 0; isds < nsds; isds++) {
+        if ((tsds_id = SDselect(truth_id, isds)) == FAIL ||
+            SDgetinfo(tsds_id, name, &rank, dims, &type, &nattr) == FAIL)
+            fatal("can't get SDS info from", argv[1]);
+
+        nband = read_attr(tsds_id, "band_numbers", DFNT_INT32, MAXSDSBANDS,
+                          bands);
+        if (rank != 3 || type != DFNT_UINT16 || nband != dims[0] ||
+            read_attr(tsds_id, "destriped", DFNT_INT8, MAXSDSBANDS,
+                      destriped) != nband ||
+            read_attr(tsds_id, "bad_detectors", DFNT_INT8,
+                      MAXSDSBANDS * MAXSTRIP, bad) != nband * MAXSTRIP) {
+            SDendaccess(tsds_id);
+            continue;
+        }
+
+        for (ib = 0, ndestriped = 0; ib < nband; ib++)
+            ndestriped += destriped[ib];
+        if (ndestriped == 0 && ref_id == FAIL) {
+            SDendaccess(tsds_id);
+            continue;
+        }
+
+        if ((index = SDnametoindex(sd_id, name)) == FAIL ||
+            (sds_id = SDselect(sd_id, index)) == FAIL) {
+            printf("%-24s missing\n", name);
+            SDendaccess(tsds_id);
+            status = 1;
+            continue;
+        }
+        if (ref_id != FAIL &&
+            ((index = SDnametoindex(ref_id, name)) == FAIL ||
+             (rsds_id = SDselect(ref_id, index)) == FAIL)) {
+            printf("%-24s missing in the reference\n", name);
+            SDendaccess(tsds_id);
+            SDendaccess(sds_id);
+            status = 1;
+            continue;
+        }
+
+        tbuf = (uint16 *)malloc((size_t)dims[1] * dims[2] * sizeof(uint16));
+        buf = (uint16 *)malloc((size_t)dims[1] * dims[2] * sizeof(uint16));
+        if (ref_id != FAIL)
+            rbuf = (uint16 *)malloc((size_t)dims[1] * dims[2] * sizeof(uint16));
+        if (tbuf == NULL || buf == NULL || (ref_id != FAIL && rbuf == NULL))
+            fatal("allocating band buffers for", name);
+
+        for (ib = 0; ib < nband; ib++) {
+            if (!destriped[ib] && ref_id == FAIL)
+                continue;
+
+            start[0] = ib;  start[1] = 0;        start[2] = 0;
+            edges[0] = 1;   edges[1] = dims[1];  edges[2] = dims[2];
+            if (SDreaddata(sds_id, start, NULL, edges, buf) == FAIL) {
+                printf("%-24s band %2d can't read\n", name, (int)bands[ib]);
+                status = 1;
+                continue;
+            }
+
+            if (ref_id != FAIL) {
+                if (SDreaddata(rsds_id, start, NULL, edges, rbuf) == FAIL) {
+                    printf("%-24s band %2d can't read the reference\n", name,
+                           (int)bands[ib]);
+                    status = 1;
+                }
+                else if ((ndiff = count_diff(buf, rbuf, dims[1], dims[2]))) {
+                    printf("%-24s band %2d differs from the reference in %lu values\n",
+                           name, (int)bands[ib], (unsigned long)ndiff);
+                    status = 1;
+                }
+            }
+
+            if (!destriped[ib])
+                continue;
+
+            if (SDreaddata(tsds_id, start, NULL, edges, tbuf) == FAIL)
+                fatal("can't read SDS", name);
+
+            stripe = residual_stripe(tbuf, buf, dims[1], dims[2], stripsize,
+                                     bad + ib * MAXSTRIP);
+            printf("%-24s band %2d stripe %.3f\n", name, (int)bands[ib],
+                   stripe);
+            if (stripe > maxstripe) maxstripe = stripe;
+        }
+
+        free(tbuf);
+        free(buf);
+        free(rbuf);
+        rbuf = NULL;
+        SDendaccess(tsds_id);
+        SDendaccess(sds_id);
+        if (rsds_id != FAIL)
+            SDendaccess(rsds_id);
+        rsds_id = FAIL;
+    }
+
+    SDend(truth_id);
+    SDend(sd_id);
+    if (ref_id != FAIL)
+        SDend(ref_id);
+
+    printf("max %.3f\n", maxstripe);
+    exit(status);
+}
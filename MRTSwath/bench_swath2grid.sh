@@ -0,0 +1,204 @@
+#!/bin/bash
+# Copyright (c) 2011, Brian Case
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+
+###############################################################################
+## @brief benchmark swath2grid over synthetic granules
+##
+## @details
+## generates synthetic MOD021KM/MOD02HKM/MOD02QKM/MOD03 granules with
+## mkswath (once per orbit, kept in the work dir) and runs swath2grid over
+## every combination of orbit, kernel, output projection and output pixel
+## size.  throughput (input Mpixel/s) and peak RSS come from the swath2grid
+## -stats report.  results are printed as a table and written to
+## <workdir>/bench_swath2grid.csv
+##
+## -t runs swath2grid with bowtie trimming (-bowtie=TRIM)
+##
+## usage: bench_swath2grid.sh [-b bindir] [-w workdir] [-o orbits]
+##                            [-k kernels] [-p projections] [-s sizes]
+##                            [-r input resolution] [-n nscan] [-t]
+##
+###############################################################################
+
+bindir="."
+workdir="bench"
+orbits="midlat polar dateline"
+kernels="NN BI CC"
+projs="GEO SNSOID PS"
+sizes="1000 2000"
+res="1000"
+nscan=""
+bowtie="NONE"
+
+while getopts "b:w:o:k:p:s:r:n:th" opt
+do
+    case $opt in
+        b) bindir="$OPTARG" ;;
+        w) workdir="$OPTARG" ;;
+        o) orbits="$OPTARG" ;;
+        k) kernels="$OPTARG" ;;
+        p) projs="$OPTARG" ;;
+        s) sizes="$OPTARG" ;;
+        r) res="$OPTARG" ;;
+        n) nscan="-nscan=$OPTARG" ;;
+        t) bowtie="TRIM" ;;
+        *) sed -n '/^## usage/,/^##$/p' "$0" | sed 's/^## //' ; exit 1 ;;
+    esac
+done
+
+mkswath="${bindir}/mkswath"
+swath2grid="${bindir}/swath2grid"
+
+for prog in "$mkswath" "$swath2grid"
+do
+    if [ ! -x "$prog" ]
+    then
+        echo "bench_swath2grid: $prog not found, run make first" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$workdir" || exit 1
+
+###############################################################################
+## @brief get a number from a swath2grid -stats report
+##
+## @param file      the report file
+## @param key       the key to get; the value in the "total" block is used
+##                  when the key is repeated per band
+##
+## @retval stdout   the value
+##
+###############################################################################
+
+stats_value () {
+    local file="$1"
+    local key="$2"
+
+    grep "^ *\"${key}\":" "$file" | tail -n 1 | sed 's/.*: *\(-*[0-9.]*\).*/\1/'
+}
+
+###############################################################################
+## @brief get the swath2grid projection options for a benchmark projection
+##
+## @param proj      the projection name (GEO, SNSOID, PS, UTM)
+## @param orbit     the orbit name, used to pick a central meridian/zone
+##
+## @retval stdout   the swath2grid options
+##
+###############################################################################
+
+proj_opts () {
+    local proj="$1"
+    local orbit="$2"
+    local lon0=0
+
+    if [ "$orbit" == "dateline" ]
+    then
+        lon0=180
+    fi
+
+    case $proj in
+        GEO)    echo "-oproj=GEO -oprm=0 -osp=8" ;;
+        SNSOID) echo "-oproj=SNSOID -oprm=6371007.181,0,0,0,${lon0}" ;;
+        PS)     echo "-oproj=PS -oprm=0,0,0,0,${lon0},70 -osp=8" ;;
+        UTM)    echo "-oproj=UTM -oprm=0 -osp=8 -ozn=14" ;;
+        *)      return 1 ;;
+    esac
+}
+
+case $res in
+    1000) ext="MOD021KM" ; sds="EV_1KM_RefSB,1" ;;
+    500)  ext="MOD02HKM" ; sds="EV_500_RefSB,1" ;;
+    250)  ext="MOD02QKM" ; sds="EV_250_RefSB,1" ;;
+    *)    echo "bench_swath2grid: invalid input resolution $res" >&2 ; exit 1 ;;
+esac
+
+csv="${workdir}/bench_swath2grid.csv"
+echo "orbit,kernel,proj,pixel_size,input_res,bowtie,wall_s,mpix_s,peak_rss_kb" > "$csv"
+
+printf "%-9s %-3s %-7s %6s %5s %9s %9s %12s\n" \
+       orbit kernel proj size res "wall(s)" "Mpix/s" "peakRSS(kB)"
+
+for orbit in $orbits
+do
+    base="${workdir}/${orbit}"
+
+    if [ ! -f "${base}.MOD03.hdf" ] || [ ! -f "${base}.${ext}.hdf" ]
+    then
+        "$mkswath" -orbit=$orbit -res=$res $nscan "$base" > /dev/null || exit 1
+    fi
+
+    for proj in $projs
+    do
+        popts=$(proj_opts $proj $orbit) || {
+            echo "bench_swath2grid: unknown projection $proj" >&2
+            exit 1
+        }
+
+        for size in $sizes
+        do
+            opsz=$size
+            if [ "$proj" == "GEO" ]
+            then
+                opsz=$(awk "BEGIN { printf \"%.6f\", $size / 111320.0 }")
+            fi
+
+            for kernel in $kernels
+            do
+                stats="${workdir}/stats.json"
+                out="${workdir}/out"
+                rm -f "$stats"
+
+                "$swath2grid" -if="${base}.${ext}.hdf" \
+                              -gf="${base}.MOD03.hdf" \
+                              -of="$out" \
+                              -off=GEOTIFF_FMT \
+                              -sds="$sds" \
+                              -kk=$kernel \
+                              -bowtie=$bowtie \
+                              $popts \
+                              -opsz=$opsz \
+                              -stats="$stats" > /dev/null 2>&1
+
+                if [ $? -ne 0 ] || [ ! -f "$stats" ]
+                then
+                    printf "%-9s %-3s %-7s %6s %5s %s\n" \
+                           $orbit $kernel $proj $size $res "FAILED"
+                    echo "$orbit,$kernel,$proj,$size,$res,$bowtie,,," >> "$csv"
+                    continue
+                fi
+
+                wall=$(stats_value "$stats" wall_seconds)
+                mpix=$(stats_value "$stats" input_mpixels_per_second)
+                rss=$(stats_value "$stats" peak_rss_kb)
+
+                printf "%-9s %-3s %-7s %6s %5s %9.3f %9.3f %12s\n" \
+                       $orbit $kernel $proj $size $res $wall $mpix $rss
+                echo "$orbit,$kernel,$proj,$size,$res,$bowtie,$wall,$mpix,$rss" >> "$csv"
+
+                rm -f "${out}"*.tif "${out}"*.hdf "${out}"*.dat "${out}"*.hdr
+            done
+        done
+    done
+done
+
+rm -f "${workdir}/stats.json"
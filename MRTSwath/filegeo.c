@@ -2,9 +2,18 @@
 #include "GeoS2G.h"
 #include "param.h"
 #include <tiffio.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* GDAL metadata tag; not known to libtiff so it is registered here */
+#define TIFFTAG_GDAL_METADATA 42112
+
+static const TIFFFieldInfo gdal_field_info[] = {
+   { TIFFTAG_GDAL_METADATA, -1, -1, TIFF_ASCII, FIELD_CUSTOM, 1, 0,
+     (char *)"GDALMetadata" }
+};
+
 FILE_ID *Open_GEOTIFF( void *params ) {
    FILE_ID *fid = new_FILE_ID();
 
@@ -53,4 +62,33 @@ int GEOTIFF_WriteScanline(FILE_ID *fid, void *data, void *flag, void *sample) {
    return result;
 }
 
+/* Set the GDAL statistics metadata (STATISTICS_*) for the single band of a
+ * GeoTIFF, so GDAL doesn't have to scan the image to get them.  The
+ * statistics don't include fill pixels.  Must be called before the file is
+ * closed.  Returns 1 on success, 0 on failure. */
+int GEOTIFF_SetStatistics(FILE_ID *fid, double min, double max, double mean,
+                          double stddev, double valid_percent) {
+   int result = 0;
+   char xml[1024];
+
+   if( fid && fid->ftype == FILE_GEOTIFF_FILETYPE ) {
+      GeoTIFFFD *gfid = (GeoTIFFFD *)fid->fptr;
 
+      if( ! TIFFFindFieldInfo(gfid->tif, TIFFTAG_GDAL_METADATA, TIFF_ANY) )
+         TIFFMergeFieldInfo(gfid->tif, gdal_field_info,
+                            sizeof(gdal_field_info) / sizeof(gdal_field_info[0]));
+
+      sprintf( xml,
+               "<GDALMetadata>\n"
+               "  <Item name=\"STATISTICS_MAXIMUM\" sample=\"0\">%.17g</Item>\n"
+               "  <Item name=\"STATISTICS_MEAN\" sample=\"0\">%.17g</Item>\n"
+               "  <Item name=\"STATISTICS_MINIMUM\" sample=\"0\">%.17g</Item>\n"
+               "  <Item name=\"STATISTICS_STDDEV\" sample=\"0\">%.17g</Item>\n"
+               "  <Item name=\"STATISTICS_VALID_PERCENT\" sample=\"0\">%.6g</Item>\n"
+               "</GDALMetadata>\n",
+               max, mean, min, stddev, valid_percent );
+
+      result = TIFFSetField(gfid->tif, TIFFTAG_GDAL_METADATA, xml);
+   }
+   return result;
+}
@@ -67,6 +67,7 @@
 #include "myerror.h"
 #include "mystring.h"
 #include "const.h"
+#include "stats.h"
 #include "hdf.h"
 #include "mfhdf.h"
 
@@ -707,13 +708,16 @@ bool GetGeolocSwath(Geoloc_t *this, Space_t *space, int iscan)
     nval[0] = 1;
     nval[1] = this->scan_size.s;
 
+    StatsStart(STATS_GEOLOC_READ);
     if (SDreaddata(this->sds_lat.id, start, NULL, nval, 
                    this->lat_buf) == HDF_ERROR)
       LOG_RETURN_ERROR("reading latitude", "GetGeolocSwath", false);
     if (SDreaddata(this->sds_lon.id, start, NULL, nval, 
                    this->lon_buf) == HDF_ERROR)
       LOG_RETURN_ERROR("reading longitude", "GetGeolocSwath", false);
+    StatsStop(STATS_GEOLOC_READ);
 
+    StatsStart(STATS_GEOLOC_PROJ);
     img_p = this->img[il_r];
     for (is = 0; is < this->scan_size.s; is++) {
       img_p->is_fill = true;
@@ -736,6 +740,7 @@ bool GetGeolocSwath(Geoloc_t *this, Space_t *space, int iscan)
 
       img_p++;
     }
+    StatsStop(STATS_GEOLOC_PROJ);
 
     il++;
   }
@@ -41,6 +41,8 @@ void     delete_FILE_ID(FILE_ID **fid);
 
 FILE_ID *Open_GEOTIFF( void *ParamList );
 int GEOTIFF_WriteScanline(FILE_ID *, void *data, void *flag, void *sample);
+int GEOTIFF_SetStatistics(FILE_ID *fid, double min, double max, double mean,
+                          double stddev, double valid_percent);
 void Close_GEOTIFF( FILE_ID *fid );
 
 #ifdef __cplusplus
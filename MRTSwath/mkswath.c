@@ -0,0 +1,477 @@
+/************************************************************************
+
+FILE: mkswath.c
+
+PURPOSE:  Generate a synthetic MODIS L1B swath granule (MOD021KM, MOD02HKM,
+          MOD02QKM) and the matching MOD03 geolocation file, for
+          benchmarking swath2grid without real data.
+
+HISTORY:
+Version    Date     Programmer      Code     Reason
+-------    ----     ----------      ----     ------
+1.0        10/26                             Original Development
+
+HARDWARE AND/OR SOFTWARE LIMITATIONS:
+    None
+
+PROJECT:        Modis Reprojection Tool
+
+NOTES:
+  1. The scan geometry is a simple whisk-broom model of a 705 km circular
+     orbit: each scan of 10 (1 km) detectors sweeps +/-55 degrees across
+     track and the along-track footprint of a detector grows with the slant
+     range, so adjacent scans overlap towards the swath edges (bowtie).
+  2. The ground track is a great circle given by a start point and heading,
+     so polar and dateline crossings fall out of the geometry.  Earth
+     rotation during the granule is ignored.
+  3. Geolocation is computed from the model at the centre of every 1 km,
+     500 m and 250 m pixel, so the higher resolution SDSs are consistent
+     with the 1 km lat/long the same way real granules are.
+  4. The radiance field is a smooth function of lat/long (so resampled
+     output has structure to compare) plus a small per-detector gain error.
+
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mfhdf.h"
+
+#ifndef PI
+#define PI (3.141592653589793238)
+#endif
+#define RAD (PI / 180.0)
+#define DEG (180.0 / PI)
+
+#define EARTH_RADIUS (6371.007)   /* km */
+#define ORBIT_HEIGHT (705.0)      /* km */
+#define SCAN_ANGLE_MAX (55.0)     /* degrees */
+#define NDET_1KM (10)             /* 1 km detectors per scan */
+#define NFRAME_1KM (1354)         /* 1 km frames per scan */
+#define NSCAN_DEFAULT (203)       /* scans per 5 minute granule */
+
+#define REFL_SCALE (5.0e-5)       /* reflectance_scales */
+#define DATA_FILL (65535)         /* L1B _FillValue */
+#define GEO_FILL (-999.0)         /* MOD03 _FillValue */
+
+/* Geometry of the synthetic orbit */
+
+typedef struct {
+  double p0[3];         /* Unit vector to the first sub-satellite point */
+  double t0[3];         /* Unit vector along track at the first point */
+  double n0[3];         /* Unit vector to the orbit pole */
+} Orbit_t;
+
+/* Predefined orbits: name, start lat, start long, heading (degrees) */
+
+static const struct {
+  const char *name;
+  double lat0, lon0, heading;
+} orbit_preset[] = {
+  {"midlat",   55.0,  -95.0, 193.0},
+  {"equator",   9.0,   10.0, 193.0},
+  {"polar",    72.0,   20.0, 352.0},
+  {"dateline", 10.0,  178.0, 193.0},
+  {NULL, 0.0, 0.0, 0.0}
+};
+
+static void usage(void)
+{
+  printf("\n");
+  printf("Usage: mkswath [-orbit=midlat|equator|polar|dateline]\n");
+  printf("               [-lat0=<deg> -lon0=<deg> -heading=<deg>]\n");
+  printf("               [-nscan=<scans>] [-nband=<bands per SDS>]\n");
+  printf("               [-res=<list of 1000,500,250>] [-fill=<percent>]\n");
+  printf("               [-geofill=<scans>] <output basename>\n");
+  printf("\n");
+  printf("Writes <basename>.MOD03.hdf and <basename>.MOD021KM.hdf,\n");
+  printf("<basename>.MOD02HKM.hdf, <basename>.MOD02QKM.hdf for each\n");
+  printf("requested resolution.\n");
+  printf("\n");
+}
+
+static void fatal(const char *msg, const char *arg)
+{
+  fprintf(stderr, "mkswath: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+  exit(EXIT_FAILURE);
+}
+
+static void cross(const double a[3], const double b[3], double c[3])
+{
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/* Set up the orbit from the start point and heading (degrees) */
+static void setup_orbit(Orbit_t *orbit, double lat0, double lon0,
+  double heading)
+{
+  double lat = lat0 * RAD, lon = lon0 * RAD, az = heading * RAD;
+  double north[3], east[3];
+  int i;
+
+  orbit->p0[0] = cos(lat) * cos(lon);
+  orbit->p0[1] = cos(lat) * sin(lon);
+  orbit->p0[2] = sin(lat);
+  north[0] = -sin(lat) * cos(lon);
+  north[1] = -sin(lat) * sin(lon);
+  north[2] = cos(lat);
+  east[0] = -sin(lon);
+  east[1] = cos(lon);
+  east[2] = 0.0;
+  for (i = 0; i < 3; i++)
+    orbit->t0[i] = cos(az) * north[i] + sin(az) * east[i];
+  cross(orbit->p0, orbit->t0, orbit->n0);
+}
+
+/* Locate a point in the swath.  'det' is the (fractional) 1 km detector
+   position from the start of the granule (scan * 10 + detector) and 'frame'
+   is the (fractional) 1 km frame number; both refer to pixel centres. */
+static void locate(const Orbit_t *orbit, double det, double frame,
+  double *lat, double *lon)
+{
+  double theta, gamma, slant, along, s, c_s, s_s, c_g, s_g;
+  double q[3];
+  int iscan, i;
+
+  /* Scan angle and earth central angle across track */
+  theta = (frame - (NFRAME_1KM - 1) * 0.5) *
+          (2.0 * SCAN_ANGLE_MAX * RAD / NFRAME_1KM);
+  gamma = asin((EARTH_RADIUS + ORBIT_HEIGHT) / EARTH_RADIUS * sin(theta))
+          - theta;
+  slant = sqrt(EARTH_RADIUS * EARTH_RADIUS +
+               (EARTH_RADIUS + ORBIT_HEIGHT) * (EARTH_RADIUS + ORBIT_HEIGHT) -
+               2.0 * EARTH_RADIUS * (EARTH_RADIUS + ORBIT_HEIGHT) * cos(gamma));
+
+  /* Along track: scans advance 10 km, detectors within a scan spread with
+     the slant range (bowtie) */
+  iscan = (int)floor((det + 0.5) / NDET_1KM);
+  along = iscan * (double)NDET_1KM +
+          (det - iscan * NDET_1KM - (NDET_1KM - 1) * 0.5) *
+          (slant / ORBIT_HEIGHT);
+
+  s = along / EARTH_RADIUS;
+  c_s = cos(s);  s_s = sin(s);
+  c_g = cos(gamma);  s_g = sin(gamma);
+  for (i = 0; i < 3; i++)
+    q[i] = (orbit->p0[i] * c_s + orbit->t0[i] * s_s) * c_g -
+           orbit->n0[i] * s_g;
+
+  *lat = asin(q[2]) * DEG;
+  *lon = atan2(q[1], q[0]) * DEG;
+}
+
+/* Synthetic top-of-atmosphere reflectance for a band and detector */
+static double reflectance(double lat, double lon, int iband, int idet)
+{
+  double r;
+
+  r = 0.30 + 0.12 * sin(lat * 0.35) * cos(lon * 0.21 + iband) +
+      0.05 * cos(lat * 2.1 + lon * 1.7) + 0.02 * iband;
+  r *= 1.0 + 0.002 * ((idet % 4) - 1.5);
+  if (r < 0.0) r = 0.0;
+  return r;
+}
+
+/* Is a pixel in the data fill region? */
+static int is_fill(int iscan, int nscan, double fill_pct, double frame)
+{
+  int nfill, first;
+
+  if (fill_pct <= 0.0) return 0;
+  nfill = (int)(nscan * fill_pct / 100.0 + 0.5);
+  first = (int)(nscan * 0.6) - nfill / 2;
+  return (iscan >= first && iscan < first + nfill &&
+          frame < NFRAME_1KM * 0.5);
+}
+
+static int32 create_sds(int32 sd_id, const char *name, int32 type,
+  int32 rank, int32 *dims)
+{
+  int32 sds_id;
+
+  sds_id = SDcreate(sd_id, (char *)name, type, rank, dims);
+  if (sds_id == FAIL)
+    fatal("can't create SDS", name);
+  return sds_id;
+}
+
+/* Write the 1 km geolocation file; returns the bounding coordinates */
+static void write_geoloc(const char *file_name, const Orbit_t *orbit,
+  int nscan, int geofill, double bound[4])
+{
+  int32 sd_id, lat_id, lon_id;
+  int32 dims[2], start[2], edges[2];
+  float32 *lat_buf, *lon_buf, fill = GEO_FILL;
+  double lat, lon, lon360, west180, east180, west360, east360;
+  int il, is, nline = nscan * NDET_1KM;
+
+  sd_id = SDstart((char *)file_name, DFACC_CREATE);
+  if (sd_id == FAIL)
+    fatal("can't create", file_name);
+
+  dims[0] = nline;
+  dims[1] = NFRAME_1KM;
+  lat_id = create_sds(sd_id, "Latitude", DFNT_FLOAT32, 2, dims);
+  lon_id = create_sds(sd_id, "Longitude", DFNT_FLOAT32, 2, dims);
+  SDsetfillvalue(lat_id, &fill);
+  SDsetfillvalue(lon_id, &fill);
+
+  lat_buf = (float32 *)malloc(NFRAME_1KM * sizeof(float32));
+  lon_buf = (float32 *)malloc(NFRAME_1KM * sizeof(float32));
+  if (lat_buf == NULL || lon_buf == NULL)
+    fatal("allocating geolocation buffers", NULL);
+
+  bound[0] = -90.0;  bound[1] = 90.0;
+  west180 = west360 = 360.0;
+  east180 = east360 = -360.0;
+
+  for (il = 0; il < nline; il++) {
+    for (is = 0; is < NFRAME_1KM; is++) {
+      if (il / NDET_1KM >= nscan - geofill) {
+        lat_buf[is] = lon_buf[is] = GEO_FILL;
+        continue;
+      }
+      locate(orbit, (double)il, (double)is, &lat, &lon);
+      lat_buf[is] = (float32)lat;
+      lon_buf[is] = (float32)lon;
+
+      if (lat > bound[0]) bound[0] = lat;
+      if (lat < bound[1]) bound[1] = lat;
+      lon360 = (lon < 0.0) ? lon + 360.0 : lon;
+      if (lon < west180) west180 = lon;
+      if (lon > east180) east180 = lon;
+      if (lon360 < west360) west360 = lon360;
+      if (lon360 > east360) east360 = lon360;
+    }
+    start[0] = il;  start[1] = 0;
+    edges[0] = 1;   edges[1] = NFRAME_1KM;
+    if (SDwritedata(lat_id, start, NULL, edges, lat_buf) == FAIL ||
+        SDwritedata(lon_id, start, NULL, edges, lon_buf) == FAIL)
+      fatal("writing geolocation to", file_name);
+  }
+
+  /* Pick the narrower of the two longitude ranges; a granule that crosses
+     the dateline is reported with west > east, and one that covers a pole
+     spans all longitudes */
+  if (east180 - west180 <= east360 - west360) {
+    bound[2] = east180;  bound[3] = west180;
+  } else {
+    bound[2] = (east360 > 180.0) ? east360 - 360.0 : east360;
+    bound[3] = (west360 > 180.0) ? west360 - 360.0 : west360;
+  }
+  if (east180 - west180 > 300.0 && east360 - west360 > 300.0) {
+    bound[2] = 180.0;  bound[3] = -180.0;
+  }
+
+  free(lat_buf);
+  free(lon_buf);
+  SDendaccess(lat_id);
+  SDendaccess(lon_id);
+  SDend(sd_id);
+}
+
+/* Write the bounding coordinates as global attributes */
+static void write_bounds(int32 sd_id, const double bound[4])
+{
+  SDsetattr(sd_id, "NORTHBOUNDINGCOORDINATE", DFNT_FLOAT64, 1,
+            (VOIDP)&bound[0]);
+  SDsetattr(sd_id, "SOUTHBOUNDINGCOORDINATE", DFNT_FLOAT64, 1,
+            (VOIDP)&bound[1]);
+  SDsetattr(sd_id, "EASTBOUNDINGCOORDINATE", DFNT_FLOAT64, 1,
+            (VOIDP)&bound[2]);
+  SDsetattr(sd_id, "WESTBOUNDINGCOORDINATE", DFNT_FLOAT64, 1,
+            (VOIDP)&bound[3]);
+}
+
+/* Write an L1B file at relative resolution 'ires' (1, 2 or 4) */
+static void write_l1b(const char *file_name, const char *sds_name,
+  const Orbit_t *orbit, int ires, int nscan, int nband, double fill_pct,
+  const double bound[4])
+{
+  int32 sd_id, sds_id, b26_id = FAIL;
+  int32 dims[3], start[3], edges[3];
+  uint16 *buf, *b26_buf = NULL, fill = DATA_FILL;
+  float32 *scales, *offsets;
+  int nline = NDET_1KM * ires, nsamp = NFRAME_1KM * ires;
+  int iscan, il, is, ib, idet;
+  double det, frame, lat, lon, r;
+
+  sd_id = SDstart((char *)file_name, DFACC_CREATE);
+  if (sd_id == FAIL)
+    fatal("can't create", file_name);
+  write_bounds(sd_id, bound);
+
+  dims[0] = nband;
+  dims[1] = nscan * nline;
+  dims[2] = nsamp;
+  sds_id = create_sds(sd_id, sds_name, DFNT_UINT16, 3, dims);
+  SDsetfillvalue(sds_id, &fill);
+
+  scales = (float32 *)malloc(nband * sizeof(float32));
+  offsets = (float32 *)malloc(nband * sizeof(float32));
+  if (scales == NULL || offsets == NULL)
+    fatal("allocating attribute buffers", NULL);
+  for (ib = 0; ib < nband; ib++) {
+    scales[ib] = (float32)REFL_SCALE;
+    offsets[ib] = 0.0;
+  }
+  SDsetattr(sds_id, "reflectance_scales", DFNT_FLOAT32, nband, scales);
+  SDsetattr(sds_id, "reflectance_offsets", DFNT_FLOAT32, nband, offsets);
+
+  /* The 1 km file also gets a 2D SDS, like EV_Band26 */
+  if (ires == 1) {
+    b26_id = create_sds(sd_id, "EV_Band26", DFNT_UINT16, 2, &dims[1]);
+    SDsetfillvalue(b26_id, &fill);
+    SDsetattr(b26_id, "reflectance_scales", DFNT_FLOAT32, 1, scales);
+    SDsetattr(b26_id, "reflectance_offsets", DFNT_FLOAT32, 1, offsets);
+    b26_buf = (uint16 *)malloc((size_t)nline * nsamp * sizeof(uint16));
+    if (b26_buf == NULL)
+      fatal("allocating scan buffer", NULL);
+  }
+
+  buf = (uint16 *)malloc((size_t)nband * nline * nsamp * sizeof(uint16));
+  if (buf == NULL)
+    fatal("allocating scan buffer", NULL);
+
+  for (iscan = 0; iscan < nscan; iscan++) {
+    for (il = 0; il < nline; il++) {
+      idet = il;
+      det = iscan * NDET_1KM + (il + 0.5) / ires - 0.5;
+      for (is = 0; is < nsamp; is++) {
+        frame = (is + 0.5) / ires - 0.5;
+        if (is_fill(iscan, nscan, fill_pct, frame)) {
+          for (ib = 0; ib < nband; ib++)
+            buf[((size_t)ib * nline + il) * nsamp + is] = DATA_FILL;
+          if (b26_buf != NULL)
+            b26_buf[(size_t)il * nsamp + is] = DATA_FILL;
+          continue;
+        }
+        locate(orbit, det, frame, &lat, &lon);
+        for (ib = 0; ib < nband; ib++) {
+          r = reflectance(lat, lon, ib, idet) / REFL_SCALE + 0.5;
+          buf[((size_t)ib * nline + il) * nsamp + is] =
+            (uint16)((r > 32767.0) ? 32767.0 : r);
+        }
+        if (b26_buf != NULL) {
+          r = reflectance(lat, lon, nband, idet) / REFL_SCALE + 0.5;
+          b26_buf[(size_t)il * nsamp + is] =
+            (uint16)((r > 32767.0) ? 32767.0 : r);
+        }
+      }
+    }
+
+    start[0] = 0;      start[1] = iscan * nline;  start[2] = 0;
+    edges[0] = nband;  edges[1] = nline;          edges[2] = nsamp;
+    if (SDwritedata(sds_id, start, NULL, edges, buf) == FAIL)
+      fatal("writing data to", file_name);
+    if (b26_buf != NULL &&
+        SDwritedata(b26_id, &start[1], NULL, &edges[1], b26_buf) == FAIL)
+      fatal("writing data to", file_name);
+  }
+
+  free(buf);
+  free(scales);
+  free(offsets);
+  if (b26_buf != NULL) {
+    free(b26_buf);
+    SDendaccess(b26_id);
+  }
+  SDendaccess(sds_id);
+  SDend(sd_id);
+}
+
+int main(int argc, char *argv[])
+{
+  char *base = NULL, *val, file_name[1024], res_list[256] = "1000,500,250";
+  double lat0, lon0, heading, fill_pct = 2.0, bound[4];
+  int nscan = NSCAN_DEFAULT, nband = 2, geofill = 0;
+  int iarg, ip, have_start = 0;
+  Orbit_t orbit;
+
+  lat0 = orbit_preset[0].lat0;
+  lon0 = orbit_preset[0].lon0;
+  heading = orbit_preset[0].heading;
+
+  for (iarg = 1; iarg < argc; iarg++) {
+    val = strchr(argv[iarg], '=');
+    if (val != NULL) val++;
+    if (strncmp(argv[iarg], "-orbit=", 7) == 0) {
+      for (ip = 0; orbit_preset[ip].name != NULL; ip++)
+        if (strcmp(val, orbit_preset[ip].name) == 0) break;
+      if (orbit_preset[ip].name == NULL)
+        fatal("unknown orbit", val);
+      if (!have_start) {
+        lat0 = orbit_preset[ip].lat0;
+        lon0 = orbit_preset[ip].lon0;
+        heading = orbit_preset[ip].heading;
+      }
+    }
+    else if (strncmp(argv[iarg], "-lat0=", 6) == 0) {
+      lat0 = atof(val);  have_start = 1;
+    }
+    else if (strncmp(argv[iarg], "-lon0=", 6) == 0) {
+      lon0 = atof(val);  have_start = 1;
+    }
+    else if (strncmp(argv[iarg], "-heading=", 9) == 0) {
+      heading = atof(val);  have_start = 1;
+    }
+    else if (strncmp(argv[iarg], "-nscan=", 7) == 0)
+      nscan = atoi(val);
+    else if (strncmp(argv[iarg], "-nband=", 7) == 0)
+      nband = atoi(val);
+    else if (strncmp(argv[iarg], "-res=", 5) == 0) {
+      strncpy(res_list, val, sizeof(res_list) - 1);
+      res_list[sizeof(res_list) - 1] = '\0';
+    }
+    else if (strncmp(argv[iarg], "-fill=", 6) == 0)
+      fill_pct = atof(val);
+    else if (strncmp(argv[iarg], "-geofill=", 9) == 0)
+      geofill = atoi(val);
+    else if (argv[iarg][0] == '-') {
+      usage();
+      exit(EXIT_FAILURE);
+    }
+    else
+      base = argv[iarg];
+  }
+
+  if (base == NULL || nscan < 1 || nband < 1 || geofill < 0 ||
+      geofill >= nscan) {
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  setup_orbit(&orbit, lat0, lon0, heading);
+
+  sprintf(file_name, "%s.MOD03.hdf", base);
+  printf("mkswath: writing %s (%d scans)\n", file_name, nscan);
+  write_geoloc(file_name, &orbit, nscan, geofill, bound);
+  printf("mkswath: bounds N %.4f S %.4f E %.4f W %.4f\n",
+         bound[0], bound[1], bound[2], bound[3]);
+
+  if (strstr(res_list, "1000") != NULL) {
+    sprintf(file_name, "%s.MOD021KM.hdf", base);
+    printf("mkswath: writing %s\n", file_name);
+    write_l1b(file_name, "EV_1KM_RefSB", &orbit, 1, nscan, nband, fill_pct,
+              bound);
+  }
+  if (strstr(res_list, "500") != NULL) {
+    sprintf(file_name, "%s.MOD02HKM.hdf", base);
+    printf("mkswath: writing %s\n", file_name);
+    write_l1b(file_name, "EV_500_RefSB", &orbit, 2, nscan, nband, fill_pct,
+              bound);
+  }
+  if (strstr(res_list, "250") != NULL) {
+    sprintf(file_name, "%s.MOD02QKM.hdf", base);
+    printf("mkswath: writing %s\n", file_name);
+    write_l1b(file_name, "EV_250_RefSB", &orbit, 4, nscan, nband, fill_pct,
+              bound);
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,625 @@
+/*
+!C****************************************************************************
+
+!File: ostats.c
+
+!Description: Functions for computing output image statistics (minimum,
+ maximum, mean, standard deviation, histogram, valid and fill pixel counts)
+ while the output lines are written, and for writing them to a JSON file.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The following public functions handle the output statistics:
+
+	OstatsInit - Initialize the output statistics.
+	OstatsBeginBand - Start computing the statistics for an SDS/band.
+	OstatsDataType - Set the output data type and fill value of the band.
+	OstatsLine - Add an output line to the statistics.
+	OstatsEndBand - Finish computing the statistics for an SDS/band.
+	OstatsWrite - Write the statistics to the JSON file.
+	OstatsFree - Free the output statistics memory.
+
+   2. The following internal functions are used:
+
+	AddValue - Add a valid value to the statistics.
+	GrowFine - Double the width of the fine histogram bins.
+	DataTypeName - Get the name of an HDF data type.
+
+   3. Statistics are kept in a single static structure since there is only
+      one resampling run per process.  Unlike the processing statistics
+      (see 'stats.c'), output statistics are always computed since they are
+      also written to the GeoTIFF output files.
+   4. Values are first counted in a fine histogram of 'NFINE' bins.  For
+      8 and 16-bit data types there is one bin per value.  For 32-bit and
+      float data types the bins start around the first valid value and
+      double in width (merging pairs of bins) whenever a value falls
+      outside of them.  The fine histogram is folded into 'OSTATS_NBUCKET'
+      buckets between the minimum and maximum values when the band is
+      finished, so only one pass over the output is needed.
+   5. The mean and standard deviation are accumulated relative to the first
+      valid value to limit round off error.
+
+!END****************************************************************************
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "ostats.h"
+#include "stats.h"
+#include "myerror.h"
+
+/* Constants */
+
+#define NBAND_ALLOC (16)    /* Number of band entries to allocate at a time */
+#define NFINE (65536)       /* Number of fine histogram bins */
+
+/* Type definitions */
+
+typedef struct {
+  char *file_name;      /* JSON file name; NULL if not written */
+  int nband;            /* Number of bands computed */
+  int nband_alloc;      /* Number of band entries allocated */
+  Ostats_band_t *band;  /* Band entries */
+  Ostats_band_t *curr;  /* Band currently being computed (NULL if none) */
+  bool have_type;       /* Has the current band's data type been set? */
+  bool exact;           /* Is there one fine bin per value? */
+  double shift;         /* First valid value of the current band */
+  double sum;           /* Sum of (value - shift) */
+  double sum2;          /* Sum of (value - shift)^2 */
+  double fine_lo;       /* Lower bound of the first fine bin */
+  double fine_width;    /* Width of each fine bin */
+  double *fine;         /* Fine histogram bin counts */
+} Ostats_t;
+
+static Ostats_t ostats = {NULL, 0, 0, NULL, NULL, false, false,
+                          0.0, 0.0, 0.0, 0.0, 0.0, NULL};
+
+bool OstatsInit(const char *file_name)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsInit' initializes the output statistics.
+
+!Input Parameters:
+ file_name      name of the JSON file; if NULL, the statistics are only
+                written to the GeoTIFF output files
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. An error status is returned when:
+       a. there is an error allocating memory.
+   2. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+
+!END****************************************************************************
+*/
+{
+  ostats.file_name = (char *)NULL;
+  if (file_name != (char *)NULL) {
+    ostats.file_name = strdup(file_name);
+    if (ostats.file_name == (char *)NULL)
+      LOG_RETURN_ERROR("allocating output statistics file name",
+                       "OstatsInit", false);
+  }
+
+  ostats.fine = (double *)calloc(NFINE, sizeof(double));
+  if (ostats.fine == (double *)NULL)
+    LOG_RETURN_ERROR("allocating histogram bins", "OstatsInit", false);
+
+  ostats.nband = 0;
+  ostats.nband_alloc = 0;
+  ostats.band = (Ostats_band_t *)NULL;
+  ostats.curr = (Ostats_band_t *)NULL;
+
+  return true;
+}
+
+bool OstatsBeginBand(const char *sds_name)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsBeginBand' starts computing the statistics for an
+ SDS/band.
+
+!Input Parameters:
+ sds_name       SDS/band name
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. 'OstatsDataType' must be called before any lines are added.
+   2. An error status is returned when:
+       a. there is an error allocating memory.
+   3. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+
+!END****************************************************************************
+*/
+{
+  Ostats_band_t *band;
+  int n;
+
+  if (ostats.fine == (double *)NULL)
+    return true;
+
+  if (ostats.nband >= ostats.nband_alloc) {
+    n = ostats.nband_alloc + NBAND_ALLOC;
+    band = (Ostats_band_t *)realloc(ostats.band, n * sizeof(Ostats_band_t));
+    if (band == (Ostats_band_t *)NULL)
+      LOG_RETURN_ERROR("allocating band statistics", "OstatsBeginBand",
+                       false);
+    ostats.band = band;
+    ostats.nband_alloc = n;
+  }
+
+  ostats.curr = &ostats.band[ostats.nband++];
+  memset(ostats.curr, 0, sizeof(Ostats_band_t));
+  ostats.curr->sds_name = strdup(sds_name);
+  if (ostats.curr->sds_name == (char *)NULL)
+    LOG_RETURN_ERROR("allocating band name", "OstatsBeginBand", false);
+
+  memset(ostats.fine, 0, NFINE * sizeof(double));
+  ostats.have_type = false;
+  ostats.sum = 0.0;
+  ostats.sum2 = 0.0;
+
+  return true;
+}
+
+void OstatsDataType(int32 data_type, double fill)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsDataType' sets the output data type and fill value of
+ the current SDS/band.
+
+!Input Parameters:
+ data_type      output data type
+ fill           output fill value (in the output data type)
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  if (ostats.curr == (Ostats_band_t *)NULL)
+    return;
+
+  ostats.curr->data_type = data_type;
+  ostats.curr->fill = fill;
+
+  /* 8 and 16-bit types get one fine bin per value */
+
+  ostats.exact = true;
+  ostats.fine_width = 1.0;
+  switch (data_type) {
+    case DFNT_CHAR8:
+    case DFNT_INT8:
+      ostats.fine_lo = -128.5;
+      break;
+    case DFNT_UINT8:
+    case DFNT_UINT16:
+      ostats.fine_lo = -0.5;
+      break;
+    case DFNT_INT16:
+      ostats.fine_lo = -32768.5;
+      break;
+    default:
+      ostats.exact = false;
+  }
+
+  ostats.have_type = true;
+}
+
+static void GrowFine(bool down)
+/*
+!C******************************************************************************
+
+!Description: 'GrowFine' doubles the width of the fine histogram bins.
+
+!Input Parameters:
+ down           'true' = extend the bins below the current lower bound
+                'false' = extend the bins above the current upper bound
+
+!Output Parameters: (none)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Pairs of bins are merged in place; when extending down the merged
+      bins move to the upper half so they must be done from the top down.
+
+!END****************************************************************************
+*/
+{
+  int i;
+
+  if (down) {
+    for (i = (NFINE / 2) - 1; i >= 0; i--)
+      ostats.fine[(NFINE / 2) + i] = ostats.fine[2 * i] +
+                                     ostats.fine[(2 * i) + 1];
+    for (i = 0; i < (NFINE / 2); i++)
+      ostats.fine[i] = 0.0;
+    ostats.fine_lo -= ostats.fine_width * NFINE;
+  } else {
+    for (i = 0; i < (NFINE / 2); i++)
+      ostats.fine[i] = ostats.fine[2 * i] + ostats.fine[(2 * i) + 1];
+    for (i = (NFINE / 2); i < NFINE; i++)
+      ostats.fine[i] = 0.0;
+  }
+  ostats.fine_width *= 2.0;
+}
+
+static void AddValue(double v)
+/*
+!C******************************************************************************
+
+!Description: 'AddValue' adds a valid value to the current SDS/band
+ statistics.
+
+!Input Parameters:
+ v              value
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  Ostats_band_t *band = ostats.curr;
+  double d;
+  double scale;
+  long i;
+
+  if (band->nvalid == 0.0) {
+    band->min = band->max = v;
+    ostats.shift = v;
+
+    /* Start the 32-bit and float bins around the first value */
+
+    if (!ostats.exact) {
+      if (band->data_type == DFNT_FLOAT32) {
+        scale = (fabs(v) > 1.0) ? fabs(v) : 1.0;
+        ostats.fine_width = (2.0 * scale) / NFINE;
+        ostats.fine_lo = v - scale;
+      } else {
+        ostats.fine_width = 1.0;
+        ostats.fine_lo = floor(v) - (NFINE / 2) - 0.5;
+      }
+    }
+  } else {
+    if (v < band->min) band->min = v;
+    if (v > band->max) band->max = v;
+  }
+
+  band->nvalid++;
+  d = v - ostats.shift;
+  ostats.sum += d;
+  ostats.sum2 += d * d;
+
+  if (!ostats.exact) {
+    while (v < ostats.fine_lo)
+      GrowFine(true);
+    while (v >= ostats.fine_lo + (ostats.fine_width * NFINE))
+      GrowFine(false);
+  }
+
+  i = (long)((v - ostats.fine_lo) / ostats.fine_width);
+  if (i < 0) i = 0;
+  if (i >= NFINE) i = NFINE - 1;
+  ostats.fine[i]++;
+}
+
+void OstatsLine(const void *line, int nsamp)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsLine' adds an output line to the current SDS/band
+ statistics.
+
+!Input Parameters:
+ line           output line (in the output data type)
+ nsamp          number of samples in the line
+
+!Output Parameters: (none)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Pixels equal to the fill value (and float NaN's) are counted as fill.
+
+!END****************************************************************************
+*/
+{
+  Ostats_band_t *band = ostats.curr;
+  double fill;
+  int is;
+
+  if (band == (Ostats_band_t *)NULL  ||  !ostats.have_type)
+    return;
+
+  fill = band->fill;
+
+  switch (band->data_type) {
+    case DFNT_CHAR8:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const char8 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const char8 *)line)[is]);
+      }
+      break;
+    case DFNT_UINT8:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const uint8 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const uint8 *)line)[is]);
+      }
+      break;
+    case DFNT_INT8:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const int8 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const int8 *)line)[is]);
+      }
+      break;
+    case DFNT_INT16:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const int16 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const int16 *)line)[is]);
+      }
+      break;
+    case DFNT_UINT16:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const uint16 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const uint16 *)line)[is]);
+      }
+      break;
+    case DFNT_INT32:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const int32 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const int32 *)line)[is]);
+      }
+      break;
+    case DFNT_UINT32:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const uint32 *)line)[is] == fill) band->nfill++;
+        else AddValue((double)((const uint32 *)line)[is]);
+      }
+      break;
+    case DFNT_FLOAT32:
+      for (is = 0; is < nsamp; is++) {
+        if ((double)((const float32 *)line)[is] == fill  ||
+            ((const float32 *)line)[is] != ((const float32 *)line)[is])
+          band->nfill++;
+        else AddValue((double)((const float32 *)line)[is]);
+      }
+      break;
+  }
+}
+
+Ostats_band_t *OstatsEndBand(void)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsEndBand' finishes computing the statistics for the
+ current SDS/band.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      the band statistics; NULL if no band is being computed.
+                The statistics are valid until the next 'OstatsBeginBand'
+                or 'OstatsFree' call.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Integer histograms run from half a value below the minimum to half a
+      value above the maximum, so each bucket holds whole values.
+
+!END****************************************************************************
+*/
+{
+  Ostats_band_t *band = ostats.curr;
+  double n, var, center, range;
+  long i, ib;
+
+  if (band == (Ostats_band_t *)NULL)
+    return (Ostats_band_t *)NULL;
+  ostats.curr = (Ostats_band_t *)NULL;
+
+  n = band->nvalid;
+  if (n <= 0.0)
+    return band;
+
+  band->mean = ostats.shift + (ostats.sum / n);
+  var = (ostats.sum2 / n) - ((ostats.sum / n) * (ostats.sum / n));
+  band->stddev = (var > 0.0) ? sqrt(var) : 0.0;
+
+  /* Fold the fine bins into the histogram buckets */
+
+  band->hist_min = band->min;
+  band->hist_max = band->max;
+  if (band->data_type != DFNT_FLOAT32  ||  band->min == band->max) {
+    band->hist_min -= 0.5;
+    band->hist_max += 0.5;
+  }
+  band->hist_approx = (bool)(band->data_type == DFNT_FLOAT32  ||
+                             ostats.fine_width > 1.0);
+  range = band->hist_max - band->hist_min;
+
+  for (i = 0; i < NFINE; i++) {
+    if (ostats.fine[i] == 0.0)
+      continue;
+    center = ostats.fine_lo + ((i + 0.5) * ostats.fine_width);
+    if (center < band->min) center = band->min;
+    if (center > band->max) center = band->max;
+    ib = (long)(((center - band->hist_min) / range) * OSTATS_NBUCKET);
+    if (ib < 0) ib = 0;
+    if (ib >= OSTATS_NBUCKET) ib = OSTATS_NBUCKET - 1;
+    band->hist[ib] += ostats.fine[i];
+  }
+
+  return band;
+}
+
+static const char *DataTypeName(int32 data_type)
+/*
+!C******************************************************************************
+
+!Description: 'DataTypeName' returns the name of an HDF data type, as used
+ for the '-oty' option.
+
+!Input Parameters:
+ data_type      HDF data type
+
+!Output Parameters:
+ (returns)      data type name
+
+!END****************************************************************************
+*/
+{
+  switch (data_type) {
+    case DFNT_CHAR8:   return "CHAR8";
+    case DFNT_UINT8:   return "UINT8";
+    case DFNT_INT8:    return "INT8";
+    case DFNT_INT16:   return "INT16";
+    case DFNT_UINT16:  return "UINT16";
+    case DFNT_INT32:   return "INT32";
+    case DFNT_UINT32:  return "UINT32";
+    case DFNT_FLOAT32: return "FLOAT32";
+  }
+  return "UNKNOWN";
+}
+
+bool OstatsWrite(void)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsWrite' writes the per-band output statistics to the
+ JSON file.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. An error status is returned when:
+       a. the JSON file can't be opened.
+       b. there is an error writing the JSON file.
+   2. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+   3. Nothing is written if no JSON file name was given to 'OstatsInit'.
+
+!END****************************************************************************
+*/
+{
+  FILE *file;
+  Ostats_band_t *band;
+  double npix;
+  int ib, i;
+
+  if (ostats.file_name == (char *)NULL)
+    return true;
+
+  file = fopen(ostats.file_name, "w");
+  if (file == (FILE *)NULL)
+    LOG_RETURN_ERROR("opening output statistics file", "OstatsWrite", false);
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"program\": \"swath2grid\",\n");
+  fprintf(file, "  \"bands\": [\n");
+  for (ib = 0; ib < ostats.nband; ib++) {
+    band = &ostats.band[ib];
+    npix = band->nvalid + band->nfill;
+
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"sds\": ");
+    StatsWriteString(file, band->sds_name);
+    fprintf(file, ",\n");
+    fprintf(file, "      \"data_type\": \"%s\",\n",
+            DataTypeName(band->data_type));
+    fprintf(file, "      \"fill_value\": %.10g,\n", band->fill);
+    fprintf(file, "      \"valid_pixels\": %.0f,\n", band->nvalid);
+    fprintf(file, "      \"fill_pixels\": %.0f,\n", band->nfill);
+    fprintf(file, "      \"fill_fraction\": %.6f,\n",
+            (npix > 0.0) ? band->nfill / npix : 0.0);
+    fprintf(file, "      \"minimum\": %.10g,\n", band->min);
+    fprintf(file, "      \"maximum\": %.10g,\n", band->max);
+    fprintf(file, "      \"mean\": %.10g,\n", band->mean);
+    fprintf(file, "      \"stddev\": %.10g,\n", band->stddev);
+    fprintf(file, "      \"histogram\": {\n");
+    fprintf(file, "        \"min\": %.10g,\n", band->hist_min);
+    fprintf(file, "        \"max\": %.10g,\n", band->hist_max);
+    fprintf(file, "        \"buckets\": %d,\n", OSTATS_NBUCKET);
+    fprintf(file, "        \"approximate\": %s,\n",
+            band->hist_approx ? "true" : "false");
+    fprintf(file, "        \"counts\": [");
+    for (i = 0; i < OSTATS_NBUCKET; i++)
+      fprintf(file, "%s%.0f", (i > 0) ? "," : "", band->hist[i]);
+    fprintf(file, "]\n");
+    fprintf(file, "      }\n");
+    fprintf(file, "    }%s\n", (ib < ostats.nband - 1) ? "," : "");
+  }
+  fprintf(file, "  ]\n");
+  fprintf(file, "}\n");
+
+  if (ferror(file)) {
+    fclose(file);
+    LOG_RETURN_ERROR("writing output statistics file", "OstatsWrite", false);
+  }
+  if (fclose(file) != 0)
+    LOG_RETURN_ERROR("closing output statistics file", "OstatsWrite", false);
+
+  return true;
+}
+
+void OstatsFree(void)
+/*
+!C******************************************************************************
+
+!Description: 'OstatsFree' frees the output statistics memory.
+
+!Input Parameters: (none)
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  int ib;
+
+  for (ib = 0; ib < ostats.nband; ib++) {
+    if (ostats.band[ib].sds_name != (char *)NULL)
+      free(ostats.band[ib].sds_name);
+  }
+  if (ostats.band != (Ostats_band_t *)NULL)
+    free(ostats.band);
+  if (ostats.fine != (double *)NULL)
+    free(ostats.fine);
+  if (ostats.file_name != (char *)NULL)
+    free(ostats.file_name);
+
+  ostats.band = (Ostats_band_t *)NULL;
+  ostats.curr = (Ostats_band_t *)NULL;
+  ostats.fine = (double *)NULL;
+  ostats.file_name = (char *)NULL;
+  ostats.nband = 0;
+  ostats.nband_alloc = 0;
+}
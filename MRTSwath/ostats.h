@@ -0,0 +1,61 @@
+/*
+!C****************************************************************************
+
+!File: ostats.h
+
+!Description: Header file for 'ostats.c' - see 'ostats.c' for more
+ information.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The band statistics are in the output data type; fill pixels are not
+      included in the minimum, maximum, mean, standard deviation or
+      histogram.
+
+!END****************************************************************************
+*/
+
+#ifndef OSTATS_H
+#define OSTATS_H
+
+#include "hdf.h"
+#include "bool.h"
+
+/* Constants */
+
+#define OSTATS_NBUCKET (256)  /* Number of histogram buckets */
+
+/* Output band statistics */
+
+typedef struct {
+  char *sds_name;       /* SDS/band name */
+  int32 data_type;      /* Output data type */
+  double fill;          /* Output fill value */
+  double nvalid;        /* Number of valid (non-fill) pixels */
+  double nfill;         /* Number of fill pixels */
+  double min;           /* Minimum valid value */
+  double max;           /* Maximum valid value */
+  double mean;          /* Mean of the valid values */
+  double stddev;        /* Standard deviation of the valid values */
+  double hist_min;      /* Lower bound of the first histogram bucket */
+  double hist_max;      /* Upper bound of the last histogram bucket */
+  bool hist_approx;     /* Are the bucket counts approximate? */
+  double hist[OSTATS_NBUCKET];  /* Histogram bucket counts */
+} Ostats_band_t;
+
+/* Prototypes */
+
+bool OstatsInit(const char *file_name);
+bool OstatsBeginBand(const char *sds_name);
+void OstatsDataType(int32 data_type, double fill);
+void OstatsLine(const void *line, int nsamp);
+Ostats_band_t *OstatsEndBand(void);
+bool OstatsWrite(void);
+void OstatsFree(void);
+
+#endif
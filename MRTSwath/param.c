@@ -212,6 +212,8 @@ Param_t *GetParam(int argc, const char **argv)
   this->output_sds_name = (char *)NULL;
   this->iband = -1;
   this->kernel_type = NN;
+  this->bowtie_trim = false;
+  this->pyramid_levels = 0;
 
   this->output_space_def.proj_num = -1;
   for (ip = 0; ip < NPROJ_PARAM; ip++)
@@ -254,6 +256,8 @@ Param_t *GetParam(int argc, const char **argv)
 
   this->output_data_type = -1;
   this->patches_file_name = "patches.tmp";        
+  this->stats_file_name = (char *)NULL;
+  this->ostats_file_name = (char *)NULL;
 
   /* Read the command-line and parameter file parameters */
   if (!ReadCmdLine(argc, argv, this)) {
@@ -708,6 +712,8 @@ Param_t *CopyParam(Param_t *param)
 
   this->iband = param->iband;
   this->kernel_type = param->kernel_type;
+  this->bowtie_trim = param->bowtie_trim;
+  this->pyramid_levels = param->pyramid_levels;
 
   /* Space_def_t doesn't contain any pointers, so its ok to make an
      exact copy */
@@ -718,6 +724,16 @@ Param_t *CopyParam(Param_t *param)
   this->output_data_type = param->output_data_type;
   this->patches_file_name = strdup(param->patches_file_name);
 
+  if (param->stats_file_name != NULL)
+    this->stats_file_name = strdup(param->stats_file_name);
+  else
+    this->stats_file_name = (char *)NULL;
+
+  if (param->ostats_file_name != NULL)
+    this->ostats_file_name = strdup(param->ostats_file_name);
+  else
+    this->ostats_file_name = (char *)NULL;
+
   return this;
 }
 
@@ -731,7 +747,8 @@ bool FreeParam(Param_t *this)
 !Input Parameters:
  this           'param' data structure; the following fields are input:
                    input_file_name, output_file_name, geoloc_file_name, 
-		   input_sds_name, output_sds_name
+		   input_sds_name, output_sds_name, stats_file_name,
+		   ostats_file_name
 
 !Output Parameters:
  (returns)      status:
@@ -752,6 +769,8 @@ bool FreeParam(Param_t *this)
     if (this->geoloc_file_name != (char *)NULL) free(this->geoloc_file_name);
     if (this->input_sds_name   != (char *)NULL) free(this->input_sds_name);
     if (this->output_sds_name  != (char *)NULL) free(this->output_sds_name);
+    if (this->stats_file_name  != (char *)NULL) free(this->stats_file_name);
+    if (this->ostats_file_name != (char *)NULL) free(this->ostats_file_name);
     free(this);
   }
   return true;
@@ -1127,6 +1146,13 @@ void PrintParam
             ResamplingTypeStrings[param->kernel_type]);
     LogInfomsg(msg);
 
+    sprintf(msg, "bowtie_trimming:         %s\n",
+            param->bowtie_trim ? "TRIM" : "NONE");
+    LogInfomsg(msg);
+
+    sprintf(msg, "pyramid_levels:          %d\n", param->pyramid_levels);
+    LogInfomsg(msg);
+
     strcpy(msg, "output projection parameters: ");
     for (i = 0; i < 15; i++)
     {
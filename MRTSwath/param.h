@@ -123,6 +123,10 @@ typedef struct {
                              index in the other dimensions are indicated by a
                              value of zero or greater */
   Kernel_type_t kernel_type;    /* Input kernel type (see 'kernel.h') */
+  bool bowtie_trim;     /* Skip the input lines that overlap the neighboring
+                           scans ('true') or resample all lines ('false') */
+  int pyramid_levels;   /* Number of coarser (2x, 4x, ...) GeoTiff output
+                           levels written with each SDS/band; 0 for none */
   Space_def_t input_space_def;  /* Input space map projection information */
   Space_def_t output_space_def; /* Output space map projection information */
   Output_spatial_subset_t output_spatial_subset_type;  /* Output spatial
@@ -137,6 +141,10 @@ typedef struct {
                                        one for each SDS */
   char *patches_file_name;  /* Patches file name; this is an intermediate file
                             that can be deleted after the program exits */
+  char *stats_file_name;    /* Processing statistics (JSON) report file name;
+                            NULL if statistics are not collected */
+  char *ostats_file_name;   /* Output image statistics (JSON) file name;
+                            NULL if only written to the GeoTIFF files */
   double output_pixel_size[MAX_SDS_DIMS]; /* Output pixel size (meters,
                                          degrees for GEO) one for each SDS */
   Img_coord_int_t output_img_size[MAX_SDS_DIMS]; /* Output image size
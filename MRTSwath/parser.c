@@ -130,6 +130,7 @@
 #include "bool.h"
 #include "myerror.h"
 #include "myisoc.h"
+#include "pyramid.h"
 
 
 /* Constants */
@@ -277,6 +278,35 @@ bool ReadCmdLine(int argc, const char **argv, Param_t *this)
       }
     }
 
+    else if (IsArgID(argv[iarg], "-bowtie")) {
+      tmp = GetArgVal(argv[iarg]);
+      if (tmp == (char *)NULL) {
+        error_string = "can't get argument value (-bowtie)";
+	continue;
+      }
+      strupper(tmp);
+      if (strcmp(tmp, "TRIM") == 0)
+        this->bowtie_trim = true;
+      else if (strcmp(tmp, "NONE") == 0)
+        this->bowtie_trim = false;
+      else
+        error_string = "invalid bowtie trimming type (-bowtie)";
+      free(tmp);
+    }
+
+    else if (IsArgID(argv[iarg], "-pyramid")) {
+      tmp = GetArgVal(argv[iarg]);
+      if (tmp == (char *)NULL) {
+        error_string = "can't get argument value (-pyramid)";
+	continue;
+      }
+      if (sscanf(tmp, "%d", &this->pyramid_levels) != 1  ||
+          this->pyramid_levels < 0  ||
+          this->pyramid_levels > PYRAMID_MAX_LEVEL)
+        error_string = "invalid number of pyramid levels (-pyramid)";
+      free(tmp);
+    }
+
     else if(IsArgID(argv[iarg],"-off")) {
       tmp = GetArgVal(argv[iarg]);
       if(tmp == (char *)NULL) {
@@ -504,6 +534,20 @@ bool ReadCmdLine(int argc, const char **argv, Param_t *this)
       free(tmp);
     }
 
+    else if (IsArgID(argv[iarg], "-stats")) {
+      this->stats_file_name = GetArgVal(argv[iarg]);
+      if (this->stats_file_name == (char *)NULL) {
+        error_string = "can't get argument value (-stats)";
+      }
+    }
+
+    else if (IsArgID(argv[iarg], "-ostats")) {
+      this->ostats_file_name = GetArgVal(argv[iarg]);
+      if (this->ostats_file_name == (char *)NULL) {
+        error_string = "can't get argument value (-ostats)";
+      }
+    }
+
     else if (IsArgID(argv[iarg], "-pf")) {
       tmp = GetArgVal(argv[iarg]);
       if (tmp == (char *)NULL) {
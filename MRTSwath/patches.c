@@ -116,6 +116,8 @@
 #include "param.h"
 #include "rb.h"
 #include "geowrpr.h"
+#include "stats.h"
+#include "ostats.h"
 #include <sys/types.h>
 #ifdef __CYGWIN__
 #include <getopt.h>             /* getopt  prototype */
@@ -837,6 +839,8 @@ bool InitPatchInMem(Patches_t *this, int il_patch, int is_patch)
         }
     }
 
+    StatsCount(STATS_PATCH_LOADS, 1.0);
+
     return true;
 }
 
@@ -1498,6 +1502,8 @@ bool TossPatches(Patches_t *this, int32 output_data_type)
         if (fwrite(this->buf.val_void[0], this->patch_size, 1, this->file) != 1)
             LOG_RETURN_ERROR("writing patch to disk", "TossPatches", false);
         this->file_size += this->patch_size;
+        StatsCount(STATS_PATCH_EVICTIONS, 1.0);
+        StatsCount(STATS_BYTES_SPILLED, (double)this->patch_size);
 
         /* Remove patch from used list */
 
@@ -1555,10 +1561,13 @@ bool TossPatches(Patches_t *this, int32 output_data_type)
  output_data_type output data type, patches are stored in the input data
                     type
  kernel_type    NN, Bilinear, CC kernel to be used for resampling process
+ pyramid        'pyramid' data structure for the coarser output levels or
+                NULL for none
 
 !Output Parameters:
  this           'patches' data structure; the following fields are modified:
                   file
+ pyramid        'pyramid' data structure; the levels are written
  output         'output' data structure; no fields are modified:
  (returns)      status:
                   'true' = okay
@@ -1585,6 +1594,13 @@ bool TossPatches(Patches_t *this, int32 output_data_type)
        * e. there are an invalid number (< 0) of null or used patches.
    5. 'SetupPatches' must be called before this routine is called.
    6. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+   7. The output statistics (see 'ostats.c') are computed from each set of
+      output lines, after any gaps are filled, as they are written.
+      'OstatsBeginBand' should be called before this routine is called.
+   8. The coarser pyramid levels (see 'pyramid.c') are aggregated from the
+      same output lines, so the levels of an SDS/band don't map and resample
+      the geolocation again.  Each SDS/band is still mapped at its own input
+      resolution.
 
 !END****************************************************************************
 */
@@ -1593,7 +1609,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
                        Output_file_format_t output_format,
                        FILE_ID *GeoTiffFile, FILE *rbfile,
                        int32 output_data_type,
-                       Kernel_type_t kernel_type)
+                       Kernel_type_t kernel_type, Pyramid_t *pyramid)
 {
     union {
         void *val_void[NLINE_PATCH];
@@ -1624,6 +1640,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
     int32 fill_int32 = 0;
     uint32 fill_uint32 = 0;
     float32 fill_float32 = 0;
+    double fill_out = 0.0;
     
     int il, is;
     int il_patch, is_patch;
@@ -1679,6 +1696,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
     switch (output_data_type) {
         case DFNT_CHAR8:
             fill_char8 = ConvertToChar8(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_char8;
             val_char8_p = (char8 *)calloc(n, sizeof(char8));
             if (val_char8_p == (char8 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1690,6 +1708,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_UINT8:
             fill_uint8 = ConvertToUint8(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_uint8;
             val_uint8_p = (uint8 *)calloc(n, sizeof(uint8));
             if (val_uint8_p == (uint8 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1701,6 +1720,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_INT8:
             fill_int8 = ConvertToInt8(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_int8;
             val_int8_p = (int8 *)calloc(n, sizeof(int8));
             if (val_int8_p == (int8 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1712,6 +1732,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_INT16:
             fill_int16 = ConvertToInt16(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_int16;
             val_int16_p = (int16 *)calloc(n, sizeof(int16));
             if (val_int16_p == (int16 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1723,6 +1744,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_UINT16:
             fill_uint16 = ConvertToUint16(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_uint16;
             val_uint16_p = (uint16 *)calloc(n, sizeof(uint16));
             if (val_uint16_p == (uint16 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1734,6 +1756,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_INT32:
             fill_int32 = ConvertToInt32(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_int32;
             val_int32_p = (int32 *)calloc(n, sizeof(int32));
             if (val_int32_p == (int32 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer", 
@@ -1745,6 +1768,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_UINT32:
             fill_uint32 = ConvertToUint32(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_uint32;
             val_uint32_p = (uint32 *)calloc(n, sizeof(uint32));
             if (val_uint32_p == (uint32 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer",
@@ -1756,6 +1780,7 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
             break;
         case DFNT_FLOAT32:
             fill_float32 = ConvertToFloat32(this->fill_value, slope, same_data_type);
+            fill_out = (double)fill_float32;
             val_float32_p = (float32 *)calloc(n, sizeof(float32));
             if (val_float32_p == (float32 *)NULL)
                 LOG_RETURN_ERROR("allocating output product i/o buffer",
@@ -1768,6 +1793,9 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
         default:
             LOG_RETURN_ERROR("invalid data type (a)", "UnscramblePatches", false);
     }
+    OstatsDataType(output_data_type, fill_out);
+    if (pyramid != (Pyramid_t *)NULL)
+        pyramid->fill = fill_out;
 #ifdef DEBUG_ZEROS
     printf("checking for isolated zeros\n");
     if (this->data_type != DFNT_INT16) 
@@ -1829,6 +1857,8 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
                               free(buf.val_void[0]);
                               LOG_RETURN_ERROR("reading patch from disk","UnscramblePatches",false);
                           }
+                StatsCount(STATS_PATCH_READS, 1.0);
+                StatsCount(STATS_BYTES_READ, (double)this->patch_size);
 
                 /* Store the patch in the output buffer */
 
@@ -1924,12 +1954,26 @@ bool UnscramblePatches(Patches_t *this, Output_t *output,
 
         if(kernel_type == NN)
         {
+            StatsStart(STATS_FILL_OUTPUT);
             if (!FillOutput(buf.val_void, NLINE_PATCH, output->size.s,
                             output_data_type, this->fill_value, slope, same_data_type))
             {
                 LOG_RETURN_ERROR("filling gaps in output file", "UnscramblePatches",
                                  false);
             }
+            StatsStop(STATS_FILL_OUTPUT);
+        }
+
+        /* Add the lines to the output statistics and pyramid levels */
+
+        for (il = il1, il_rel = 0; il < il2; il++, il_rel++) {
+            OstatsLine(buf.val_void[il_rel], output->size.s);
+            if (pyramid != (Pyramid_t *)NULL  &&
+                !PyramidLine(pyramid, buf.val_void[il_rel], il)) {
+                free(buf.val_void[0]);
+                LOG_RETURN_ERROR("writing pyramid levels", "UnscramblePatches",
+                                 false);
+            }
         }
 
         /* Write the lines to disk */
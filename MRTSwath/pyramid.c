@@ -0,0 +1,405 @@
+/*
+!C****************************************************************************
+
+!File: pyramid.c
+
+!Description: Functions for writing coarser resolution (2x, 4x, 8x) copies
+ of the output image, aggregated from the native resolution output lines as
+ they are written, so browse products come out of the same run.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The following public functions handle the output pyramid:
+
+	OpenPyramid - Set up the pyramid and open the output files.
+	PyramidLine - Add a native resolution output line to the pyramid.
+	ClosePyramid - Close the output files and free the pyramid.
+
+   2. The following internal functions are used:
+
+	DataSize - Get the size of an HDF data type.
+	PutValue - Store a value in an output line.
+
+   3. Each level is aggregated directly from the native resolution lines,
+      so a level's value is the mean of the valid native values it covers
+      (or the first valid value for NN, so class values are not mixed).
+      A level pixel is fill if more than half of the native pixels it covers
+      are fill, as is done in 'ProcessScan' for the kernel.
+   4. The levels are written as GeoTiff files named as the native file with
+      '_<factor>x' appended to the SDS name.  The upper left corner of the
+      image is the same as the native image and the pixel size is scaled by
+      the factor.
+   5. The levels are built from the native output of one SDS/band, after
+      its patches are unscrambled, not in the 'patches' accumulator.  Each
+      SDS/band still reads and maps the geolocation for its own input
+      resolution; sharing one mapped scan between the 250 m, 500 m and 1 km
+      SDSs of a product is not done.
+   6. The statistics of each level (min, max, mean, standard deviation and
+      valid percent of the written pixels, fill excluded) are computed as
+      the level lines are written and stored as GDAL metadata (see
+      'GEOTIFF_SetStatistics') when the level is closed, as 'main' does for
+      the native image.
+
+!END****************************************************************************
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pyramid.h"
+#include "myerror.h"
+
+static size_t DataSize(int32 data_type)
+/*
+!C******************************************************************************
+
+!Description: 'DataSize' returns the size of an HDF data type.
+
+!Input Parameters:
+ data_type      HDF data type
+
+!Output Parameters:
+ (returns)      size of the data type (bytes); 0 for an invalid data type
+
+!END****************************************************************************
+*/
+{
+  switch (data_type) {
+    case DFNT_CHAR8:
+    case DFNT_UINT8:
+    case DFNT_INT8:
+      return 1;
+    case DFNT_INT16:
+    case DFNT_UINT16:
+      return 2;
+    case DFNT_INT32:
+    case DFNT_UINT32:
+    case DFNT_FLOAT32:
+      return 4;
+  }
+  return 0;
+}
+
+static void PutValue(void *line, int32 data_type, int is, double v)
+/*
+!C******************************************************************************
+
+!Description: 'PutValue' stores a value in an output line, rounding it to
+ the nearest integer for the integer data types.
+
+!Input Parameters:
+ line           output line
+ data_type      output data type
+ is             sample number
+ v              value
+
+!Output Parameters:
+ line           output line with the sample set
+
+!END****************************************************************************
+*/
+{
+  if (data_type != DFNT_FLOAT32)
+    v = floor(v + 0.5);
+
+  switch (data_type) {
+    case DFNT_CHAR8:   ((char8 *)line)[is] = (char8)v; break;
+    case DFNT_UINT8:   ((uint8 *)line)[is] = (uint8)v; break;
+    case DFNT_INT8:    ((int8 *)line)[is] = (int8)v; break;
+    case DFNT_INT16:   ((int16 *)line)[is] = (int16)v; break;
+    case DFNT_UINT16:  ((uint16 *)line)[is] = (uint16)v; break;
+    case DFNT_INT32:   ((int32 *)line)[is] = (int32)v; break;
+    case DFNT_UINT32:  ((uint32 *)line)[is] = (uint32)v; break;
+    case DFNT_FLOAT32: ((float32 *)line)[is] = (float32)v; break;
+  }
+}
+
+Pyramid_t *OpenPyramid(Param_t *param, int nlevel)
+/*
+!C******************************************************************************
+
+!Description: 'OpenPyramid' sets up the 'pyramid' data structure and opens
+ the output GeoTiff file for each level.
+
+!Input Parameters:
+ param          'param' data structure for the current SDS/band; the
+                following fields are input:
+                  output_space_def, output_data_type, kernel_type,
+                  output_file_name, output_sds_name
+ nlevel         number of coarser levels (1 to 'PYRAMID_MAX_LEVEL')
+
+!Output Parameters:
+ (returns)      'pyramid' data structure or NULL when an error occurs
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The output fill value is set to 0; it should be set to the output fill
+      value (in the output data type) before any lines are added.
+   2. An error status is returned when:
+       a. the number of levels or the output data type is invalid.
+       b. memory allocation is not successful.
+       c. an output file can't be opened.
+   3. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+   4. 'ClosePyramid' should be called to close the files and deallocate the
+      memory used by the 'pyramid' data structure.
+
+!END****************************************************************************
+*/
+{
+  Pyramid_t *this;
+  Pyramid_level_t *level;
+  Param_t *level_param;
+  size_t size;
+  int k;
+  char *error_string = (char *)NULL;
+
+  if (nlevel < 1  ||  nlevel > PYRAMID_MAX_LEVEL)
+    LOG_RETURN_ERROR("invalid number of pyramid levels", "OpenPyramid",
+                     (Pyramid_t *)NULL);
+
+  size = DataSize(param->output_data_type);
+  if (size == 0)
+    LOG_RETURN_ERROR("invalid data type", "OpenPyramid", (Pyramid_t *)NULL);
+
+  this = (Pyramid_t *)calloc(1, sizeof(Pyramid_t));
+  if (this == (Pyramid_t *)NULL)
+    LOG_RETURN_ERROR("allocating pyramid structure", "OpenPyramid",
+                     (Pyramid_t *)NULL);
+
+  this->size = param->output_space_def.img_size;
+  this->data_type = param->output_data_type;
+  this->fill = 0.0;
+  this->nn = (bool)(param->kernel_type == NN);
+
+  for (k = 0; k < nlevel  &&  error_string == (char *)NULL; k++) {
+    level = &this->level[k];
+    this->nlevel = k + 1;
+
+    level->factor = 1 << (k + 1);
+    level->size.l = (this->size.l + level->factor - 1) / level->factor;
+    level->size.s = (this->size.s + level->factor - 1) / level->factor;
+    level->il = 0;
+
+    level->sum = (double *)calloc((size_t)level->size.s, sizeof(double));
+    level->nvalid = (int *)calloc((size_t)level->size.s, sizeof(int));
+    level->ntotal = (int *)calloc((size_t)level->size.s, sizeof(int));
+    level->line = calloc((size_t)level->size.s, size);
+    if (level->sum == (double *)NULL  ||  level->nvalid == (int *)NULL  ||
+        level->ntotal == (int *)NULL  ||  level->line == NULL) {
+      error_string = "allocating pyramid level buffers";
+      break;
+    }
+
+    /* Open the level's GeoTiff file, named after the SDS and factor */
+
+    level_param = CopyParam(param);
+    if (level_param == (Param_t *)NULL) {
+      error_string = "copying parameters for a pyramid level";
+      break;
+    }
+    level_param->output_space_def.img_size = level->size;
+    level_param->output_space_def.pixel_size *= (double)level->factor;
+    free(level_param->output_sds_name);
+    level_param->output_sds_name =
+      (char *)malloc(strlen(param->output_sds_name) + 16);
+    if (level_param->output_sds_name == (char *)NULL) {
+      FreeParam(level_param);
+      error_string = "allocating pyramid level SDS name";
+      break;
+    }
+    sprintf(level_param->output_sds_name, "%s_%dx", param->output_sds_name,
+            level->factor);
+
+    level->fid = Open_GEOTIFF(level_param);
+    FreeParam(level_param);
+    if (level->fid == (FILE_ID *)NULL)
+      error_string = "allocating pyramid level GeoTiff file id structure";
+    else if (level->fid->error) {
+      delete_FILE_ID(&level->fid);
+      level->fid = (FILE_ID *)NULL;
+      error_string = "opening pyramid level GeoTiff file";
+    }
+  }
+
+  if (error_string != (char *)NULL) {
+    ClosePyramid(this);
+    LOG_RETURN_ERROR(error_string, "OpenPyramid", (Pyramid_t *)NULL);
+  }
+
+  return this;
+}
+
+bool PyramidLine(Pyramid_t *this, const void *line, int il)
+/*
+!C******************************************************************************
+
+!Description: 'PyramidLine' adds a native resolution output line to each
+ level of the pyramid and writes any level lines that are complete.
+
+!Input Parameters:
+ this           'pyramid' data structure; the following fields are input:
+                  nlevel, size, data_type, fill, nn, level[*]
+ line           native resolution output line (in the output data type)
+ il             native resolution line number
+
+!Output Parameters:
+ this           'pyramid' data structure; the following fields are
+                modified:
+                  level[*].sum, level[*].nvalid, level[*].ntotal,
+                  level[*].line, level[*].il and the level statistics
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Lines must be added in order.
+   2. An error status is returned when:
+       a. there is an error writing a level line.
+   3. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+
+!END****************************************************************************
+*/
+{
+  Pyramid_level_t *level;
+  int k, is, js;
+  double v;
+  uint32 row;
+  uint16 zero = 0;
+
+  for (k = 0; k < this->nlevel; k++) {
+    level = &this->level[k];
+
+    /* Add the line to the current level line */
+
+    for (is = 0; is < this->size.s; is++) {
+      switch (this->data_type) {
+        case DFNT_CHAR8:   v = ((const char8 *)line)[is]; break;
+        case DFNT_UINT8:   v = ((const uint8 *)line)[is]; break;
+        case DFNT_INT8:    v = ((const int8 *)line)[is]; break;
+        case DFNT_INT16:   v = ((const int16 *)line)[is]; break;
+        case DFNT_UINT16:  v = ((const uint16 *)line)[is]; break;
+        case DFNT_INT32:   v = ((const int32 *)line)[is]; break;
+        case DFNT_UINT32:  v = ((const uint32 *)line)[is]; break;
+        default:           v = ((const float32 *)line)[is]; break;
+      }
+
+      js = is / level->factor;
+      level->ntotal[js]++;
+      if (v == this->fill  ||  v != v)
+        continue;
+
+      if (!this->nn)
+        level->sum[js] += v;
+      else if (level->nvalid[js] == 0)
+        level->sum[js] = v;
+      level->nvalid[js]++;
+    }
+
+    /* Write the level line once all of its native lines are added */
+
+    if (((il + 1) % level->factor) != 0  &&  il != (this->size.l - 1))
+      continue;
+
+    for (js = 0; js < level->size.s; js++) {
+      if (level->nvalid[js] > 0  &&
+          (2 * level->nvalid[js]) >= level->ntotal[js]) {
+        v = level->sum[js];
+        if (!this->nn)
+          v /= (double)level->nvalid[js];
+
+        /* The statistics are of the value as it is written */
+        if (this->data_type != DFNT_FLOAT32)
+          v = floor(v + 0.5);
+        else
+          v = (float32)v;
+        if (level->nstat == 0.0) {
+          level->min = level->max = level->shift = v;
+        } else {
+          if (v < level->min) level->min = v;
+          if (v > level->max) level->max = v;
+        }
+        level->stat_sum += v - level->shift;
+        level->stat_sum2 += (v - level->shift) * (v - level->shift);
+        level->nstat++;
+      } else {
+        v = this->fill;
+        level->nfill++;
+      }
+      PutValue(level->line, this->data_type, js, v);
+
+      level->sum[js] = 0.0;
+      level->nvalid[js] = 0;
+      level->ntotal[js] = 0;
+    }
+
+    row = (uint32)level->il;
+    if (GEOTIFF_WriteScanline(level->fid, level->line, &row, &zero) != 1)
+      LOG_RETURN_ERROR("writing pyramid level line", "PyramidLine", false);
+    level->il++;
+  }
+
+  return true;
+}
+
+bool ClosePyramid(Pyramid_t *this)
+/*
+!C******************************************************************************
+
+!Description: 'ClosePyramid' stores the statistics of each level, closes
+ the output files and frees the 'pyramid' data structure memory.
+
+!Input Parameters:
+ this           'pyramid' data structure; the following fields are input:
+                  nlevel, level[*]
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay (always returned)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. 'OpenPyramid' must be called before this routine is called.
+   2. An error status is never returned; a warning is logged if the
+      statistics of a level can't be stored.
+
+!END****************************************************************************
+*/
+{
+  Pyramid_level_t *level;
+  double mean, var;
+  int k;
+
+  if (this == (Pyramid_t *)NULL)
+    return true;
+
+  for (k = 0; k < this->nlevel; k++) {
+    level = &this->level[k];
+    if (level->fid != (FILE_ID *)NULL  &&  level->nstat > 0.0) {
+      mean = level->stat_sum / level->nstat;
+      var = (level->stat_sum2 / level->nstat) - (mean * mean);
+      if (!GEOTIFF_SetStatistics(level->fid, level->min, level->max,
+            level->shift + mean, (var > 0.0) ? sqrt(var) : 0.0,
+            100.0 * level->nstat / (level->nstat + level->nfill)))
+        LOG_WARNING("writing pyramid level statistics metadata",
+                    "ClosePyramid");
+    }
+    if (level->fid != (FILE_ID *)NULL) Close_GEOTIFF(level->fid);
+    if (level->sum != (double *)NULL) free(level->sum);
+    if (level->nvalid != (int *)NULL) free(level->nvalid);
+    if (level->ntotal != (int *)NULL) free(level->ntotal);
+    if (level->line != NULL) free(level->line);
+  }
+  free(this);
+
+  return true;
+}
@@ -0,0 +1,76 @@
+/*
+!C****************************************************************************
+
+!File: pyramid.h
+
+!Description: Header file for 'pyramid.c' - see 'pyramid.c' for more
+ information.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Level 'k' of the pyramid is aggregated by a factor of 2^k from the
+      native resolution output.
+   2. The statistics of each level are stored in its GeoTiff file, as for
+      the native image.
+
+!END****************************************************************************
+*/
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "hdf.h"
+#include "bool.h"
+#include "param.h"
+#include "geowrpr.h"
+
+/* Constants */
+
+#define PYRAMID_MAX_LEVEL (3)  /* Maximum number of coarser levels (8x) */
+
+/* Structure for a pyramid level */
+
+typedef struct {
+  int factor;             /* Aggregation factor relative to the native
+                             resolution */
+  Img_coord_int_t size;   /* Level image size */
+  FILE_ID *fid;           /* Output GeoTiff file */
+  double *sum;            /* Sum of the valid values (or first valid value
+                             for NN) for each sample of the current line */
+  int *nvalid;            /* Number of valid values for each sample */
+  int *ntotal;            /* Number of values for each sample */
+  void *line;             /* Output line buffer (output data type) */
+  int il;                 /* Current level line */
+  double nstat;           /* Number of valid level pixels written */
+  double nfill;           /* Number of fill level pixels written */
+  double min, max;        /* Range of the valid level pixels */
+  double shift;           /* First valid level pixel, the sums are taken
+                             about it */
+  double stat_sum;        /* Sum of the shifted valid level pixels */
+  double stat_sum2;       /* Sum of their squares */
+} Pyramid_level_t;
+
+/* Structure for the 'pyramid' data type */
+
+typedef struct {
+  int nlevel;             /* Number of coarser levels */
+  Pyramid_level_t level[PYRAMID_MAX_LEVEL];  /* Coarser levels */
+  Img_coord_int_t size;   /* Native resolution image size */
+  int32 data_type;        /* Output data type */
+  double fill;            /* Output fill value (in the output data type) */
+  bool nn;                /* Use the first valid value ('true', for NN) or
+                             the mean of the valid values ('false') */
+} Pyramid_t;
+
+/* Prototypes */
+
+Pyramid_t *OpenPyramid(Param_t *param, int nlevel);
+bool PyramidLine(Pyramid_t *this, const void *line, int il);
+bool ClosePyramid(Pyramid_t *this);
+
+#endif
@@ -144,6 +144,9 @@
 #include "rb.h"
 #include "addmeta.h"
 #include "logh.h"
+#include "stats.h"
+#include "ostats.h"
+#include "pyramid.h"
 
 /* Macros */
 
@@ -215,15 +218,20 @@ int main (int argc, const char **argv)
   Kernel_t *kernel = NULL;
   Input_t *input = NULL;
   Scan_t *scan = NULL;
+  Scan_t *next = NULL;
+  Scan_t *tmp_scan = NULL;
   Space_t *output_space = NULL;
   Patches_t *patches = NULL;
   int iscan, kscan;
+  bool have_next;
   int il, nl;
   Output_t *output = NULL;
   Img_coord_double_t img;
   Geo_coord_t geo;
   FILE_ID *MasterGeoMem;    /* Output GeoTiff file */
   FILE *rbfile = NULL;       /* Output Raw Binary file */
+  Ostats_band_t *ostats;     /* Output image statistics */
+  Pyramid_t *pyramid;        /* Coarser GeoTiff output levels */
   char HDF_File[1024], CharThisPid[256], FinalFileName[1024];
   Output_t output_mem;       /* Contains output HDF file */
   int32 exec_resamp, ThisPid; 
@@ -257,6 +265,14 @@ int main (int argc, const char **argv)
   /* Print out the user-specified processing information */
   PrintParam(param_save);
 
+  /* Enable processing statistics, if requested */
+  if (!StatsInit(param_save->stats_file_name))
+    LOG_ERROR("initializing processing statistics", "main");
+
+  /* Set up the output image statistics */
+  if (!OstatsInit(param_save->ostats_file_name))
+    LOG_ERROR("initializing output statistics", "main");
+
   /* Loop through all the SDSs */
   for (curr_sds = 0; curr_sds < param_save->num_input_sds; curr_sds++)
   {
@@ -312,6 +328,7 @@ int main (int argc, const char **argv)
         LOG_WARNING("not processing SDS/band", "main");
         break;
       }
+      StatsBeginBand(param->input_sds_name);
 
       /* Setup kernel */
       kernel = GenKernel(param->kernel_type);
@@ -327,6 +344,18 @@ int main (int argc, const char **argv)
       scan = SetupScan(geoloc, input, kernel);
       if (scan == (Scan_t *)NULL)
         LOG_ERROR("setting up scan data structure", "main");
+      scan->trim = param->bowtie_trim;
+
+      /* With bowtie trimming the next scan is mapped ahead of the current 
+         one, so the end of the current scan can be trimmed against it */
+      next = (Scan_t *)NULL;
+      if (param->bowtie_trim)
+      {
+        next = SetupScan(geoloc, input, kernel);
+        if (next == (Scan_t *)NULL)
+          LOG_ERROR("setting up next scan data structure", "main");
+        next->trim = true;
+      }
 
       /* Set up the output space, using the current pixel size and
          number of lines and samples based on the current SDS (pixel size
@@ -467,16 +496,48 @@ int main (int argc, const char **argv)
 	  }
         }
 
-        /* Read the geolocation data for the scan and map to output space */
-        if (!GetGeolocSwath(geoloc, output_space, iscan)) 
-          LOG_ERROR("reading geolocation for a scan", "main");
+        /* Read the geolocation data for the scan and map to output space
+           (when trimming, all but the first scan were mapped as the next 
+           scan) */
+        if (next == (Scan_t *)NULL  ||  iscan == 0)
+        {
+          StatsStart(STATS_GEOLOC);
+          if (!GetGeolocSwath(geoloc, output_space, iscan)) 
+            LOG_ERROR("reading geolocation for a scan", "main");
+          StatsStop(STATS_GEOLOC);
+
+          /* Map scan to input resolution */
+          StatsStart(STATS_MAP_SCAN);
+          if (!MapScanSwath(scan, geoloc)) 
+            LOG_ERROR("mapping a scan (swath)", "main");
+          StatsStop(STATS_MAP_SCAN);
+        }
+
+        /* Map the next scan and find the lines that overlap it */
+        if (next != (Scan_t *)NULL)
+        {
+          have_next = (iscan + 1 < geoloc->nscan);
+          if (have_next)
+          {
+            StatsStart(STATS_GEOLOC);
+            if (!GetGeolocSwath(geoloc, output_space, iscan + 1)) 
+              LOG_ERROR("reading geolocation for a scan", "main");
+            StatsStop(STATS_GEOLOC);
+
+            StatsStart(STATS_MAP_SCAN);
+            if (!MapScanSwath(next, geoloc)) 
+              LOG_ERROR("mapping a scan (swath)", "main");
+            StatsStop(STATS_MAP_SCAN);
+          }
 
-        /* Map scan to input resolution */
-        if (!MapScanSwath(scan, geoloc)) 
-          LOG_ERROR("mapping a scan (swath)", "main");
+          if (!TrimScan(scan, have_next ? next : (Scan_t *)NULL))
+            LOG_ERROR("trimming the scan overlap", "main");
+        }
 
         /* Extend the scan */
+        StatsStart(STATS_EXTEND_SCAN);
         if (!ExtendScan(scan)) LOG_ERROR("extending the scan", "main");
+        StatsStop(STATS_EXTEND_SCAN);
 
         /* Read input scan data into extended scan */
         il = iscan * input->scan_size.l;
@@ -484,16 +545,31 @@ int main (int argc, const char **argv)
         if (il + nl > input->size.l)
           nl = input->size.l - il;
 
+        StatsStart(STATS_SCAN_INPUT);
         if (!GetScanInput(scan, input, il, nl))
           LOG_ERROR("reading input data for a scan", "main");
+        StatsStop(STATS_SCAN_INPUT);
+        StatsCount(STATS_INPUT_PIXELS, (double)nl * (double)input->size.s);
 
         /* Resample all of the points in the extended scan */
+        StatsStart(STATS_PROCESS_SCAN);
         if (!ProcessScan(scan, kernel, patches, nl, param->kernel_type))
           LOG_ERROR("resampling a scan", "main");
+        StatsStop(STATS_PROCESS_SCAN);
 
         /* Toss patches that were not touched */
+        StatsStart(STATS_TOSS_PATCHES);
         if (!TossPatches(patches, param->output_data_type))
           LOG_ERROR("writting patches to disk", "main");
+        StatsStop(STATS_TOSS_PATCHES);
+
+        /* The next scan becomes the current scan */
+        if (next != (Scan_t *)NULL)
+        {
+          tmp_scan = scan;
+          scan = next;
+          next = tmp_scan;
+        }
 
       } /* End loop for each input scan */
 
@@ -516,6 +592,8 @@ int main (int argc, const char **argv)
       /* Done with scan and kernel strutures */
       if (!FreeScan(scan))
         LOG_ERROR("freeing scan structure", "main");
+      if (next != (Scan_t *)NULL  &&  !FreeScan(next))
+        LOG_ERROR("freeing next scan structure", "main");
       if (!FreeKernel(kernel))
         LOG_ERROR("freeing kernel structure", "main");
 
@@ -533,8 +611,10 @@ int main (int argc, const char **argv)
       /* Write remaining patches in memory to disk */
       if (!UntouchPatches(patches)) 
         LOG_ERROR("untouching patches", "main");
+      StatsStart(STATS_TOSS_PATCHES);
       if (!TossPatches(patches, param->output_data_type))
         LOG_ERROR("writting remaining patches to disk", "main");
+      StatsStop(STATS_TOSS_PATCHES);
       if (!FreePatchesInMem(patches))
         LOG_ERROR("freeing patches data structure in memory", "main");
 
@@ -679,9 +759,36 @@ int main (int argc, const char **argv)
       /* Read patches (in input data type) and write to output file (in
          output data type). If NN kernel, then fill any holes left from the
          resampling process. */
+      if (!OstatsBeginBand(param->output_sds_name))
+        LOG_ERROR("starting output statistics", "main");
+
+      /* Open the coarser output levels; they are aggregated from the same
+         output lines, so the swath is only mapped once for all levels */
+      pyramid = (Pyramid_t *)NULL;
+      if (param->pyramid_levels > 0)
+      {
+        if (param->output_file_format == GEOTIFF_FMT ||
+            param->output_file_format == BOTH)
+        {
+          pyramid = OpenPyramid(param, param->pyramid_levels);
+          if (pyramid == (Pyramid_t *)NULL)
+            LOG_ERROR("opening the pyramid output levels", "main");
+        }
+        else
+          LOG_WARNING("pyramid levels are only written for GeoTiff output",
+                      "main");
+      }
+
+      StatsStart(STATS_UNSCRAMBLE);
       if (!UnscramblePatches(patches, output, param->output_file_format,
-          MasterGeoMem, rbfile, param->output_data_type, param->kernel_type))
+          MasterGeoMem, rbfile, param->output_data_type, param->kernel_type,
+          pyramid))
         LOG_ERROR("unscrambling the output file", "main");
+      StatsStop(STATS_UNSCRAMBLE);
+      ostats = OstatsEndBand();
+
+      if (!ClosePyramid(pyramid))
+        LOG_ERROR("closing the pyramid output levels", "main");
 
       /* Done with the patches */
       if (!FreePatches(patches))
@@ -706,6 +813,16 @@ int main (int argc, const char **argv)
       if (param->output_file_format == GEOTIFF_FMT ||
           param->output_file_format == BOTH)
       {
+        /* Store the output statistics as GDAL metadata so GDAL doesn't
+           have to scan the image again */
+        if (ostats != (Ostats_band_t *)NULL  &&  ostats->nvalid > 0.0)
+        {
+          if (!GEOTIFF_SetStatistics(MasterGeoMem, ostats->min, ostats->max,
+              ostats->mean, ostats->stddev, 100.0 * ostats->nvalid /
+              (ostats->nvalid + ostats->nfill)))
+            LOG_WARNING("writing GeoTiff statistics metadata", "main");
+        }
+
         Close_GEOTIFF( MasterGeoMem );
         /* CloseGeoTIFFFile(&MasterGeoMem); */
         output->open = false;
@@ -740,6 +857,7 @@ int main (int argc, const char **argv)
       {
         LOG_ERROR("Something bad happened deleting patches file", "main");
       }  
+      StatsEndBand();
 
       /* Free the parameter structure */
       if (!FreeParam(param)) 
@@ -812,6 +930,16 @@ int main (int argc, const char **argv)
     }
   }
 
+  /* Write the processing statistics report */
+  if (!StatsWrite())
+    LOG_WARNING("writing processing statistics report", "main");
+  StatsFree();
+
+  /* Write the output image statistics */
+  if (!OstatsWrite())
+    LOG_WARNING("writing output statistics file", "main");
+  OstatsFree();
+
   /* Free the saved parameter structure */
   if (!FreeParam(param_save))
     LOG_ERROR("freeing saved user parameter structure", "main");
@@ -26,6 +26,10 @@
  mechanism to identify which input pixel is closest to an output pixel.
  Plus corrected nearest neighbor so it selects the nearest input pixel 
  rather than sum and average a number of input pixels.
+
+ Revision 2.3.0 2026/10/18
+ Added optional trimming of the lines that overlap the neighboring scans
+ (bowtie effect).
  
 
  !Team Unique Header:
@@ -57,6 +61,8 @@
           band and resolution and store it in the 'scan' data structure.
         MapScanGrid - copy the input grid locations to the output grid
           and store it in the the 'scan' data structure.
+        TrimScan - determine the lines that overlap the neighboring scans
+          (bowtie effect) and don't need to be resampled.
         ExtendScan - extend the scan to allow for large kernels and
           to handle the scan overlap region.
         GetScanInput - reads a scan of input data.
@@ -85,11 +91,13 @@
 
 #include "scan.h"
 #include "myerror.h"
+#include "stats.h"
 
 /* Constants */
 
 #define NSCAN_TOUCH (2)   /* Value to set 'ntouch' to when a scan is touched */
 #define MIN_WEIGHT (0.10) /* Minimum weight for a valid output pixel */
+#define EPS_TRIM (1.0e-6) /* Minimum squared scan length for trimming */
 
 /* #define DEBUG_ZEROS */
 
@@ -108,7 +116,9 @@ Scan_t *SetupScan(Geoloc_t *geoloc, Input_t *input, Kernel_t *kernel)
                   after, before
 
 !Output Parameters:
- (returns)      'scan' data structure or NULL when an error occurs
+ (returns)      'scan' data structure or NULL when an error occurs; bowtie
+                trimming is off ('trim' is 'false') unless it is turned on
+                by the caller
 
 !Team Unique Header:
 
@@ -202,6 +212,10 @@ Scan_t *SetupScan(Geoloc_t *geoloc, Input_t *input, Kernel_t *kernel)
   }
 
   this->isin_buf = (Scan_isin_buf_t **)NULL;
+  this->trim = false;
+  this->have_prev = false;
+  this->trim_before = (int *)NULL;
+  this->trim_after = (int *)NULL;
 
   if (this->isin_type != SPACE_NOT_ISIN) {
 
@@ -227,11 +241,23 @@ Scan_t *SetupScan(Geoloc_t *geoloc, Input_t *input, Kernel_t *kernel)
     }
   }
 
+  /* Set up the bowtie trimming buffers */
+
+  if (error_string == (char *)NULL) {
+    this->trim_before = (int *)calloc((size_t)this->size.s, sizeof(int));
+    this->trim_after = (int *)calloc((size_t)this->size.s, sizeof(int));
+    if (this->trim_before == (int *)NULL  ||  
+        this->trim_after == (int *)NULL)
+      error_string = "allocating scan trim buffers";
+  }
+
   if (error_string != (char *)NULL) {
     if (this->buf != (Scan_buf_t **)NULL) {
       if (this->buf[0] != (Scan_buf_t *)NULL) free(this->buf[0]);
       free(this->buf);
     }
+    if (this->trim_before != (int *)NULL) free(this->trim_before);
+    if (this->trim_after != (int *)NULL) free(this->trim_after);
     if (this->isin_buf != (Scan_isin_buf_t **)NULL) {
       if (this->isin_buf[0] != (Scan_isin_buf_t *)NULL) free(this->isin_buf[0]);
       free(this->isin_buf);
@@ -252,7 +278,7 @@ bool FreeScan(Scan_t *this)
  
 !Input Parameters:
  this           'input' data structure; the following fields are input:
-                   buf
+                   buf, trim_before, trim_after
 
 !Output Parameters:
  (returns)      status:
@@ -283,6 +309,9 @@ bool FreeScan(Scan_t *this)
       }
     }
 
+    if (this->trim_before != (int *)NULL) free(this->trim_before);
+    if (this->trim_after != (int *)NULL) free(this->trim_after);
+
     free(this);
   }
   return true;
@@ -848,6 +877,171 @@ bool MapScanGrid(Scan_t *this, Geoloc_t *geoloc, Space_def_t *output_space_def,
   return true;
 }
 
+bool TrimScan(Scan_t *this, Scan_t *next)
+/* 
+!C******************************************************************************
+
+!Description: 'TrimScan' determines, for each sample, the lines at the end
+ of the scan and at the start of the next scan that overlap (bowtie effect) 
+ and don't need to be resampled.
+ 
+!Input Parameters:
+ this           'scan' data structure; the following fields are input:
+                   trim, have_prev, extra_before, size, extra_after, 
+                   buf[*][*].img
+ next           'scan' data structure for the next scan, or NULL for the
+                last scan; the following fields are input:
+                   extra_before, size, extra_after, buf[*][*].img
+
+!Output Parameters:
+ this           'scan' data structure; the following fields are modified:
+                   trim_before (first scan only), trim_after
+ next           'scan' data structure for the next scan; the following 
+                fields are modified:
+                   have_prev, trim_before
+ (returns)      status:
+                  'true' = okay (always returned)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. Away from nadir the ground footprint of a scan grows, so the last 
+      lines of a scan cover the same ground as the first lines of the 
+      next scan.  For each sample the lines of each scan are projected onto
+      the along-track direction of that scan (first to last line).  The 
+      lines of this scan that lie past the first line of the next scan, 
+      less half a line, and the lines of the next scan that lie before the 
+      last line of this scan, plus half a line, are counted as overlap.
+   2. Each overlap is split, so each scan keeps the lines nearest its own 
+      center (the least distorted lines).  At least one line of overlap is 
+      kept so there are no gaps between the scans.
+   3. Nothing is trimmed from the start of the first scan or from the end 
+      of the last scan, when any of the points are fill, or when the 
+      neighboring scan doesn't lie past the middle of the scan.
+   4. An error status is never returned.
+   5. 'MapScanSwath' must be called for this scan and the next scan before 
+      this routine is called.
+
+!END****************************************************************************
+*/
+{
+  int il1, il2, nl1, nl2;
+  int is1, is2;
+  int il, is;
+  int nline, nline_next, nover;
+  Img_coord_double_t *p0, *p1, *q0, *q1, *p;
+  Img_coord_double_t t;
+  double tt, scale, a, a_lim;
+
+  if (!this->trim)
+    return true;
+
+  il1 = this->extra_before.l;
+  il2 = this->size.l - this->extra_after.l;
+  is1 = this->extra_before.s;
+  is2 = this->size.s - this->extra_after.s;
+  nline = il2 - il1;
+
+  if (!this->have_prev) {
+    for (is = 0; is < this->size.s; is++)
+      this->trim_before[is] = 0;
+  }
+
+  if (next != (Scan_t *)NULL) {
+    nl1 = next->extra_before.l;
+    nl2 = next->size.l - next->extra_after.l;
+    nline_next = nl2 - nl1;
+  } else {
+    nl1 = nl2 = nline_next = 0;
+  }
+
+  for (is = is1; is < is2; is++) {
+    this->trim_after[is] = 0;
+    if (next != (Scan_t *)NULL)
+      next->trim_before[is] = 0;
+
+    if (next == (Scan_t *)NULL  ||  nline < 2  ||  nline_next < 2)
+      continue;
+
+    p0 = &this->buf[il1][is].img;
+    p1 = &this->buf[il2 - 1][is].img;
+    q0 = &next->buf[nl1][is].img;
+    q1 = &next->buf[nl2 - 1][is].img;
+    if (p0->is_fill  ||  p1->is_fill  ||  q0->is_fill  ||  q1->is_fill)
+      continue;
+
+    /* Lines at the end of this scan past the first line of the next scan */
+
+    t.l = p1->l - p0->l;
+    t.s = p1->s - p0->s;
+    tt = (t.l * t.l) + (t.s * t.s);
+
+    if (tt > EPS_TRIM) {
+      scale = (double)(nline - 1) / tt;
+      a_lim = (((q0->l - p0->l) * t.l) + ((q0->s - p0->s) * t.s)) * scale;
+
+      nover = 0;
+      if (a_lim > (0.5 * (nline - 1))) {
+        for (il = il2 - 1; il >= il1; il--) {
+          p = &this->buf[il][is].img;
+          if (p->is_fill) break;
+          a = (((p->l - p0->l) * t.l) + ((p->s - p0->s) * t.s)) * scale;
+          if (a <= (a_lim - 0.5)) break;
+          nover++;
+        }
+      }
+
+      if (nover > 1)
+        this->trim_after[is] = (nover - 1) / 2;
+    }
+
+    /* Lines at the start of the next scan before the last line of this 
+       scan */
+
+    t.l = q1->l - q0->l;
+    t.s = q1->s - q0->s;
+    tt = (t.l * t.l) + (t.s * t.s);
+
+    if (tt > EPS_TRIM) {
+      scale = (double)(nline_next - 1) / tt;
+      a_lim = (((p1->l - q0->l) * t.l) + ((p1->s - q0->s) * t.s)) * scale;
+
+      nover = 0;
+      if (a_lim < (0.5 * (nline_next - 1))) {
+        for (il = nl1; il < nl2; il++) {
+          p = &next->buf[il][is].img;
+          if (p->is_fill) break;
+          a = (((p->l - q0->l) * t.l) + ((p->s - q0->s) * t.s)) * scale;
+          if (a >= (a_lim + 0.5)) break;
+          nover++;
+        }
+      }
+
+      if (nover > 1)
+        next->trim_before[is] = (nover - 1) / 2;
+    }
+  }
+
+  /* The extra samples use the values of the nearest actual sample */
+
+  for (is = 0; is < is1; is++) {
+    this->trim_after[is] = this->trim_after[is1];
+    if (next != (Scan_t *)NULL)
+      next->trim_before[is] = next->trim_before[is1];
+  }
+  for (is = is2; is < this->size.s; is++) {
+    this->trim_after[is] = this->trim_after[is2 - 1];
+    if (next != (Scan_t *)NULL)
+      next->trim_before[is] = next->trim_before[is2 - 1];
+  }
+
+  if (next != (Scan_t *)NULL)
+    next->have_prev = true;
+
+  return true;
+}
+
+
 bool ExtendScan(Scan_t *this)
 /* 
 !C******************************************************************************
@@ -1196,7 +1390,8 @@ bool ProcessScan (Scan_t*        this,
  
 !Input Parameters:
  this           'scan' data structure; the following fields are input:
-                  isin_type, size, extra_before, extra_after, buf, isin_buf
+                  isin_type, size, extra_before, extra_after, buf, isin_buf,
+                  trim, trim_before, trim_after
  kernel         'kernel' data structure; the following fields are input:
                   before, after, delta_inv, l, s, 
  patches        'patches' data structure; the following fields are input:
@@ -1224,6 +1419,8 @@ bool ProcessScan (Scan_t*        this,
    2. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
    3. 'SetupScan', 'SetupKernel' and 'SetupPatches' must be called before 
       this routine is called.
+   4. When bowtie trimming is on, 'TrimScan' must be called for the scan
+      (and for the previous scan) before this routine is called.
 
 !END****************************************************************************
 */
@@ -1259,6 +1456,9 @@ bool ProcessScan (Scan_t*        this,
     int fill_count;
     int half_kernel_ttl;
     bool fill;
+    double nupdate;
+    double ntrim;
+    int il_last;
 
 /* #define DEBUG */
 #ifdef DEBUG
@@ -1282,6 +1482,8 @@ bool ProcessScan (Scan_t*        this,
     special input ISIN case
     -------------------------------------------------------*/
     ds = (double*)NULL;
+    nupdate = 0.0;
+    ntrim = 0.0;
 
     if (this->isin_type != SPACE_NOT_ISIN) 
     {
@@ -1303,6 +1505,7 @@ bool ProcessScan (Scan_t*        this,
     il_in2 = this->extra_before.l + nl;
     is_in1 = this->extra_before.s;
     is_in2 = this->size.s - this->extra_after.s;
+    il_last = this->size.l - this->extra_after.l - 1;
 
     /*
     -------------------------------------------------------
@@ -1332,6 +1535,22 @@ bool ProcessScan (Scan_t*        this,
         -------------------------------------------------------*/
         for (is_in = 0; is_in < (this->size.s - 1); is_in++) 
         {
+            /*
+            -------------------------------------------------------
+            Skip the lines that overlap the neighboring scans (see 
+            'TrimScan', which keeps a line of overlap so there are 
+            no gaps)
+            -------------------------------------------------------*/
+            if (this->trim  &&
+                ((this->trim_before[is_in] > 0  &&
+                  il_in < il_in1 + this->trim_before[is_in])  ||
+                 (this->trim_after[is_in] > 0  &&
+                  il_in > il_last - this->trim_after[is_in])))
+            {
+                ntrim++;
+                continue;
+            }
+
             /*
             -------------------------------------------------------
             Get location in output space of the input point and 
@@ -1591,6 +1810,7 @@ bool ProcessScan (Scan_t*        this,
                     }
 
                     mem_p    = loc_p->u.pntr;
+                    nupdate++;
                     sum_p    = &mem_p->sum[il_rel][is_rel];
                     weight_p = &mem_p->weight[il_rel][is_rel];
                     nn_wt_p  = &mem_p->nn_wt[il_rel][is_rel];
@@ -1814,6 +2034,9 @@ bool ProcessScan (Scan_t*        this,
     if (this->isin_type != SPACE_NOT_ISIN) 
         free(ds);
 
+    StatsCount(STATS_ACCUMULATOR_UPDATES, nupdate);
+    StatsCount(STATS_TRIMMED_CELLS, ntrim);
+
     return true;
 
 } /* ProcessScan */
@@ -14,6 +14,9 @@
  Robert Wolfe
  Added special handling for input ISIN case.
 
+ Revision 1.2 2026/10/18
+ Added bowtie overlap trimming.
+
 !Team Unique Header:
   This software was developed by the MODIS Land Science Team Support 
   Group for the Laboratory for Terrestrial Physics (Code 922) at the 
@@ -86,6 +89,15 @@ typedef struct {
   Space_isin_t isin_type; /* Flag to indicate whether the input 
                              projection is ISIN, and if it is, the 
 			     ISIN nesting */
+  bool trim;            /* Flag to indicate whether the lines that overlap
+                           the neighboring scans (bowtie effect) are 
+                           trimmed */
+  bool have_prev;       /* Flag to indicate whether 'trim_before' was set 
+                           by 'TrimScan' for the previous scan */
+  int *trim_before;     /* Number of lines trimmed from the start of the 
+                           scan, for each sample */
+  int *trim_after;      /* Number of lines trimmed from the end of the scan,
+                           for each sample */
 } Scan_t;
 
 /* Prototypes */
@@ -95,6 +107,7 @@ bool FreeScan(Scan_t *this);
 bool MapScanSwath(Scan_t *this, Geoloc_t *geoloc);
 bool MapScanGrid(Scan_t *this, Geoloc_t *geoloc, Space_def_t *output_space_def, 
                  int iscan);
+bool TrimScan(Scan_t *this, Scan_t *next);
 bool ExtendScan(Scan_t *this);
 bool GetScanInput(Scan_t *this, Input_t *input, int il, int nl);
 bool ProcessScan(Scan_t *this, Kernel_t *kernel, Patches_t *patches, int nl,
@@ -0,0 +1,574 @@
+/*
+!C****************************************************************************
+
+!File: stats.c
+
+!Description: Functions for collecting per-stage timings and event counters
+ while resampling, and for writing them to a JSON report.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The following public functions handle the processing statistics:
+
+	StatsInit - Enable statistics collection.
+	StatsEnabled - Is statistics collection enabled?
+	StatsBeginBand - Start collecting statistics for an SDS/band.
+	StatsEndBand - Finish collecting statistics for an SDS/band.
+	StatsStart - Start timing a processing stage.
+	StatsStop - Stop timing a processing stage.
+	StatsCount - Add to an event counter.
+	StatsWrite - Write the statistics to the JSON report file.
+	StatsFree - Free the statistics memory.
+	StatsWriteString - Write a JSON string.
+
+   2. The following internal functions are used:
+
+	WallTime - Get the current wall clock time.
+	CpuTime - Get the current processor time.
+	WriteBand - Write the statistics for an SDS/band.
+	PeakRss - Get the peak resident set size.
+
+   3. Statistics are kept in a single static structure since there is only
+      one resampling run per process.  When 'StatsInit' is not called with
+      a file name, all of the collection functions return immediately.
+   4. Stage times are inclusive; e.g., 'STATS_GEOLOC' includes
+      'STATS_GEOLOC_READ' and 'STATS_GEOLOC_PROJ', and 'STATS_UNSCRAMBLE'
+      includes 'STATS_FILL_OUTPUT'.
+
+!END****************************************************************************
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef WIN32
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+#include "stats.h"
+#include "myerror.h"
+
+/* Constants */
+
+#define NBAND_ALLOC (16)  /* Number of band entries to allocate at a time */
+
+/* Type definitions */
+
+typedef struct {
+  double wall;          /* Accumulated wall clock time (seconds) */
+  double cpu;           /* Accumulated processor time (seconds) */
+  long ncall;           /* Number of times the stage was timed */
+  double wall_start;    /* Wall clock time at the last 'StatsStart' */
+  double cpu_start;     /* Processor time at the last 'StatsStart' */
+} Stats_timer_t;
+
+typedef struct {
+  char *sds_name;       /* SDS/band name */
+  double wall;          /* Total wall clock time for the band (seconds) */
+  double cpu;           /* Total processor time for the band (seconds) */
+  Stats_timer_t timer[STATS_NSTAGE];  /* Stage timers */
+  double count[STATS_NCOUNTER];       /* Event counters */
+} Stats_band_t;
+
+typedef struct {
+  bool enabled;         /* Is statistics collection enabled? */
+  char *file_name;      /* JSON report file name */
+  double wall_start;    /* Wall clock time at 'StatsInit' */
+  double cpu_start;     /* Processor time at 'StatsInit' */
+  double band_wall_start;  /* Wall clock time at 'StatsBeginBand' */
+  double band_cpu_start;   /* Processor time at 'StatsBeginBand' */
+  int nband;            /* Number of bands collected */
+  int nband_alloc;      /* Number of band entries allocated */
+  Stats_band_t *band;   /* Band entries */
+  Stats_band_t *curr;   /* Band currently being collected (NULL if none) */
+} Stats_t;
+
+/* Names of the stages and counters in the JSON report */
+
+static const char *stage_name[STATS_NSTAGE] = {
+  "geoloc", "geoloc_read", "geoloc_proj", "map_scan", "extend_scan",
+  "scan_input", "process_scan", "toss_patches", "unscramble_patches",
+  "fill_output"
+};
+
+static const char *counter_name[STATS_NCOUNTER] = {
+  "input_pixels", "accumulator_updates", "patch_loads", "patch_evictions",
+  "bytes_spilled", "patch_reads", "bytes_read", "trimmed_cells"
+};
+
+static Stats_t stats = {false, NULL, 0.0, 0.0, 0.0, 0.0, 0, 0, NULL, NULL};
+
+static double WallTime(void)
+/*
+!C******************************************************************************
+
+!Description: 'WallTime' returns the current wall clock time.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      wall clock time (seconds)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. On Windows the processor clock is used, since 'gettimeofday' is not
+      available.
+
+!END****************************************************************************
+*/
+{
+#ifndef WIN32
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec * 1.0e-6);
+#else
+  return (double)clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+static double CpuTime(void)
+/*
+!C******************************************************************************
+
+!Description: 'CpuTime' returns the processor time used by the program.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      processor time (seconds)
+
+!END****************************************************************************
+*/
+{
+  return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+bool StatsInit(const char *file_name)
+/*
+!C******************************************************************************
+
+!Description: 'StatsInit' enables statistics collection.
+
+!Input Parameters:
+ file_name      name of the JSON report file; if NULL, statistics are not
+                collected
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. An error status is returned when:
+       a. there is an error allocating memory.
+   2. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+
+!END****************************************************************************
+*/
+{
+  stats.enabled = false;
+  if (file_name == (char *)NULL)
+    return true;
+
+  stats.file_name = strdup(file_name);
+  if (stats.file_name == (char *)NULL)
+    LOG_RETURN_ERROR("allocating report file name", "StatsInit", false);
+
+  stats.nband = 0;
+  stats.nband_alloc = 0;
+  stats.band = (Stats_band_t *)NULL;
+  stats.curr = (Stats_band_t *)NULL;
+  stats.wall_start = WallTime();
+  stats.cpu_start = CpuTime();
+  stats.enabled = true;
+
+  return true;
+}
+
+bool StatsEnabled(void)
+/*
+!C******************************************************************************
+
+!Description: 'StatsEnabled' returns whether statistics are being collected.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      'true' = statistics are being collected
+                'false' = statistics are not being collected
+
+!END****************************************************************************
+*/
+{
+  return stats.enabled;
+}
+
+void StatsBeginBand(const char *sds_name)
+/*
+!C******************************************************************************
+
+!Description: 'StatsBeginBand' starts collecting statistics for an SDS/band.
+
+!Input Parameters:
+ sds_name       SDS/band name
+
+!Output Parameters: (none)
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. If the band entries can't be allocated, a warning is issued and
+      statistics collection is disabled.
+
+!END****************************************************************************
+*/
+{
+  Stats_band_t *band;
+  int n;
+
+  if (!stats.enabled)
+    return;
+
+  if (stats.nband >= stats.nband_alloc) {
+    n = stats.nband_alloc + NBAND_ALLOC;
+    band = (Stats_band_t *)realloc(stats.band, n * sizeof(Stats_band_t));
+    if (band == (Stats_band_t *)NULL) {
+      LOG_WARNING("allocating band statistics; statistics disabled",
+                  "StatsBeginBand");
+      stats.enabled = false;
+      return;
+    }
+    stats.band = band;
+    stats.nband_alloc = n;
+  }
+
+  stats.curr = &stats.band[stats.nband++];
+  memset(stats.curr, 0, sizeof(Stats_band_t));
+  stats.curr->sds_name = strdup(sds_name);
+
+  stats.band_wall_start = WallTime();
+  stats.band_cpu_start = CpuTime();
+}
+
+void StatsEndBand(void)
+/*
+!C******************************************************************************
+
+!Description: 'StatsEndBand' finishes collecting statistics for the current
+ SDS/band.
+
+!Input Parameters: (none)
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  if (!stats.enabled  ||  stats.curr == (Stats_band_t *)NULL)
+    return;
+
+  stats.curr->wall = WallTime() - stats.band_wall_start;
+  stats.curr->cpu = CpuTime() - stats.band_cpu_start;
+  stats.curr = (Stats_band_t *)NULL;
+}
+
+void StatsStart(Stats_stage_t stage)
+/*
+!C******************************************************************************
+
+!Description: 'StatsStart' starts timing a processing stage for the current
+ SDS/band.
+
+!Input Parameters:
+ stage          processing stage
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  Stats_timer_t *timer;
+
+  if (!stats.enabled  ||  stats.curr == (Stats_band_t *)NULL)
+    return;
+
+  timer = &stats.curr->timer[stage];
+  timer->wall_start = WallTime();
+  timer->cpu_start = CpuTime();
+}
+
+void StatsStop(Stats_stage_t stage)
+/*
+!C******************************************************************************
+
+!Description: 'StatsStop' stops timing a processing stage for the current
+ SDS/band and adds the elapsed time to the stage totals.
+
+!Input Parameters:
+ stage          processing stage
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  Stats_timer_t *timer;
+
+  if (!stats.enabled  ||  stats.curr == (Stats_band_t *)NULL)
+    return;
+
+  timer = &stats.curr->timer[stage];
+  timer->wall += WallTime() - timer->wall_start;
+  timer->cpu += CpuTime() - timer->cpu_start;
+  timer->ncall++;
+}
+
+void StatsCount(Stats_counter_t counter, double n)
+/*
+!C******************************************************************************
+
+!Description: 'StatsCount' adds to an event counter for the current SDS/band.
+
+!Input Parameters:
+ counter        event counter
+ n              amount to add to the counter
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  if (!stats.enabled  ||  stats.curr == (Stats_band_t *)NULL)
+    return;
+
+  stats.curr->count[counter] += n;
+}
+
+static long PeakRss(void)
+/*
+!C******************************************************************************
+
+!Description: 'PeakRss' returns the peak resident set size of the program.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      peak resident set size (kilobytes); -1 if not available
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. 'ru_maxrss' is in kilobytes on Linux but in bytes on Mac OS X.
+
+!END****************************************************************************
+*/
+{
+#ifndef WIN32
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+#ifdef __APPLE__
+  return (long)(usage.ru_maxrss / 1024);
+#else
+  return (long)usage.ru_maxrss;
+#endif
+#else
+  return -1;
+#endif
+}
+
+void StatsWriteString(FILE *file, const char *s)
+/*
+!C******************************************************************************
+
+!Description: 'StatsWriteString' writes a quoted and escaped JSON string.
+
+!Input Parameters:
+ file           output file
+ s              string to write (NULL is written as an empty string)
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  fputc('"', file);
+  for (; s != (char *)NULL  &&  *s != '\0'; s++) {
+    if (*s == '"'  ||  *s == '\\')
+      fprintf(file, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(file, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, file);
+  }
+  fputc('"', file);
+}
+
+static void WriteBand(FILE *file, Stats_band_t *band, const char *indent)
+/*
+!C******************************************************************************
+
+!Description: 'WriteBand' writes the timings and counters for an SDS/band
+ (or the totals) as the members of a JSON object.
+
+!Input Parameters:
+ file           output file
+ band           band statistics
+ indent         indentation for each member
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  int i;
+  double mpix;
+
+  fprintf(file, "%s\"wall_seconds\": %.6f,\n", indent, band->wall);
+  fprintf(file, "%s\"cpu_seconds\": %.6f,\n", indent, band->cpu);
+
+  mpix = 0.0;
+  if (band->wall > 0.0)
+    mpix = band->count[STATS_INPUT_PIXELS] / band->wall * 1.0e-6;
+  fprintf(file, "%s\"input_mpixels_per_second\": %.3f,\n", indent, mpix);
+
+  fprintf(file, "%s\"stages\": {\n", indent);
+  for (i = 0; i < STATS_NSTAGE; i++) {
+    fprintf(file, "%s  \"%s\": {\"wall_seconds\": %.6f, "
+            "\"cpu_seconds\": %.6f, \"calls\": %ld}%s\n", indent,
+            stage_name[i], band->timer[i].wall, band->timer[i].cpu,
+            band->timer[i].ncall, (i < STATS_NSTAGE - 1) ? "," : "");
+  }
+  fprintf(file, "%s},\n", indent);
+
+  fprintf(file, "%s\"counters\": {\n", indent);
+  for (i = 0; i < STATS_NCOUNTER; i++) {
+    fprintf(file, "%s  \"%s\": %.0f%s\n", indent, counter_name[i],
+            band->count[i], (i < STATS_NCOUNTER - 1) ? "," : "");
+  }
+  fprintf(file, "%s}\n", indent);
+}
+
+bool StatsWrite(void)
+/*
+!C******************************************************************************
+
+!Description: 'StatsWrite' writes the per-band and total statistics to the
+ JSON report file.
+
+!Input Parameters: (none)
+
+!Output Parameters:
+ (returns)      status:
+                  'true' = okay
+		  'false' = error return
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. An error status is returned when:
+       a. the report file can't be opened.
+       b. there is an error writing the report file.
+   2. Error messages are handled with the 'LOG_RETURN_ERROR' macro.
+   3. Nothing is written if statistics collection is not enabled.
+
+!END****************************************************************************
+*/
+{
+  FILE *file;
+  Stats_band_t total;
+  int ib, i;
+
+  if (!stats.enabled)
+    return true;
+
+  StatsEndBand();
+
+  memset(&total, 0, sizeof(Stats_band_t));
+  for (ib = 0; ib < stats.nband; ib++) {
+    for (i = 0; i < STATS_NSTAGE; i++) {
+      total.timer[i].wall += stats.band[ib].timer[i].wall;
+      total.timer[i].cpu += stats.band[ib].timer[i].cpu;
+      total.timer[i].ncall += stats.band[ib].timer[i].ncall;
+    }
+    for (i = 0; i < STATS_NCOUNTER; i++)
+      total.count[i] += stats.band[ib].count[i];
+  }
+  total.wall = WallTime() - stats.wall_start;
+  total.cpu = CpuTime() - stats.cpu_start;
+
+  file = fopen(stats.file_name, "w");
+  if (file == (FILE *)NULL)
+    LOG_RETURN_ERROR("opening statistics report file", "StatsWrite", false);
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"program\": \"swath2grid\",\n");
+  fprintf(file, "  \"peak_rss_kb\": %ld,\n", PeakRss());
+  fprintf(file, "  \"bands\": [\n");
+  for (ib = 0; ib < stats.nband; ib++) {
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"sds\": ");
+    StatsWriteString(file, stats.band[ib].sds_name);
+    fprintf(file, ",\n");
+    WriteBand(file, &stats.band[ib], "      ");
+    fprintf(file, "    }%s\n", (ib < stats.nband - 1) ? "," : "");
+  }
+  fprintf(file, "  ],\n");
+  fprintf(file, "  \"total\": {\n");
+  WriteBand(file, &total, "    ");
+  fprintf(file, "  }\n");
+  fprintf(file, "}\n");
+
+  if (ferror(file)) {
+    fclose(file);
+    LOG_RETURN_ERROR("writing statistics report file", "StatsWrite", false);
+  }
+  if (fclose(file) != 0)
+    LOG_RETURN_ERROR("closing statistics report file", "StatsWrite", false);
+
+  return true;
+}
+
+void StatsFree(void)
+/*
+!C******************************************************************************
+
+!Description: 'StatsFree' frees the statistics memory and disables
+ statistics collection.
+
+!Input Parameters: (none)
+
+!Output Parameters: (none)
+
+!END****************************************************************************
+*/
+{
+  int ib;
+
+  for (ib = 0; ib < stats.nband; ib++) {
+    if (stats.band[ib].sds_name != (char *)NULL)
+      free(stats.band[ib].sds_name);
+  }
+  if (stats.band != (Stats_band_t *)NULL)
+    free(stats.band);
+  if (stats.file_name != (char *)NULL)
+    free(stats.file_name);
+
+  stats.band = (Stats_band_t *)NULL;
+  stats.curr = (Stats_band_t *)NULL;
+  stats.file_name = (char *)NULL;
+  stats.nband = 0;
+  stats.nband_alloc = 0;
+  stats.enabled = false;
+}
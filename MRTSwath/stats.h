@@ -0,0 +1,71 @@
+/*
+!C****************************************************************************
+
+!File: stats.h
+
+!Description: Header file for 'stats.c' - see 'stats.c' for more information.
+
+!Revision History:
+ Revision 1.0 2026/10/18
+ Original Version.
+
+!Team Unique Header:
+
+ ! Design Notes:
+   1. The stage and counter enumerations index the per-band accumulators
+      kept by 'stats.c'; 'STATS_NSTAGE' and 'STATS_NCOUNTER' must stay last.
+
+!END****************************************************************************
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "bool.h"
+
+/* Processing stages that are timed */
+
+typedef enum {
+  STATS_GEOLOC,          /* GetGeolocSwath (read + projection) */
+  STATS_GEOLOC_READ,     /* geolocation SDreaddata calls */
+  STATS_GEOLOC_PROJ,     /* geolocation ToSpace calls */
+  STATS_MAP_SCAN,        /* MapScanSwath */
+  STATS_EXTEND_SCAN,     /* ExtendScan */
+  STATS_SCAN_INPUT,      /* GetScanInput */
+  STATS_PROCESS_SCAN,    /* ProcessScan (kernel splat) */
+  STATS_TOSS_PATCHES,    /* TossPatches (patch spill to disk) */
+  STATS_UNSCRAMBLE,      /* UnscramblePatches (includes FillOutput) */
+  STATS_FILL_OUTPUT,     /* FillOutput (NN gap filling) */
+  STATS_NSTAGE
+} Stats_stage_t;
+
+/* Event counters */
+
+typedef enum {
+  STATS_INPUT_PIXELS,    /* input pixels read */
+  STATS_ACCUMULATOR_UPDATES, /* patch accumulator updates, not distinct
+                                output pixels */
+  STATS_PATCH_LOADS,     /* patches initialized in memory */
+  STATS_PATCH_EVICTIONS, /* patches written to the temporary file */
+  STATS_BYTES_SPILLED,   /* bytes written to the temporary file */
+  STATS_PATCH_READS,     /* patches read back from the temporary file */
+  STATS_BYTES_READ,      /* bytes read back from the temporary file */
+  STATS_TRIMMED_CELLS,   /* input cells skipped by bowtie trimming */
+  STATS_NCOUNTER
+} Stats_counter_t;
+
+/* Prototypes */
+
+bool StatsInit(const char *file_name);
+bool StatsEnabled(void);
+void StatsBeginBand(const char *sds_name);
+void StatsEndBand(void);
+void StatsStart(Stats_stage_t stage);
+void StatsStop(Stats_stage_t stage);
+void StatsCount(Stats_counter_t counter, double n);
+bool StatsWrite(void);
+void StatsFree(void);
+void StatsWriteString(FILE *file, const char *s);
+
+#endif
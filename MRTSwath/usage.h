@@ -73,6 +73,8 @@
 "    swath2grid -if=<input file> -of=<output file> -gf=<geolocation file>\n" \
 "           [-off=<output file format (HDF_FMT, GEOTIFF_FMT, RB_FMT)>]\n" \
 "           [-sds=<SDS name>] [-kk=<resampling type (NN, BI, CC)>]\n" \
+"           [-bowtie=<bowtie trimming (NONE, TRIM)>]\n" \
+"           [-pyramid=<number of coarser output levels (0-3)>]\n" \
 "           -oproj=<output projection>\n" \
 "           [-oprm=<output projection parameters>]\n" \
 "           [-opsz=<output pixel sizes>]\n" \
@@ -84,6 +86,8 @@
 "           [-osp=<output sphere number>]\n" \
 "           [-oty=<output data type>]\n" \
 "           [-pf=<parameter file>]\n" \
+"           [-stats=<statistics report file>]\n" \
+"           [-ostats=<output statistics file>]\n" \
 " \n" \
 "DESCRIPTION \n" \
 "    Resample one or more SDSs from a L2 MODIS granule into user-specified\n"\
@@ -139,6 +143,17 @@
 "                               MRTSwath tries to process them.\n" \
 "    -kk=kernel                 Resampling kernel type (CC, NN, or BI) \n" \
 "                               Default is NN.\n" \
+"    -bowtie=trimming           Bowtie trimming (NONE or TRIM).  TRIM skips\n" \
+"                               the input lines that overlap the\n" \
+"                               neighboring scans away from nadir, keeping\n" \
+"                               the ones nearest the center of each scan.\n" \
+"                               Default is NONE.\n" \
+"    -pyramid=levels            Number of coarser resolution GeoTiff levels\n" \
+"                               (0 to 3) written with each SDS/band.  Level\n" \
+"                               k is aggregated by 2^k from the output lines\n" \
+"                               and named <output file>_<SDS>_<2^k>x.tif.\n" \
+"                               Each SDS/band is still mapped and resampled\n" \
+"                               at its own resolution.  Default is 0.\n" \
 "    -oproj=output projection   Output projection number or short name. \n" \
 "                               AEA, ER, GEO, GOODE, HAMMER, ISIN, LAMAZ, \n" \
 "                               LAMCC, MERCAT, MOLL, PS, SNSOID, TM, and UTM\n"\
@@ -183,6 +198,15 @@
 "                               INT16, UINT16, INT32, UINT32)\n" \
 "                               Default is same as input data type.\n" \
 "    -pf=parameter file         Parameter file\n" \
+"    -stats=report filename     Write per-stage timings (wall and CPU) and\n" \
+"                               counters (input pixels, accumulator\n" \
+"                               updates, patch loads, evictions, bytes\n" \
+"                               spilled) for each SDS/band to a JSON file.\n" \
+"    -ostats=output stats file  Write the minimum, maximum, mean, standard\n" \
+"                               deviation, histogram, valid pixel count and\n" \
+"                               fill fraction of each output SDS/band to a\n" \
+"                               JSON file.  GeoTIFF output always gets these\n" \
+"                               as GDAL statistics metadata.\n" \
 "\n" \
 "Examples:\n" \
 "\n" \
@@ -213,6 +237,8 @@
 "     swath2grid -if=<input file> -of=<output file> -gf=<geolocation file> \n" \
 "            [-off=<output file format (HDF_FMT, GEOTIFF_FMT, RB_FMT)>] \n" \
 "            [-sds=<SDS name>] [-kk=<resampling type (NN, BI, CC)>] \n" \
+"            [-bowtie=<bowtie trimming (NONE, TRIM)>] \n" \
+"            [-pyramid=<number of coarser output levels (0-3)>] \n" \
 "            -oproj=<output projection> \n" \
 "            [-oprm=<output projection parameters>] \n" \
 "            [-opsz=<output pixel sizes>] [-oul=<output upper left corner>]\n" \
@@ -222,6 +248,8 @@
 "            [-osp=<output sphere number>] \n" \
 "            [-oty=<output data type>] \n" \
 "            [-pf=<parameter file>] \n" \
+"            [-stats=<statistics report file>] \n" \
+"            [-ostats=<output statistics file>] \n" \
 " \n" \
 " For more information use \n" \
 "     swath2grid -help \n" \
@@ -0,0 +1,237 @@
+#!/bin/bash
+# Copyright (c) 2011, Brian Case
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+
+###############################################################################
+## @brief benchmark crefl over a synthetic granule
+##
+## @details
+## generates a synthetic MOD021KM/MOD02HKM/MOD02QKM granule and DEM with
+## mkl1b (once, kept in the work dir) and runs crefl in TOA, sealevel and
+## DEM mode with bilinear and nearest upsampling.  each combination is run
+## serially with the exact correction and the scalar code (CREFL_NOSIMD, the
+## reference path), serially with the SIMD code (avx2, the same as the
+## reference on a CPU without AVX2 or a build without CREFL_AVX2), with the
+## atmospheric lookup table (--atmlut, not for TOA) and with threads; the
+## optimized runs are compared to the reference run with crefldiff and the
+## maximum DN difference is recorded.  -r also runs a reference crefl
+## binary (eg. a build of the previous release) and compares its output to
+## the reference path.
+##
+## throughput is in scans/s.  results are printed as a table and written to
+## <workdir>/bench_crefl.csv.  the exit status is 1 if a DN difference is
+## over its limit: -d for the avx2, threaded and reference binary runs
+## (default 0, they should be identical), -a for --atmlut (default 5, the
+## lookup table bound over the MODIS scan, see ATMLUT in crefl.c)
+##
+## usage: bench_crefl.sh [-b bindir] [-w workdir] [-n nscan] [-g georesolution]
+##                       [-B bands] [-j threads] [-r reference crefl]
+##                       [-d max DN difference] [-a max atmlut DN difference]
+##                       [-x "extra crefl options"]
+##
+###############################################################################
+
+bindir="."
+workdir="bench"
+nscan=""
+geores="5"
+bands="1,3,4"
+threads=4
+refcrefl=""
+maxdiff=0
+maxatmdiff=5
+extra=""
+
+while getopts "b:w:n:g:B:j:r:d:a:x:h" opt
+do
+    case $opt in
+        b) bindir="$OPTARG" ;;
+        w) workdir="$OPTARG" ;;
+        n) nscan="$OPTARG" ;;
+        g) geores="$OPTARG" ;;
+        B) bands="$OPTARG" ;;
+        j) threads="$OPTARG" ;;
+        r) refcrefl="$OPTARG" ;;
+        d) maxdiff="$OPTARG" ;;
+        a) maxatmdiff="$OPTARG" ;;
+        x) extra="$OPTARG" ;;
+        *) sed -n '/^## usage/,/^##$/p' "$0" | sed 's/^## //' ; exit 1 ;;
+    esac
+done
+
+mkl1b="${bindir}/mkl1b"
+crefldiff="${bindir}/crefldiff"
+crefl="${bindir}/crefl"
+
+for prog in "$mkl1b" "$crefldiff" "$crefl" $refcrefl
+do
+    if [ ! -x "$prog" ]
+    then
+        echo "bench_crefl: $prog not found, run make first" >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$workdir" || exit 1
+
+###############################################################################
+## @brief run crefl over the benchmark granule
+##
+## @param prog      the crefl binary
+## @param out       the output file
+## @param ...       crefl options
+##
+## @retval stdout   the wall time in seconds
+##
+###############################################################################
+
+run_crefl () {
+    local prog="$1"
+    local out="$2"
+    shift 2
+    local t0 t1
+
+    t0=$(date +%s.%N)
+    CREFL_NOSIMD="$nosimd" ANCPATH="$workdir" \
+        "$prog" "$@" $extra --bands="$bands" --overwrite \
+        --of="$out" $granule > /dev/null 2>&1 || return 1
+    t1=$(date +%s.%N)
+
+    awk "BEGIN { printf \"%.3f\", $t1 - $t0 }"
+}
+
+###############################################################################
+## @brief compare a crefl output file to the reference path output
+##
+## @param out       the output file
+## @param ref       the reference output file
+##
+## @retval stdout   the maximum DN difference and the number of fill
+##                  mismatches
+##
+###############################################################################
+
+max_diff () {
+    "$crefldiff" "$2" "$1" | sed -n 's/^max //p'
+}
+
+id="A2026001.0000"
+granule="${workdir}/MOD021KM.${id}.hdf ${workdir}/MOD02HKM.${id}.hdf ${workdir}/MOD02QKM.${id}.hdf"
+nscan=${nscan:-203}
+
+## the granule is kept between runs, unless it was made with other options
+args="-nscan=$nscan -geores=$geores -id=$id -dem"
+if [ ! -f "${workdir}/MOD021KM.${id}.hdf" ] ||
+   [ "$(cat "${workdir}/mkl1b.args" 2> /dev/null)" != "$args" ]
+then
+    "$mkl1b" $args "$workdir" > /dev/null || exit 1
+    echo "$args" > "${workdir}/mkl1b.args"
+fi
+
+## build the DEM cache and the atmospheric lookup table before timing
+run_crefl "$crefl" "${workdir}/out.hdf" --atmlut > /dev/null || {
+    echo "bench_crefl: crefl failed" >&2
+    exit 1
+}
+
+csv="${workdir}/bench_crefl.csv"
+echo "mode,upsample,variant,wall_s,scans_s,max_dn_diff,fill_mismatch" > "$csv"
+
+printf "%-8s %-8s %-10s %9s %9s %8s %8s\n" \
+       mode upsample variant "wall(s)" "scans/s" maxDN fillDiff
+
+status=0
+
+for mode in toa sealevel dem
+do
+    case $mode in
+        toa)      mopts="--toa" ;;
+        sealevel) mopts="--sealevel" ;;
+        dem)      mopts="" ;;
+    esac
+
+    for upsample in bilinear nearest
+    do
+        uopts=""
+        if [ "$upsample" == "nearest" ]
+        then
+            uopts="--nearest"
+        fi
+
+        variants="reference avx2 threads"
+        if [ "$mode" != "toa" ]
+        then
+            variants="$variants atmlut"
+        fi
+        if [ -n "$refcrefl" ]
+        then
+            variants="$variants refbin"
+        fi
+
+        ref="${workdir}/ref.hdf"
+
+        for variant in $variants
+        do
+            prog="$crefl"
+            out="${workdir}/out.hdf"
+            limit=$maxdiff
+            nosimd=""
+            case $variant in
+                reference) vopts="--threads=1" ; out="$ref" ; nosimd=1 ;;
+                avx2)      vopts="--threads=1" ;;
+                threads)   vopts="--threads=$threads" ;;
+                atmlut)    vopts="--threads=1 --atmlut" ; limit=$maxatmdiff ;;
+                refbin)    vopts="" ; prog="$refcrefl" ;;
+            esac
+
+            wall=$(run_crefl "$prog" "$out" $mopts $uopts $vopts)
+            if [ $? -ne 0 ]
+            then
+                printf "%-8s %-8s %-10s %s\n" $mode $upsample $variant "FAILED"
+                echo "$mode,$upsample,$variant,,,," >> "$csv"
+                status=1
+                continue
+            fi
+            rate=$(awk "BEGIN { printf \"%.2f\", $nscan / ($wall > 0 ? $wall : 0.001) }")
+
+            diff="-"
+            nfill="-"
+            if [ "$variant" != "reference" ]
+            then
+                set -- $(max_diff "$out" "$ref")
+                diff=$1
+                nfill=$2
+                if [ -z "$diff" ] ||
+                   awk "BEGIN { exit !($diff > $limit || $nfill > 0) }"
+                then
+                    status=1
+                fi
+            fi
+
+            printf "%-8s %-8s %-10s %9.3f %9.2f %8s %8s\n" \
+                   $mode $upsample $variant $wall $rate $diff $nfill
+            echo "$mode,$upsample,$variant,$wall,$rate,${diff#-},${nfill#-}" >> "$csv"
+        done
+    done
+done
+
+rm -f "${workdir}/out.hdf" "${workdir}/ref.hdf"
+
+exit $status
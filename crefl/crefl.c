@@ -1,6 +1,6 @@
 /*
 Linux
-  cc -O crefl.c -o crefl -I$HDFINC -L$HDFLIB -lmfhdf -ldf -lz -lm -ljpeg
+  cc -O crefl.c -o crefl -I$HDFINC -L$HDFLIB -lmfhdf -ldf -lz -lm -ljpeg -lpthread
 */
 
 /*************************************************************************
@@ -52,9 +52,26 @@ Revision history:
 #include <math.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mfhdf.h"
+#if defined(CREFL_AVX2) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#undef CREFL_AVX2
+#endif
 
 #define MAXNAMELENGTH 200
+#define BATCHLINELENGTH 4096	/* longest line of a --batch file */
+#define MAXOVERLAYS 2		/* destriped 1KM and HKM files */
+#define BATCHMAXFILES (4 + MAXOVERLAYS)	/* 1KM, HKM, QKM, destriped and output file */
+#define COMPRESS_NONE	0	/* --compress, deflate levels are 1 to 9 */
+#define COMPRESS_SZIP	-1
+#define GZIPLEVEL	4	/* deflate level of --gzip */
 #define Nbands 16
 #define DEG2RAD	0.0174532925199		/* PI/180 */
 #define UO3	0.319
@@ -64,6 +81,7 @@ Revision history:
 #define ANCPATH		"."
 #define DEMFILENAME	"tbase.hdf"
 #define DEMSDSNAME	"Elevation"
+#define DEMCACHEFILENAME	"tbase.dem"
 #define REFSDS	SOLZ
 #define MISSING	-2
 #define SATURATED	-3
@@ -71,10 +89,16 @@ Revision history:
 #define MAXAIRMASS 18
 #define	SCALEHEIGHT 8000
 #define FILL_INT16	-32768
+#define FILL_UINT8	0	/* fill of the --enhance output */
+
+/* Rapid Response true colour stretch, corrected reflectance * 10000 to byte:
+ reflectance 0-1.1 scaled to 0-255 stretched by 0:0,30:110,60:160,120:210,190:240,255:255 */
+#define ENHANCELUT	"0:0,1294:110,2588:160,5176:210,8196:240,11000:255"
 #define	NUM1KMCOLPERSCAN	1354
 #define	NUM1KMROWPERSCAN	10
 #define	TAUSTEP4SPHALB		0.0001
 #define MAXNUMSPHALBVALUES	4000		/* with no aerosol taur <= 0.4 in all bands everywhere */
+#define MAXTHREADS	64
 
 /**************************************************************************//**
  hdf subdataset structure
@@ -101,6 +125,8 @@ typedef struct {
     void *fillvalue;
     float64 factor;
     float64 offset;
+    FILE *fp;		/* raw output file, NULL for HDF */
+    int chunked;	/* non zero if written one chunk per scan */
 } SDS;
 
 /**************************************************************************//**
@@ -117,32 +143,296 @@ enum {BAND1, BAND2, BAND3, BAND4, BAND5, BAND6, BAND7, BAND8, BAND9, BAND10,
 
 enum {INPUT_1KM, INPUT_500M, INPUT_250M, INPUT_UNKNOWN};
 
+/**************************************************************************//**
+ atmospheric correction lookup table
+
+ Tabulates the output of getatmvariables() for all bands on a regular grid
+ of (solar zenith, sensor zenith, height).  The azimuth dependence is kept
+ exact: rhoray is stored as the three coefficients of rhoray = A +
+ B cos(phi+180) + C cos(2 (phi+180)), the form computed by chand().  The
+ ozone and water vapour transmittances only depend on the air mass and are
+ tabulated separately against it.  Values are linearly interpolated, see
+ getatmvariables_lut().
+
+ The zenith grid is uniform in log(sec + tan) of the zenith angle, which
+ keeps the nodes dense where the air mass terms change fastest.  Max.
+ difference from the exact path in corrected reflectance, for reflectances
+ up to 1.6 and heights 0-9000 m, is 2.5e-4 for solar zenith <= 70 and
+ 5.0e-4 up to MAXSOLZ within the MODIS scan (sensor zenith <= 65), i.e. at
+ most 3 and 5 DN of the int16 output (scale factor 0.0001).  Over the whole
+ valid geometry range (1/mus + 1/muv <= MAXAIRMASS) it is 5.0e-4 and 1.1e-3,
+ the larger sensor zeniths being limited by the height grid.
+******************************************************************************/
+
+#define ATMLUTFILENAME	"crefl_atm.lut"
+#define ATMLUT_MAGIC	"CREFLATMLUT1"
+#define ATMLUT_NANGLE	88		/* solar/sensor zenith grid, 0 to ATMLUT_MAXANGLE */
+#define ATMLUT_MAXANGLE	87.0F
+#define ATMLUT_NHEIGHT	19		/* height grid, 0 to ATMLUT_MAXHEIGHT */
+#define ATMLUT_MAXHEIGHT	9000.0F
+#define ATMLUT_NAIRMASS	321		/* air mass grid, 2 to MAXAIRMASS */
+#define ATMLUT_NVAR	5		/* rhoray A, B, C, sphalb, Ttotray */
+
+typedef struct {
+    int nangle;
+    int nheight;
+    int nairmass;
+    float anglestep;	/* in log(sec + tan) of the zenith angle */
+    float heightstep;
+    float airmassstep;
+    int nband;		/* number of bands in the table */
+    int band[Nbands];	/* index of each band in the table, -1 if not processed */
+    float *data;	/* [isolz][isenz][iheight][band][ATMLUT_NVAR] */
+    float *gas;		/* [iairmass][band][tOG, tH2O] */
+} ATMLUT;
+
+/**************************************************************************//**
+ DEM, tiled and memory mapped from the DEM cache file
+
+ The global DEM is converted once from DEMFILENAME into DEMCACHEFILENAME in
+ the same directory: a DEMCACHE_HDRSIZE byte header followed by the DEM in
+ square tiles of DEMTILESIZE x DEMTILESIZE int16, row of tiles by row of
+ tiles, edge tiles padded.  The cache is mapped read only and shared, so
+ only the tiles a granule touches are read and concurrent crefl processes
+ share the pages.  The cache is rebuilt when the DEM file size or
+ modification time changes, see open_dem().
+******************************************************************************/
+
+#define DEMCACHE_MAGIC	"CREFLDEMTILES1"
+#define DEMCACHE_HDRSIZE	4096		/* keeps the tiles page aligned */
+#define DEMTILESHIFT	8
+#define DEMTILESIZE	(1 << DEMTILESHIFT)	/* rows and columns per tile */
+
+typedef struct {
+    char magic[16];
+    int32 Nl;
+    int32 Np;
+    int32 tilesize;
+    int32 reserved;
+    float64 demsize;	/* DEM file size and modification time */
+    float64 demmtime;
+} DEMCACHEHEADER;
+
+typedef struct {
+    int Nl;
+    int Np;
+    int ntilecols;	/* tiles per row of tiles */
+    int16 *tiles;	/* [itile][row in tile][col in tile] */
+    void *map;		/* cache file mapping, NULL if the tiles are in memory */
+    size_t maplen;
+} DEM;
+
+#define DEMVALUE(dem, row, col) \
+    ((dem)->tiles[((((row) >> DEMTILESHIFT) * (dem)->ntilecols + ((col) >> DEMTILESHIFT)) << (2 * DEMTILESHIFT)) + \
+                  (((row) & (DEMTILESIZE - 1)) << DEMTILESHIFT) + ((col) & (DEMTILESIZE - 1))])
+
+/**************************************************************************//**
+ upsampling kernel from the 1km grid to an output band grid
+
+ The coarse pixels and weights of the bilinear interpolation only depend on
+ the output row and column and on the aggregation factor, so they are
+ computed once per band instead of for each pixel, see init_upsample().
+******************************************************************************/
+
+typedef struct {
+    int aggfactor;
+    int *crsrow;	/* [irow] coarse row containing the output row */
+    int *crsrow1;	/* [irow] coarse rows bracketing the output row */
+    int *crsrow2;
+    float *t;		/* [irow] row interpolation weight */
+    int *crscol;	/* [jcol] coarse column containing the output column */
+    int *crscol1;	/* [jcol] coarse columns bracketing the output column */
+    int *crscol2;
+    float *u;		/* [jcol] column interpolation weight */
+} UPSAMPLE;
+
+/**************************************************************************//**
+ atmospheric variables interpolated to one output row, see interp_row()
+
+******************************************************************************/
+
+typedef struct {
+    float *mus;
+    float *rhoray;
+    float *sphalb;
+    float *TtotraytH2O;
+    float *tOG;
+    unsigned char *ok;	/* 0 if the output pixel was already set to a fill value */
+} ROWBUF;
+
+/**************************************************************************//**
+ scan buffers, one set for each scan in the pipeline
+
+******************************************************************************/
+
+enum {SCAN_FREE, SCAN_READ, SCAN_BUSY, SCAN_DONE};
+
+typedef struct {
+    int state;		/* SCAN_FREE, SCAN_READ (read, waiting for a worker),
+                           SCAN_BUSY (being processed) or SCAN_DONE (waiting to be written) */
+    int nactive;	/* number of 1km pixels to correct, with a region of
+                           interest the bands are not read if 0, see load_scan() */
+    void *data[Nitems];	/* input scan data */
+    unsigned char *roimask;	/* 1km pixels in the region, NULL without one */
+    float *mus;
+    int16 *height;
+    float *rhoray;	/* [idx][band] */
+    float *sphalb;
+    float *TtotraytH2O;
+    float *tOG;
+    void *outdata[Nbands];	/* output scan data */
+    ROWBUF row;
+} SCANBUF;
+
+/**************************************************************************//**
+ settings and tables shared by all scans, read only while processing
+
+******************************************************************************/
+
+typedef struct {
+    SDS *sds;
+    SDS *outsds;
+    DEM *dem;
+    unsigned char *process;
+    int sealevel;
+    int TOA;
+    int nearest;
+    int atmlut;
+    ATMLUT *lut;
+    UPSAMPLE *upsample;
+    float maxsolz;
+    float reflmin;
+    float reflmax;
+    int roi;		/* non zero to only correct the pixels in the region */
+    float roilon1;	/* west, east, south and north of the region; the */
+    float roilon2;	/* region crosses the date line if roilon1 > roilon2 */
+    float roilat1;
+    float roilat2;
+    unsigned char *enhance;	/* corrected reflectance + 32768 to byte, NULL if no --enhance */
+    char *enhancelut;	/* the --enhance lookup table */
+    int verbose;
+} CREFL;
+
+/**************************************************************************//**
+ scan pipeline for --threads: a reader thread, worker threads and the
+ writer (main thread) hand the scan buffers round in scan order
+
+******************************************************************************/
+
+typedef struct {
+    CREFL *cr;
+    SCANBUF *scan;	/* scan buffers, scan iscan uses scan[iscan % nbuf] */
+    int nbuf;
+    int Nscans;		/* scans to process, lowered if a scan can't be read */
+    int next;		/* next scan to be processed by a worker */
+    int verbose;
+    pthread_mutex_t lock;	/* protects the above and the buffer states */
+    pthread_cond_t cond;	/* signaled when a buffer state changes */
+    pthread_mutex_t hdflock;	/* serializes the HDF calls */
+} PIPELINE;
+
+/**************************************************************************//**
+ output options, the same for all granules
+
+******************************************************************************/
+
+typedef struct {
+    int output500m;
+    int output1km;
+    int overwrite;
+    int append;
+    int compress;	/* COMPRESS_NONE, COMPRESS_SZIP or deflate level 1-9 */
+    int raw;		/* non zero for raw files with ENVI headers instead of HDF */
+} OUTOPT;
+
+/**************************************************************************//**
+ files, SDSs and buffers of the granule being corrected
+
+******************************************************************************/
+
+typedef struct {
+    int32 MOD021KMfile_id;	/* -1 if not open */
+    int32 MOD02HKMfile_id;
+    int32 MOD02QKMfile_id;
+    int32 sd_id;		/* output file */
+    int32 overlay_id[MAXOVERLAYS];	/* destriped files, see select_overlay() */
+    char *overlay_file[MAXOVERLAYS];
+    int noverlays;
+    SDS sds[Nitems];
+    SDS outsds[Nbands];
+    unsigned char process[Nbands];
+    UPSAMPLE upsample[Nbands];
+    SCANBUF *scan;
+    int nbuf;
+    int maxNp;
+    int Nscans;
+} GRANULE;
+
 
 
 void usage(void);
 int input_file_type(char *file);
+int select_overlay(GRANULE *g, SDS *sds);
+void ancillary_file(char *filename, char *name);
 int parse_bands(char *bandstr, unsigned char process[Nbands]);
 int range_check(float x, float xmin, float xmax);
 
 void set_dimnames(int samples, char **dimname1, char **dimname2);
 
 int init_output_sds(int32 sd_id, unsigned char *process, SDS outsds[Nbands], SDS sds[Nitems],
-                    int gzip, int verbose);
-int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands]);
-int read_scan(int iscan, SDS sds[Nitems]);
+                    int compress, char *enhancelut, int verbose);
+int init_output_raw(char *filename, unsigned char *process, SDS outsds[Nbands], SDS sds[Nitems],
+                    int overwrite, char *enhancelut, int verbose);
+int parse_compress(char *str, int *compress);
+int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands], void *data[Nbands]);
+int read_scan(int iscan, SDS sds[Nitems], void *data[Nitems], int item1, int item2,
+              int crscol1, int crscol2);
 int write_global_attributes(int32 sd_id, char *MOD021KMfile,
                             char *MOD02HKMfile, char *MOD02QKMfile, float maxsolz,
-                            int sealevel, int TOA, int nearest);
+                            int sealevel, int TOA, int nearest, int atmlut);
 
 int getatmvariables(float mus, float muv, float phi, int16 height,
                     unsigned char *process, float *sphalb, float *rhoray, float *TtotraytH2O, float *tOG);
+void atmvariables(float mus, float muv, float phi, int16 height,
+                  unsigned char *process, float *sphalb, float *rhoray, float *TtotraytH2O, float *tOG);
+void gasabsorption(double m, int ib, double *tO3, double *tH2O);
+int getatmvariables_lut(ATMLUT *lut, float mus, float muv, float phi, int16 height,
+                        unsigned char *process, float *sphalb, float *rhoray, float *TtotraytH2O, float *tOG);
+int init_atmlut(ATMLUT *lut, char *filename, unsigned char *process, int verbose);
+void free_atmlut(ATMLUT *lut);
 void chand(float phi, float muv, float mus, float *tau, float *rhoray, float *trup,
            float *trdown, unsigned char *process);
 float csalbr(float tau);
 double fintexp1(float tau);
 double fintexp3(float tau);
 float correctedrefl(float refl, float TtotraytH2O, float tOG, float rhoray, float sphalb);
-int interp_dem(float lat, float lon, SDS *dem);
+int interp_dem(float lat, float lon, DEM *dem);
+int open_dem(DEM *dem, char *filename, char *cachefile, int verbose);
+void close_dem(DEM *dem);
+int init_upsample(UPSAMPLE *up, int aggfactor, int rowsperscan, int Np, int crsrowsperscan, int crsNp);
+void free_upsample(UPSAMPLE *up);
+void interp_row(UPSAMPLE *up, int irow, int Np, int crsNp, int ib, int nearest, int TOA,
+                int16 *solz, int16 solzfill, unsigned char *roimask, float *mus, float *rhoray, float *sphalb,
+                float *TtotraytH2O, float *tOG, int16 *l1bdata, int16 outfill,
+                int16 *out, ROWBUF *row);
+void correct_row(int Np, int TOA, int16 *l1bdata, double offset, double factor,
+                 ROWBUF *row, float reflmin, float reflmax, double outfactor, int16 *out);
+int alloc_scanbuf(SCANBUF *buf, CREFL *cr, int maxNp);
+void free_scanbuf(SCANBUF *buf, CREFL *cr);
+int mask_scan(CREFL *cr, SCANBUF *buf, int *crscol1, int *crscol2);
+int load_scan(CREFL *cr, int iscan, SCANBUF *buf);
+void process_scan(CREFL *cr, SCANBUF *buf);
+int init_enhance(unsigned char **enhance, char *lutstr);
+void enhance_scan(CREFL *cr, SCANBUF *buf);
+int run_pipeline(CREFL *cr, SCANBUF *scan, int nthreads, int Nscans, int verbose);
+int crefl_granule(CREFL *settings, OUTOPT *opt, char **infiles, int ninfiles, char *filename,
+                  int nthreads);
+void init_granule(GRANULE *g, CREFL *cr, CREFL *settings);
+int open_granule(GRANULE *g, CREFL *cr, OUTOPT *opt, char **infiles, int ninfiles, char *filename);
+int process_granule(GRANULE *g, CREFL *cr, int nthreads);
+void close_granule(GRANULE *g, CREFL *cr);
+int crefl_batch(CREFL *settings, OUTOPT *opt, char *batchfile, int nthreads);
+
 
 /******************************************************************************
 
@@ -151,109 +441,58 @@ main
 
 int main(int argc, char *argv[])
 {
-    char *MOD021KMfile, *MOD02HKMfile, *MOD02QKMfile;
     char *filename;	/* output file */
+    char *batchfile;	/* list of granules */
+    char *enhancelut;	/* lookup table for 8-bit output */
 
-    FILE *fp;
-    int outfile_exists;
-
-    char *ancpath;
-    SDS sds[Nitems], outsds[Nbands], dem, height;
-    int32 MOD02QKMfile_id, MOD02HKMfile_id, MOD021KMfile_id;
-    int32 sd_id, attr_index, count, num_type;
-
-    int ib, j, iscan, Nscans, irow, jcol, idx, crsidx;
-    int nbands;
-
-    char *SDSlocatorQKM[Nitems] = {"EV_250_RefSB", "EV_250_RefSB",
-        "EV_500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
-        "EV_500_RefSB", "EV_500_RefSB","EV_1KM_RefSB", "EV_1KM_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
-        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
-        "Latitude"};
-
-    char *SDSlocatorHKM[Nitems] = {"EV_250_Aggr500_RefSB",
-        "EV_250_Aggr500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
-        "EV_500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
-        "EV_1KM_RefSB","EV_1KM_RefSB","EV_1KM_RefSB",
-        "EV_1KM_RefSB","EV_1KM_RefSB","EV_1KM_RefSB", "EV_1KM_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
-        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
-        "Latitude"};
-
-    char *SDSlocator1KM[Nitems] = {"EV_250_Aggr1km_RefSB",
-        "EV_250_Aggr1km_RefSB", "EV_500_Aggr1km_RefSB",
-        "EV_500_Aggr1km_RefSB", "EV_500_Aggr1km_RefSB",
-        "EV_500_Aggr1km_RefSB",  "EV_500_Aggr1km_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB",
-        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
-        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
-        "Latitude"};
+    DEM dem;
 
-    char indexlocator[Nitems] = {0, 1, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 5, 7,
-        9, 10, 0, 0, 0, 0, 0, 0};
-
-    char numtypelocator[Nitems] = {DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
-        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
-        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
-        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
-        DFNT_UINT16, DFNT_INT16, DFNT_INT16, DFNT_INT16, DFNT_INT16,
-        DFNT_FLOAT32, DFNT_FLOAT32};
-
-    int16 *l1bdata[Nbands], *sola, *solz, *sena, *senz, *solzfill;
-    float32 *lon, *lat, *lonfill, *latfill;
-    char *attr_name;
-    float64 scale_factor[Nitems], add_offset[Nitems];
+    int ib, nbands, status;
 
     unsigned char process[Nbands];
 
-    float refl, *mus, muv, phi;
-    float *rhoray, *sphalb, *TtotraytH2O, *tOG;
-    int aggfactor, crsrow1, crsrow2, crscol1, crscol2;
-    int crsidx11, crsidx12, crsidx21, crsidx22;
-    float mus0, mus11, mus12, mus21, mus22;
-    float fractrow, fractcol, t, u;
-    float rhoray0, rhoray11, rhoray12, rhoray21, rhoray22;
-    float sphalb0, sphalb11, sphalb12, sphalb21, sphalb22;
+    CREFL cr;
+    OUTOPT opt;
+    int nthreads = 1, compress = COMPRESS_NONE;
     float reflmin=REFLMIN, reflmax=REFLMAX, maxsolz=MAXSOLZ;
-    int bad;
-
-    int write_mode = DFACC_CREATE;
-
-    int st;
-
-    size_t nbytes;
-
-    int ftype;
+    float roi[4];
+    int userroi = 0;
 
     extern char *optarg;
     extern int optind, opterr;
     int option_index = 0;
 
     static int verbose, overwrite;
-    static int gzip, append;
+    static int gzip, append, raw;
 
     static int output500m, output1km;
-    static int sealevel, TOA, nearest;
+    static int sealevel, TOA, nearest, atmlut;
+    static int buildcache;
+    ATMLUT lut;
 
-    char dummy[MAX_NC_NAME];
-
-    enum{OPT_BANDS = 1, OPT_RANGE, OPT_OUTFILE, OPT_MAXSOLZ};
+    enum{OPT_BANDS = 1, OPT_RANGE, OPT_OUTFILE, OPT_MAXSOLZ, OPT_THREADS, OPT_ROI,
+        OPT_BATCH, OPT_ENHANCE, OPT_COMPRESS};
 
     static struct option long_options[] = {
         {"1km",		no_argument,		&output1km, 1},
         {"500m",	no_argument,		&output500m, 1},
         {"append",	no_argument,		&append, 1},
+        {"atmlut",	no_argument,		&atmlut, 1},
         {"bands",	required_argument,	(int *) NULL, OPT_BANDS},
+        {"build-cache",	no_argument,		&buildcache, 1},
+        {"compress",	required_argument,	(int *) NULL, OPT_COMPRESS},
+        {"batch",	required_argument,	(int *) NULL, OPT_BATCH},
+        {"enhance",	optional_argument,	(int *) NULL, OPT_ENHANCE},
         {"gzip",	no_argument,		&gzip,	1},
         {"maxsolz",	required_argument,	(int *) NULL, OPT_MAXSOLZ},
         {"nearest",	no_argument,		&nearest, 1},
         {"of",		required_argument,	(int *) NULL, OPT_OUTFILE},
         {"overwrite",	no_argument,		&overwrite, 1},
         {"range",	required_argument,	(int *) NULL, OPT_RANGE},
+        {"raw",		no_argument,		&raw, 1},
+        {"roi",		required_argument,	(int *) NULL, OPT_ROI},
         {"sealevel",	no_argument,		&sealevel, 1},
+        {"threads",	required_argument,	(int *) NULL, OPT_THREADS},
         {"toa",		no_argument,		&TOA, 1},
         {"verbose",	no_argument,		&verbose, 1},
         {(char *) NULL, 0, (int *) NULL, 0}
@@ -262,16 +501,18 @@ int main(int argc, char *argv[])
     int c;
 
     static char dem_filename_buff[MAXNAMELENGTH];
+    static char demcache_filename_buff[MAXNAMELENGTH];
+    static char atmlut_filename_buff[MAXNAMELENGTH];
 
 
-    MOD021KMfile = MOD02HKMfile = MOD02QKMfile = (char *) NULL;
-    filename = (char *) NULL;
+    filename = batchfile = enhancelut = (char *) NULL;
 
     for (ib = 0; ib < Nbands; ib++) process[ib] = FALSE;
 
     /* default settings */
     output500m = output1km = 0;
-    append = gzip = nearest = sealevel = TOA = verbose = overwrite = 0;
+    append = gzip = raw = nearest = sealevel = TOA = verbose = overwrite = atmlut = 0;
+    buildcache = 0;
 
 
     while ((c = getopt_long(argc, argv, "", long_options,
@@ -321,16 +562,77 @@ int main(int argc, char *argv[])
                 filename = optarg;
                 break;
 
+            case OPT_BATCH:
+                batchfile = optarg;
+                break;
+
+            case OPT_COMPRESS:
+                if (parse_compress(optarg, &compress)) {
+                    fputs("Invalid compression, use none, deflate[:level] or szip.\n", stderr);
+                    exit(1);
+                }
+                break;
+
+            case OPT_ENHANCE:
+                enhancelut = optarg ? optarg : ENHANCELUT;
+                break;
+
+            case OPT_ROI:
+                if (sscanf(optarg, "%g,%g,%g,%g", &roi[0], &roi[1], &roi[2], &roi[3]) != 4) {
+                    fputs("Error parsing region of interest.\n", stderr);
+                    exit(1);
+                }
+
+                if ( range_check(roi[0], -180.0F, 180.0F) ||
+                    range_check(roi[1], -90.0F, 90.0F) ||
+                    range_check(roi[2], -180.0F, 180.0F) ||
+                    range_check(roi[3], -90.0F, 90.0F) ||
+                    (roi[1] >= roi[3]) ) {
+                        fputs("Invalid region of interest.\n", stderr);
+                        exit(1);
+                    }
+
+                printf("Region of interest lon [%g,%g] lat [%g,%g] requested.\n",
+                       roi[0], roi[2], roi[1], roi[3]);
+                userroi = 1;
+                break;
+
+            case OPT_THREADS:
+                nthreads = atoi(optarg);
+                if (nthreads < 1 || nthreads > MAXTHREADS) {
+                    fprintf(stderr, "Invalid number of threads (1-%d).\n", MAXTHREADS);
+                    exit(1);
+                }
+                break;
+
             default:
                 usage();
                 exit(1);
         }
     }
-    
-    if (append) write_mode = DFACC_RDWR;
 
-    /* at least one input file must follow */
-    if (optind >= argc) {
+    /* build the DEM cache and the atmospheric lookup table for all bands,
+       e.g. at install time, instead of on first use */
+    if (buildcache) {
+        for (ib = 0; ib < Nbands; ib++) process[ib] = TRUE;
+        ancillary_file(dem_filename_buff, DEMFILENAME);
+        ancillary_file(demcache_filename_buff, DEMCACHEFILENAME);
+        ancillary_file(atmlut_filename_buff, ATMLUTFILENAME);
+
+        dem.tiles = (int16 *) NULL;
+        dem.map = NULL;
+        status = open_dem(&dem, dem_filename_buff, demcache_filename_buff, verbose)  ||  !dem.map;
+        if (dem.tiles) close_dem(&dem);
+
+        if (init_atmlut(&lut, atmlut_filename_buff, process, verbose)) exit(1);
+        free_atmlut(&lut);
+        if (access(atmlut_filename_buff, R_OK) != 0) status = 1;
+
+        return status;
+    }
+
+    /* at least one input file must follow, unless a batch file is given */
+    if (!batchfile && optind >= argc) {
         usage();
         exit(1);
     }
@@ -347,6 +649,13 @@ int main(int argc, char *argv[])
               stderr);
         exit(1);
     }
+    if (raw && append) {
+        fputs("Options --raw and --append are mutually exclusive.\n",
+              stderr);
+        exit(1);
+    }
+    if (gzip && compress == COMPRESS_NONE) compress = GZIPLEVEL;
+    if (raw) compress = COMPRESS_NONE;
 
 #ifdef DEBUG
     printf("append = %d\n", append);
@@ -364,72 +673,33 @@ int main(int argc, char *argv[])
 
 
     if (verbose) puts("Verbose mode requested.");
+    if (batchfile) printf("Correcting the granules listed in %s.\n", batchfile);
     if (overwrite) puts("Overwriting existing output file.");
-    if (gzip) puts("Gzip compression requested.");
+    if (nthreads > 1) printf("Processing with %d worker threads.\n", nthreads);
+    if (compress == COMPRESS_SZIP) puts("Szip compression requested.");
+    else if (compress != COMPRESS_NONE) printf("Deflate compression level %d requested.\n", compress);
+    if (raw) puts("Raw output with ENVI headers requested.");
     if (sealevel) puts("Sea-level atmospheric correction requested. Terrain height ignored.");
     if (TOA) puts("Top-of-the-atmosphere reflectance requested. No atmospheric correction.");
     if (output1km) puts("1km-resolution output requested.");
     if (nearest) puts("Interpolation disabled.");
+    if (atmlut && !TOA) puts("Atmospheric lookup table requested.");
+    if (enhancelut) printf("8-bit output enhanced with lookup table %s requested.\n", enhancelut);
 
 
 
-    /* parse input file names */
-    for (j = optind; j < argc; j++) {
-        ftype = input_file_type(argv[j]);
-
-        switch (ftype) {
-            case INPUT_1KM:
-                MOD021KMfile = argv[j];
-                break;
-
-            case INPUT_500M:
-                MOD02HKMfile = argv[j];
-                break;
-
-            case INPUT_250M:
-                MOD02QKMfile = argv[j];
-                break;
-
-            default:
-                fprintf(stderr,
-                        "Unrecognized input file \"%s\".\n",
-                        argv[j]);
-                exit(1);
-                break;
+    /* output file name is mandatory, unless read from the batch list */
+    if (batchfile) {
+        if (filename || optind < argc) {
+            fputs("Option --batch excludes input files and --of.\n", stderr);
+            exit(1);
         }
     }
-
-
-
-    if (verbose && MOD021KMfile)
-        printf("Input geolocation file: %s\n", MOD021KMfile);
-
-
-    /* output file name is mandatory */
-    if (!filename) {
+    else if (!filename) {
         fputs("Missing output file name.\n", stderr);
         exit(1);
     }
 
-#ifdef DEBUG
-    if (MOD021KMfile) printf("MOD/MYD021KMfile = %s\n", MOD021KMfile);
-    if (MOD02HKMfile) printf("MOD/MYD02HKMfile = %s\n", MOD02HKMfile);
-    if (MOD02QKMfile) printf("MOD/MYD02QKMfile = %s\n", MOD02QKMfile);
-#endif
-
-
-        /*
-         1KM file is mandatory for angles.
-         HKM file is mandatory unless 1-km output is requested.
-         QKM file is mandatory unless 500-m or 1-km output is requested.
-         */
-        if ( (!MOD021KMfile) ||
-            (!MOD02HKMfile && !output1km) ||
-            (!MOD02QKMfile && !output500m && !output1km) ) {
-                fputs("Invalid combination of input files.\n", stderr);
-                exit(1);
-            }
-
 
     /* count number of bands to process */
     for (ib = nbands = 0; ib < Nbands; ib++) if (process[ib]) nbands++;
@@ -440,102 +710,367 @@ int main(int argc, char *argv[])
     }
 
 
-    /* open input files */
-    if ( MOD02QKMfile && (!output500m)  &&
-        !output1km &&
-        (MOD02QKMfile_id = SDstart(MOD02QKMfile, DFACC_READ)) == -1 ) {
-            fprintf(stderr, "Cannot open input file %s.\n", MOD02QKMfile);
-            exit(1);
-        }
-    if ( MOD02HKMfile && (!output1km) &&
-        (MOD02HKMfile_id = SDstart(MOD02HKMfile, DFACC_READ)) == -1 ) {
-            fprintf(stderr, "Cannot open input file %s.\n", MOD02HKMfile);
-            exit(1);
-        }
-    if ( MOD021KMfile &&
-        (MOD021KMfile_id = SDstart(MOD021KMfile, DFACC_READ)) == -1 ) {
-            fprintf(stderr, "Cannot open input file %s.\n", MOD021KMfile);
-            exit(1);
-        }
+    /* the DEM cache is kept next to the DEM */
+    dem.tiles = (int16 *) NULL;
+    if (!sealevel && !TOA) {
+        ancillary_file(dem_filename_buff, DEMFILENAME);
+        ancillary_file(demcache_filename_buff, DEMCACHEFILENAME);
 
+        if (open_dem(&dem, dem_filename_buff, demcache_filename_buff, verbose)) exit(1);
+    }
 
-    if (!sealevel && !TOA) {
-        dem.filename = dem_filename_buff;
 
-        if ((ancpath = getenv("ANCPATH")) == NULL) {
-#ifdef CREFL_DATA_DIR
-            sprintf(dem.filename, "%s/%s", CREFL_DATA_DIR, DEMFILENAME);
-#else            
-            sprintf(dem.filename, "%s/%s", ANCPATH, DEMFILENAME);
-#endif
-        }
+    /* the atmospheric lookup table is cached next to the DEM */
+    if (atmlut && !TOA) {
+        ancillary_file(atmlut_filename_buff, ATMLUTFILENAME);
 
-        else
-            sprintf(dem.filename, "%s/%s", ancpath, DEMFILENAME);
+        if (init_atmlut(&lut, atmlut_filename_buff, process, verbose)) exit(1);
+    }
 
 
-        if ( (dem.file_id = SDstart(dem.filename, DFACC_READ)) == -1 ) {
-            fprintf(stderr, "Cannot open file %s.\n", dem.filename);
-            exit(1);
-        }
+    /* piecewise linear enhancement to bytes */
+    cr.enhance = (unsigned char *) NULL;
+    cr.enhancelut = enhancelut;
+    if (enhancelut && init_enhance(&cr.enhance, enhancelut)) {
+        fputs("Invalid enhancement lookup table.\n", stderr);
+        exit(1);
     }
 
 
-    if ( (fp = fopen(filename, "r")) ) {
-        (void) fclose(fp);
-        outfile_exists = 1;
+    /* settings shared by all granules; the granule's SDSs are set by crefl_granule() */
+    cr.sds = cr.outsds = (SDS *) NULL;
+    cr.upsample = (UPSAMPLE *) NULL;
+    cr.dem = &dem;
+    cr.process = process;
+    cr.sealevel = sealevel;
+    cr.TOA = TOA;
+    cr.nearest = nearest;
+    cr.atmlut = atmlut;
+    cr.lut = &lut;
+    cr.maxsolz = maxsolz;
+    cr.reflmin = reflmin;
+    cr.reflmax = reflmax;
+    cr.roi = userroi;
+    if (userroi) {
+        cr.roilon1 = roi[0];
+        cr.roilat1 = roi[1];
+        cr.roilon2 = roi[2];
+        cr.roilat2 = roi[3];
     }
+    cr.verbose = verbose;
+
+    opt.output500m = output500m;
+    opt.output1km = output1km;
+    opt.overwrite = overwrite;
+    opt.append = append;
+    opt.compress = compress;
+    opt.raw = raw;
+
+    if (batchfile)
+        status = crefl_batch(&cr, &opt, batchfile, nthreads);
     else
-        outfile_exists = 0;
+        status = crefl_granule(&cr, &opt, &argv[optind], argc - optind, filename, nthreads);
 
-    if ((write_mode == DFACC_CREATE)  &&  !overwrite  && outfile_exists) {
-        fprintf(stderr, "File \"%s\" already exits.\n", filename);
-        exit(1);
-    }
 
-    if (output500m) {
-        sds[BAND1].file_id = sds[BAND2].file_id = MOD02HKMfile_id;
-        sds[BAND1].filename = sds[BAND2].filename = MOD02HKMfile;
-    }
-    else {
-        if (output1km) {
-            sds[BAND1].file_id = sds[BAND2].file_id = MOD021KMfile_id;
-            sds[BAND1].filename = sds[BAND2].filename = MOD021KMfile;
-        }
-        else {
-            sds[BAND1].file_id = sds[BAND2].file_id = MOD02QKMfile_id;
-            sds[BAND1].filename = sds[BAND2].filename = MOD02QKMfile;
-        }
-    }
+    /* ----- free memory ----- */
 
-    if (output1km) {
-        sds[BAND3].file_id = sds[BAND4].file_id =
-            sds[BAND5].file_id = sds[BAND6].file_id =
-            sds[BAND7].file_id = MOD021KMfile_id;
-        sds[BAND3].filename = sds[BAND4].filename =
-            sds[BAND5].filename = sds[BAND6].filename =
-            sds[BAND7].filename = MOD021KMfile;
-    }
-    else {
-        sds[BAND3].file_id = sds[BAND4].file_id =
-            sds[BAND5].file_id = sds[BAND6].file_id =
-            sds[BAND7].file_id = MOD02HKMfile_id;
-        sds[BAND3].filename = sds[BAND4].filename =
-            sds[BAND5].filename = sds[BAND6].filename =
-            sds[BAND7].filename = MOD02HKMfile;
-    }
+    if (!TOA && atmlut) free_atmlut(&lut);
 
-    sds[BAND8].file_id = sds[SOLZ].file_id = sds[SOLA].file_id =
-        sds[SENZ].file_id = sds[SENA].file_id = sds[LON].file_id =
-        sds[LAT].file_id = MOD021KMfile_id;
-    sds[BAND8].filename = sds[SOLZ].filename = sds[SOLA].filename =
-        sds[SENZ].filename = sds[SENA].filename = sds[LON].filename =
-        sds[LAT].filename = MOD021KMfile;
+    /* not opened if --sealevel or --toa specified */
+    if (dem.tiles) close_dem(&dem);
 
-    sds[BAND9].file_id = sds[BAND10].file_id = sds[BAND11].file_id =
+    if (cr.enhance) free(cr.enhance);
+
+
+    return status;
+}
+
+
+/**************************************************************************//**
+ correct one granule: the input files are the 1KM, HKM and QKM files in
+ any order, the output file is created (or appended to)
+
+ returns 0 on success, non zero on error; the files are closed and the
+ memory released in either case, after run_pipeline() has joined its
+ threads, so a batch can go on with the next granule
+
+******************************************************************************/
+
+int crefl_granule(CREFL *settings,
+                  OUTOPT *opt,
+                  char **infiles,
+                  int ninfiles,
+                  char *filename,
+                  int nthreads)
+{
+    GRANULE g;
+    CREFL cr;
+    int status;
+
+    init_granule(&g, &cr, settings);
+
+    status = open_granule(&g, &cr, opt, infiles, ninfiles, filename);
+    if (!status) status = process_granule(&g, &cr, nthreads);
+
+    close_granule(&g, &cr);
+
+    return status;
+}
+
+
+/**************************************************************************//**
+ initialize a granule and the granule's copy of the settings: nothing is
+ open yet, so close_granule() can be called at any point after this
+
+******************************************************************************/
+
+void init_granule(GRANULE *g, CREFL *cr, CREFL *settings)
+{
+    int ib;
+
+    /* initializing these fields will simplify releasing memory later */
+    g->MOD021KMfile_id = g->MOD02HKMfile_id = g->MOD02QKMfile_id = g->sd_id = -1;
+    g->noverlays = 0;
+    for (ib = 0; ib < Nitems; ib++) {
+        g->sds[ib].id = -1;
+        g->sds[ib].fillvalue = (void *) NULL;
+    }
+    for (ib = 0; ib < Nbands; ib++) {
+        g->outsds[ib].id = -1;
+        g->outsds[ib].name = (char *) NULL;
+        g->outsds[ib].fp = (FILE *) NULL;
+        g->process[ib] = settings->process[ib];
+    }
+    memset(g->upsample, 0, sizeof(g->upsample));
+    g->scan = (SCANBUF *) NULL;
+    g->nbuf = 0;
+
+    /* bands that can't be read are dropped for this granule only */
+    *cr = *settings;
+    cr->sds = g->sds;
+    cr->outsds = g->outsds;
+    cr->process = g->process;
+    cr->upsample = g->upsample;
+}
+
+
+/**************************************************************************//**
+ open the input files and the output file of a granule, set up the input
+ and output SDSs and the upsampling kernels
+
+ returns 0 on success, non zero on error
+
+******************************************************************************/
+
+int open_granule(GRANULE *g,
+                 CREFL *cr,
+                 OUTOPT *opt,
+                 char **infiles,
+                 int ninfiles,
+                 char *filename)
+{
+    char *MOD021KMfile, *MOD02HKMfile, *MOD02QKMfile;
+
+    FILE *fp;
+    int outfile_exists;
+
+    SDS *sds = g->sds, *outsds = g->outsds;
+    unsigned char *process = g->process;
+    int32 attr_index, count, num_type;
+
+    int ib, j;
+    int verbose = cr->verbose;
+    int output500m = opt->output500m, output1km = opt->output1km;
+
+    char *SDSlocatorQKM[Nitems] = {"EV_250_RefSB", "EV_250_RefSB",
+        "EV_500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
+        "EV_500_RefSB", "EV_500_RefSB","EV_1KM_RefSB", "EV_1KM_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
+        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
+        "Latitude"};
+
+    char *SDSlocatorHKM[Nitems] = {"EV_250_Aggr500_RefSB",
+        "EV_250_Aggr500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
+        "EV_500_RefSB", "EV_500_RefSB", "EV_500_RefSB",
+        "EV_1KM_RefSB","EV_1KM_RefSB","EV_1KM_RefSB",
+        "EV_1KM_RefSB","EV_1KM_RefSB","EV_1KM_RefSB", "EV_1KM_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
+        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
+        "Latitude"};
+
+    char *SDSlocator1KM[Nitems] = {"EV_250_Aggr1km_RefSB",
+        "EV_250_Aggr1km_RefSB", "EV_500_Aggr1km_RefSB",
+        "EV_500_Aggr1km_RefSB", "EV_500_Aggr1km_RefSB",
+        "EV_500_Aggr1km_RefSB",  "EV_500_Aggr1km_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB",
+        "EV_1KM_RefSB", "EV_1KM_RefSB", "EV_1KM_RefSB", "SolarZenith",
+        "SensorZenith", "SolarAzimuth", "SensorAzimuth", "Longitude",
+        "Latitude"};
+
+    char indexlocator[Nitems] = {0, 1, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 5, 7,
+        9, 10, 0, 0, 0, 0, 0, 0};
+
+    char numtypelocator[Nitems] = {DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
+        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
+        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
+        DFNT_UINT16, DFNT_UINT16, DFNT_UINT16, DFNT_UINT16,
+        DFNT_UINT16, DFNT_INT16, DFNT_INT16, DFNT_INT16, DFNT_INT16,
+        DFNT_FLOAT32, DFNT_FLOAT32};
+
+    char *attr_name;
+    float64 scale_factor[Nitems], add_offset[Nitems];
+
+    int write_mode = opt->append ? DFACC_RDWR : DFACC_CREATE;
+
+    int ftype;
+
+    char dummy[MAX_NC_NAME];
+
+    int32 overlay_id;
+
+
+    MOD021KMfile = MOD02HKMfile = MOD02QKMfile = (char *) NULL;
+
+    /* parse input file names */
+    for (j = 0; j < ninfiles; j++) {
+        ftype = input_file_type(infiles[j]);
+
+        switch (ftype) {
+            case INPUT_1KM:
+                MOD021KMfile = infiles[j];
+                break;
+
+            case INPUT_500M:
+                MOD02HKMfile = infiles[j];
+                break;
+
+            case INPUT_250M:
+                MOD02QKMfile = infiles[j];
+                break;
+
+            default:
+                /* a file written by modis_destripe -of */
+                if ( g->noverlays < MAXOVERLAYS &&
+                    (overlay_id = SDstart(infiles[j], DFACC_READ)) != -1 ) {
+                    if (SDfindattr(overlay_id, "UW_DESTRIPE") != -1) {
+                        g->overlay_id[g->noverlays] = overlay_id;
+                        g->overlay_file[g->noverlays++] = infiles[j];
+                        if (verbose)
+                            printf("Destriped input file: %s\n", infiles[j]);
+                        break;
+                    }
+                    SDend(overlay_id);
+                }
+                fprintf(stderr,
+                        "Unrecognized input file \"%s\".\n",
+                        infiles[j]);
+                return 1;
+                break;
+        }
+    }
+
+
+
+    if (verbose && MOD021KMfile)
+        printf("Input geolocation file: %s\n", MOD021KMfile);
+
+
+#ifdef DEBUG
+    if (MOD021KMfile) printf("MOD/MYD021KMfile = %s\n", MOD021KMfile);
+    if (MOD02HKMfile) printf("MOD/MYD02HKMfile = %s\n", MOD02HKMfile);
+    if (MOD02QKMfile) printf("MOD/MYD02QKMfile = %s\n", MOD02QKMfile);
+#endif
+
+
+        /*
+         1KM file is mandatory for angles.
+         HKM file is mandatory unless 1-km output is requested.
+         QKM file is mandatory unless 500-m or 1-km output is requested.
+         */
+        if ( (!MOD021KMfile) ||
+            (!MOD02HKMfile && !output1km) ||
+            (!MOD02QKMfile && !output500m && !output1km) ) {
+                fputs("Invalid combination of input files.\n", stderr);
+                return 1;
+            }
+
+
+    /* open input files */
+    if ( MOD02QKMfile && (!output500m)  &&
+        !output1km &&
+        (g->MOD02QKMfile_id = SDstart(MOD02QKMfile, DFACC_READ)) == -1 ) {
+            fprintf(stderr, "Cannot open input file %s.\n", MOD02QKMfile);
+            return 1;
+        }
+    if ( MOD02HKMfile && (!output1km) &&
+        (g->MOD02HKMfile_id = SDstart(MOD02HKMfile, DFACC_READ)) == -1 ) {
+            fprintf(stderr, "Cannot open input file %s.\n", MOD02HKMfile);
+            return 1;
+        }
+    if ( MOD021KMfile &&
+        (g->MOD021KMfile_id = SDstart(MOD021KMfile, DFACC_READ)) == -1 ) {
+            fprintf(stderr, "Cannot open input file %s.\n", MOD021KMfile);
+            return 1;
+        }
+
+
+    if ( !opt->raw && (fp = fopen(filename, "r")) ) {
+        (void) fclose(fp);
+        outfile_exists = 1;
+    }
+    else
+        outfile_exists = 0;
+
+    if ((write_mode == DFACC_CREATE)  &&  !opt->overwrite  && outfile_exists) {
+        fprintf(stderr, "File \"%s\" already exits.\n", filename);
+        return 1;
+    }
+
+    if (output500m) {
+        sds[BAND1].file_id = sds[BAND2].file_id = g->MOD02HKMfile_id;
+        sds[BAND1].filename = sds[BAND2].filename = MOD02HKMfile;
+    }
+    else {
+        if (output1km) {
+            sds[BAND1].file_id = sds[BAND2].file_id = g->MOD021KMfile_id;
+            sds[BAND1].filename = sds[BAND2].filename = MOD021KMfile;
+        }
+        else {
+            sds[BAND1].file_id = sds[BAND2].file_id = g->MOD02QKMfile_id;
+            sds[BAND1].filename = sds[BAND2].filename = MOD02QKMfile;
+        }
+    }
+
+    if (output1km) {
+        sds[BAND3].file_id = sds[BAND4].file_id =
+            sds[BAND5].file_id = sds[BAND6].file_id =
+            sds[BAND7].file_id = g->MOD021KMfile_id;
+        sds[BAND3].filename = sds[BAND4].filename =
+            sds[BAND5].filename = sds[BAND6].filename =
+            sds[BAND7].filename = MOD021KMfile;
+    }
+    else {
+        sds[BAND3].file_id = sds[BAND4].file_id =
+            sds[BAND5].file_id = sds[BAND6].file_id =
+            sds[BAND7].file_id = g->MOD02HKMfile_id;
+        sds[BAND3].filename = sds[BAND4].filename =
+            sds[BAND5].filename = sds[BAND6].filename =
+            sds[BAND7].filename = MOD02HKMfile;
+    }
+
+    sds[BAND8].file_id = sds[SOLZ].file_id = sds[SOLA].file_id =
+        sds[SENZ].file_id = sds[SENA].file_id = sds[LON].file_id =
+        sds[LAT].file_id = g->MOD021KMfile_id;
+    sds[BAND8].filename = sds[SOLZ].filename = sds[SOLA].filename =
+        sds[SENZ].filename = sds[SENA].filename = sds[LON].filename =
+        sds[LAT].filename = MOD021KMfile;
+
+    sds[BAND9].file_id = sds[BAND10].file_id = sds[BAND11].file_id =
         sds[BAND12].file_id = sds[BAND13].file_id =
         sds[BAND14].file_id = sds[BAND15].file_id =
-        sds[BAND16].file_id = MOD021KMfile_id;
+        sds[BAND16].file_id = g->MOD021KMfile_id;
     sds[BAND9].filename = sds[BAND10].filename = sds[BAND11].filename =
         sds[BAND12].filename = sds[BAND13].filename =
         sds[BAND14].filename = sds[BAND15].filename =
@@ -583,6 +1118,9 @@ int main(int argc, char *argv[])
             continue;
         }
 
+        if (ib < Nbands && select_overlay(g, &sds[ib]) && verbose)
+            printf("SDS \"%s\" read from destriped file %s\n", sds[ib].name, sds[ib].filename);
+
 
         sds[ib].factor = 1;
         attr_name = "reflectance_scales";
@@ -616,7 +1154,7 @@ int main(int argc, char *argv[])
         sds[ib].fillvalue = (void *) malloc(1 * DFKNTsize(sds[ib].num_type));
         if ( SDgetfillvalue(sds[ib].id, sds[ib].fillvalue) != 0 ) {
             fprintf(stderr, "Cannot read fill value of SDS \"%s\".\n", sds[ib].name);
-            exit(1);
+            return 1;
         }
 
         switch (sds[ib].rank) {
@@ -646,41 +1184,8 @@ int main(int argc, char *argv[])
             printf("SDS \"%s\": %dx%d   scale factor: %g  offset: %g\n", sds[ib].name, sds[ib].Np, sds[ib].Nl, sds[ib].factor, sds[ib].offset);
         if (sds[ib].num_type != numtypelocator[ib]) {
             fprintf(stderr, "SDS \"%s\" has not the expected data type.\n", sds[ib].name);
-            exit(-1);
-        }
-        sds[ib].data = malloc(sds[ib].Np * sds[ib].rowsperscan * DFKNTsize(sds[ib].num_type));
-        if (!sds[ib].data) {
-            (void) fputs("Error allocating memory.\n", stderr);
-            exit(1);
-        }
-    }
-
-    if (sealevel || TOA) {
-        dem.id = -1;
-        dem.Nl = dem.Np = 0;
-    }
-    else {
-        /* dem.name = strdup(DEMSDSNAME); */
-        dem.name = DEMSDSNAME;
-
-        if ( (dem.index = SDnametoindex(dem.file_id, dem.name)) == -1 ) {
-            fprintf(stderr, "Cannot find SDS %s in file %s.\n", dem.name, dem.filename);
-            exit(1);
-        }
-
-        if ( (dem.id = SDselect(dem.file_id, dem.index)) == -1 ) {
-            fprintf(stderr, "Cannot select SDS no. %d\n", dem.index);
-            exit(1);
-        }
-        if (SDgetinfo(dem.id, dummy, &dem.rank, dem.dim_sizes, &dem.num_type, &dem.n_attr) == -1) {
-            fprintf(stderr, "Can't get info from SDS \"%s\" in file %s.\n", dem.name, dem.filename);
-            SDendaccess(dem.id);
-            exit(1);
+            return 1;
         }
-
-        dem.Nl = dem.dim_sizes[0];
-        dem.Np = dem.dim_sizes[1];
-        dem.rowsperscan = (int)(NUM1KMROWPERSCAN * dem.Np / (float)NUM1KMCOLPERSCAN + 0.5);
     }
 
     if ( sds[SOLZ].id == -1 ||
@@ -688,10 +1193,9 @@ int main(int argc, char *argv[])
         sds[SENZ].id == -1 ||
         sds[SENA].id == -1 ||
         sds[LON].id == -1 ||
-        sds[LAT].id == -1 ||
-        ((dem.id == -1) && !sealevel && !TOA) ) {
+        sds[LAT].id == -1 ) {
             fprintf(stderr, "Solar and Sensor angles and DEM are necessary to process granule.\n");
-            exit(1);
+            return 1;
         }
 
     if ( sds[REFSDS].Np != sds[SOLZ].Np ||
@@ -701,287 +1205,224 @@ int main(int argc, char *argv[])
         sds[REFSDS].Np != sds[LON].Np ||
         sds[REFSDS].Np != sds[LAT].Np ) {
             fprintf(stderr, "Solar and Sensor angles must have identical dimensions.\n");
-            exit(1);
+            return 1;
         }
 
     ib = 0;
     while (sds[ib].id == -1) ib++;
     if (ib >= Nbands) {
         fprintf(stderr, "No L1B SDS can be read successfully.\n");
-        exit(1);
+        return 1;
     }
 
-    Nscans = sds[ib].Nl / sds[ib].rowsperscan;
+    g->Nscans = sds[ib].Nl / sds[ib].rowsperscan;
 
 
     /* finally, open output file */
-    if ( (sd_id = SDstart(filename, write_mode)) == -1 ) {
-        fprintf(stderr, "Cannot open output file %s.\n", filename);
-        exit(1);
+    if (opt->raw) {
+        /* one raw file per band, named after the output file */
+        if (init_output_raw(filename, process, outsds, sds, opt->overwrite,
+                            cr->enhancelut, verbose)) return 1;
     }
+    else {
+        if ( (g->sd_id = SDstart(filename, write_mode)) == -1 ) {
+            fprintf(stderr, "Cannot open output file %s.\n", filename);
+            return 1;
+        }
 
-    if (!append) {
-        if (write_global_attributes(sd_id, MOD021KMfile, MOD02HKMfile,
-                                    MOD02QKMfile, maxsolz, sealevel, TOA, nearest)) {
-                                        fputs("Error writing global attributes.\n", stderr);
-                                        exit(1);
-                                    }
-    }
+        if (!opt->append) {
+            if (write_global_attributes(g->sd_id, MOD021KMfile, MOD02HKMfile,
+                                        MOD02QKMfile, cr->maxsolz, cr->sealevel, cr->TOA, cr->nearest,
+                                        cr->atmlut && !cr->TOA)) {
+                                            fputs("Error writing global attributes.\n", stderr);
+                                            return 1;
+                                        }
+        }
 
-    /* create output SDSs and set SDS-specific attributes and dimension names */
-    if (init_output_sds(sd_id, process, outsds, sds, gzip, verbose)) exit(1);
+        /* create output SDSs and set SDS-specific attributes and dimension names */
+        if (init_output_sds(g->sd_id, process, outsds, sds, opt->compress, cr->enhancelut,
+                            verbose)) return 1;
+    }
 
 
-    mus = (float *) malloc(sds[REFSDS].rowsperscan * sds[REFSDS].Np * sizeof(float));
-    height.data = (int16 *) malloc(sds[REFSDS].rowsperscan * sds[REFSDS].Np * sizeof(int16));
-    if (!mus || !height.data) {
-        (void) fputs("Error allocating memory.\n", stderr);
-        exit(1);
+    /* upsampling kernels for the output bands */
+    g->maxNp = 0;
+    for (ib = 0; ib < Nbands; ib++) {
+        if (! process[ib]) continue;
+        if (init_upsample(&g->upsample[ib], outsds[ib].rowsperscan / sds[REFSDS].rowsperscan,
+                          outsds[ib].rowsperscan, outsds[ib].Np,
+                          sds[REFSDS].rowsperscan, sds[REFSDS].Np)) return 1;
+        if (outsds[ib].Np > g->maxNp) g->maxNp = outsds[ib].Np;
     }
 
-    if (sealevel || TOA)
-        dem.data = (void *) NULL;
-    else {
-        dem.data = (int16 *) malloc(dem.Nl * dem.Np * sizeof(int16));
-        if (!dem.data) {
-            (void) fputs("Error allocating memory.\n", stderr);
-            exit(1);
-        }
-    }
+    return 0;
+}
 
-    if (!TOA) {
-        nbytes = Nbands * sds[REFSDS].rowsperscan * sds[REFSDS].Np * sizeof(float);
 
-        rhoray =      (float *) malloc(nbytes);
-        sphalb =      (float *) malloc(nbytes);
-        TtotraytH2O = (float *) malloc(nbytes);
-        tOG =         (float *) malloc(nbytes);
+/**************************************************************************//**
+ correct and write all scans of an open granule
 
-        if (!rhoray || !sphalb || !TtotraytH2O || !tOG) {
-            (void) fputs("Error allocating memory.\n", stderr);
-            exit(1);
-        }
-    }
+ returns 0 on success, non zero on error
 
-    solz = sds[SOLZ].data;
-    sola = sds[SOLA].data;
-    senz = sds[SENZ].data;
-    sena = sds[SENA].data;
-    solzfill = sds[SOLZ].fillvalue;
-    lon = sds[LON].data;
-    lat = sds[LAT].data;
-    lonfill = sds[LON].fillvalue;
-    latfill = sds[LAT].fillvalue;
-    for (ib = 0; ib < Nbands; ib++) l1bdata[ib] = sds[ib].data;
+******************************************************************************/
 
-    /* don't need DEM if --sealevel or --toa specified */
-    if (!sealevel && !TOA) {
-        dem.start[0] = 0;
-        dem.start[1] = 0;
-        dem.edges[0] = dem.Nl;
-        dem.edges[1] = dem.Np;
-        if (SDreaddata(dem.id, dem.start, NULL, dem.edges, dem.data) == -1) {
-            fprintf(stderr, "  Can't read DEM SDS \"%s\"\n", dem.name);
-            exit(-1);
-        }
-        (void) SDendaccess(dem.id);
-        (void) SDend(dem.file_id);
+int process_granule(GRANULE *g, CREFL *cr, int nthreads)
+{
+    int j, iscan;
+
+    /* scan buffers, enough for the reader, the workers and the writer */
+    g->nbuf = (nthreads > 1) ? nthreads + 2 : 1;
+    g->scan = (SCANBUF *) calloc(g->nbuf, sizeof(SCANBUF));
+    if (!g->scan) {
+        g->nbuf = 0;
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
     }
+    for (j = 0; j < g->nbuf; j++)
+        if (alloc_scanbuf(&g->scan[j], cr, g->maxNp)) return 1;
+
+    if (nthreads > 1)
+        return run_pipeline(cr, g->scan, nthreads, g->Nscans, cr->verbose);
 
     /* loop over each MODIS scan */
-    for (iscan = 0; iscan < Nscans; iscan++) {
-        if ((iscan % NUM1KMROWPERSCAN == 0) && verbose)
+    for (iscan = 0; iscan < g->Nscans; iscan++) {
+        if ((iscan % NUM1KMROWPERSCAN == 0) && cr->verbose)
             printf("Processing scan %d...\n", iscan);
 
         /* Fill scan buffer for each band to be processed.
          Exit scan loop if error occurred while reading. */
-        if (read_scan(iscan, sds)) break;
+        if (load_scan(cr, iscan, &g->scan[0])) break;
 
-        for (idx = 0; idx < sds[REFSDS].rowsperscan*sds[REFSDS].Np; idx++) {
-            if (solz[idx] * sds[SOLZ].factor >= maxsolz)
-                solz[idx] = *solzfill;
+        process_scan(cr, &g->scan[0]);
 
-            if (!sealevel &&
-                (lon[idx] == *lonfill || lat[idx] == *latfill))
-                solz[idx] = *solzfill;
+        /* write current scan line for all processed bands */
+        if (write_scan(iscan, g->process, g->outsds, g->scan[0].outdata)) return 1;
+    } /* end of scan loop */
 
-            if (solz[idx] != *solzfill) {
-                mus[idx] = cos(solz[idx] * sds[SOLZ].factor * DEG2RAD);
+    return 0;
+}
 
-                if (sealevel || TOA)
-                    ((int16 *)height.data)[idx] = 0;
-                else
-                    ((int16 *)height.data)[idx] =
-                    (int16) interp_dem(lat[idx],
-                                       lon[idx], &dem);
-            }
-        }
 
+/**************************************************************************//**
+ close the files of a granule and free its memory, also after open_granule()
+ or process_granule() failed part way
 
-        if (!TOA) {
-            for (irow=0; irow<sds[REFSDS].rowsperscan; irow++) {
-                for (jcol=0; jcol<sds[REFSDS].Np; jcol++) {
-                    idx = irow * sds[REFSDS].Np + jcol;
-                    if (solz[idx] == *solzfill) continue;
-                    phi = sola[idx] * sds[SOLA].factor - sena[idx] * sds[SENA].factor;
-                    muv = cos(senz[idx] * sds[SENZ].factor * DEG2RAD);
-                    if ( getatmvariables(mus[idx], muv, phi, ((int16 *)height.data)[idx],
-                                         process,
-                                         &sphalb[idx * Nbands], &rhoray[idx * Nbands],
-                                         &TtotraytH2O[idx * Nbands], &tOG[idx * Nbands]) == -1 )
-                        solz[idx] = *solzfill;
-                }
-            }
-        }
+******************************************************************************/
 
-        for (ib=0; ib<Nbands; ib++) {
-            if (! process[ib]) continue;
-            aggfactor = outsds[ib].rowsperscan / sds[REFSDS].rowsperscan;
-            for (irow=0; irow<outsds[ib].rowsperscan; irow++) {
-                if (!nearest) {
-                    fractrow = (float)irow / aggfactor - 0.5;	/* We want fractrow integer on coarse pixel center */
-                    crsrow1 = floor(fractrow);
-                    crsrow2 = crsrow1 + 1;
-                    if (crsrow1 < 0) crsrow1 = crsrow2 + 1;
-                    if (crsrow2 > sds[REFSDS].rowsperscan - 1) crsrow2 = crsrow1 - 1;
-                    t = (fractrow - crsrow1) / (crsrow2 - crsrow1);
-                }
+void close_granule(GRANULE *g, CREFL *cr)
+{
+    int ib, j;
 
-                for (jcol=0; jcol<outsds[ib].Np; jcol++) {
-                    idx = irow * outsds[ib].Np + jcol;
-                    crsidx = (int)(irow / aggfactor) * sds[REFSDS].Np + (int)(jcol / aggfactor);
-                    if ( solz[crsidx] == *solzfill  ||	/* Bad geolocation or night pixel */
-                        l1bdata[ib][idx] < 0 ) {	/* L1B is read as int16, not uint16, so faulty is negative */
-                            if (l1bdata[ib][idx] == MISSING)
-                                ((int16 *)outsds[ib].data)[idx] = 32768 + MISSING;
-                            else if (l1bdata[ib][idx] == SATURATED)
-                                ((int16 *)outsds[ib].data)[idx] = 32768 + SATURATED;
-                            else
-                                ((int16 *)outsds[ib].data)[idx] = *(int16 *)outsds[ib].fillvalue;
-
-                            continue;
-                        }
-
-                    if (nearest) {
-                        mus0 = mus[crsidx];
-                        if (! TOA) {
-                            rhoray0 = rhoray[crsidx * Nbands + ib];
-                            sphalb0 = sphalb[crsidx * Nbands + ib];
-                            if ( sphalb0 <= 0.0F ) {	/* Atm variables not computed successfully in this band */
-                                ((int16 *)outsds[ib].data)[idx] = *(int16 *)outsds[ib].fillvalue;
-                                continue;
-                            }
-                        }
-                    }
-                    else {
-                        fractcol = ((float) jcol) / aggfactor - 0.5F;	/* We want fractcol integer on coarse pixel center */
-                        crscol1 = (int) floor(fractcol);
-                        crscol2 = crscol1 + 1;
-                        if (crscol1 < 0) crscol1 = crscol2 + 1;
-                        if (crscol2 > sds[REFSDS].Np - 1) crscol2 = crscol1 - 1;
-                        u = (fractcol - crscol1) / (crscol2 - crscol1);		/* We want u=0 on coarse pixel center */
-                        crsidx11 = crsrow1 * sds[REFSDS].Np + crscol1;
-                        crsidx12 = crsrow1 * sds[REFSDS].Np + crscol2;
-                        crsidx21 = crsrow2 * sds[REFSDS].Np + crscol1;
-                        crsidx22 = crsrow2 * sds[REFSDS].Np + crscol2;
-                        mus0 = t * u * mus[crsidx22] + (1.0F - t) * u * mus[crsidx12] + t * (1.0F - u) * mus[crsidx21] + (1.0F - t) * (1.0F - u) * mus[crsidx11];
-
-                        bad = (solz[crsidx11] == *solzfill) ||
-                            (solz[crsidx12] == *solzfill) ||
-                            (solz[crsidx21] == *solzfill) ||
-                            (solz[crsidx22] == *solzfill);
-
-                        if (bad) {
-                            ((int16 *)outsds[ib].data)[idx] = *(int16 *)outsds[ib].fillvalue;
-                            continue;
-                        }
-
-                        if (! TOA) {
-                            rhoray11 = rhoray[crsidx11 * Nbands + ib];
-                            rhoray12 = rhoray[crsidx12 * Nbands + ib];
-                            rhoray21 = rhoray[crsidx21 * Nbands + ib];
-                            rhoray22 = rhoray[crsidx22 * Nbands + ib];
-                            rhoray0 = t * u * rhoray22 + (1.0F - t) * u * rhoray12 + t * (1.0F - u) * rhoray21 + (1.0F - t) * (1.0F - u) * rhoray11;
-                            sphalb11 = sphalb[crsidx11 * Nbands + ib];
-                            sphalb12 = sphalb[crsidx12 * Nbands + ib];
-                            sphalb21 = sphalb[crsidx21 * Nbands + ib];
-                            sphalb22 = sphalb[crsidx22 * Nbands + ib];
-
-                            bad = (sphalb11 <= 0.0F) ||
-                                (sphalb12 <= 0.0F) ||
-                                (sphalb21 <= 0.0F) ||
-                                (sphalb22 <= 0.0F);
-
-                            if (bad) {
-                                ((int16 *)outsds[ib].data)[idx] = *(int16 *)outsds[ib].fillvalue;
-                                continue;
-                            }
-                            sphalb0 = t * u * sphalb22 + (1.0F - t) * u * sphalb12 + t * (1.0F - u) * sphalb21 + (1.0F - t) * (1.0F - u) * sphalb11;
-                        }
-                    }
+    for (ib = 0; ib < Nitems; ib++)
+        if (g->sds[ib].id != -1) SDendaccess(g->sds[ib].id);
 
-                    /* TOA reflectance */
-                    refl = (l1bdata[ib][idx] - sds[ib].offset) * sds[ib].factor / mus0;
+    for (ib = 0; ib < Nbands; ib++)
+        if (g->outsds[ib].id != -1) SDendaccess(g->outsds[ib].id);
 
-                    /* corrected reflectance */
-                    if (!TOA)
-                        refl = correctedrefl(refl, TtotraytH2O[crsidx * Nbands + ib],
-                                             tOG[crsidx * Nbands + ib], rhoray0, sphalb0);
+    if (g->MOD02QKMfile_id != -1) SDend(g->MOD02QKMfile_id);
+    if (g->MOD02HKMfile_id != -1) SDend(g->MOD02HKMfile_id);
+    if (g->MOD021KMfile_id != -1) SDend(g->MOD021KMfile_id);
+    if (g->sd_id != -1) SDend(g->sd_id);
+    for (j = 0; j < g->noverlays; j++) SDend(g->overlay_id[j]);
 
-                    /* reflectance bounds checking */
-                    if (refl > reflmax) refl = reflmax;
-                    if (refl < reflmin) refl = reflmin;
 
-                    ((int16 *)outsds[ib].data)[idx] = (int16) (refl / outsds[ib].factor + 0.5);
-                }
-            }
-        }
+    /* ----- free memory ----- */
 
+    for (j = 0; j < g->nbuf; j++) free_scanbuf(&g->scan[j], cr);
+    if (g->scan) free(g->scan);
 
-        /* write current scan line for all processed bands */
-        if (write_scan(iscan, process, outsds)) {
-            fprintf(stderr, "Cannot write scan %d of SDS %s\n",
-                    iscan, outsds[ib].name);
-            exit(1);
-        }
+    for (ib = 0; ib < Nitems; ib++)
+        if (g->sds[ib].fillvalue) free(g->sds[ib].fillvalue);
 
-    } /* end of scan loop */
+    for (ib = 0; ib < Nbands; ib++) {
+        free_upsample(&g->upsample[ib]);
+        if (g->outsds[ib].name) free(g->outsds[ib].name);
+        if (g->outsds[ib].fp) (void) fclose(g->outsds[ib].fp);
+    }
+}
 
 
-    for (ib = 0; ib < Nitems; ib++)
-        if (sds[ib].id != -1) SDendaccess(sds[ib].id);
+/**************************************************************************//**
+ correct the granules listed in a batch file, one granule per line:
 
-    for (ib = 0; ib < Nbands; ib++)
-        if (process[ib]) SDendaccess(outsds[ib].id);
+     <MOD021KM file> [<MOD02HKM file>] [<MOD02QKM file>] <output file>
 
-    SDend(MOD02QKMfile_id);
-    SDend(MOD02HKMfile_id);
-    SDend(MOD021KMfile_id);
-    SDend(sd_id);
+ blank lines and lines starting with '#' are ignored, a line longer than
+ BATCHLINELENGTH - 1 characters is an error; the DEM, the lookup tables
+ and the settings are shared by all granules and a granule that fails
+ doesn't stop the batch
 
+ returns 0 if all granules were corrected, non zero otherwise
 
-    /* ----- free memory ----- */
+******************************************************************************/
 
-    for (ib = 0; ib < Nitems; ib++) {
-        if (sds[ib].fillvalue) free(sds[ib].fillvalue);
-        if (sds[ib].data) free(sds[ib].data);
+int crefl_batch(CREFL *settings,
+                OUTOPT *opt,
+                char *batchfile,
+                int nthreads)
+{
+    FILE *fp;
+    char line[BATCHLINELENGTH];
+    char *files[BATCHMAXFILES + 1], *token;
+    size_t len;
+    int nfiles, lineno, ngranules, nfailed, c;
+
+    if ( !(fp = fopen(batchfile, "r")) ) {
+        fprintf(stderr, "Cannot open batch file %s.\n", batchfile);
+        return 1;
     }
 
-    free(height.data);
-    free(mus);
+    lineno = ngranules = nfailed = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+
+        /* a full buffer without the newline is a line fgets() split, unless
+           the newline or the end of the file comes next */
+        len = strlen(line);
+        if ( len == sizeof(line) - 1  &&  line[len - 1] != '\n'  &&
+            (c = getc(fp)) != EOF  &&  c != '\n' ) {
+            fprintf(stderr, "Line %d of batch file %s: longer than %d characters.\n",
+                    lineno, batchfile, (int) sizeof(line) - 1);
+            while ((c = getc(fp)) != EOF  &&  c != '\n');
+            ngranules++;
+            nfailed++;
+            continue;
+        }
+
+        nfiles = 0;
+        for (token = strtok(line, " \t\r\n"); token; token = strtok((char *) NULL, " \t\r\n")) {
+            if (nfiles == 0 && token[0] == '#') break;
+            if (nfiles > BATCHMAXFILES) break;
+            files[nfiles++] = token;
+        }
+        if (nfiles == 0) continue;
+
+        ngranules++;
+        if (nfiles < 2 || nfiles > BATCHMAXFILES) {
+            fprintf(stderr, "Line %d of batch file %s: expected input files and an output file.\n",
+                    lineno, batchfile);
+            nfailed++;
+            continue;
+        }
+
+        if (settings->verbose)
+            printf("Batch granule %d: %s\n", ngranules, files[nfiles - 1]);
 
-    if (!TOA) {
-        free(tOG);
-        free(TtotraytH2O);
-        free(sphalb);
-        free(rhoray);
+        if (crefl_granule(settings, opt, files, nfiles - 1, files[nfiles - 1], nthreads)) {
+            fprintf(stderr, "Line %d of batch file %s: granule %s failed.\n",
+                    lineno, batchfile, files[nfiles - 1]);
+            nfailed++;
+        }
     }
 
-    /* not allocated if --sealevel specified */
-    if (dem.data) free(dem.data);
+    (void) fclose(fp);
 
+    if (nfailed)
+        fprintf(stderr, "%d of %d granule(s) failed.\n", nfailed, ngranules);
+    else if (settings->verbose)
+        printf("%d granule(s) corrected.\n", ngranules);
 
-    return 0;
+    return nfailed ? 1 : 0;
 }
 
 
@@ -993,10 +1434,17 @@ int main(int argc, char *argv[])
 void usage(void)
 {
     fputs("Usage:\n", stderr);
-    fputs("crefl [--verbose] [--1km|--500m] [--nearest] [--toa|--sealevel]\n"
-          "      [--gzip] [--maxsolz=angle] [--range=min,max] [--overwrite|--append]\n"
+    fputs("crefl [--verbose] [--1km|--500m] [--nearest] [--toa|--sealevel] [--atmlut]\n"
+          "      [--gzip|--compress=none|deflate[:level]|szip] [--raw]\n"
+          "      [--maxsolz=angle] [--range=min,max] [--overwrite|--append]\n"
+          "      [--threads=n] [--roi=lon1,lat1,lon2,lat2] [--enhance[=in:out,...]]\n"
           "      [--bands=<band1,band2,band3,...>] --of=<output file>\n"
-          "      <MOD021KM|MOD02CRS|MOD09CRS file> [<MOD02HKM file>] [<MOD02QKM file>]\n", stderr);
+          "      <MOD021KM|MOD02CRS|MOD09CRS file> [<MOD02HKM file>] [<MOD02QKM file>]\n"
+          "      [<modis_destripe -of file> ...]\n"
+          "   or crefl [options] --batch=<list file>\n"
+          "      with one granule per line: <input files> <output file>\n"
+          "   or crefl [--verbose] --build-cache\n"
+          "      to build the DEM cache and the atmospheric lookup table\n", stderr);
 
     fprintf(stderr, "Version %s, compiled %s %s.\n", PROCESS_VERSION_NUMBER,
             __DATE__, __TIME__);
@@ -1048,6 +1496,85 @@ int input_file_type(char *filename)
 }
 
 
+/**************************************************************************//**
+ read a band SDS from a destriped file instead of the L1B file
+
+ modis_destripe -of writes the destriped SDSs of a L1B file to a new file,
+ with the names, dimensions and attributes of the L1B SDSs, and leaves the
+ L1B file as it is.  Given as an extra input file it overlays the L1B file:
+ an SDS found in it with the same dimensions and data type is read from it.
+
+ @param g       granule, with the destriped files open
+ @param sds     band SDS, selected in the L1B file; switched to the SDS of
+                the destriped file
+
+ @return 1 if the SDS is read from a destriped file, 0 otherwise
+
+******************************************************************************/
+
+int select_overlay(GRANULE *g, SDS *sds)
+{
+    int32 index, id, rank, dim_sizes[MAX_VAR_DIMS], num_type, n_attr;
+    char dummy[MAX_NC_NAME];
+    int j, k;
+
+    for (j = 0; j < g->noverlays; j++) {
+        if ( (index = SDnametoindex(g->overlay_id[j], sds->name)) == -1 ) continue;
+        if ( (id = SDselect(g->overlay_id[j], index)) == -1 ) continue;
+
+        if ( SDgetinfo(id, dummy, &rank, dim_sizes, &num_type, &n_attr) == -1 ||
+            rank != sds->rank || num_type != sds->num_type ) {
+            SDendaccess(id);
+            continue;
+        }
+        for (k = 0; k < rank; k++)
+            if (dim_sizes[k] != sds->dim_sizes[k]) break;
+        if (k < rank) {
+            fprintf(stderr, "SDS \"%s\" in %s does not match the L1B file, not used.\n",
+                    sds->name, g->overlay_file[j]);
+            SDendaccess(id);
+            continue;
+        }
+
+        SDendaccess(sds->id);
+        sds->id = id;
+        sds->index = index;
+        sds->file_id = g->overlay_id[j];
+        sds->filename = g->overlay_file[j];
+        sds->n_attr = n_attr;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ full name of an ancillary file: in $ANCPATH if set, else in the installed
+ data directory
+
+ @param filename    full name, MAXNAMELENGTH characters
+ @param name        name of the ancillary file
+
+******************************************************************************/
+
+void ancillary_file(char *filename, char *name)
+{
+    char *ancpath;
+
+    if ((ancpath = getenv("ANCPATH")) == NULL) {
+#ifdef CREFL_DATA_DIR
+        sprintf(filename, "%s/%s", CREFL_DATA_DIR, name);
+#else
+        sprintf(filename, "%s/%s", ANCPATH, name);
+#endif
+    }
+
+    else
+        sprintf(filename, "%s/%s", ancpath, name);
+}
+
+
 
 /**************************************************************************//**
  Parse band list and set relevant elements in process[] array.
@@ -1080,6 +1607,34 @@ int parse_bands(char *bandstr, unsigned char process[Nbands])
     return 0;
 }
 
+/**************************************************************************//**
+ Parse the --compress codec: none, deflate[:level] or szip.
+
+ @param str         codec
+ @param compress    returns COMPRESS_NONE, COMPRESS_SZIP or the deflate level
+
+ @returns non-zero if invalid codec specified, 0 otherwise (i.e., success).
+
+******************************************************************************/
+
+int parse_compress(char *str, int *compress)
+{
+    if (!strcmp(str, "none"))
+        *compress = COMPRESS_NONE;
+    else if (!strcmp(str, "szip"))
+        *compress = COMPRESS_SZIP;
+    else if (!strcmp(str, "deflate"))
+        *compress = GZIPLEVEL;
+    else if (!strncmp(str, "deflate:", 8)) {
+        *compress = atoi(str + 8);
+        if (*compress < 1 || *compress > 9) return -1;
+    }
+    else
+        return -1;
+
+    return 0;
+}
+
 /**************************************************************************//**
  set 250-m, 500-m, or 1-km line and sample dimension names for MODIS bands
  given number of samples across scan
@@ -1123,13 +1678,13 @@ void set_dimnames(int samples, char **dimname1, char **dimname2)
 
  @param lat     latitude of point
  @param lon     longitude of point
- @param dem     dem subdataset
+ @param dem     DEM
 
  @returns elevation of the point at lat,lon
  
 ******************************************************************************/
 
-int interp_dem(float lat, float lon, SDS *dem)
+int interp_dem(float lat, float lon, DEM *dem)
 {
     float fractrow, fractcol, t, u;
     int demrow1, demcol1, demrow2, demcol2;
@@ -1150,10 +1705,10 @@ int interp_dem(float lat, float lon, SDS *dem)
     if (demcol2 > dem->Np - 1) demcol2 = demcol1 - 1;
     u = (fractcol - demcol1) / (demcol2 - demcol1);
 
-    height11 = ((int16 *)dem->data)[demrow1 * dem->Np + demcol1];
-    height12 = ((int16 *)dem->data)[demrow1 * dem->Np + demcol2];
-    height21 = ((int16 *)dem->data)[demrow2 * dem->Np + demcol1];
-    height22 = ((int16 *)dem->data)[demrow2 * dem->Np + demcol2];
+    height11 = DEMVALUE(dem, demrow1, demcol1);
+    height12 = DEMVALUE(dem, demrow1, demcol2);
+    height21 = DEMVALUE(dem, demrow2, demcol1);
+    height22 = DEMVALUE(dem, demrow2, demcol2);
     height = (int) (t * u * height22 + t * (1.0F - u) * height21 +
                     (1.0F - t) * u * height12 + (1.0F - t) * (1.0F - u) * height11);
 
@@ -1163,27 +1718,270 @@ int interp_dem(float lat, float lon, SDS *dem)
 
 
 
+/**************************************************************************//**
+ map the DEM cache file if it is valid for the DEM file
+
+ @param dem         DEM
+ @param cachefile   DEM cache file name
+ @param st          DEM file status
+
+ @return 0 if mapped, non zero otherwise
+
+******************************************************************************/
+
+static int map_demcache(DEM *dem, char *cachefile, struct stat *st)
+{
+    DEMCACHEHEADER *hdr;
+    struct stat cst;
+    size_t ntiles;
+    void *map;
+    int fd;
+
+    if ( (fd = open(cachefile, O_RDONLY)) == -1 ) return 1;
+    if ( fstat(fd, &cst) == -1  ||  cst.st_size < DEMCACHE_HDRSIZE ) {
+        (void) close(fd);
+        return 1;
+    }
+    map = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    hdr = (DEMCACHEHEADER *) map;
+    ntiles = (size_t) ((hdr->Nl + DEMTILESIZE - 1) >> DEMTILESHIFT) *
+        ((hdr->Np + DEMTILESIZE - 1) >> DEMTILESHIFT);
+    if ( memcmp(hdr->magic, DEMCACHE_MAGIC, sizeof(DEMCACHE_MAGIC)) != 0  ||
+        hdr->tilesize != DEMTILESIZE  ||  hdr->Nl <= 0  ||  hdr->Np <= 0  ||
+        hdr->demsize != (float64) st->st_size  ||
+        hdr->demmtime != (float64) st->st_mtime  ||
+        (size_t) cst.st_size != DEMCACHE_HDRSIZE + (ntiles << (2 * DEMTILESHIFT)) * sizeof(int16) ) {
+        (void) munmap(map, cst.st_size);
+        return 1;
+    }
+
+    dem->Nl = hdr->Nl;
+    dem->Np = hdr->Np;
+    dem->ntilecols = (dem->Np + DEMTILESIZE - 1) >> DEMTILESHIFT;
+    dem->tiles = (int16 *) ((char *) map + DEMCACHE_HDRSIZE);
+    dem->map = map;
+    dem->maplen = cst.st_size;
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ read the DEM subdataset and tile it in memory
+
+ @param dem         DEM
+ @param filename    DEM file name
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+static int read_dem(DEM *dem, char *filename)
+{
+    int32 file_id, index, id, rank, num_type, n_attr;
+    int32 dim_sizes[MAX_VAR_DIMS], start[2], edges[2];
+    char name[MAX_NC_NAME];
+    int16 *data;
+    size_t ntiles;
+    int row, col;
+
+    if ( (file_id = SDstart(filename, DFACC_READ)) == -1 ) {
+        fprintf(stderr, "Cannot open file %s.\n", filename);
+        return 1;
+    }
+    if ( (index = SDnametoindex(file_id, DEMSDSNAME)) == -1 ) {
+        fprintf(stderr, "Cannot find SDS %s in file %s.\n", DEMSDSNAME, filename);
+        return 1;
+    }
+    if ( (id = SDselect(file_id, index)) == -1 ) {
+        fprintf(stderr, "Cannot select SDS no. %d\n", index);
+        return 1;
+    }
+    if (SDgetinfo(id, name, &rank, dim_sizes, &num_type, &n_attr) == -1) {
+        fprintf(stderr, "Can't get info from SDS \"%s\" in file %s.\n", DEMSDSNAME, filename);
+        SDendaccess(id);
+        return 1;
+    }
+
+    dem->Nl = dim_sizes[0];
+    dem->Np = dim_sizes[1];
+    dem->ntilecols = (dem->Np + DEMTILESIZE - 1) >> DEMTILESHIFT;
+    ntiles = (size_t) ((dem->Nl + DEMTILESIZE - 1) >> DEMTILESHIFT) * dem->ntilecols;
+
+    data = (int16 *) malloc((size_t) dem->Nl * dem->Np * sizeof(int16));
+    dem->tiles = (int16 *) calloc(ntiles << (2 * DEMTILESHIFT), sizeof(int16));
+    dem->map = NULL;
+    if (!data || !dem->tiles) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+
+    start[0] = start[1] = 0;
+    edges[0] = dem->Nl;
+    edges[1] = dem->Np;
+    if (SDreaddata(id, start, NULL, edges, data) == -1) {
+        fprintf(stderr, "  Can't read DEM SDS \"%s\"\n", DEMSDSNAME);
+        return 1;
+    }
+    (void) SDendaccess(id);
+    (void) SDend(file_id);
+
+    for (row = 0; row < dem->Nl; row++)
+        for (col = 0; col < dem->Np; col++)
+            DEMVALUE(dem, row, col) = data[(size_t) row * dem->Np + col];
+
+    free(data);
+    return 0;
+}
+
+
+/**************************************************************************//**
+ open the DEM: map the DEM cache, building it from the DEM file first if
+ it is missing or out of date.  If the cache can't be written the tiled
+ DEM is kept in memory.
+
+ @param dem         DEM
+ @param filename    DEM file name
+ @param cachefile   DEM cache file name
+ @param verbose     non zero to print extra info
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+int open_dem(DEM *dem, char *filename, char *cachefile, int verbose)
+{
+    DEMCACHEHEADER *hdr;
+    struct stat st;
+    char *tmpfile, header[DEMCACHE_HDRSIZE];
+    int16 *tiles;
+    size_t n;
+    FILE *fp;
+    int ok;
+
+    if (stat(filename, &st) == -1) {
+        fprintf(stderr, "Cannot open file %s.\n", filename);
+        return 1;
+    }
+
+    if (map_demcache(dem, cachefile, &st) == 0) {
+        if (verbose) printf("DEM cache %s mapped.\n", cachefile);
+        return 0;
+    }
+
+    if (verbose) printf("Building DEM cache %s.\n", cachefile);
+    if (read_dem(dem, filename)) return 1;
+
+    /* write to a temporary file and rename it, so concurrent runs never
+       map a partial cache */
+    memset(header, 0, sizeof(header));
+    hdr = (DEMCACHEHEADER *) header;
+    memcpy(hdr->magic, DEMCACHE_MAGIC, sizeof(DEMCACHE_MAGIC));
+    hdr->Nl = dem->Nl;
+    hdr->Np = dem->Np;
+    hdr->tilesize = DEMTILESIZE;
+    hdr->demsize = (float64) st.st_size;
+    hdr->demmtime = (float64) st.st_mtime;
+    n = (size_t) ((dem->Nl + DEMTILESIZE - 1) >> DEMTILESHIFT) * dem->ntilecols << (2 * DEMTILESHIFT);
+
+    tmpfile = (char *) malloc(strlen(cachefile) + 32);
+    if (!tmpfile) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+    sprintf(tmpfile, "%s.%ld", cachefile, (long) getpid());
+    ok = (fp = fopen(tmpfile, "wb")) != NULL  &&
+        fwrite(header, 1, sizeof(header), fp) == sizeof(header)  &&
+        fwrite(dem->tiles, sizeof(int16), n, fp) == n;
+    if (fp  &&  fclose(fp) != 0) ok = 0;
+    if (ok) ok = rename(tmpfile, cachefile) == 0;
+    if (!ok  &&  fp) (void) remove(tmpfile);
+    free(tmpfile);
+
+    /* use the cache from now on, as later runs will */
+    tiles = dem->tiles;
+    if (ok  &&  map_demcache(dem, cachefile, &st) == 0) {
+        free(tiles);
+        return 0;
+    }
+
+    fprintf(stderr, "Cannot write DEM cache %s, using the DEM in memory.\n", cachefile);
+    return 0;
+}
+
+
+/**************************************************************************//**
+ unmap or free the DEM
+
+ @param dem         DEM
+
+******************************************************************************/
+
+void close_dem(DEM *dem)
+{
+    if (dem->map)
+        (void) munmap(dem->map, dem->maplen);
+    else
+        free(dem->tiles);
+    dem->tiles = (int16 *) NULL;
+}
+
+
+
 /**************************************************************************//**
  Write current scan line for all processed bands.
 
  @param iscan       current scanline
  @param process     array of true/false bands to flag as proccess
  @param outsds      output subdataset array
+ @param data        scan data for each band
 
  @return 0 if no errors, non-zero otherwise.
 
 ******************************************************************************/
 
-int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands])
+int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands], void *data[Nbands])
 {
     int ib;
+    size_t n;
+    int32 origin[2];
 
     for (ib = 0; ib < Nbands; ib++) {
         if (!process[ib]) continue;
 
+        /* raw files are written in scan order */
+        if (outsds[ib].fp) {
+            n = outsds[ib].rowsperscan * outsds[ib].Np;
+            if (fwrite(data[ib], DFKNTsize(outsds[ib].num_type), n, outsds[ib].fp) != n) {
+                fprintf(stderr, "Cannot write scan %d of %s\n",
+                        iscan, outsds[ib].name);
+                return 1;
+            }
+            continue;
+        }
+
+        /* a scan is a whole chunk, skip the chunk cache */
+        if (outsds[ib].chunked) {
+            origin[0] = iscan;
+            origin[1] = 0;
+            if (SDwritechunk(outsds[ib].id, origin, data[ib]) == -1) {
+                fprintf(stderr, "Cannot write scan %d of SDS %s\n",
+                        iscan, outsds[ib].name);
+                return 1;
+            }
+            continue;
+        }
+
         outsds[ib].start[0] = iscan * outsds[ib].rowsperscan;
         if (SDwritedata(outsds[ib].id, outsds[ib].start, NULL,
-                        outsds[ib].edges, outsds[ib].data) == -1) return 1;
+                        outsds[ib].edges, data[ib]) == -1) {
+            fprintf(stderr, "Cannot write scan %d of SDS %s\n",
+                    iscan, outsds[ib].name);
+            return 1;
+        }
     }
 
     return 0;
@@ -1191,10 +1989,17 @@ int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands])
 
 
 /**************************************************************************//**
- Read current scan line for all bands to be processed.
-
- @param iscan   scanline
- @param sds     input subdataset array
+ Read current scan line for a range of subdatasets, only the columns
+ covered by a range of 1km columns.  The data is stored at its place in
+ the full scan, the columns outside the range are not set.
+
+ @param iscan       scanline
+ @param sds         input subdataset array
+ @param data        scan data for each subdataset
+ @param item1       first subdataset to read
+ @param item2       one past the last subdataset to read
+ @param crscol1     first 1km column to read
+ @param crscol2     last 1km column to read
 
  @return 0 if no errors, non-zero otherwise.
 
@@ -1202,23 +2007,46 @@ int write_scan(int iscan, unsigned char *process, SDS outsds[Nbands])
 
 
 
-int read_scan(int iscan, SDS sds[Nitems])
+int read_scan(int iscan, SDS sds[Nitems], void *data[Nitems], int item1, int item2,
+              int crscol1, int crscol2)
 {
-    int ib;
+    int ib, irow, aggfactor, col1, ncol;
+    size_t size;
 
-    for (ib = 0; ib < Nitems; ib++) {
+    for (ib = item1; ib < item2; ib++) {
         if (sds[ib].id == -1) continue;
 
+        aggfactor = sds[ib].Np / sds[REFSDS].Np;
+        col1 = crscol1 * aggfactor;
+        ncol = (crscol2 - crscol1 + 1) * aggfactor;
+        if (col1 + ncol > sds[ib].Np) ncol = sds[ib].Np - col1;
+
         switch (sds[ib].rank) {
-            case 2: sds[ib].start[0] = iscan * sds[ib].rowsperscan; break;
-            case 3: sds[ib].start[1] = iscan * sds[ib].rowsperscan; break;
+            case 2:
+                sds[ib].start[0] = iscan * sds[ib].rowsperscan;
+                sds[ib].start[1] = col1;
+                sds[ib].edges[1] = ncol;
+                break;
+            case 3:
+                sds[ib].start[1] = iscan * sds[ib].rowsperscan;
+                sds[ib].start[2] = col1;
+                sds[ib].edges[2] = ncol;
+                break;
         }
 
         if (SDreaddata(sds[ib].id, sds[ib].start, NULL, sds[ib].edges,
-                       sds[ib].data) == -1) {
+                       data[ib]) == -1) {
                            fprintf(stderr, "  Can't read scan %d of SDS \"%s\"\n", iscan, sds[ib].name);
                            return 1;
                        }
+
+        /* move the rows from the start of the buffer to their place */
+        if (ncol < sds[ib].Np) {
+            size = DFKNTsize(sds[ib].num_type);
+            for (irow = sds[ib].rowsperscan - 1; irow >= 0; irow--)
+                memmove((char *) data[ib] + ((size_t) irow * sds[ib].Np + col1) * size,
+                        (char *) data[ib] + (size_t) irow * ncol * size, ncol * size);
+        }
     }
 
     return 0;
@@ -1255,215 +2083,1563 @@ double fintexp1(float tau)
         xx += a[i] * xftau;
     }
 
-    return xx - log(tau);
+    return xx - log(tau);
+}
+
+
+/**************************************************************************//**
+ This function computes the parameter Α(τR) necessary to compute Rayleigh
+ spherical albedo
+
+ @param tau  molecular optical depth
+
+******************************************************************************/
+
+double fintexp3(float tau)
+{
+    return (expf(-tau) * (1.0F - tau) + tau * tau * fintexp1(tau)) / 2.0;
+}
+
+
+/**************************************************************************//**
+This function computes the molecular atmospheric reflectance 
+
+ @param phi     azimuthal difference between sun and observation in degree
+                (phi=0 in backscattering direction)
+ @param mus     cosine of the sun zenith angle
+ @param muv     cosine of the observation zenith angle
+ @param taur    molecular optical depth
+ @param rhoray  molecular path reflectance
+ @param trup
+ @param trdown
+ @param process array of true/false bands to flag as proccess
+ constant xdep: depolarization factor (0.0279)
+ xfd = (1-xdep/(2-xdep)) / (1 + 2*xdep/(2-xdep)) = 2 * (1 - xdep) / (2 + xdep) = 0.958725775
+******************************************************************************/
+
+void chand(float phi,
+           float muv,
+           float mus,
+           float *taur,
+           float *rhoray,
+           float *trup,
+           float *trdown,
+           unsigned char *process)
+{
+
+    const double xfd = 0.958725775;
+    const float xbeta2 = 0.5F;
+    float pl[5];
+    double fs01, fs02, fs0, fs1,fs2;
+    const float as0[10] = {0.33243832F, 0.16285370F, -0.30924818F, -0.10324388F,
+        0.11493334F, -6.777104e-02F, 1.577425e-03F, -1.240906e-02F,
+        3.241678e-02F, -3.503695e-02F};
+    const float as1[2] = {0.19666292F, -5.439061e-02F};
+    const float as2[2] = {0.14545937F,-2.910845e-02F};
+    float phios, xcos1, xcos2, xcos3;
+    float xph1, xph2, xph3, xitm1, xitm2;
+    float xlntaur, xitot1, xitot2, xitot3;
+    int i,ib;
+
+    phios = phi + 180.0F;
+    xcos1 = 1.0F;
+    xcos2 = cos(phios * DEG2RAD);
+    xcos3 = cos(2.0 * phios * DEG2RAD);
+    xph1 = 1.0 + (3.0F * mus * mus - 1.0F) * (3.0F * muv * muv - 1.0F) * xfd / 8.0;
+    xph2 = - xfd * xbeta2 * 1.5 * mus * muv * sqrtf(1.0F - mus * mus) * sqrtf(1.0F - muv * muv);
+    xph3 =   xfd * xbeta2 * 0.375 * (1.0F - mus * mus) * (1.0F - muv * muv);
+
+    pl[0] = 1.0F;
+    pl[1] = mus + muv;
+    pl[2] = mus * muv;
+    pl[3] = mus * mus + muv * muv;
+    pl[4] = mus * mus * muv * muv;
+
+    fs01 = fs02 = 0.0;
+    for (i = 0; i < 5; i++) {
+        fs01 += (double) (pl[i] * as0[i]);
+        fs02 += (double) (pl[i] * as0[5 + i]);
+    }
+
+    for (ib = 0; ib < Nbands; ib++) {
+        if (process[ib]) {
+            xlntaur = logf(taur[ib]);
+            fs0 = fs01 + fs02 * xlntaur;
+            fs1 = as1[0] + xlntaur * as1[1];
+            fs2 = as2[0] + xlntaur * as2[1];
+            trdown[ib] = expf(-taur[ib]/mus);
+            trup[ib]   = expf(-taur[ib]/muv);
+            xitm1 = (1.0F - trdown[ib] * trup[ib]) / 4.0F / (mus + muv);
+            xitm2 = (1.0F - trdown[ib]) * (1.0F - trup[ib]);
+            xitot1 = xph1 * (xitm1 + xitm2 * fs0);
+            xitot2 = xph2 * (xitm1 + xitm2 * fs1);
+            xitot3 = xph3 * (xitm1 + xitm2 * fs2);
+            rhoray[ib] = xitot1 * xcos1 + xitot2 * xcos2 * 2.0F + xitot3 * xcos3 * 2.0F;
+        }
+    }
+
+}
+
+/**************************************************************************//**
+
+ @param mus             cosine of the sun zenith angle
+ @param muv             cosine of the observation zenith angle
+ @param phi             azimuthal difference between sun and observation in degree
+                        (phi=0 in backscattering direction)
+ @param height
+ @param process         array of true/false bands to flag as proccess
+ @param sphalb          spherical albedo correction table
+ @param rhoray          molecular path reflectance
+ @param TtotraytH2O
+ @param tOG
+
+ @return 0 if ok, -1 if the air mass is too large
+
+******************************************************************************/
+
+int getatmvariables(float mus,
+                    float muv,
+                    float phi,
+                    int16 height,
+                    unsigned char *process,
+                    float *sphalb,
+                    float *rhoray,
+                    float *TtotraytH2O,
+                    float *tOG)
+{
+    double m;
+
+    m = 1.0 / mus + 1.0 / muv;
+    if (m > MAXAIRMASS) return -1;
+
+    atmvariables(mus, muv, phi, height, process, sphalb, rhoray, TtotraytH2O, tOG);
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ ozone and water vapour transmittance; these depend on the air mass only
+
+ @param m       air mass, 1/mus + 1/muv
+ @param ib      band
+ @param tO3     ozone transmittance
+ @param tH2O    water vapour transmittance
+
+******************************************************************************/
+
+void gasabsorption(double m, int ib, double *tO3, double *tH2O)
+{
+    /*
+     Values for bands 9-16 below provided by B Murch and C Hu Univ South Florida
+     IMaRS, obtained from SEADAS.
+     For the moment I've retained the Jacques values for 1-8 but show the differing
+     SEADAS values in the commented out line.
+     */
+    const float aH2O[Nbands]={ -5.60723, -5.25251, 0, 0, -6.29824, -7.70944, -3.91877, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const float bH2O[Nbands]={ 0.820175, 0.725159, 0, 0, 0.865732, 0.966947, 0.745342, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    /*const float aO3[Nbands]={ 0.0711,    0.00313, 0.0104,     0.0930,   0, 0, 0, 0.00244, 0.00383, 0.0225, 0.0663, 0.0836, 0.0485, 0.0395, 0.0119, 0.00263};*/
+    const float aO3[Nbands]={ 0.0715289, 0,       0.00743232, 0.089691, 0, 0, 0, 0.001,   0.00383, 0.0225, 0.0663, 0.0836, 0.0485, 0.0395, 0.0119, 0.00263};
+
+    *tO3 = *tH2O = 1.0;
+    if (aO3[ib] != 0) *tO3 = exp(-m * UO3 * aO3[ib]);
+    if (bH2O[ib] != 0) *tH2O = exp(-exp(aH2O[ib] + bH2O[ib] * log(m * UH2O)));
+}
+
+
+/**************************************************************************//**
+ spherical albedo table, filled once by init_sphalb0()
+
+******************************************************************************/
+
+static float sphalb0[MAXNUMSPHALBVALUES];
+static pthread_once_t sphalb0_once = PTHREAD_ONCE_INIT;
+
+static void init_sphalb0(void)
+{
+    int j;
+
+    sphalb0[0] = 0.0F;
+    for(j = 1; j < MAXNUMSPHALBVALUES; j++)
+        sphalb0[j] = csalbr(j * TAUSTEP4SPHALB);
+}
+
+
+/**************************************************************************//**
+ compute the atmospheric variables without checking the air mass; see
+ getatmvariables() for the parameters
+
+******************************************************************************/
+
+void atmvariables(float mus,
+                  float muv,
+                  float phi,
+                  int16 height,
+                  unsigned char *process,
+                  float *sphalb,
+                  float *rhoray,
+                  float *TtotraytH2O,
+                  float *tOG)
+{
+    double m, Ttotrayu, Ttotrayd, tO3, tO2, tH2O;
+    float psurfratio;
+    int ib;
+    /*const float taur0[Nbands] = { 0.0507,  0.0164,  0.1915,  0.0948,  0.0036,  0.0012,  0.0004,  0.3109, 0.2375, 0.1596, 0.1131, 0.0994, 0.0446, 0.0416, 0.0286, 0.0155};*/
+    const float taur0[Nbands] = { 0.05100, 0.01631, 0.19325, 0.09536, 0.00366, 0.00123, 0.00043, 0.3139, 0.2375, 0.1596, 0.1131, 0.0994, 0.0446, 0.0416, 0.0286, 0.0155};
+
+    float taur[Nbands], trup[Nbands], trdown[Nbands];
+
+
+    /* scans may be processed by several threads, see init_sphalb0() */
+    (void) pthread_once(&sphalb0_once, init_sphalb0);
+
+    m = 1.0 / mus + 1.0 / muv;
+
+    psurfratio = expf(-height / (float) SCALEHEIGHT);
+    for (ib = 0; ib < Nbands; ib++)
+        if (process[ib]) taur[ib] = taur0[ib] * psurfratio;
+
+    chand(phi, muv, mus, taur, rhoray, trup, trdown, process);
+
+    for (ib = 0; ib < Nbands; ib++) {
+        if (!process[ib]) continue;
+
+        if (taur[ib] / TAUSTEP4SPHALB >= MAXNUMSPHALBVALUES) {
+            sphalb[ib] = -1.0F;
+            /* Use sphalb as flag to indicate atm variables are not computed successfully */
+            continue;
+        }
+
+        sphalb[ib] = sphalb0[(int)(taur[ib] / TAUSTEP4SPHALB + 0.5)];
+        Ttotrayu = ((2 / 3. + muv) + (2 / 3. - muv) * trup[ib])   / (4 / 3. + taur[ib]);
+        Ttotrayd = ((2 / 3. + mus) + (2 / 3. - mus) * trdown[ib]) / (4 / 3. + taur[ib]);
+        tO2 = 1.0;
+        gasabsorption(m, ib, &tO3, &tH2O);
+        /*
+         t02 = exp(-m * aO2);
+         */
+        TtotraytH2O[ib] = Ttotrayu * Ttotrayd * tH2O;
+        tOG[ib] = tO3 * tO2;
+    }
+}
+
+
+/**************************************************************************//**
+ fill the atmospheric lookup table for all bands
+
+ @param lut     lookup table, grid set
+ @param table   table for each band, [isolz][isenz][iheight][ATMLUT_NVAR]
+
+******************************************************************************/
+
+static void build_atmlut(ATMLUT *lut, float *table[Nbands])
+{
+    int isolz, isenz, ih, im, ib;
+    float mus, muv, r0[Nbands], r90[Nbands], r180[Nbands];
+    float sphalb[Nbands], TtotraytH2O[Nbands], tOG[Nbands];
+    unsigned char process[Nbands];
+    float *node;
+    int16 height;
+    double m, tO3, tH2O;
+    size_t inode;
+
+    for (ib = 0; ib < Nbands; ib++) process[ib] = TRUE;
+
+    inode = 0;
+    for (isolz = 0; isolz < lut->nangle; isolz++) {
+        mus = 1.0 / cosh(isolz * lut->anglestep);
+        for (isenz = 0; isenz < lut->nangle; isenz++) {
+            muv = 1.0 / cosh(isenz * lut->anglestep);
+            m = 1.0 / mus + 1.0 / muv;
+            for (ih = 0; ih < lut->nheight; ih++, inode += ATMLUT_NVAR) {
+                height = (int16) (ih * lut->heightstep + 0.5F);
+
+                /* rhoray = A + B cos(phi+180) + C cos(2 (phi+180)); solve
+                   for A, B, C from phi+180 = 0, 90 and 180 degrees */
+                atmvariables(mus, muv, -180.0F, height, process, sphalb, r0, TtotraytH2O, tOG);
+                atmvariables(mus, muv, -90.0F, height, process, sphalb, r90, TtotraytH2O, tOG);
+                atmvariables(mus, muv, 0.0F, height, process, sphalb, r180, TtotraytH2O, tOG);
+
+                for (ib = 0; ib < Nbands; ib++) {
+                    gasabsorption(m, ib, &tO3, &tH2O);
+                    node = table[ib] + inode;
+                    node[0] = ((r0[ib] + r180[ib]) / 2.0F + r90[ib]) / 2.0F;
+                    node[1] = (r0[ib] - r180[ib]) / 2.0F;
+                    node[2] = ((r0[ib] + r180[ib]) / 2.0F - r90[ib]) / 2.0F;
+                    node[3] = sphalb[ib];
+                    node[4] = TtotraytH2O[ib] / tH2O;
+                }
+            }
+        }
+    }
+
+    /* gaseous transmittances only depend on the air mass */
+    node = lut->gas;
+    for (im = 0; im < lut->nairmass; im++) {
+        m = 2.0 + im * lut->airmassstep;
+        for (ib = 0; ib < Nbands; ib++, node += 2) {
+            gasabsorption(m, ib, &tO3, &tH2O);
+            node[0] = tO3;
+            node[1] = tH2O;
+        }
+    }
+}
+
+
+/**************************************************************************//**
+ set up the atmospheric lookup table for the bands to be processed, reading
+ it from the cache file if it matches the current grid, otherwise building
+ it for all bands and writing the cache file
+
+ @param lut         lookup table
+ @param filename    cache file name
+ @param process     array of true/false bands to flag as proccess
+ @param verbose     non zero to print extra info
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+int init_atmlut(ATMLUT *lut, char *filename, unsigned char *process, int verbose)
+{
+    FILE *fp;
+    char magic[sizeof(ATMLUT_MAGIC)], *tmpfile;
+    int32 grid[3];
+    float *table[Nbands];
+    size_t n, ngas, inode;
+    long offset;
+    int ib, ok, q;
+
+    lut->nangle = ATMLUT_NANGLE;
+    lut->nheight = ATMLUT_NHEIGHT;
+    lut->nairmass = ATMLUT_NAIRMASS;
+    lut->anglestep = log((1.0 + sin(ATMLUT_MAXANGLE * DEG2RAD)) / cos(ATMLUT_MAXANGLE * DEG2RAD)) /
+        (ATMLUT_NANGLE - 1);
+    lut->heightstep = ATMLUT_MAXHEIGHT / (ATMLUT_NHEIGHT - 1);
+    lut->airmassstep = (MAXAIRMASS - 2.0F) / (ATMLUT_NAIRMASS - 1);
+
+    /* cache file: magic, grid, one table per band, air mass table */
+    n = (size_t) lut->nangle * lut->nangle * lut->nheight * ATMLUT_NVAR;
+    ngas = (size_t) lut->nairmass * Nbands * 2;
+    offset = sizeof(magic) + sizeof(grid);
+
+    for (ib = lut->nband = 0; ib < Nbands; ib++) {
+        table[ib] = (float *) NULL;
+        lut->band[ib] = process[ib] ? lut->nband++ : -1;
+    }
+    lut->data = (float *) malloc(n * lut->nband * sizeof(float));
+    lut->gas = (float *) malloc(ngas * sizeof(float));
+    if (!lut->data || !lut->gas) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+    for (ib = 0; ib < Nbands; ib++)
+        if ( process[ib]  &&  !(table[ib] = (float *) malloc(n * sizeof(float))) ) {
+            (void) fputs("Error allocating memory.\n", stderr);
+            return 1;
+        }
+
+    ok = 0;
+    if ( (fp = fopen(filename, "rb")) ) {
+        ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic)  &&
+            memcmp(magic, ATMLUT_MAGIC, sizeof(magic)) == 0  &&
+            fread(grid, sizeof(int32), 3, fp) == 3  &&
+            grid[0] == lut->nangle  &&  grid[1] == lut->nheight  &&
+            grid[2] == lut->nairmass;
+        for (ib = 0; ok && ib < Nbands; ib++)
+            if (process[ib])
+                ok = fseek(fp, offset + ib * n * sizeof(float), SEEK_SET) == 0  &&
+                    fread(table[ib], sizeof(float), n, fp) == n;
+        ok = ok  &&  fseek(fp, offset + Nbands * n * sizeof(float), SEEK_SET) == 0  &&
+            fread(lut->gas, sizeof(float), ngas, fp) == ngas;
+        (void) fclose(fp);
+        if (ok && verbose) printf("Atmospheric lookup table read from %s\n", filename);
+    }
+
+    /* no usable cache file, build the table for all bands */
+    if (!ok) {
+        for (ib = 0; ib < Nbands; ib++)
+            if ( !table[ib]  &&  !(table[ib] = (float *) malloc(n * sizeof(float))) ) {
+                (void) fputs("Error allocating memory.\n", stderr);
+                return 1;
+            }
+
+        if (verbose) puts("Building atmospheric lookup table.");
+        build_atmlut(lut, table);
+
+        grid[0] = lut->nangle;
+        grid[1] = lut->nheight;
+        grid[2] = lut->nairmass;
+
+        /* write to a temporary file and rename it, as for the DEM cache,
+           so concurrent runs never read a partial table */
+        tmpfile = (char *) malloc(strlen(filename) + 32);
+        if (!tmpfile) {
+            (void) fputs("Error allocating memory.\n", stderr);
+            return 1;
+        }
+        sprintf(tmpfile, "%s.%ld", filename, (long) getpid());
+        ok = (fp = fopen(tmpfile, "wb")) != NULL  &&
+            fwrite(ATMLUT_MAGIC, 1, sizeof(magic), fp) == sizeof(magic)  &&
+            fwrite(grid, sizeof(int32), 3, fp) == 3;
+        for (ib = 0; ok && ib < Nbands; ib++)
+            ok = fwrite(table[ib], sizeof(float), n, fp) == n;
+        ok = ok  &&  fwrite(lut->gas, sizeof(float), ngas, fp) == ngas;
+        if (fp  &&  fclose(fp) != 0) ok = 0;
+        if (ok) ok = rename(tmpfile, filename) == 0;
+        if (!ok  &&  fp) (void) remove(tmpfile);
+        free(tmpfile);
+
+        if (ok) {
+            if (verbose) printf("Atmospheric lookup table written to %s\n", filename);
+        }
+        else {
+            /* the cache is only an optimization, keep going without it */
+            fprintf(stderr, "Cannot write atmospheric lookup table %s, it is built on every run.\n",
+                    filename);
+        }
+    }
+
+    /* interleave the processed bands so each grid node is contiguous */
+    for (ib = 0; ib < Nbands; ib++) {
+        if (process[ib])
+            for (inode = 0; inode < n / ATMLUT_NVAR; inode++)
+                for (q = 0; q < ATMLUT_NVAR; q++)
+                    lut->data[(inode * lut->nband + lut->band[ib]) * ATMLUT_NVAR + q] =
+                        table[ib][inode * ATMLUT_NVAR + q];
+        if (table[ib]) free(table[ib]);
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ free the atmospheric lookup table
+
+ @param lut     lookup table
+
+******************************************************************************/
+
+void free_atmlut(ATMLUT *lut)
+{
+    free(lut->data);
+    free(lut->gas);
+}
+
+
+/**************************************************************************//**
+ lookup table version of getatmvariables()
+
+ @param lut             atmospheric lookup table
+ @param mus             cosine of the sun zenith angle
+ @param muv             cosine of the observation zenith angle
+ @param phi             azimuthal difference between sun and observation in degree
+                        (phi=0 in backscattering direction)
+ @param height
+ @param process         array of true/false bands to flag as proccess, only
+                        the bands in the table (lut->band[]) are computed
+ @param sphalb          spherical albedo correction table
+ @param rhoray          molecular path reflectance
+ @param TtotraytH2O
+ @param tOG
+
+ @return 0 if ok, -1 if the air mass is too large
+
+******************************************************************************/
+
+int getatmvariables_lut(ATMLUT *lut,
+                        float mus,
+                        float muv,
+                        float phi,
+                        int16 height,
+                        unsigned char *process,
+                        float *sphalb,
+                        float *rhoray,
+                        float *TtotraytH2O,
+                        float *tOG)
+{
+    float x, y, z, a, cosphi, cos2phi, w[8], v[ATMLUT_NVAR];
+    float *gas1, *gas2, *node[8], *p[8];
+    size_t stride;
+    double m;
+    int i, j, k, ib, ic, q;
+
+    m = 1.0 / mus + 1.0 / muv;
+    if (m > MAXAIRMASS) return -1;
+
+    /* grid cell and weights; the zenith angle grid is regular in
+       log(sec + tan), clamp to the edges of the table */
+    x = logf((1.0F + sqrtf(1.0F - mus * mus)) / mus) / lut->anglestep;
+    y = logf((1.0F + sqrtf(1.0F - muv * muv)) / muv) / lut->anglestep;
+    z = height / lut->heightstep;
+    if (x > lut->nangle - 1) x = lut->nangle - 1;
+    if (y > lut->nangle - 1) y = lut->nangle - 1;
+    if (z < 0.0F) z = 0.0F;
+    if (z > lut->nheight - 1) z = lut->nheight - 1;
+    i = (int) x;
+    j = (int) y;
+    k = (int) z;
+    if (i > lut->nangle - 2) i = lut->nangle - 2;
+    if (j > lut->nangle - 2) j = lut->nangle - 2;
+    if (k > lut->nheight - 2) k = lut->nheight - 2;
+    x -= i;
+    y -= j;
+    z -= k;
+
+    stride = lut->nband * ATMLUT_NVAR;
+    node[0] = lut->data + (((size_t) i * lut->nangle + j) * lut->nheight + k) * stride;
+    node[1] = node[0] + stride;
+    node[2] = node[0] + lut->nheight * stride;
+    node[3] = node[2] + stride;
+    node[4] = node[0] + (size_t) lut->nangle * lut->nheight * stride;
+    node[5] = node[4] + stride;
+    node[6] = node[4] + lut->nheight * stride;
+    node[7] = node[6] + stride;
+
+    w[0] = (1.0F - x) * (1.0F - y) * (1.0F - z);
+    w[1] = (1.0F - x) * (1.0F - y) * z;
+    w[2] = (1.0F - x) * y * (1.0F - z);
+    w[3] = (1.0F - x) * y * z;
+    w[4] = x * (1.0F - y) * (1.0F - z);
+    w[5] = x * (1.0F - y) * z;
+    w[6] = x * y * (1.0F - z);
+    w[7] = x * y * z;
+
+    a = (m - 2.0) / lut->airmassstep;
+    if (a < 0.0F) a = 0.0F;
+    i = (int) a;
+    if (i > lut->nairmass - 2) i = lut->nairmass - 2;
+    a -= i;
+    gas1 = lut->gas + (size_t) i * Nbands * 2;
+    gas2 = gas1 + Nbands * 2;
+
+    cosphi = cos((phi + 180.0F) * DEG2RAD);
+    cos2phi = 2.0F * cosphi * cosphi - 1.0F;
+
+    /* each band is at its own slot of the table, lut->band[], whatever
+       bands this granule processes */
+    for (ib = 0; ib < Nbands; ib++) {
+        if (!process[ib] || lut->band[ib] < 0) continue;
+
+        for (ic = 0; ic < 8; ic++) p[ic] = node[ic] + lut->band[ib] * ATMLUT_NVAR;
+        for (q = 0; q < ATMLUT_NVAR; q++)
+            v[q] = w[0] * p[0][q] + w[1] * p[1][q] + w[2] * p[2][q] +
+                w[3] * p[3][q] + w[4] * p[4][q] + w[5] * p[5][q] +
+                w[6] * p[6][q] + w[7] * p[7][q];
+
+        rhoray[ib] = v[0] + v[1] * cosphi + v[2] * cos2phi;
+        sphalb[ib] = v[3];
+        tOG[ib] = (1.0F - a) * gas1[2 * ib] + a * gas2[2 * ib];
+        TtotraytH2O[ib] = v[4] * ((1.0F - a) * gas1[2 * ib + 1] + a * gas2[2 * ib + 1]);
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+
+ @param refl
+ @param TtotraytH2O
+ @param tOG
+ @param rhoray          molecular path reflectance
+ @param sphalb          spherical albedo correction table
+
+ @return corrected reflectance
+
+******************************************************************************/
+
+float correctedrefl(float refl,
+                    float TtotraytH2O,
+                    float tOG,
+                    float rhoray,
+                    float sphalb)
+{
+    float corr_refl;
+
+    corr_refl = (refl / tOG - rhoray) / TtotraytH2O;
+    corr_refl /= (1.0F + corr_refl * sphalb);
+    return corr_refl;
+}
+
+/**************************************************************************//**
+ set up the upsampling kernel from the 1km grid to an output band grid
+
+ @param up              upsampling kernel
+ @param aggfactor       number of output pixels per 1km pixel
+ @param rowsperscan     output rows per scan
+ @param Np              output columns
+ @param crsrowsperscan  1km rows per scan
+ @param crsNp           1km columns
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+int init_upsample(UPSAMPLE *up,
+                  int aggfactor,
+                  int rowsperscan,
+                  int Np,
+                  int crsrowsperscan,
+                  int crsNp)
+{
+    int irow, jcol, crs1, crs2;
+    float fractrow, fractcol;
+
+    up->aggfactor = aggfactor;
+    up->crsrow = (int *) malloc(rowsperscan * sizeof(int));
+    up->crsrow1 = (int *) malloc(rowsperscan * sizeof(int));
+    up->crsrow2 = (int *) malloc(rowsperscan * sizeof(int));
+    up->t = (float *) malloc(rowsperscan * sizeof(float));
+    up->crscol = (int *) malloc(Np * sizeof(int));
+    up->crscol1 = (int *) malloc(Np * sizeof(int));
+    up->crscol2 = (int *) malloc(Np * sizeof(int));
+    up->u = (float *) malloc(Np * sizeof(float));
+    if (!up->crsrow || !up->crsrow1 || !up->crsrow2 || !up->t ||
+        !up->crscol || !up->crscol1 || !up->crscol2 || !up->u) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+
+    for (irow=0; irow<rowsperscan; irow++) {
+        up->crsrow[irow] = irow / aggfactor;
+        fractrow = (float)irow / aggfactor - 0.5;	/* We want fractrow integer on coarse pixel center */
+        crs1 = floor(fractrow);
+        crs2 = crs1 + 1;
+        if (crs1 < 0) crs1 = crs2 + 1;
+        if (crs2 > crsrowsperscan - 1) crs2 = crs1 - 1;
+        up->crsrow1[irow] = crs1;
+        up->crsrow2[irow] = crs2;
+        up->t[irow] = (fractrow - crs1) / (crs2 - crs1);
+    }
+
+    for (jcol=0; jcol<Np; jcol++) {
+        up->crscol[jcol] = jcol / aggfactor;
+        fractcol = ((float) jcol) / aggfactor - 0.5F;	/* We want fractcol integer on coarse pixel center */
+        crs1 = (int) floor(fractcol);
+        crs2 = crs1 + 1;
+        if (crs1 < 0) crs1 = crs2 + 1;
+        if (crs2 > crsNp - 1) crs2 = crs1 - 1;
+        up->crscol1[jcol] = crs1;
+        up->crscol2[jcol] = crs2;
+        up->u[jcol] = (fractcol - crs1) / (crs2 - crs1);		/* We want u=0 on coarse pixel center */
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ free the upsampling kernel
+
+ @param up  upsampling kernel
+
+******************************************************************************/
+
+void free_upsample(UPSAMPLE *up)
+{
+    free(up->crsrow);
+    free(up->crsrow1);
+    free(up->crsrow2);
+    free(up->t);
+    free(up->crscol);
+    free(up->crscol1);
+    free(up->crscol2);
+    free(up->u);
+}
+
+
+/**************************************************************************//**
+ interpolate the atmospheric variables of one band to one output row
+
+ Output pixels that can't be corrected (bad geolocation, night, faulty L1B
+ or atmospheric variables not computed) are set to their fill value here
+ and flagged in row->ok, the others are computed by correct_row().
+
+ @param up              upsampling kernel of the band
+ @param irow            output row in the scan
+ @param Np              output columns
+ @param crsNp           1km columns
+ @param ib              band
+ @param nearest         non zero to use the nearest 1km pixel
+ @param TOA             non zero for top of atmosphere reflectance only
+ @param solz            1km solar zenith of the scan
+ @param solzfill        solar zenith fill value
+ @param roimask         1km pixels in the region of interest, NULL for all
+ @param mus             1km cosine of the solar zenith of the scan
+ @param rhoray          1km atmospheric variables of the scan, [idx][band]
+ @param sphalb
+ @param TtotraytH2O
+ @param tOG
+ @param l1bdata         L1B row
+ @param outfill         output fill value
+ @param out             output row
+ @param row             interpolated atmospheric variables
+
+******************************************************************************/
+
+void interp_row(UPSAMPLE *up,
+                int irow,
+                int Np,
+                int crsNp,
+                int ib,
+                int nearest,
+                int TOA,
+                int16 *solz,
+                int16 solzfill,
+                unsigned char *roimask,
+                float *mus,
+                float *rhoray,
+                float *sphalb,
+                float *TtotraytH2O,
+                float *tOG,
+                int16 *l1bdata,
+                int16 outfill,
+                int16 *out,
+                ROWBUF *row)
+{
+    int jcol, crsidx, crsidx11, crsidx12, crsidx21, crsidx22;
+    int crsoff, crsoff1, crsoff2;
+    float t, u, w11, w12, w21, w22;
+
+    crsoff = up->crsrow[irow] * crsNp;
+    crsoff1 = up->crsrow1[irow] * crsNp;
+    crsoff2 = up->crsrow2[irow] * crsNp;
+    t = up->t[irow];
+
+    for (jcol=0; jcol<Np; jcol++) {
+        row->ok[jcol] = 0;
+        crsidx = crsoff + up->crscol[jcol];
+        if ( solz[crsidx] == solzfill  ||	/* Bad geolocation or night pixel */
+            (roimask && !roimask[crsidx])  ||	/* Outside the region of interest */
+            l1bdata[jcol] < 0 ) {		/* L1B is read as int16, not uint16, so faulty is negative */
+                if (l1bdata[jcol] == MISSING)
+                    out[jcol] = 32768 + MISSING;
+                else if (l1bdata[jcol] == SATURATED)
+                    out[jcol] = 32768 + SATURATED;
+                else
+                    out[jcol] = outfill;
+
+                continue;
+            }
+
+        if (nearest) {
+            row->mus[jcol] = mus[crsidx];
+            if (! TOA) {
+                row->rhoray[jcol] = rhoray[crsidx * Nbands + ib];
+                row->sphalb[jcol] = sphalb[crsidx * Nbands + ib];
+                if ( row->sphalb[jcol] <= 0.0F ) {	/* Atm variables not computed successfully in this band */
+                    out[jcol] = outfill;
+                    continue;
+                }
+            }
+        }
+        else {
+            crsidx11 = crsoff1 + up->crscol1[jcol];
+            crsidx12 = crsoff1 + up->crscol2[jcol];
+            crsidx21 = crsoff2 + up->crscol1[jcol];
+            crsidx22 = crsoff2 + up->crscol2[jcol];
+
+            if ( solz[crsidx11] == solzfill  ||  solz[crsidx12] == solzfill  ||
+                solz[crsidx21] == solzfill  ||  solz[crsidx22] == solzfill ) {
+                out[jcol] = outfill;
+                continue;
+            }
+
+            u = up->u[jcol];
+            w22 = t * u;
+            w12 = (1.0F - t) * u;
+            w21 = t * (1.0F - u);
+            w11 = (1.0F - t) * (1.0F - u);
+            row->mus[jcol] = w22 * mus[crsidx22] + w12 * mus[crsidx12] + w21 * mus[crsidx21] + w11 * mus[crsidx11];
+
+            if (! TOA) {
+                crsidx11 = crsidx11 * Nbands + ib;
+                crsidx12 = crsidx12 * Nbands + ib;
+                crsidx21 = crsidx21 * Nbands + ib;
+                crsidx22 = crsidx22 * Nbands + ib;
+
+                if ( sphalb[crsidx11] <= 0.0F  ||  sphalb[crsidx12] <= 0.0F  ||
+                    sphalb[crsidx21] <= 0.0F  ||  sphalb[crsidx22] <= 0.0F ) {
+                    out[jcol] = outfill;
+                    continue;
+                }
+                row->rhoray[jcol] = w22 * rhoray[crsidx22] + w12 * rhoray[crsidx12] + w21 * rhoray[crsidx21] + w11 * rhoray[crsidx11];
+                row->sphalb[jcol] = w22 * sphalb[crsidx22] + w12 * sphalb[crsidx12] + w21 * sphalb[crsidx21] + w11 * sphalb[crsidx11];
+            }
+        }
+
+        if (! TOA) {
+            row->TtotraytH2O[jcol] = TtotraytH2O[crsidx * Nbands + ib];
+            row->tOG[jcol] = tOG[crsidx * Nbands + ib];
+        }
+        row->ok[jcol] = 1;
+    }
+}
+
+
+#ifdef CREFL_AVX2
+static pthread_once_t avx2_once = PTHREAD_ONCE_INIT;
+static int use_avx2;
+
+/**************************************************************************//**
+ set use_avx2: the CPU has AVX2 and CREFL_NOSIMD is not set (or is empty) in
+ the environment, which forces the scalar path for comparison
+
+******************************************************************************/
+
+static void init_avx2(void)
+{
+    char *nosimd = getenv("CREFL_NOSIMD");
+
+    use_avx2 = __builtin_cpu_supports("avx2")  &&  !(nosimd && *nosimd);
+}
+
+
+/**************************************************************************//**
+ AVX2 kernel of correct_row(), 8 pixels at a time
+
+ Built with the avx2 target attribute when configure finds the compiler
+ supports it (CREFL_AVX2), only called when use_avx2 is set.
+
+ @return number of columns done, the rest are left to correct_row()
+
+******************************************************************************/
+
+AVX2_TARGET
+static int correct_row_avx2(int Np,
+                            int TOA,
+                            int16 *l1bdata,
+                            double offset,
+                            double factor,
+                            ROWBUF *row,
+                            float reflmin,
+                            float reflmax,
+                            double outfactor,
+                            int16 *out)
+{
+    int jcol = 0;
+    __m256i l1b;
+    __m256d dlo, dhi;
+    __m256 vrefl, corr;
+    __m128i iout, keep;
+
+    for (; jcol + 8 <= Np; jcol += 8) {
+        /* TOA reflectance, in double as (l1bdata - offset) * factor / mus */
+        l1b = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) &l1bdata[jcol]));
+        dlo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(l1b));
+        dhi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(l1b, 1));
+        dlo = _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(dlo, _mm256_set1_pd(offset)), _mm256_set1_pd(factor)),
+                            _mm256_cvtps_pd(_mm_loadu_ps(&row->mus[jcol])));
+        dhi = _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(dhi, _mm256_set1_pd(offset)), _mm256_set1_pd(factor)),
+                            _mm256_cvtps_pd(_mm_loadu_ps(&row->mus[jcol + 4])));
+        vrefl = _mm256_set_m128(_mm256_cvtpd_ps(dhi), _mm256_cvtpd_ps(dlo));
+
+        /* corrected reflectance */
+        if (!TOA) {
+            corr = _mm256_div_ps(_mm256_sub_ps(_mm256_div_ps(vrefl, _mm256_loadu_ps(&row->tOG[jcol])),
+                                               _mm256_loadu_ps(&row->rhoray[jcol])),
+                                 _mm256_loadu_ps(&row->TtotraytH2O[jcol]));
+            vrefl = _mm256_div_ps(corr, _mm256_add_ps(_mm256_set1_ps(1.0F),
+                                                      _mm256_mul_ps(corr, _mm256_loadu_ps(&row->sphalb[jcol]))));
+        }
+
+        /* reflectance bounds checking */
+        vrefl = _mm256_blendv_ps(vrefl, _mm256_set1_ps(reflmax),
+                                 _mm256_cmp_ps(vrefl, _mm256_set1_ps(reflmax), _CMP_GT_OQ));
+        vrefl = _mm256_blendv_ps(vrefl, _mm256_set1_ps(reflmin),
+                                 _mm256_cmp_ps(vrefl, _mm256_set1_ps(reflmin), _CMP_LT_OQ));
+
+        /* scale, truncating as the (int16) cast does */
+        dlo = _mm256_add_pd(_mm256_div_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(vrefl)), _mm256_set1_pd(outfactor)),
+                            _mm256_set1_pd(0.5));
+        dhi = _mm256_add_pd(_mm256_div_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(vrefl, 1)), _mm256_set1_pd(outfactor)),
+                            _mm256_set1_pd(0.5));
+        iout = _mm_packs_epi32(_mm256_cvttpd_epi32(dlo), _mm256_cvttpd_epi32(dhi));
+
+        /* keep the fill values set by interp_row() */
+        keep = _mm_cmpeq_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i *) &row->ok[jcol])),
+                               _mm_setzero_si128());
+        iout = _mm_blendv_epi8(iout, _mm_loadu_si128((__m128i *) &out[jcol]), keep);
+        _mm_storeu_si128((__m128i *) &out[jcol], iout);
+    }
+
+    return jcol;
+}
+#endif
+
+
+/**************************************************************************//**
+ compute the output reflectance of one band for one output row
+
+ Same computation as correctedrefl() plus the bounds checking and scaling.
+ Pixels not flagged in row->ok are left unchanged.  Runs correct_row_avx2()
+ on CPUs with AVX2 when built with CREFL_AVX2, unless CREFL_NOSIMD is set,
+ see init_avx2().
+
+ @param Np          output columns
+ @param TOA         non zero for top of atmosphere reflectance only
+ @param l1bdata     L1B row
+ @param offset      L1B reflectance offset
+ @param factor      L1B reflectance scale factor
+ @param row         interpolated atmospheric variables, see interp_row()
+ @param reflmin     reflectance bounds
+ @param reflmax
+ @param outfactor   output scale factor
+ @param out         output row
+
+******************************************************************************/
+
+void correct_row(int Np,
+                 int TOA,
+                 int16 *l1bdata,
+                 double offset,
+                 double factor,
+                 ROWBUF *row,
+                 float reflmin,
+                 float reflmax,
+                 double outfactor,
+                 int16 *out)
+{
+    int jcol = 0;
+    float refl;
+
+#ifdef CREFL_AVX2
+    (void) pthread_once(&avx2_once, init_avx2);
+    if (use_avx2)
+        jcol = correct_row_avx2(Np, TOA, l1bdata, offset, factor, row, reflmin, reflmax, outfactor, out);
+#endif
+
+    for (; jcol<Np; jcol++) {
+        if (!row->ok[jcol]) continue;
+
+        /* TOA reflectance */
+        refl = (l1bdata[jcol] - offset) * factor / row->mus[jcol];
+
+        /* corrected reflectance */
+        if (!TOA)
+            refl = correctedrefl(refl, row->TtotraytH2O[jcol], row->tOG[jcol],
+                                 row->rhoray[jcol], row->sphalb[jcol]);
+
+        /* reflectance bounds checking */
+        if (refl > reflmax) refl = reflmax;
+        if (refl < reflmin) refl = reflmin;
+
+        out[jcol] = (int16) (refl / outfactor + 0.5);
+    }
+}
+
+
+/**************************************************************************//**
+ allocate the buffers for one scan
+
+ @param buf     scan buffers
+ @param cr      settings, the input and output subdatasets must be open
+ @param maxNp   max. number of output columns
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+int alloc_scanbuf(SCANBUF *buf, CREFL *cr, int maxNp)
+{
+    SDS *sds = cr->sds, *outsds = cr->outsds;
+    size_t n1km, nbytes;
+    int ib;
+
+    buf->state = SCAN_FREE;
+
+    for (ib = 0; ib < Nitems; ib++) {
+        buf->data[ib] = (void *) NULL;
+        if (sds[ib].id == -1) continue;
+        buf->data[ib] = malloc(sds[ib].Np * sds[ib].rowsperscan * DFKNTsize(sds[ib].num_type));
+        if (!buf->data[ib]) {
+            (void) fputs("Error allocating memory.\n", stderr);
+            return 1;
+        }
+    }
+
+    for (ib = 0; ib < Nbands; ib++) {
+        buf->outdata[ib] = (void *) NULL;
+        if (!cr->process[ib]) continue;
+        /* corrected reflectance, enhanced in place to bytes for --enhance */
+        buf->outdata[ib] = malloc(outsds[ib].rowsperscan * outsds[ib].Np * sizeof(int16));
+        if (!buf->outdata[ib]) {
+            (void) fputs("Error allocating memory.\n", stderr);
+            return 1;
+        }
+    }
+
+    n1km = sds[REFSDS].rowsperscan * sds[REFSDS].Np;
+    buf->mus = (float *) malloc(n1km * sizeof(float));
+    buf->height = (int16 *) malloc(n1km * sizeof(int16));
+    buf->roimask = cr->roi ? (unsigned char *) malloc(n1km) : (unsigned char *) NULL;
+    if (!buf->mus || !buf->height || (cr->roi && !buf->roimask)) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+
+    buf->rhoray = buf->sphalb = buf->TtotraytH2O = buf->tOG = (float *) NULL;
+    if (!cr->TOA) {
+        nbytes = Nbands * n1km * sizeof(float);
+
+        buf->rhoray =      (float *) malloc(nbytes);
+        buf->sphalb =      (float *) malloc(nbytes);
+        buf->TtotraytH2O = (float *) malloc(nbytes);
+        buf->tOG =         (float *) malloc(nbytes);
+
+        if (!buf->rhoray || !buf->sphalb || !buf->TtotraytH2O || !buf->tOG) {
+            (void) fputs("Error allocating memory.\n", stderr);
+            return 1;
+        }
+    }
+
+    buf->row.mus =         (float *) calloc(maxNp, sizeof(float));
+    buf->row.rhoray =      (float *) calloc(maxNp, sizeof(float));
+    buf->row.sphalb =      (float *) calloc(maxNp, sizeof(float));
+    buf->row.TtotraytH2O = (float *) calloc(maxNp, sizeof(float));
+    buf->row.tOG =         (float *) calloc(maxNp, sizeof(float));
+    buf->row.ok =          (unsigned char *) calloc(maxNp, sizeof(unsigned char));
+    if (!buf->row.mus || !buf->row.rhoray || !buf->row.sphalb ||
+        !buf->row.TtotraytH2O || !buf->row.tOG || !buf->row.ok) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ free the buffers for one scan
+
+ @param buf     scan buffers
+ @param cr      settings
+
+******************************************************************************/
+
+void free_scanbuf(SCANBUF *buf, CREFL *cr)
+{
+    int ib;
+
+    for (ib = 0; ib < Nitems; ib++)
+        if (buf->data[ib]) free(buf->data[ib]);
+    for (ib = 0; ib < Nbands; ib++)
+        if (buf->outdata[ib]) free(buf->outdata[ib]);
+
+    free(buf->mus);
+    free(buf->height);
+    if (buf->roimask) free(buf->roimask);
+
+    if (!cr->TOA) {
+        free(buf->tOG);
+        free(buf->TtotraytH2O);
+        free(buf->sphalb);
+        free(buf->rhoray);
+    }
+
+    free(buf->row.mus);
+    free(buf->row.rhoray);
+    free(buf->row.sphalb);
+    free(buf->row.TtotraytH2O);
+    free(buf->row.tOG);
+    free(buf->row.ok);
+}
+
+
+/**************************************************************************//**
+ flag the 1km pixels of a scan that don't need to be corrected, i.e. night,
+ above the max. solar zenith angle or bad geolocation, by setting their
+ solar zenith to fill.  With a region of interest, buf->roimask flags the
+ pixels in the region and the pixels more than one pixel away from it are
+ set to fill too; the others are kept as neighbours for the interpolation,
+ so the output in the region is the same as without one.
+
+ @param cr          settings
+ @param buf         scan buffers, geometry read
+ @param crscol1     first 1km column with a pixel to correct
+ @param crscol2     last 1km column with a pixel to correct
+
+ @return number of pixels to correct
+
+******************************************************************************/
+
+int mask_scan(CREFL *cr, SCANBUF *buf, int *crscol1, int *crscol2)
+{
+    SDS *sds = cr->sds;
+    int16 *solz, *solzfill;
+    float32 *lon, *lat, *lonfill, *latfill;
+    unsigned char *roimask = buf->roimask;
+    int idx, irow, jcol, i, j, near, nactive;
+    int Nl = sds[REFSDS].rowsperscan, Np = sds[REFSDS].Np;
+
+    solz = buf->data[SOLZ];
+    solzfill = sds[SOLZ].fillvalue;
+    lon = buf->data[LON];
+    lat = buf->data[LAT];
+    lonfill = sds[LON].fillvalue;
+    latfill = sds[LAT].fillvalue;
+
+    for (idx = 0; idx < Nl*Np; idx++) {
+        if (solz[idx] * sds[SOLZ].factor >= cr->maxsolz)
+            solz[idx] = *solzfill;
+
+        if (!cr->sealevel &&
+            (lon[idx] == *lonfill || lat[idx] == *latfill))
+            solz[idx] = *solzfill;
+
+        if (roimask)
+            roimask[idx] = solz[idx] != *solzfill  &&
+                lat[idx] >= cr->roilat1  &&  lat[idx] <= cr->roilat2  &&
+                ( cr->roilon1 <= cr->roilon2 ?
+                 (lon[idx] >= cr->roilon1  &&  lon[idx] <= cr->roilon2) :
+                 (lon[idx] >= cr->roilon1  ||  lon[idx] <= cr->roilon2) );
+    }
+
+    nactive = 0;
+    *crscol1 = Np;
+    *crscol2 = -1;
+    for (irow = 0; irow < Nl; irow++) {
+        for (jcol = 0; jcol < Np; jcol++) {
+            idx = irow * Np + jcol;
+            if (solz[idx] == *solzfill) continue;
+
+            if (roimask  &&  !roimask[idx]) {
+                /* keep the pixels next to the region for the interpolation */
+                near = 0;
+                for (i = irow - 1; i <= irow + 1 && !near; i++)
+                    for (j = jcol - 1; j <= jcol + 1 && !near; j++)
+                        near = i >= 0  &&  i < Nl  &&  j >= 0  &&  j < Np  &&  roimask[i * Np + j];
+                if (!near) solz[idx] = *solzfill;
+                continue;
+            }
+
+            nactive++;
+            if (jcol < *crscol1) *crscol1 = jcol;
+            if (jcol > *crscol2) *crscol2 = jcol;
+        }
+    }
+
+    return nactive;
+}
+
+
+/**************************************************************************//**
+ read a scan: the geometry first, then the bands.  With a region of
+ interest the bands are only read for the 1km columns that have pixels to
+ correct, and not at all if the scan has none; the band pixels outside
+ these columns are set to the L1B fill value so their output is fill.
+ Without one the full scan is always read, even if it is all night, so the
+ L1B missing and saturated flags are passed through for the pixels that
+ are not corrected.
+
+ @param cr          settings
+ @param iscan       scanline
+ @param buf         scan buffers
+
+ @return 0 if no errors, non-zero otherwise.
+
+******************************************************************************/
+
+int load_scan(CREFL *cr, int iscan, SCANBUF *buf)
+{
+    SDS *sds = cr->sds;
+    int ib, irow, jcol, crscol1, crscol2, aggfactor;
+    int16 *l1bdata;
+
+    if (read_scan(iscan, sds, buf->data, SOLZ, Nitems, 0, sds[REFSDS].Np - 1)) return 1;
+
+    buf->nactive = mask_scan(cr, buf, &crscol1, &crscol2);
+    if (buf->nactive == 0  &&  cr->roi) {
+        if (cr->verbose) printf("Scan %d has no pixels to correct, skipped.\n", iscan);
+        return 0;
+    }
+    if (!cr->roi) {
+        crscol1 = 0;
+        crscol2 = sds[REFSDS].Np - 1;
+    }
+
+    if (read_scan(iscan, sds, buf->data, 0, Nbands, crscol1, crscol2)) return 1;
+
+    if (crscol1 > 0  ||  crscol2 < sds[REFSDS].Np - 1) {
+        for (ib = 0; ib < Nbands; ib++) {
+            if (sds[ib].id == -1) continue;
+            aggfactor = sds[ib].Np / sds[REFSDS].Np;
+            for (irow = 0; irow < sds[ib].rowsperscan; irow++) {
+                l1bdata = (int16 *) buf->data[ib] + irow * sds[ib].Np;
+                for (jcol = 0; jcol < crscol1 * aggfactor; jcol++)
+                    l1bdata[jcol] = -1;
+                for (jcol = (crscol2 + 1) * aggfactor; jcol < sds[ib].Np; jcol++)
+                    l1bdata[jcol] = -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/**************************************************************************//**
+ compute the output of one scan from its input data
+
+ Only uses the scan buffers and read only settings, so scans can be
+ processed in parallel.
+
+ @param cr      settings
+ @param buf     scan buffers, input data read
+
+******************************************************************************/
+
+void process_scan(CREFL *cr, SCANBUF *buf)
+{
+    SDS *sds = cr->sds, *outsds = cr->outsds;
+    int16 *l1bdata[Nbands], *sola, *solz, *sena, *senz, *solzfill;
+    float32 *lon, *lat;
+    float muv, phi;
+    int ib, irow, jcol, idx, st;
+
+    solz = buf->data[SOLZ];
+    sola = buf->data[SOLA];
+    senz = buf->data[SENZ];
+    sena = buf->data[SENA];
+    solzfill = sds[SOLZ].fillvalue;
+    lon = buf->data[LON];
+    lat = buf->data[LAT];
+    for (ib = 0; ib < Nbands; ib++) l1bdata[ib] = buf->data[ib];
+
+    /* nothing to correct in the region, the bands were not read */
+    if (buf->nactive == 0  &&  cr->roi) {
+        for (ib = 0; ib < Nbands; ib++) {
+            if (! cr->process[ib]) continue;
+            for (idx = 0; idx < outsds[ib].rowsperscan * outsds[ib].Np; idx++)
+                ((int16 *)buf->outdata[ib])[idx] = *(int16 *)outsds[ib].fillvalue;
+        }
+        if (cr->enhance) enhance_scan(cr, buf);
+        return;
+    }
+
+    /* pixels to correct, see mask_scan() */
+    for (idx = 0; idx < sds[REFSDS].rowsperscan*sds[REFSDS].Np; idx++) {
+        if (solz[idx] != *solzfill) {
+            buf->mus[idx] = cos(solz[idx] * sds[SOLZ].factor * DEG2RAD);
+
+            if (cr->sealevel || cr->TOA)
+                buf->height[idx] = 0;
+            else
+                buf->height[idx] =
+                (int16) interp_dem(lat[idx],
+                                   lon[idx], cr->dem);
+        }
+    }
+
+
+    if (!cr->TOA) {
+        for (irow=0; irow<sds[REFSDS].rowsperscan; irow++) {
+            for (jcol=0; jcol<sds[REFSDS].Np; jcol++) {
+                idx = irow * sds[REFSDS].Np + jcol;
+                if (solz[idx] == *solzfill) continue;
+                phi = sola[idx] * sds[SOLA].factor - sena[idx] * sds[SENA].factor;
+                muv = cos(senz[idx] * sds[SENZ].factor * DEG2RAD);
+                if (cr->atmlut)
+                    st = getatmvariables_lut(cr->lut, buf->mus[idx], muv, phi, buf->height[idx],
+                                             cr->process,
+                                             &buf->sphalb[idx * Nbands], &buf->rhoray[idx * Nbands],
+                                             &buf->TtotraytH2O[idx * Nbands], &buf->tOG[idx * Nbands]);
+                else
+                    st = getatmvariables(buf->mus[idx], muv, phi, buf->height[idx],
+                                         cr->process,
+                                         &buf->sphalb[idx * Nbands], &buf->rhoray[idx * Nbands],
+                                         &buf->TtotraytH2O[idx * Nbands], &buf->tOG[idx * Nbands]);
+                if (st == -1)
+                    solz[idx] = *solzfill;
+            }
+        }
+    }
+
+    for (ib=0; ib<Nbands; ib++) {
+        if (! cr->process[ib]) continue;
+        for (irow=0; irow<outsds[ib].rowsperscan; irow++) {
+            idx = irow * outsds[ib].Np;
+            interp_row(&cr->upsample[ib], irow, outsds[ib].Np, sds[REFSDS].Np, ib, cr->nearest, cr->TOA,
+                       solz, *solzfill, buf->roimask, buf->mus, buf->rhoray, buf->sphalb, buf->TtotraytH2O, buf->tOG,
+                       &l1bdata[ib][idx], *(int16 *)outsds[ib].fillvalue,
+                       &((int16 *)buf->outdata[ib])[idx], &buf->row);
+            correct_row(outsds[ib].Np, cr->TOA, &l1bdata[ib][idx], sds[ib].offset, sds[ib].factor,
+                        &buf->row, cr->reflmin, cr->reflmax, outsds[ib].factor,
+                        &((int16 *)buf->outdata[ib])[idx]);
+        }
+    }
+
+    if (cr->enhance) enhance_scan(cr, buf);
 }
 
 
 /**************************************************************************//**
- This function computes the parameter Α(τR) necessary to compute Rayleigh
- spherical albedo
+ build the table for --enhance from a piecewise linear lookup table, as
+ for a GDAL VRT: "in1:out1,in2:out2,..." with the input in corrected
+ reflectance * 10000 (the int16 output), increasing, and the output in
+ 0-255.  The input below the first or above the last point is clamped.
+ The fill value maps to FILL_UINT8 and valid pixels to at least 1, so
+ the fill stays apart from dark pixels.
 
- @param tau  molecular optical depth
+ @param enhance     returns the table, indexed by the int16 value + 32768
+ @param lutstr      lookup table
+
+ @return 0 if ok, non zero on error
 
 ******************************************************************************/
 
-double fintexp3(float tau)
+int init_enhance(unsigned char **enhance, char *lutstr)
 {
-    return (expf(-tau) * (1.0F - tau) + tau * tau * fintexp1(tau)) / 2.0;
-}
+    float in[256], out[256], v;
+    int n, i, k, len;
+    char *s = lutstr;
+
+    for (n = 0; n < 256; n++) {
+        if (sscanf(s, "%g:%g%n", &in[n], &out[n], &len) != 2) return 1;
+        if (range_check(out[n], 0.0F, 255.0F)) return 1;
+        if (n > 0 && in[n] <= in[n - 1]) return 1;
+        s += len;
+        if (*s == '\0') break;
+        if (*s++ != ',') return 1;
+    }
+    if (n++ == 256) return 1;
 
+    if ( !(*enhance = (unsigned char *) malloc(65536)) ) {
+        (void) fputs("Error allocating memory.\n", stderr);
+        return 1;
+    }
 
-/**************************************************************************//**
-This function computes the molecular atmospheric reflectance 
+    for (i = 0, k = 0; i < 65536; i++) {
+        v = i - 32768;
+        while (k < n - 1 && v > in[k + 1]) k++;
+        if (n == 1 || v <= in[0])
+            v = out[0];
+        else if (v >= in[n - 1])
+            v = out[n - 1];
+        else
+            v = out[k] + (out[k + 1] - out[k]) * (v - in[k]) / (in[k + 1] - in[k]);
+        v = floor(v + 0.5);
+        (*enhance)[i] = (v < 1) ? 1 : (unsigned char) v;
+    }
+    (*enhance)[FILL_INT16 + 32768] = FILL_UINT8;
 
- @param phi     azimuthal difference between sun and observation in degree
-                (phi=0 in backscattering direction)
- @param mus     cosine of the sun zenith angle
- @param muv     cosine of the observation zenith angle
- @param taur    molecular optical depth
- @param rhoray  molecular path reflectance
- @param trup
- @param trdown
- @param process array of true/false bands to flag as proccess
- constant xdep: depolarization factor (0.0279)
- xfd = (1-xdep/(2-xdep)) / (1 + 2*xdep/(2-xdep)) = 2 * (1 - xdep) / (2 + xdep) = 0.958725775
-******************************************************************************/
+    return 0;
+}
 
-void chand(float phi,
-           float muv,
-           float mus,
-           float *taur,
-           float *rhoray,
-           float *trup,
-           float *trdown,
-           unsigned char *process)
-{
 
-    const double xfd = 0.958725775;
-    const float xbeta2 = 0.5F;
-    float pl[5];
-    double fs01, fs02, fs0, fs1,fs2;
-    const float as0[10] = {0.33243832F, 0.16285370F, -0.30924818F, -0.10324388F,
-        0.11493334F, -6.777104e-02F, 1.577425e-03F, -1.240906e-02F,
-        3.241678e-02F, -3.503695e-02F};
-    const float as1[2] = {0.19666292F, -5.439061e-02F};
-    const float as2[2] = {0.14545937F,-2.910845e-02F};
-    float phios, xcos1, xcos2, xcos3;
-    float xph1, xph2, xph3, xitm1, xitm2;
-    float xlntaur, xitot1, xitot2, xitot3;
-    int i,ib;
+/**************************************************************************//**
+ enhance the corrected reflectance of a scan to bytes, in place
 
-    phios = phi + 180.0F;
-    xcos1 = 1.0F;
-    xcos2 = cos(phios * DEG2RAD);
-    xcos3 = cos(2.0 * phios * DEG2RAD);
-    xph1 = 1.0 + (3.0F * mus * mus - 1.0F) * (3.0F * muv * muv - 1.0F) * xfd / 8.0;
-    xph2 = - xfd * xbeta2 * 1.5 * mus * muv * sqrtf(1.0F - mus * mus) * sqrtf(1.0F - muv * muv);
-    xph3 =   xfd * xbeta2 * 0.375 * (1.0F - mus * mus) * (1.0F - muv * muv);
+ @param cr      settings
+ @param buf     scan buffers, output computed
 
-    pl[0] = 1.0F;
-    pl[1] = mus + muv;
-    pl[2] = mus * muv;
-    pl[3] = mus * mus + muv * muv;
-    pl[4] = mus * mus * muv * muv;
+******************************************************************************/
 
-    fs01 = fs02 = 0.0;
-    for (i = 0; i < 5; i++) {
-        fs01 += (double) (pl[i] * as0[i]);
-        fs02 += (double) (pl[i] * as0[5 + i]);
-    }
+void enhance_scan(CREFL *cr, SCANBUF *buf)
+{
+    SDS *outsds = cr->outsds;
+    int16 *refl;
+    uint8 *out;
+    int ib, idx, n;
 
     for (ib = 0; ib < Nbands; ib++) {
-        if (process[ib]) {
-            xlntaur = logf(taur[ib]);
-            fs0 = fs01 + fs02 * xlntaur;
-            fs1 = as1[0] + xlntaur * as1[1];
-            fs2 = as2[0] + xlntaur * as2[1];
-            trdown[ib] = expf(-taur[ib]/mus);
-            trup[ib]   = expf(-taur[ib]/muv);
-            xitm1 = (1.0F - trdown[ib] * trup[ib]) / 4.0F / (mus + muv);
-            xitm2 = (1.0F - trdown[ib]) * (1.0F - trup[ib]);
-            xitot1 = xph1 * (xitm1 + xitm2 * fs0);
-            xitot2 = xph2 * (xitm1 + xitm2 * fs1);
-            xitot3 = xph3 * (xitm1 + xitm2 * fs2);
-            rhoray[ib] = xitot1 * xcos1 + xitot2 * xcos2 * 2.0F + xitot3 * xcos3 * 2.0F;
-        }
+        if (! cr->process[ib]) continue;
+        refl = (int16 *) buf->outdata[ib];
+        out = (uint8 *) buf->outdata[ib];
+        n = outsds[ib].rowsperscan * outsds[ib].Np;
+
+        /* out[idx] only overlaps refl[idx / 2], already read */
+        for (idx = 0; idx < n; idx++)
+            out[idx] = cr->enhance[refl[idx] + 32768];
     }
-
 }
 
+
 /**************************************************************************//**
+ pipeline reader thread: read the scans in order into free scan buffers
 
- @param mus             cosine of the sun zenith angle
- @param muv             cosine of the observation zenith angle
- @param phi             azimuthal difference between sun and observation in degree
-                        (phi=0 in backscattering direction)
- @param height
- @param process         array of true/false bands to flag as proccess
- @param sphalb          spherical albedo correction table
- @param rhoray          molecular path reflectance
- @param TtotraytH2O
- @param tOG
+ @param arg     pipeline
+
+ @return NULL
 
 ******************************************************************************/
 
-int getatmvariables(float mus,
-                    float muv,
-                    float phi,
-                    int16 height,
-                    unsigned char *process,
-                    float *sphalb,
-                    float *rhoray,
-                    float *TtotraytH2O,
-                    float *tOG)
+static void *pipeline_reader(void *arg)
 {
-    double m, Ttotrayu, Ttotrayd, tO3, tO2, tH2O;
-    float psurfratio;
-    int j, ib;
-    /*
-     Values for bands 9-16 below provided by B Murch and C Hu Univ South Florida
-     IMaRS, obtained from SEADAS.
-     For the moment I've retained the Jacques values for 1-8 but show the differing
-     SEADAS values in the commented out line.
-     */
-    const float aH2O[Nbands]={ -5.60723, -5.25251, 0, 0, -6.29824, -7.70944, -3.91877, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    const float bH2O[Nbands]={ 0.820175, 0.725159, 0, 0, 0.865732, 0.966947, 0.745342, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    /*const float aO3[Nbands]={ 0.0711,    0.00313, 0.0104,     0.0930,   0, 0, 0, 0.00244, 0.00383, 0.0225, 0.0663, 0.0836, 0.0485, 0.0395, 0.0119, 0.00263};*/
-    const float aO3[Nbands]={ 0.0715289, 0,       0.00743232, 0.089691, 0, 0, 0, 0.001,   0.00383, 0.0225, 0.0663, 0.0836, 0.0485, 0.0395, 0.0119, 0.00263};
-    /*const float taur0[Nbands] = { 0.0507,  0.0164,  0.1915,  0.0948,  0.0036,  0.0012,  0.0004,  0.3109, 0.2375, 0.1596, 0.1131, 0.0994, 0.0446, 0.0416, 0.0286, 0.0155};*/
-    const float taur0[Nbands] = { 0.05100, 0.01631, 0.19325, 0.09536, 0.00366, 0.00123, 0.00043, 0.3139, 0.2375, 0.1596, 0.1131, 0.0994, 0.0446, 0.0416, 0.0286, 0.0155};
+    PIPELINE *p = (PIPELINE *) arg;
+    SCANBUF *buf;
+    int iscan, st;
+
+    for (iscan = 0; ; iscan++) {
+        buf = &p->scan[iscan % p->nbuf];
+
+        /* Nscans is lowered to stop the pipeline on an error */
+        pthread_mutex_lock(&p->lock);
+        while (iscan < p->Nscans  &&  buf->state != SCAN_FREE)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (iscan >= p->Nscans) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
 
-    float taur[Nbands], trup[Nbands], trdown[Nbands];
-    static float sphalb0[MAXNUMSPHALBVALUES];
-    static char first_time = TRUE;
+        if ((iscan % NUM1KMROWPERSCAN == 0) && p->verbose)
+            printf("Processing scan %d...\n", iscan);
 
+        pthread_mutex_lock(&p->hdflock);
+        st = load_scan(p->cr, iscan, buf);
+        pthread_mutex_unlock(&p->hdflock);
 
-    if (first_time) {
-        sphalb0[0] = 0.0F;
-        for(j = 1; j < MAXNUMSPHALBVALUES; j++)
-            sphalb0[j] = csalbr(j * TAUSTEP4SPHALB);
-        first_time = FALSE;
+        /* stop at the first scan that can't be read, as the serial loop does */
+        pthread_mutex_lock(&p->lock);
+        if (st) {
+            if (iscan < p->Nscans)
+                p->Nscans = iscan;
+        }
+        else
+            buf->state = SCAN_READ;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        if (st) break;
     }
 
-    m = 1.0 / mus + 1.0 / muv;
-    if (m > MAXAIRMASS) return -1;
+    return NULL;
+}
 
-    psurfratio = expf(-height / (float) SCALEHEIGHT);
-    for (ib = 0; ib < Nbands; ib++)
-        if (process[ib]) taur[ib] = taur0[ib] * psurfratio;
 
-    chand(phi, muv, mus, taur, rhoray, trup, trdown, process);
+/**************************************************************************//**
+ pipeline worker thread: process the scans that have been read
 
-    for (ib = 0; ib < Nbands; ib++) {
-        if (!process[ib]) continue;
+ @param arg     pipeline
 
-        if (taur[ib] / TAUSTEP4SPHALB >= MAXNUMSPHALBVALUES) {
-            sphalb[ib] = -1.0F;
-            /* Use sphalb as flag to indicate atm variables are not computed successfully */
-            continue;
+ @return NULL
+
+******************************************************************************/
+
+static void *pipeline_worker(void *arg)
+{
+    PIPELINE *p = (PIPELINE *) arg;
+    SCANBUF *buf;
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (p->next < p->Nscans  &&  p->scan[p->next % p->nbuf].state != SCAN_READ)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->next >= p->Nscans) {
+            pthread_mutex_unlock(&p->lock);
+            break;
         }
+        buf = &p->scan[p->next % p->nbuf];
+        buf->state = SCAN_BUSY;
+        p->next++;
+        pthread_mutex_unlock(&p->lock);
 
-        sphalb[ib] = sphalb0[(int)(taur[ib] / TAUSTEP4SPHALB + 0.5)];
-        Ttotrayu = ((2 / 3. + muv) + (2 / 3. - muv) * trup[ib])   / (4 / 3. + taur[ib]);
-        Ttotrayd = ((2 / 3. + mus) + (2 / 3. - mus) * trdown[ib]) / (4 / 3. + taur[ib]);
-        tO3 = tO2 = tH2O = 1.0;
-        if (aO3[ib] != 0) tO3 = exp(-m * UO3 * aO3[ib]);
-        if (bH2O[ib] != 0) tH2O = exp(-exp(aH2O[ib] + bH2O[ib] * log(m * UH2O)));
-        /*
-         t02 = exp(-m * aO2);
-         */
-        TtotraytH2O[ib] = Ttotrayu * Ttotrayd * tH2O;
-        tOG[ib] = tO3 * tO2;
-    }
+        process_scan(p->cr, buf);
 
-    return 0;
+        pthread_mutex_lock(&p->lock);
+        buf->state = SCAN_DONE;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
 
+    return NULL;
 }
 
 
 /**************************************************************************//**
+ process all scans with a reader thread and nthreads worker threads, the
+ calling thread writes the scans in order.  Only the reader and the writer
+ call the HDF library, one at a time, so the output is the same as the
+ serial loop in main().  On an error the threads are stopped and joined
+ before returning, as they use the scan buffers.
+
+ @param cr          settings
+ @param scan        scan buffers, nthreads + 2
+ @param nthreads    number of worker threads
+ @param Nscans      number of scans
+ @param verbose     non zero to print extra info
 
- @param refl
- @param TtotraytH2O
- @param tOG
- @param rhoray          molecular path reflectance
- @param sphalb          spherical albedo correction table
-
- @return corrected reflectance
+ @return 0 if ok, non zero on error
 
 ******************************************************************************/
 
-float correctedrefl(float refl,
-                    float TtotraytH2O,
-                    float tOG,
-                    float rhoray,
-                    float sphalb)
+int run_pipeline(CREFL *cr, SCANBUF *scan, int nthreads, int Nscans, int verbose)
 {
-    float corr_refl;
+    PIPELINE p;
+    pthread_t reader, worker[MAXTHREADS];
+    SCANBUF *buf;
+    int iscan = 0, it, havereader, nworkers = 0, st = 0;
+
+    p.cr = cr;
+    p.scan = scan;
+    p.nbuf = nthreads + 2;
+    p.Nscans = Nscans;
+    p.next = 0;
+    p.verbose = verbose;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    pthread_mutex_init(&p.hdflock, NULL);
+
+    havereader = ! pthread_create(&reader, NULL, pipeline_reader, &p);
+    if (! havereader) {
+        (void) fputs("Cannot create reader thread.\n", stderr);
+        st = 1;
+    }
+    for (it = 0; ! st  &&  it < nthreads; it++) {
+        if (pthread_create(&worker[it], NULL, pipeline_worker, &p)) {
+            (void) fputs("Cannot create worker thread.\n", stderr);
+            st = 1;
+        }
+        else
+            nworkers++;
+    }
 
-    corr_refl = (refl / tOG - rhoray) / TtotraytH2O;
-    corr_refl /= (1.0F + corr_refl * sphalb);
-    return corr_refl;
+    for (; ! st; iscan++) {
+        buf = &scan[iscan % p.nbuf];
+
+        pthread_mutex_lock(&p.lock);
+        while (iscan < p.Nscans  &&  buf->state != SCAN_DONE)
+            pthread_cond_wait(&p.cond, &p.lock);
+        if (iscan >= p.Nscans) {
+            pthread_mutex_unlock(&p.lock);
+            break;
+        }
+        pthread_mutex_unlock(&p.lock);
+
+        /* write current scan line for all processed bands */
+        pthread_mutex_lock(&p.hdflock);
+        st = write_scan(iscan, cr->process, cr->outsds, buf->outdata);
+        pthread_mutex_unlock(&p.hdflock);
+        if (st) break;
+
+        pthread_mutex_lock(&p.lock);
+        buf->state = SCAN_FREE;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    /* on an error stop the reader and workers at the scan that failed (scan
+     0 if they could not all be started), they finish the scan in hand */
+    if (st) {
+        pthread_mutex_lock(&p.lock);
+        if (iscan < p.Nscans)
+            p.Nscans = iscan;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    if (havereader)
+        (void) pthread_join(reader, NULL);
+    for (it = 0; it < nworkers; it++)
+        (void) pthread_join(worker[it], NULL);
+
+    pthread_mutex_destroy(&p.hdflock);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+
+    return st;
 }
 
 /**************************************************************************//**
@@ -1473,7 +3649,9 @@ float correctedrefl(float refl,
  @param process  array of true/false bands to flag as proccess
  @param outsds   output subdataset array
  @param sds      input subdataset array
- @param gzip     non zero if the output is gziped
+ @param compress COMPRESS_NONE, COMPRESS_SZIP or deflate level 1-9
+ @param enhancelut  lookup table for 8-bit enhanced output, NULL for the
+                    corrected reflectance
  @param verbose  non zero to prinx extra info
 
  @return 0 if ok, non zero on error
@@ -1484,11 +3662,13 @@ int init_output_sds(int32 sd_id,
                     unsigned char *process,
                     SDS outsds[Nbands],
                     SDS sds[Nitems],
-                    int gzip,
+                    int compress,
+                    char *enhancelut,
                     int verbose)
 {
     int ib;
     int32 dim_id;
+    uint32 szip_config;
     char *dimname1, *dimname2;
 
     HDF_CHUNK_DEF chunk_def;
@@ -1496,6 +3676,7 @@ int init_output_sds(int32 sd_id,
 
     /* same fill value will be used for all output SDSs */
     static int16 fillvalue = FILL_INT16;
+    static uint8 enhancefill = FILL_UINT8;
 
     /* band naming convention will be "CorrRefl_XX"
      (11 characters + terminating null) */
@@ -1506,7 +3687,9 @@ int init_output_sds(int32 sd_id,
     for (ib = 0; ib < Nbands; ib++) {
         if (!process[ib]) continue;
 
-        outsds[ib].num_type = DFNT_INT16;
+        /* the factor and fill value are those of the corrected reflectance,
+         also with --enhance as the bytes are made from it */
+        outsds[ib].num_type = enhancelut ? DFNT_UINT8 : DFNT_INT16;
         outsds[ib].factor = 0.0001;
         outsds[ib].offset = 0;
         outsds[ib].rank = 2;
@@ -1527,11 +3710,17 @@ int init_output_sds(int32 sd_id,
                                       }
 
         outsds[ib].fillvalue = &fillvalue;
-        if ( SDsetfillvalue(outsds[ib].id, outsds[ib].fillvalue) ) {
+        if ( SDsetfillvalue(outsds[ib].id, enhancelut ? (void *) &enhancefill : outsds[ib].fillvalue) ) {
             fprintf(stderr, "Cannot write fill value of SDS %s\n", outsds[ib].name);
             return 1;
         }
-        if ( SDsetattr(outsds[ib].id, "scale_factor", DFNT_FLOAT64, 1, &outsds[ib].factor) == -1  ||
+        if (enhancelut) {
+            if ( SDsetattr(outsds[ib].id, "enhancement_lut", DFNT_CHAR8, strlen(enhancelut), enhancelut) == -1 ) {
+                fprintf(stderr, "Cannot write enhancement lookup table of SDS \"%s\"\n",  outsds[ib].name);
+                return 1;
+            }
+        }
+        else if ( SDsetattr(outsds[ib].id, "scale_factor", DFNT_FLOAT64, 1, &outsds[ib].factor) == -1  ||
             SDsetattr(outsds[ib].id, "add_offset",   DFNT_FLOAT64, 1, &outsds[ib].offset) == -1 ) {
                 fprintf(stderr, "Cannot write scale factor and offset of SDS \"%s\"\n",  outsds[ib].name);
                 return 1;
@@ -1546,23 +3735,31 @@ int init_output_sds(int32 sd_id,
         outsds[ib].edges[0] = outsds[ib].rowsperscan;
         outsds[ib].edges[1] = outsds[ib].Np;
 
-        /* allocate memory for band output data */
-        outsds[ib].data = malloc(outsds[ib].rowsperscan * outsds[ib].Np * DFKNTsize(outsds[ib].num_type));
-        if (!outsds[ib].data) {
-            fputs("Error allocating memory.\n", stderr);
-            return 1;
-        }
-
-        /* set optional compression */
-        if (gzip) {
+        /* set optional compression, one chunk per scan so write_scan()
+         can hand whole chunks to the compressor */
+        outsds[ib].chunked = 0;
+        if (compress != COMPRESS_NONE) {
             chunk_def.chunk_lengths[0] = chunk_def.comp.chunk_lengths[0] = outsds[ib].edges[0];
             chunk_def.chunk_lengths[1] = chunk_def.comp.chunk_lengths[1] = outsds[ib].edges[1];
-            chunk_def.comp.comp_type = COMP_CODE_DEFLATE;
-            chunk_def.comp.cinfo.deflate.level = 4;
+            if (compress == COMPRESS_SZIP) {
+                if (HCget_config_info(COMP_CODE_SZIP, &szip_config) == FAIL  ||
+                    !(szip_config & COMP_ENCODER_ENABLED)) {
+                    fputs("Szip compression is not available in this HDF library.\n", stderr);
+                    return 1;
+                }
+                chunk_def.comp.comp_type = COMP_CODE_SZIP;
+                chunk_def.comp.cinfo.szip.options_mask = SZ_NN_OPTION_MASK;
+                chunk_def.comp.cinfo.szip.pixels_per_block = 16;
+            }
+            else {
+                chunk_def.comp.comp_type = COMP_CODE_DEFLATE;
+                chunk_def.comp.cinfo.deflate.level = compress;
+            }
             if (SDsetchunk(outsds[ib].id, chunk_def, HDF_CHUNK | HDF_COMP) == FAIL) {
                 fprintf(stderr, "Cannot set chunks for SDS %s\n", outsds[ib].name);
                 return 1;
             }
+            outsds[ib].chunked = 1;
         }
 
 
@@ -1605,6 +3802,7 @@ int init_output_sds(int32 sd_id,
  @param sealevel
  @param TOA
  @param nearest
+ @param atmlut       non zero if the atmospheric lookup table was used
 
  @return 0 if no errors, non-zero otherwise.
 
@@ -1617,7 +3815,8 @@ int write_global_attributes(int32 sd_id,
                             float maxsolz,
                             int sealevel,
                             int TOA,
-                            int nearest)
+                            int nearest,
+                            int atmlut)
 {
     char *ptr;
     int j;
@@ -1657,6 +3856,109 @@ int write_global_attributes(int32 sd_id,
     if (SDsetattr(sd_id, "toa", DFNT_UINT8, 1, &u8)) return 1;
     u8 = (uint8) nearest;
     if (SDsetattr(sd_id, "nearest", DFNT_UINT8, 1, &u8)) return 1;
+    u8 = (uint8) atmlut;
+    if (SDsetattr(sd_id, "atmlut", DFNT_UINT8, 1, &u8)) return 1;
+
+    return 0;
+}
+
+/**************************************************************************//**
+ create raw output files, one per band named <filename>_CorrRefl_XX.img,
+ with ENVI headers so GDAL can read them
+
+ @param filename    output file name
+ @param process     array of true/false bands to flag as proccess
+ @param outsds      output subdataset array
+ @param sds         input subdataset array
+ @param overwrite   non zero to overwrite existing files
+ @param enhancelut  lookup table for 8-bit enhanced output, NULL for the
+                    corrected reflectance
+ @param verbose     non zero to prinx extra info
+
+ @return 0 if ok, non zero on error
+
+******************************************************************************/
+
+int init_output_raw(char *filename,
+                    unsigned char *process,
+                    SDS outsds[Nbands],
+                    SDS sds[Nitems],
+                    int overwrite,
+                    char *enhancelut,
+                    int verbose)
+{
+    int ib, one = 1;
+    FILE *fp;
+
+    /* same fill value will be used for all output bands, see init_output_sds() */
+    static int16 fillvalue = FILL_INT16;
+
+    char name[16];
+    char rawname[MAXNAMELENGTH + 32], hdrname[MAXNAMELENGTH + 32];
+
+
+    for (ib = 0; ib < Nbands; ib++) {
+        if (!process[ib]) continue;
+
+        outsds[ib].num_type = enhancelut ? DFNT_UINT8 : DFNT_INT16;
+        outsds[ib].factor = 0.0001;
+        outsds[ib].offset = 0;
+        outsds[ib].rank = 2;
+        outsds[ib].fillvalue = &fillvalue;
+
+        sprintf(name, "CorrRefl_%2.2d", ib + 1);
+        if ( !(outsds[ib].name = strdup(name)) ) return 1;
+
+        outsds[ib].Nl = outsds[ib].dim_sizes[0] = sds[ib].Nl;
+        outsds[ib].Np = outsds[ib].dim_sizes[1] = sds[ib].Np;
+        outsds[ib].rowsperscan = sds[ib].rowsperscan;
+
+        if (strlen(filename) > MAXNAMELENGTH) {
+            fprintf(stderr, "Output file name %s is too long.\n", filename);
+            return 1;
+        }
+        sprintf(rawname, "%s_%s.img", filename, name);
+        sprintf(hdrname, "%s_%s.hdr", filename, name);
+
+        if (!overwrite && (fp = fopen(rawname, "r"))) {
+            (void) fclose(fp);
+            fprintf(stderr, "File \"%s\" already exits.\n", rawname);
+            return 1;
+        }
+        if (verbose)
+            printf("Creating %s: %dx%d\n", rawname, outsds[ib].Np, outsds[ib].Nl);
+
+        if ( !(fp = fopen(hdrname, "w")) ) {
+            fprintf(stderr, "Cannot open output file %s.\n", hdrname);
+            return 1;
+        }
+        fprintf(fp, "ENVI\n"
+                "description = {crefl %s}\n"
+                "samples = %d\n"
+                "lines = %d\n"
+                "bands = 1\n"
+                "header offset = 0\n"
+                "file type = ENVI Standard\n"
+                "data type = %d\n"
+                "interleave = bsq\n"
+                "byte order = %d\n"
+                "band names = {%s}\n"
+                "data ignore value = %d\n",
+                name, outsds[ib].Np, outsds[ib].Nl, enhancelut ? 1 : 2,
+                *(char *) &one ? 0 : 1, name,
+                enhancelut ? FILL_UINT8 : FILL_INT16);
+        if (!enhancelut)
+            fprintf(fp, "reflectance scale factor = %g\n", 1.0 / outsds[ib].factor);
+        if (fclose(fp)) {
+            fprintf(stderr, "Cannot write output file %s.\n", hdrname);
+            return 1;
+        }
+
+        if ( !(outsds[ib].fp = fopen(rawname, "wb")) ) {
+            fprintf(stderr, "Cannot open output file %s.\n", rawname);
+            return 1;
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,177 @@
+/*************************************************************************
+Description:
+
+  Compare two crefl output files SDS by SDS: for every SDS of the first
+  file, report the largest absolute DN difference to the same SDS of the
+  second file, the number of pixels that differ and the number of pixels
+  that are fill in only one of the files.  Used by bench_crefl.sh to check
+  optimized code paths against the reference ones.
+
+Notes:
+
+  1. The DN difference is taken over the pixels that are not fill in either
+     file; a pixel that is fill in one file only is counted separately and
+     not in the maximum.
+  2. The last line of the report is "max <DN difference> <fill mismatches>"
+     over all SDSs.  The exit status is 0 if the files have the same SDSs
+     (with the same size), 1 otherwise.
+
+Revision history:
+
+  Version 1.0   10/26   Original Development
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mfhdf.h"
+
+typedef struct {
+    int32 id;
+    int32 rank;
+    int32 dims[MAX_VAR_DIMS];
+    int32 type;
+    double fill;
+    int hasfill;
+} SDS;
+
+static void usage(void)
+{
+    printf("\n");
+    printf("Usage: crefldiff <crefl output file> <crefl output file>\n");
+    printf("\n");
+}
+
+static void fatal(const char *msg, const char *arg)
+{
+    fprintf(stderr, "crefldiff: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+}
+
+/* Value of element i of a buffer of an HDF integer or float32 type */
+static double value(const void *buf, int32 type, size_t i)
+{
+    switch (type) {
+        case DFNT_INT8:    return ((const int8 *)buf)[i];
+        case DFNT_UINT8:   return ((const uint8 *)buf)[i];
+        case DFNT_INT16:   return ((const int16 *)buf)[i];
+        case DFNT_UINT16:  return ((const uint16 *)buf)[i];
+        case DFNT_INT32:   return ((const int32 *)buf)[i];
+        case DFNT_UINT32:  return ((const uint32 *)buf)[i];
+        case DFNT_FLOAT32: return ((const float32 *)buf)[i];
+    }
+    return 0.0;
+}
+
+/* Select an SDS and get its size, type and fill value */
+static int get_sds(int32 sd_id, int32 index, char *name, SDS *sds)
+{
+    int32 nattr;
+    char fill[8];
+
+    if ((sds->id = SDselect(sd_id, index)) == FAIL)
+        return 1;
+    if (SDgetinfo(sds->id, name, &sds->rank, sds->dims, &sds->type,
+                  &nattr) == FAIL)
+        return 1;
+    sds->hasfill = (SDgetfillvalue(sds->id, fill) == SUCCEED);
+    sds->fill = sds->hasfill ? value(fill, sds->type, 0) : 0.0;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int32 sd_id1, sd_id2, nsds, nattr, index, start[MAX_VAR_DIMS];
+    char name[MAX_NC_NAME];
+    SDS sds1, sds2;
+    void *buf1, *buf2;
+    size_t n, i, ndiff, nfill;
+    double v1, v2, diff, maxdiff, allmaxdiff = 0.0;
+    size_t allnfill = 0;
+    int isds, k, fill1, fill2, status = 0;
+
+    if (argc != 3) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if ((sd_id1 = SDstart(argv[1], DFACC_READ)) == FAIL)
+        fatal("can't open", argv[1]);
+    if ((sd_id2 = SDstart(argv[2], DFACC_READ)) == FAIL)
+        fatal("can't open", argv[2]);
+    if (SDfileinfo(sd_id1, &nsds, &nattr) == FAIL)
+        fatal("can't get SDSs of", argv[1]);
+
+    for (isds = 0; isds < nsds; isds++) {
+        if (get_sds(sd_id1, isds, name, &sds1))
+            fatal("can't get SDS info from", argv[1]);
+
+        if ((index = SDnametoindex(sd_id2, name)) == FAIL) {
+            printf("%-24s missing\n", name);
+            SDendaccess(sds1.id);
+            status = 1;
+            continue;
+        }
+        if (get_sds(sd_id2, index, name, &sds2))
+            fatal("can't get SDS info from", argv[2]);
+
+        n = 1;
+        for (k = 0; k < sds1.rank; k++) {
+            if (sds1.rank != sds2.rank || sds1.dims[k] != sds2.dims[k])
+                n = 0;
+            n *= (size_t)sds1.dims[k];
+            start[k] = 0;
+        }
+        if (n == 0) {
+            printf("%-24s size differs\n", name);
+            SDendaccess(sds1.id);
+            SDendaccess(sds2.id);
+            status = 1;
+            continue;
+        }
+
+        buf1 = malloc(n * DFKNTsize(sds1.type));
+        buf2 = malloc(n * DFKNTsize(sds2.type));
+        if (buf1 == NULL || buf2 == NULL)
+            fatal("allocating SDS buffers for", name);
+        if (SDreaddata(sds1.id, start, NULL, sds1.dims, buf1) == FAIL)
+            fatal("can't read SDS", name);
+        if (SDreaddata(sds2.id, start, NULL, sds2.dims, buf2) == FAIL)
+            fatal("can't read SDS", name);
+
+        maxdiff = 0.0;
+        ndiff = nfill = 0;
+        for (i = 0; i < n; i++) {
+            v1 = value(buf1, sds1.type, i);
+            v2 = value(buf2, sds2.type, i);
+            fill1 = sds1.hasfill && v1 == sds1.fill;
+            fill2 = sds2.hasfill && v2 == sds2.fill;
+            if (fill1 != fill2) {
+                nfill++;
+                continue;
+            }
+            diff = fabs(v1 - v2);
+            if (diff > 0.0) ndiff++;
+            if (diff > maxdiff) maxdiff = diff;
+        }
+        printf("%-24s maxdiff %g ndiff %lu fill mismatch %lu of %lu\n", name,
+               maxdiff, (unsigned long)ndiff, (unsigned long)nfill,
+               (unsigned long)n);
+
+        if (maxdiff > allmaxdiff) allmaxdiff = maxdiff;
+        allnfill += nfill;
+
+        free(buf1);
+        free(buf2);
+        SDendaccess(sds1.id);
+        SDendaccess(sds2.id);
+    }
+
+    SDend(sd_id1);
+    SDend(sd_id2);
+
+    printf("max %g %lu\n", allmaxdiff, (unsigned long)allnfill);
+    exit(status);
+}
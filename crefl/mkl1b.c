@@ -0,0 +1,576 @@
+/*************************************************************************
+Description:
+
+  Generate a synthetic MODIS L1B granule (MOD021KM, MOD02HKM, MOD02QKM)
+  with the geometry SDSs and scaled reflectances crefl reads, and
+  optionally a synthetic DEM (tbase.hdf), for benchmarking crefl without
+  real data.
+
+Notes:
+
+  1. The scan geometry is the whisk-broom model of a 705 km circular orbit
+     used by the MRTSwath mkswath generator: each scan of 10 (1 km)
+     detectors sweeps +/-55 degrees across track, with bowtie overlap
+     towards the swath edges.  Earth rotation is ignored.
+  2. The sensor angles come from the scan angle and the direction to the
+     sub-satellite point; the solar angles from a fixed sub-solar point
+     (the sun does not move during the granule).  Pixels with a solar
+     zenith angle above 90 degrees are night and get the fill value.
+  3. Like real granules the angles and lat/long are on the 5 km grid
+     (frames 2, 7, ... 1352 of detectors 2 and 7 of each scan) by default;
+     -geores=1 puts them on the 1 km grid instead.
+  4. The reflectance field is a smooth function of lat/long and band, with
+     brighter "cloud" patches, scaled to DNs with the usual L1B offsets.  A
+     small fraction of the pixels (-bad) get the L1B saturated or missing
+     values, spread over the bands so every band has some.
+  5. The files are named MOD021KM.<granule id>.hdf etc. so crefl recognises
+     them; the DEM is tbase.hdf, found by crefl with ANCPATH=<output dir>.
+
+Revision history:
+
+  Version 1.0   10/26   Original Development
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mfhdf.h"
+
+#ifndef PI
+#define PI (3.141592653589793238)
+#endif
+#define RAD (PI / 180.0)
+#define DEG (180.0 / PI)
+
+#define EARTH_RADIUS    6371.007        /* km */
+#define ORBIT_HEIGHT    705.0           /* km */
+#define SCAN_ANGLE_MAX  55.0            /* degrees */
+#define NDET_1KM        10              /* 1 km detectors per scan */
+#define NFRAME_1KM      1354            /* 1 km frames per scan */
+#define NSCAN_DEFAULT   203             /* scans per 5 minute granule */
+#define GEO5KM_OFFSET   2               /* first 5 km sample, 1 km pixels */
+#define GEO5KM_STEP     5
+
+#define DATA_FILL       65535           /* L1B _FillValue */
+#define DATA_MISSING    65534           /* L1B missing, -2 as int16 */
+#define DATA_SATURATED  65533           /* L1B saturated, -3 as int16 */
+#define DATA_MAX        32767           /* largest valid L1B DN */
+#define REFL_OFFSET     316.9722        /* reflectance_offsets */
+#define ANGLE_SCALE     0.01            /* angle scale_factor */
+#define ANGLE_FILL      (-32767)
+#define GEO_FILL        (-999.0)
+
+#define DEM_NL          1080            /* tbase.hdf: 10 arc-minute grid */
+#define DEM_NP          2160
+
+/* Geometry of the synthetic orbit */
+
+typedef struct {
+    double p0[3];       /* Unit vector to the first sub-satellite point */
+    double t0[3];       /* Unit vector along track at the first point */
+    double n0[3];       /* Unit vector to the orbit pole */
+    double sun[3];      /* Unit vector to the sub-solar point */
+} ORBIT;
+
+/* Geometry at a pixel */
+
+typedef struct {
+    double lat, lon;
+    double solz, sola, senz, sena;      /* degrees */
+} PIXEL;
+
+/* Predefined orbits: name, start lat, start long, heading (degrees) */
+
+static const struct {
+    const char *name;
+    double lat0, lon0, heading;
+} orbit_preset[] = {
+    {"midlat",   55.0,  -95.0, 193.0},
+    {"equator",   9.0,   10.0, 193.0},
+    {"polar",    72.0,   20.0, 352.0},
+    {"dateline", 10.0,  178.0, 193.0},
+    {NULL, 0.0, 0.0, 0.0}
+};
+
+/* L1B reflective solar band SDSs, in crefl band order within each file */
+
+static const struct {
+    const char *name;
+    int ires;           /* relative resolution: 1, 2 or 4 */
+    int nband;
+    int band1;          /* first band (for the reflectance field) */
+} l1b_sds[] = {
+    {"EV_250_Aggr1km_RefSB", 1,  2, 1},
+    {"EV_500_Aggr1km_RefSB", 1,  5, 3},
+    {"EV_1KM_RefSB",         1, 15, 8},
+    {"EV_250_Aggr500_RefSB", 2,  2, 1},
+    {"EV_500_RefSB",         2,  5, 3},
+    {"EV_250_RefSB",         4,  2, 1},
+    {NULL, 0, 0, 0}
+};
+
+static void usage(void)
+{
+    printf("\n");
+    printf("Usage: mkl1b [-orbit=midlat|equator|polar|dateline]\n");
+    printf("             [-lat0=<deg> -lon0=<deg> -heading=<deg>]\n");
+    printf("             [-sunlat=<deg>] [-sunlon=<deg>] [-nscan=<scans>]\n");
+    printf("             [-geores=5|1] [-bad=<percent>] [-id=<granule id>]\n");
+    printf("             [-dem] <output directory>\n");
+    printf("\n");
+    printf("Writes MOD021KM.<id>.hdf, MOD02HKM.<id>.hdf and MOD02QKM.<id>.hdf\n");
+    printf("(id A2026001.0000 by default) and, with -dem, tbase.hdf to the\n");
+    printf("output directory.\n");
+    printf("\n");
+}
+
+static void fatal(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mkl1b: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+}
+
+static void cross(const double a[3], const double b[3], double c[3])
+{
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static void unit_vector(double lat, double lon, double v[3])
+{
+    v[0] = cos(lat * RAD) * cos(lon * RAD);
+    v[1] = cos(lat * RAD) * sin(lon * RAD);
+    v[2] = sin(lat * RAD);
+}
+
+/* Set up the orbit from the start point and heading, and the sun */
+static void setup_orbit(ORBIT *orbit, double lat0, double lon0,
+                        double heading, double sunlat, double sunlon)
+{
+    double lat = lat0 * RAD, lon = lon0 * RAD, az = heading * RAD;
+    double north[3], east[3];
+    int i;
+
+    unit_vector(lat0, lon0, orbit->p0);
+    north[0] = -sin(lat) * cos(lon);
+    north[1] = -sin(lat) * sin(lon);
+    north[2] = cos(lat);
+    east[0] = -sin(lon);
+    east[1] = cos(lon);
+    east[2] = 0.0;
+    for (i = 0; i < 3; i++)
+        orbit->t0[i] = cos(az) * north[i] + sin(az) * east[i];
+    cross(orbit->p0, orbit->t0, orbit->n0);
+    unit_vector(sunlat, sunlon, orbit->sun);
+}
+
+/* Azimuth (degrees clockwise from north) at q of the great circle towards
+   the point t */
+static void direction(const double q[3], const double t[3], double *az)
+{
+    double north[3], east[3], h, dn, de;
+
+    h = sqrt(q[0] * q[0] + q[1] * q[1]);
+    if (h < 1e-12) {
+        *az = 0.0;
+        return;
+    }
+    east[0] = -q[1] / h;
+    east[1] = q[0] / h;
+    east[2] = 0.0;
+    cross(q, east, north);
+    dn = t[0] * north[0] + t[1] * north[1] + t[2] * north[2];
+    de = t[0] * east[0] + t[1] * east[1] + t[2] * east[2];
+    *az = (dn == 0.0 && de == 0.0) ? 0.0 : atan2(de, dn) * DEG;
+}
+
+/* Locate a point in the swath.  'det' is the (fractional) 1 km detector
+   position from the start of the granule (scan * 10 + detector) and 'frame'
+   is the (fractional) 1 km frame number; both refer to pixel centres. */
+static void locate(const ORBIT *orbit, double det, double frame, PIXEL *px)
+{
+    double theta, gamma, slant, along, s, c_s, s_s, c_g, s_g, c;
+    double q[3], p[3];
+    int iscan, i;
+
+    /* Scan angle and earth central angle across track */
+    theta = (frame - (NFRAME_1KM - 1) * 0.5) *
+            (2.0 * SCAN_ANGLE_MAX * RAD / NFRAME_1KM);
+    gamma = asin((EARTH_RADIUS + ORBIT_HEIGHT) / EARTH_RADIUS * sin(theta))
+            - theta;
+    slant = sqrt(EARTH_RADIUS * EARTH_RADIUS +
+                 (EARTH_RADIUS + ORBIT_HEIGHT) * (EARTH_RADIUS + ORBIT_HEIGHT) -
+                 2.0 * EARTH_RADIUS * (EARTH_RADIUS + ORBIT_HEIGHT) * cos(gamma));
+
+    /* Along track: scans advance 10 km, detectors within a scan spread with
+       the slant range (bowtie) */
+    iscan = (int)floor((det + 0.5) / NDET_1KM);
+    along = iscan * (double)NDET_1KM +
+            (det - iscan * NDET_1KM - (NDET_1KM - 1) * 0.5) *
+            (slant / ORBIT_HEIGHT);
+
+    s = along / EARTH_RADIUS;
+    c_s = cos(s);  s_s = sin(s);
+    c_g = cos(gamma);  s_g = sin(gamma);
+    for (i = 0; i < 3; i++) {
+        p[i] = orbit->p0[i] * c_s + orbit->t0[i] * s_s;
+        q[i] = p[i] * c_g - orbit->n0[i] * s_g;
+    }
+
+    px->lat = asin(q[2]) * DEG;
+    px->lon = atan2(q[1], q[0]) * DEG;
+
+    /* The view zenith is the scan angle plus the earth central angle; the
+       satellite is towards the sub-satellite point */
+    px->senz = fabs(theta + gamma) * DEG;
+    direction(q, p, &px->sena);
+
+    c = q[0] * orbit->sun[0] + q[1] * orbit->sun[1] + q[2] * orbit->sun[2];
+    px->solz = acos(c > 1.0 ? 1.0 : (c < -1.0 ? -1.0 : c)) * DEG;
+    direction(q, orbit->sun, &px->sola);
+}
+
+/* Synthetic top-of-atmosphere reflectance for a band (1 based) */
+static double reflectance(double lat, double lon, int band, int idet)
+{
+    double r, cloud;
+
+    /* Darker in the blue, brighter in the NIR over "land" */
+    r = 0.08 + 0.01 * (band % 8) +
+        0.06 * sin(lat * 0.9) * cos(lon * 0.7 + band) +
+        0.03 * cos(lat * 2.1 + lon * 1.7);
+    if (band == 2 || band == 5)
+        r += 0.15 * (0.5 + 0.5 * sin(lat * 0.9) * cos(lon * 0.7));
+    cloud = sin(lat * 3.3) * cos(lon * 2.9);
+    if (cloud > 0.6)
+        r += 1.5 * (cloud - 0.6);
+    r *= 1.0 + 0.002 * ((idet % 4) - 1.5);
+    return (r < 0.0) ? 0.0 : r;
+}
+
+/* Per-band reflectance scale, as in real granules ~2e-5 to 6e-5 */
+static float refl_scale(int band)
+{
+    return (float)(2.0e-5 + 3.0e-6 * (band % 14));
+}
+
+/* Bad pixel DN (saturated, missing) or 0 for a good pixel; deterministic
+   hash of the position so every band and resolution gets the same
+   fraction */
+static int bad_pixel(int iline, int isamp, int band, double bad_pct)
+{
+    unsigned h;
+
+    if (bad_pct <= 0.0) return 0;
+    h = (unsigned)iline * 73856093u ^ (unsigned)isamp * 19349663u ^
+        (unsigned)band * 83492791u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    if ((h % 100000u) >= (unsigned)(bad_pct * 1000.0)) return 0;
+    return (h & 0x100000u) ? DATA_SATURATED : DATA_MISSING;
+}
+
+static int32 create_sds(int32 sd_id, const char *name, int32 type,
+                        int32 rank, int32 *dims)
+{
+    int32 sds_id;
+
+    sds_id = SDcreate(sd_id, (char *)name, type, rank, dims);
+    if (sds_id == FAIL)
+        fatal("can't create SDS", name);
+    return sds_id;
+}
+
+/* Write the angles and lat/long to the 1 km file */
+static void write_geometry(int32 sd_id, const ORBIT *orbit, int nscan,
+                           int geores)
+{
+    static const char *angle_name[4] = {
+        "SolarZenith", "SolarAzimuth", "SensorZenith", "SensorAzimuth"};
+    int32 ang_id[4], lat_id, lon_id;
+    int32 dims[2], start[2], edges[2];
+    int16 *ang_buf[4], angle_fill = ANGLE_FILL;
+    float32 *lat_buf, *lon_buf, geo_fill = GEO_FILL;
+    float64 scale = ANGLE_SCALE;
+    double v[4];
+    int nrow, ncol, rowsperscan, irow, icol, k;
+    PIXEL px;
+
+    rowsperscan = (geores == 5) ? 2 : NDET_1KM;
+    ncol = (geores == 5) ? (NFRAME_1KM - GEO5KM_OFFSET + GEO5KM_STEP - 1) /
+                           GEO5KM_STEP : NFRAME_1KM;
+    nrow = nscan * rowsperscan;
+
+    dims[0] = nrow;
+    dims[1] = ncol;
+    for (k = 0; k < 4; k++) {
+        ang_id[k] = create_sds(sd_id, angle_name[k], DFNT_INT16, 2, dims);
+        SDsetfillvalue(ang_id[k], &angle_fill);
+        SDsetattr(ang_id[k], "scale_factor", DFNT_FLOAT64, 1, &scale);
+        if ((ang_buf[k] = (int16 *)malloc(ncol * sizeof(int16))) == NULL)
+            fatal("allocating geometry buffers", NULL);
+    }
+    lat_id = create_sds(sd_id, "Latitude", DFNT_FLOAT32, 2, dims);
+    lon_id = create_sds(sd_id, "Longitude", DFNT_FLOAT32, 2, dims);
+    SDsetfillvalue(lat_id, &geo_fill);
+    SDsetfillvalue(lon_id, &geo_fill);
+    lat_buf = (float32 *)malloc(ncol * sizeof(float32));
+    lon_buf = (float32 *)malloc(ncol * sizeof(float32));
+    if (lat_buf == NULL || lon_buf == NULL)
+        fatal("allocating geometry buffers", NULL);
+
+    for (irow = 0; irow < nrow; irow++) {
+        for (icol = 0; icol < ncol; icol++) {
+            if (geores == 5)
+                locate(orbit,
+                       (irow / 2) * NDET_1KM + GEO5KM_OFFSET +
+                       (irow % 2) * GEO5KM_STEP,
+                       GEO5KM_OFFSET + icol * GEO5KM_STEP, &px);
+            else
+                locate(orbit, irow, icol, &px);
+
+            lat_buf[icol] = (float32)px.lat;
+            lon_buf[icol] = (float32)px.lon;
+            v[0] = px.solz;  v[1] = px.sola;
+            v[2] = px.senz;  v[3] = px.sena;
+            for (k = 0; k < 4; k++)
+                ang_buf[k][icol] = (px.solz >= 90.0) ? ANGLE_FILL :
+                    (int16)floor(v[k] / ANGLE_SCALE + 0.5);
+        }
+
+        start[0] = irow;  start[1] = 0;
+        edges[0] = 1;     edges[1] = ncol;
+        for (k = 0; k < 4; k++)
+            if (SDwritedata(ang_id[k], start, NULL, edges, ang_buf[k]) == FAIL)
+                fatal("writing SDS", angle_name[k]);
+        if (SDwritedata(lat_id, start, NULL, edges, lat_buf) == FAIL ||
+            SDwritedata(lon_id, start, NULL, edges, lon_buf) == FAIL)
+            fatal("writing SDS", "Latitude/Longitude");
+    }
+
+    for (k = 0; k < 4; k++) {
+        free(ang_buf[k]);
+        SDendaccess(ang_id[k]);
+    }
+    free(lat_buf);
+    free(lon_buf);
+    SDendaccess(lat_id);
+    SDendaccess(lon_id);
+}
+
+/* Write an L1B SDS, a scan of all its bands at a time */
+static void write_band_sds(int32 sd_id, int isds, const ORBIT *orbit,
+                           int nscan, double bad_pct)
+{
+    int32 sds_id, dims[3], start[3], edges[3];
+    uint16 *buf, fill = DATA_FILL;
+    float32 scales[16], offsets[16];
+    int ires = l1b_sds[isds].ires, nband = l1b_sds[isds].nband;
+    int nline = NDET_1KM * ires, nsamp = NFRAME_1KM * ires;
+    int iscan, il, is, ib, band, bad;
+    double det, r;
+    size_t idx;
+    PIXEL px;
+
+    dims[0] = nband;
+    dims[1] = nscan * nline;
+    dims[2] = nsamp;
+    sds_id = create_sds(sd_id, l1b_sds[isds].name, DFNT_UINT16, 3, dims);
+    SDsetfillvalue(sds_id, &fill);
+
+    for (ib = 0; ib < nband; ib++) {
+        scales[ib] = refl_scale(l1b_sds[isds].band1 + ib);
+        offsets[ib] = (float32)REFL_OFFSET;
+    }
+    SDsetattr(sds_id, "reflectance_scales", DFNT_FLOAT32, nband, scales);
+    SDsetattr(sds_id, "reflectance_offsets", DFNT_FLOAT32, nband, offsets);
+
+    buf = (uint16 *)malloc((size_t)nband * nline * nsamp * sizeof(uint16));
+    if (buf == NULL)
+        fatal("allocating scan buffer", NULL);
+
+    for (iscan = 0; iscan < nscan; iscan++) {
+        for (il = 0; il < nline; il++) {
+            det = iscan * NDET_1KM + (il + 0.5) / ires - 0.5;
+            for (is = 0; is < nsamp; is++) {
+                locate(orbit, det, (is + 0.5) / ires - 0.5, &px);
+                for (ib = 0; ib < nband; ib++) {
+                    band = l1b_sds[isds].band1 + ib;
+                    idx = ((size_t)ib * nline + il) * nsamp + is;
+                    if (px.solz >= 90.0) {
+                        buf[idx] = DATA_FILL;
+                        continue;
+                    }
+                    bad = bad_pixel(iscan * nline + il, is, band, bad_pct);
+                    if (bad) {
+                        buf[idx] = (uint16)bad;
+                        continue;
+                    }
+                    r = reflectance(px.lat, px.lon, band, il / ires) /
+                        scales[ib] + REFL_OFFSET + 0.5;
+                    buf[idx] = (uint16)((r > DATA_MAX) ? DATA_SATURATED : r);
+                }
+            }
+        }
+
+        start[0] = 0;      start[1] = iscan * nline;  start[2] = 0;
+        edges[0] = nband;  edges[1] = nline;          edges[2] = nsamp;
+        if (SDwritedata(sds_id, start, NULL, edges, buf) == FAIL)
+            fatal("writing SDS", l1b_sds[isds].name);
+    }
+
+    free(buf);
+    SDendaccess(sds_id);
+}
+
+/* Write an L1B file at relative resolution 'ires' (1, 2 or 4) */
+static void write_l1b(const char *file_name, int ires, const ORBIT *orbit,
+                      int nscan, int geores, double bad_pct)
+{
+    int32 sd_id;
+    int isds;
+
+    sd_id = SDstart((char *)file_name, DFACC_CREATE);
+    if (sd_id == FAIL)
+        fatal("can't create", file_name);
+
+    for (isds = 0; l1b_sds[isds].name != NULL; isds++)
+        if (l1b_sds[isds].ires == ires)
+            write_band_sds(sd_id, isds, orbit, nscan, bad_pct);
+
+    if (ires == 1)
+        write_geometry(sd_id, orbit, nscan, geores);
+
+    SDend(sd_id);
+}
+
+/* Write a synthetic DEM: smooth ridges on land, 0 at sea */
+static void write_dem(const char *file_name)
+{
+    int32 sd_id, sds_id, dims[2], start[2], edges[2];
+    int16 *buf;
+    double lat, lon, h;
+    int il, is;
+
+    sd_id = SDstart((char *)file_name, DFACC_CREATE);
+    if (sd_id == FAIL)
+        fatal("can't create", file_name);
+
+    dims[0] = DEM_NL;
+    dims[1] = DEM_NP;
+    sds_id = create_sds(sd_id, "Elevation", DFNT_INT16, 2, dims);
+
+    buf = (int16 *)malloc(DEM_NP * sizeof(int16));
+    if (buf == NULL)
+        fatal("allocating DEM buffer", NULL);
+
+    for (il = 0; il < DEM_NL; il++) {
+        lat = 90.0 - (il + 0.5) * 180.0 / DEM_NL;
+        for (is = 0; is < DEM_NP; is++) {
+            lon = -180.0 + (is + 0.5) * 360.0 / DEM_NP;
+            h = 2500.0 * sin(lat * 0.11) * cos(lon * 0.07) +
+                800.0 * sin(lat * 0.9 + lon * 0.6);
+            buf[is] = (int16)((h > 0.0) ? h : 0.0);
+        }
+        start[0] = il;  start[1] = 0;
+        edges[0] = 1;   edges[1] = DEM_NP;
+        if (SDwritedata(sds_id, start, NULL, edges, buf) == FAIL)
+            fatal("writing data to", file_name);
+    }
+
+    free(buf);
+    SDendaccess(sds_id);
+    SDend(sd_id);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *l1b_type[3] = {"MOD021KM", "MOD02HKM", "MOD02QKM"};
+    char *dir = NULL, *val, file_name[1024], id[256] = "A2026001.0000";
+    double lat0, lon0, heading, sunlat = -10.0, sunlon = 0.0, bad_pct = 0.1;
+    int nscan = NSCAN_DEFAULT, geores = 5, dem = 0;
+    int iarg, ip, k, have_start = 0, have_sunlon = 0;
+    ORBIT orbit;
+
+    lat0 = orbit_preset[0].lat0;
+    lon0 = orbit_preset[0].lon0;
+    heading = orbit_preset[0].heading;
+
+    for (iarg = 1; iarg < argc; iarg++) {
+        val = strchr(argv[iarg], '=');
+        if (val != NULL) val++;
+        if (strncmp(argv[iarg], "-orbit=", 7) == 0) {
+            for (ip = 0; orbit_preset[ip].name != NULL; ip++)
+                if (strcmp(val, orbit_preset[ip].name) == 0) break;
+            if (orbit_preset[ip].name == NULL)
+                fatal("unknown orbit", val);
+            if (!have_start) {
+                lat0 = orbit_preset[ip].lat0;
+                lon0 = orbit_preset[ip].lon0;
+                heading = orbit_preset[ip].heading;
+            }
+        }
+        else if (strncmp(argv[iarg], "-lat0=", 6) == 0) {
+            lat0 = atof(val);  have_start = 1;
+        }
+        else if (strncmp(argv[iarg], "-lon0=", 6) == 0) {
+            lon0 = atof(val);  have_start = 1;
+        }
+        else if (strncmp(argv[iarg], "-heading=", 9) == 0) {
+            heading = atof(val);  have_start = 1;
+        }
+        else if (strncmp(argv[iarg], "-sunlat=", 8) == 0)
+            sunlat = atof(val);
+        else if (strncmp(argv[iarg], "-sunlon=", 8) == 0) {
+            sunlon = atof(val);  have_sunlon = 1;
+        }
+        else if (strncmp(argv[iarg], "-nscan=", 7) == 0)
+            nscan = atoi(val);
+        else if (strncmp(argv[iarg], "-geores=", 8) == 0)
+            geores = atoi(val);
+        else if (strncmp(argv[iarg], "-bad=", 5) == 0)
+            bad_pct = atof(val);
+        else if (strncmp(argv[iarg], "-id=", 4) == 0) {
+            strncpy(id, val, sizeof(id) - 1);
+            id[sizeof(id) - 1] = '\0';
+        }
+        else if (strcmp(argv[iarg], "-dem") == 0)
+            dem = 1;
+        else if (argv[iarg][0] == '-') {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        else
+            dir = argv[iarg];
+    }
+
+    if (dir == NULL || nscan < 1 || (geores != 1 && geores != 5) ||
+        bad_pct < 0.0 || bad_pct > 100.0) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    /* By default the sun is a little east of the start point: a late
+       morning overpass */
+    if (!have_sunlon)
+        sunlon = lon0 + 20.0;
+    setup_orbit(&orbit, lat0, lon0, heading, sunlat, sunlon);
+
+    for (k = 0; k < 3; k++) {
+        sprintf(file_name, "%s/%s.%s.hdf", dir, l1b_type[k], id);
+        printf("mkl1b: writing %s (%d scans)\n", file_name, nscan);
+        write_l1b(file_name, 1 << k, &orbit, nscan, geores, bad_pct);
+    }
+
+    if (dem) {
+        sprintf(file_name, "%s/tbase.hdf", dir);
+        printf("mkl1b: writing %s\n", file_name);
+        write_dem(file_name);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,1505 @@
+/*******************************************************************************
+ Copyright (c) 2011, Brian Case
+
+ Permission is hereby granted, free of charge, to any person obtaining a
+ copy of this software and associated documentation files (the "Software"),
+ to deal in the Software without restriction, including without limitation
+ the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included
+ in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+/*******************************************************************************
+ msComposite
+
+ composite the bands of a multiband image into a rgba geotiff in one pass,
+ doing what the vrt chain of doimg_multiband_cb in msimage.bash does:
+
+    lut       preprocess a band with a lut (mspreproc_lut)
+    calc      band math over the bands b1, b2, ... (mscalc)
+    gradient  colorize the calc result or the first band (msgradient)
+    scale     rescale the output to byte (rescale)
+    outlut    rescale the output with a lut (lut)
+    mask      mask bands, 0 is masked (msmaskbands, cloud masks)
+    washout   mask the 0 / 255 band staggering collar along the image edges
+              (the washout nearblack)
+
+ the output is written in tiles, and the pixels of a tile are computed by
+ a pool of threads, so each input is read once (twice with washout) and
+ only a tile of each is in memory at a time.  the output grid covers the
+ extents of all the bands at the finest resolution, as gdalbuildvrt
+ -resolution highest makes it; the inputs are sampled to it (nearest
+ neighbour) by their georeference, and are 0 off their extent.
+*******************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "gdal.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+/***** default size of the tiles the output is written in, in pixels *****/
+
+#define DEFAULT_TILE_SIZE 512
+
+/*******************************************************************************
+ lut in the gdal vrt format, in:out,in:out,...
+
+ values are interpolated linearly between the entries and clamped to the
+ first and last entry, as gdal does
+*******************************************************************************/
+
+struct Lut {
+    std::vector<double> in;
+    std::vector<double> out;
+
+    int parse(const char *lut);
+    double lookup(double value) const;
+};
+
+int Lut::parse(const char *lut) {
+
+    in.clear();
+    out.clear();
+
+    const char *p = lut;
+    while (*p) {
+        char *end;
+        double i = strtod(p, &end);
+        if (end == p || *end != ':')
+            return -1;
+        p = end + 1;
+        double o = strtod(p, &end);
+        if (end == p)
+            return -1;
+        if (!in.empty() && i < in.back())
+            return -1;
+        in.push_back(i);
+        out.push_back(o);
+        p = end;
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+
+    return in.empty() ? -1 : 0;
+}
+
+double Lut::lookup(double value) const {
+
+    size_t n = in.size();
+    size_t i = 0;
+    while (i < n && in[i] < value)
+        i++;
+
+    if (i == 0)
+        return out[0];
+    if (i == n)
+        return out[n - 1];
+    if (in[i] == value)
+        return out[i];
+
+    return out[i - 1] + (value - in[i - 1]) *
+           ((out[i] - out[i - 1]) / (in[i] - in[i - 1]));
+}
+
+/*******************************************************************************
+ round and clamp a value to a byte, as gdal does writing a byte band
+*******************************************************************************/
+
+static inline float to_byte(double value) {
+    if (!(value > 0.0))
+        return 0;
+    if (value >= 255.0)
+        return 255;
+    return floor(value + 0.5);
+}
+
+/*******************************************************************************
+ gradient, lines of "r g b value", made into a lut per color
+*******************************************************************************/
+
+struct Gradient {
+    Lut lut[3];
+
+    int parse(const char *gradient);
+};
+
+int Gradient::parse(const char *gradient) {
+
+    std::string luts[3];
+
+    char **lines = CSLTokenizeString2(gradient, "\n", 0);
+    for (int i = 0; lines && lines[i]; i++) {
+        char **vals = CSLTokenizeString2(lines[i], " \t,", 0);
+        int n = CSLCount(vals);
+        if (n != 0 && n != 4) {
+            CSLDestroy(vals);
+            CSLDestroy(lines);
+            return -1;
+        }
+        for (int c = 0; n && c < 3; c++) {
+            if (!luts[c].empty())
+                luts[c] += ",";
+            luts[c] += std::string(vals[3]) + ":" + vals[c];
+        }
+        CSLDestroy(vals);
+    }
+    CSLDestroy(lines);
+
+    for (int c = 0; c < 3; c++) {
+        if (lut[c].parse(luts[c].c_str()))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ band math expression, muparser style as otbCalc takes
+
+ numbers, the bands b1 b2 ..., the constants _pi and _e, the operators
+ + - * / ^ < > <= >= == != && || ! and ?:, and the functions sin cos tan
+ asin acos atan sinh cosh tanh sqrt exp ln log log2 log10 abs rint sign,
+ if(cond, a, b), min(...) max(...) sum(...) avg(...)
+
+ the expression is compiled to a stack program that is run over a row of
+ pixels at a time
+*******************************************************************************/
+
+class Expression {
+
+  public:
+
+    int parse(const char *expression, int nbands);
+
+    /***** the bands used, 1 for the band used and 0 otherwise *****/
+
+    std::vector<int> used;
+
+    /***** number of rows of stack needed to run it *****/
+
+    int depth;
+
+    void eval(float **bands, size_t n, float *stack, float *out) const;
+
+  private:
+
+    enum OpCode {
+        OP_CONST, OP_BAND,
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW,
+        OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE, OP_AND, OP_OR,
+        OP_NEG, OP_NOT, OP_SELECT,
+        OP_MIN, OP_MAX,
+        OP_FUNC
+    };
+
+    struct Op {
+        OpCode code;
+        double value;
+        int band;
+        double (*func)(double);
+    };
+
+    std::vector<Op> ops;
+    const char *p;
+    const char *err;
+    int nbands;
+
+    void emit(OpCode code, double value = 0.0, int band = 0,
+              double (*func)(double) = NULL);
+    void skip();
+    int accept(const char *tok);
+
+    int ternary();
+    int logical_or();
+    int logical_and();
+    int compare();
+    int additive();
+    int multiplicative();
+    int unary();
+    int power();
+    int primary();
+};
+
+static double fn_sign(double x) { return (x > 0) - (x < 0); }
+static double fn_rint(double x) { return floor(x + 0.5); }
+static double fn_log2(double x) { return log(x) / log(2.0); }
+
+static const struct {
+    const char *name;
+    double (*func)(double);
+} functions[] = {
+    { "sin", sin }, { "cos", cos }, { "tan", tan },
+    { "asin", asin }, { "acos", acos }, { "atan", atan },
+    { "sinh", sinh }, { "cosh", cosh }, { "tanh", tanh },
+    { "sqrt", sqrt }, { "exp", exp }, { "ln", log }, { "log", log },
+    { "log2", fn_log2 }, { "log10", log10 }, { "abs", fabs },
+    { "rint", fn_rint }, { "sign", fn_sign },
+    { NULL, NULL }
+};
+
+void Expression::emit(OpCode code, double value, int band,
+                      double (*func)(double)) {
+    Op op;
+    op.code = code;
+    op.value = value;
+    op.band = band;
+    op.func = func;
+    ops.push_back(op);
+}
+
+void Expression::skip() {
+    while (isspace((unsigned char) *p))
+        p++;
+}
+
+int Expression::accept(const char *tok) {
+    skip();
+    size_t len = strlen(tok);
+    if (strncmp(p, tok, len))
+        return 0;
+
+    /***** dont take < for <= or & for && etc *****/
+
+    if (len == 1 && strchr("<>=!", *tok) && p[1] == '=')
+        return 0;
+    p += len;
+    return 1;
+}
+
+int Expression::ternary() {
+    if (logical_or())
+        return -1;
+    if (accept("?")) {
+        if (ternary())
+            return -1;
+        if (!accept(":")) {
+            err = "missing : for ?";
+            return -1;
+        }
+        if (ternary())
+            return -1;
+        emit(OP_SELECT);
+    }
+    return 0;
+}
+
+int Expression::logical_or() {
+    if (logical_and())
+        return -1;
+    while (accept("||")) {
+        if (logical_and())
+            return -1;
+        emit(OP_OR);
+    }
+    return 0;
+}
+
+int Expression::logical_and() {
+    if (compare())
+        return -1;
+    while (accept("&&")) {
+        if (compare())
+            return -1;
+        emit(OP_AND);
+    }
+    return 0;
+}
+
+int Expression::compare() {
+    if (additive())
+        return -1;
+    for (;;) {
+        OpCode code;
+        if (accept("<="))
+            code = OP_LE;
+        else if (accept(">="))
+            code = OP_GE;
+        else if (accept("=="))
+            code = OP_EQ;
+        else if (accept("!="))
+            code = OP_NE;
+        else if (accept("<"))
+            code = OP_LT;
+        else if (accept(">"))
+            code = OP_GT;
+        else
+            return 0;
+        if (additive())
+            return -1;
+        emit(code);
+    }
+}
+
+int Expression::additive() {
+    if (multiplicative())
+        return -1;
+    for (;;) {
+        OpCode code;
+        if (accept("+"))
+            code = OP_ADD;
+        else if (accept("-"))
+            code = OP_SUB;
+        else
+            return 0;
+        if (multiplicative())
+            return -1;
+        emit(code);
+    }
+}
+
+int Expression::multiplicative() {
+    if (unary())
+        return -1;
+    for (;;) {
+        OpCode code;
+        if (accept("*"))
+            code = OP_MUL;
+        else if (accept("/"))
+            code = OP_DIV;
+        else
+            return 0;
+        if (unary())
+            return -1;
+        emit(code);
+    }
+}
+
+int Expression::unary() {
+    if (accept("-")) {
+        if (unary())
+            return -1;
+        emit(OP_NEG);
+        return 0;
+    }
+    if (accept("+"))
+        return unary();
+    if (accept("!")) {
+        if (unary())
+            return -1;
+        emit(OP_NOT);
+        return 0;
+    }
+    return power();
+}
+
+int Expression::power() {
+    if (primary())
+        return -1;
+    if (accept("^")) {
+        if (unary())
+            return -1;
+        emit(OP_POW);
+    }
+    return 0;
+}
+
+int Expression::primary() {
+    skip();
+
+    /***** number *****/
+
+    if (isdigit((unsigned char) *p) || *p == '.') {
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p) {
+            err = "invalid number";
+            return -1;
+        }
+        p = end;
+        emit(OP_CONST, value);
+        return 0;
+    }
+
+    /***** ( expression ) *****/
+
+    if (accept("(")) {
+        if (ternary())
+            return -1;
+        if (!accept(")")) {
+            err = "missing )";
+            return -1;
+        }
+        return 0;
+    }
+
+    /***** name *****/
+
+    if (!isalpha((unsigned char) *p) && *p != '_') {
+        err = "syntax error";
+        return -1;
+    }
+
+    const char *start = p;
+    while (isalnum((unsigned char) *p) || *p == '_')
+        p++;
+    std::string name(start, p - start);
+
+    if (name == "_pi") {
+        emit(OP_CONST, M_PI);
+        return 0;
+    }
+    if (name == "_e") {
+        emit(OP_CONST, M_E);
+        return 0;
+    }
+
+    /***** band *****/
+
+    if (name[0] == 'b' && name.size() > 1 &&
+        name.find_first_not_of("0123456789", 1) == std::string::npos)
+    {
+        int band = atoi(name.c_str() + 1);
+        if (band < 1 || band > nbands) {
+            err = "band out of range";
+            return -1;
+        }
+        used[band - 1] = 1;
+        emit(OP_BAND, 0.0, band - 1);
+        return 0;
+    }
+
+    /***** function *****/
+
+    if (!accept("(")) {
+        err = "unknown variable";
+        return -1;
+    }
+
+    int nargs = 0;
+    if (!accept(")")) {
+        do {
+            if (ternary())
+                return -1;
+            nargs++;
+        } while (accept(","));
+        if (!accept(")")) {
+            err = "missing ) after function arguments";
+            return -1;
+        }
+    }
+
+    if (name == "if") {
+        if (nargs != 3) {
+            err = "if takes 3 arguments";
+            return -1;
+        }
+        emit(OP_SELECT);
+        return 0;
+    }
+
+    if (name == "min" || name == "max" || name == "sum" || name == "avg") {
+        if (nargs < 1) {
+            err = "function needs an argument";
+            return -1;
+        }
+        OpCode code = (name == "min") ? OP_MIN :
+                      (name == "max") ? OP_MAX : OP_ADD;
+        for (int i = 1; i < nargs; i++)
+            emit(code);
+        if (name == "avg") {
+            emit(OP_CONST, nargs);
+            emit(OP_DIV);
+        }
+        return 0;
+    }
+
+    for (int i = 0; functions[i].name; i++) {
+        if (name == functions[i].name) {
+            if (nargs != 1) {
+                err = "function takes 1 argument";
+                return -1;
+            }
+            emit(OP_FUNC, 0.0, 0, functions[i].func);
+            return 0;
+        }
+    }
+
+    err = "unknown function";
+    return -1;
+}
+
+int Expression::parse(const char *expression, int nbands) {
+
+    this->nbands = nbands;
+    used.assign(nbands, 0);
+    ops.clear();
+    p = expression;
+    err = NULL;
+
+    if (ternary() || (skip(), *p)) {
+        fprintf(stderr, "Error in expression at \"%s\": %s\n", p,
+                err ? err : "syntax error");
+        return -1;
+    }
+
+    /***** stack depth *****/
+
+    int d = 0;
+    depth = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        switch (ops[i].code) {
+            case OP_CONST:
+            case OP_BAND:
+                d++;
+                break;
+            case OP_NEG:
+            case OP_NOT:
+            case OP_FUNC:
+                break;
+            case OP_SELECT:
+                d -= 2;
+                break;
+            default:
+                d--;
+                break;
+        }
+        if (d > depth)
+            depth = d;
+    }
+
+    return 0;
+}
+
+void Expression::eval(float **bands, size_t n, float *stack, float *out) const {
+
+    /***** a is the top of the stack, b and c the rows under it *****/
+
+    int top = 0;
+
+    for (size_t iop = 0; iop < ops.size(); iop++) {
+        const Op &op = ops[iop];
+        float *a = stack + (size_t) (top > 0 ? top - 1 : 0) * n;
+        float *b = (top > 1) ? a - n : NULL;
+        float *c = (top > 2) ? b - n : NULL;
+        float *push = stack + (size_t) top * n;
+        size_t i;
+
+        switch (op.code) {
+            case OP_CONST:
+                for (i = 0; i < n; i++) push[i] = op.value;
+                top++;
+                break;
+            case OP_BAND:
+                memcpy(push, bands[op.band], n * sizeof(float));
+                top++;
+                break;
+
+            case OP_ADD: for (i = 0; i < n; i++) b[i] = b[i] + a[i]; top--; break;
+            case OP_SUB: for (i = 0; i < n; i++) b[i] = b[i] - a[i]; top--; break;
+            case OP_MUL: for (i = 0; i < n; i++) b[i] = b[i] * a[i]; top--; break;
+            case OP_DIV: for (i = 0; i < n; i++) b[i] = b[i] / a[i]; top--; break;
+            case OP_POW: for (i = 0; i < n; i++) b[i] = pow(b[i], a[i]); top--; break;
+            case OP_LT:  for (i = 0; i < n; i++) b[i] = b[i] < a[i]; top--; break;
+            case OP_GT:  for (i = 0; i < n; i++) b[i] = b[i] > a[i]; top--; break;
+            case OP_LE:  for (i = 0; i < n; i++) b[i] = b[i] <= a[i]; top--; break;
+            case OP_GE:  for (i = 0; i < n; i++) b[i] = b[i] >= a[i]; top--; break;
+            case OP_EQ:  for (i = 0; i < n; i++) b[i] = b[i] == a[i]; top--; break;
+            case OP_NE:  for (i = 0; i < n; i++) b[i] = b[i] != a[i]; top--; break;
+            case OP_AND: for (i = 0; i < n; i++) b[i] = b[i] && a[i]; top--; break;
+            case OP_OR:  for (i = 0; i < n; i++) b[i] = b[i] || a[i]; top--; break;
+            case OP_MIN: for (i = 0; i < n; i++) b[i] = (a[i] < b[i]) ? a[i] : b[i]; top--; break;
+            case OP_MAX: for (i = 0; i < n; i++) b[i] = (a[i] > b[i]) ? a[i] : b[i]; top--; break;
+
+            case OP_NEG: for (i = 0; i < n; i++) a[i] = -a[i]; break;
+            case OP_NOT: for (i = 0; i < n; i++) a[i] = !a[i]; break;
+            case OP_FUNC: for (i = 0; i < n; i++) a[i] = op.func(a[i]); break;
+
+            case OP_SELECT:
+                for (i = 0; i < n; i++) c[i] = c[i] ? b[i] : a[i];
+                top -= 2;
+                break;
+        }
+    }
+
+    memcpy(out, stack, n * sizeof(float));
+}
+
+/*******************************************************************************
+ an input band, read on the output grid
+*******************************************************************************/
+
+struct Source {
+    const char *filename;
+    GDALDatasetH hDS;
+    GDALRasterBandH hBand;
+    int nx;
+    int ny;
+    double gt[6];
+    int hasgt;
+    int samegrid;
+
+    int open(const char *filename);
+    void setgrid(const double *ogt, int onx, int ony);
+    int read(const double *ogt, int x, int y, int w, int h, float *buf,
+             float fill, std::vector<float> &tmp) const;
+};
+
+int Source::open(const char *filename) {
+
+    this->filename = filename;
+    hDS = GDALOpenShared(filename, GA_ReadOnly);
+    if (!hDS) {
+        fprintf(stderr, "Unable to open %s\n", filename);
+        return -1;
+    }
+    hBand = GDALGetRasterBand(hDS, 1);
+    nx = GDALGetRasterXSize(hDS);
+    ny = GDALGetRasterYSize(hDS);
+    hasgt = (GDALGetGeoTransform(hDS, gt) == CE_None);
+    if (!hasgt) {
+        gt[0] = 0.0; gt[1] = 1.0; gt[2] = 0.0;
+        gt[3] = 0.0; gt[4] = 0.0; gt[5] = 1.0;
+    }
+    samegrid = 1;
+
+    return 0;
+}
+
+/***** set the output grid, a source without a georeference is stretched to it *****/
+
+void Source::setgrid(const double *ogt, int onx, int ony) {
+
+    if (!hasgt) {
+        gt[0] = ogt[0];
+        gt[1] = ogt[1] * onx / nx;
+        gt[2] = 0.0;
+        gt[3] = ogt[3];
+        gt[4] = 0.0;
+        gt[5] = ogt[5] * ony / ny;
+    }
+
+    samegrid = (nx == onx && ny == ony);
+    for (int i = 0; samegrid && i < 6; i++) {
+        if (fabs(gt[i] - ogt[i]) > 1e-9 * (fabs(ogt[1]) + fabs(ogt[5])))
+            samegrid = 0;
+    }
+}
+
+/***** read a window of the output grid, nearest neighbour; pixels off the source are fill *****/
+
+int Source::read(const double *ogt, int x, int y, int w, int h, float *buf,
+                 float fill, std::vector<float> &tmp) const {
+
+    if (samegrid) {
+        return GDALRasterIO(hBand, GF_Read, x, y, w, h, buf, w, h,
+                            GDT_Float32, 0, 0) == CE_None ? 0 : -1;
+    }
+
+    std::vector<int> sx(w), sy(h);
+    int x0 = nx, x1 = -1, y0 = ny, y1 = -1;
+    int i, j;
+
+    for (i = 0; i < w; i++) {
+        double gx = ogt[0] + (x + i + 0.5) * ogt[1];
+        sx[i] = (int) floor((gx - gt[0]) / gt[1]);
+        if (sx[i] < 0 || sx[i] >= nx)
+            sx[i] = -1;
+        else {
+            if (sx[i] < x0) x0 = sx[i];
+            if (sx[i] > x1) x1 = sx[i];
+        }
+    }
+    for (j = 0; j < h; j++) {
+        double gy = ogt[3] + (y + j + 0.5) * ogt[5];
+        sy[j] = (int) floor((gy - gt[3]) / gt[5]);
+        if (sy[j] < 0 || sy[j] >= ny)
+            sy[j] = -1;
+        else {
+            if (sy[j] < y0) y0 = sy[j];
+            if (sy[j] > y1) y1 = sy[j];
+        }
+    }
+
+    if (x1 < x0 || y1 < y0) {
+        for (i = 0; i < w * h; i++)
+            buf[i] = fill;
+        return 0;
+    }
+
+    int sw = x1 - x0 + 1;
+    int sh = y1 - y0 + 1;
+    tmp.resize((size_t) sw * sh);
+    if (GDALRasterIO(hBand, GF_Read, x0, y0, sw, sh, &tmp[0], sw, sh,
+                     GDT_Float32, 0, 0) != CE_None)
+        return -1;
+
+    for (j = 0; j < h; j++) {
+        float *row = buf + (size_t) j * w;
+        if (sy[j] < 0) {
+            for (i = 0; i < w; i++)
+                row[i] = fill;
+            continue;
+        }
+        const float *srow = &tmp[0] + (size_t) (sy[j] - y0) * sw - x0;
+        for (i = 0; i < w; i++)
+            row[i] = (sx[i] < 0) ? fill : srow[sx[i]];
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ options
+*******************************************************************************/
+
+struct Options {
+    unsigned int tilesize;
+    int threads;
+    GDALDataType type;
+    char **co;
+
+    std::vector<Lut> luts;                  /* per band, empty for none */
+    int havecalc;
+    Expression calc;
+    int havegradient;
+    Gradient gradient;
+    int havescale;
+    double scale;
+    double offset;
+    int haveoutlut;
+    Lut outlut;
+    int havenodata;
+    double nodata;
+    int washout;
+};
+
+/*******************************************************************************
+ the washout collar
+
+ a pixel is in the collar if every band is 0 or 255 but not all 255, and
+ so are all the pixels between it and an edge of the image in a row or a
+ column.  the rows and columns where the collar ends are found in a pass
+ over the image before the output is made
+*******************************************************************************/
+
+struct Collar {
+    std::vector<int> left;      /* per row, first x not in the left collar */
+    std::vector<int> right;     /* per row, last x not in the right collar */
+    std::vector<int> top;       /* per column, first y not in the top collar */
+    std::vector<int> bottom;    /* per column, last y not in the bottom collar */
+
+    int incollar(int x, int y) const {
+        return x < left[y] || x > right[y] || y < top[x] || y > bottom[x];
+    }
+};
+
+static inline int collar_color(float **bands, int nbands, size_t i) {
+
+    int n255 = 0;
+    for (int ib = 0; ib < nbands; ib++) {
+        float v = bands[ib][i];
+        if (v == 255.0f)
+            n255++;
+        else if (v != 0.0f)
+            return 0;
+    }
+    return n255 < nbands;
+}
+
+static void apply_luts(const Options &opts, float **bands, int nbands,
+                       size_t n) {
+
+    for (int ib = 0; ib < nbands; ib++) {
+        if (opts.luts[ib].in.empty())
+            continue;
+        float *b = bands[ib];
+        for (size_t i = 0; i < n; i++)
+            b[i] = to_byte(opts.luts[ib].lookup(b[i]));
+    }
+}
+
+static int find_collar(const Options &opts, const std::vector<Source> &srcs,
+                       const double *gt, int nx, int ny, Collar &collar) {
+
+    int nbands = srcs.size();
+    int lines = opts.tilesize * opts.tilesize / nx;
+    if (lines < 1)
+        lines = 1;
+
+    std::vector<float> data((size_t) nbands * lines * nx);
+    std::vector<float *> bands(nbands);
+    std::vector<float> tmp;
+
+    collar.left.assign(ny, nx);
+    collar.right.assign(ny, -1);
+    collar.top.assign(nx, ny);
+    collar.bottom.assign(nx, -1);
+
+    for (int y = 0; y < ny; y += lines) {
+        int h = (y + lines > ny) ? ny - y : lines;
+
+        for (int ib = 0; ib < nbands; ib++) {
+            bands[ib] = &data[0] + (size_t) ib * lines * nx;
+            if (srcs[ib].read(gt, 0, y, nx, h, bands[ib], 0.0f, tmp)) {
+                fprintf(stderr, "Unable to read %s\n", srcs[ib].filename);
+                return -1;
+            }
+        }
+        apply_luts(opts, &bands[0], nbands, (size_t) h * nx);
+
+        for (int j = 0; j < h; j++) {
+            size_t row = (size_t) j * nx;
+            for (int x = 0; x < nx; x++) {
+                if (collar_color(&bands[0], nbands, row + x))
+                    continue;
+                if (collar.left[y + j] == nx)
+                    collar.left[y + j] = x;
+                collar.right[y + j] = x;
+                if (collar.top[x] == ny)
+                    collar.top[x] = y + j;
+                collar.bottom[x] = y + j;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ composite the rows of a tile, run on a pool thread per group of rows
+*******************************************************************************/
+
+struct TileJob {
+    const Options *opts;
+    const Collar *collar;
+    int nbands;
+    int nmasks;
+    float **bands;              /* [nbands][w * h] */
+    float **masks;              /* [nmasks][w * h] */
+    float **out;                /* [4][w * h], rgba */
+    int x;
+    int y;
+    int w;
+    int row0;
+    int row1;
+};
+
+static void *composite_rows(void *arg) {
+
+    TileJob *job = (TileJob *) arg;
+    const Options &opts = *job->opts;
+    int nbands = job->nbands;
+    int w = job->w;
+
+    std::vector<float *> rowbands(nbands);
+    std::vector<float> stack, value(w);
+    if (opts.havecalc)
+        stack.resize((size_t) opts.calc.depth * w);
+
+    for (int j = job->row0; j < job->row1; j++) {
+        size_t row = (size_t) j * w;
+        int ib, c, i;
+
+        for (ib = 0; ib < nbands; ib++)
+            rowbands[ib] = job->bands[ib] + row;
+        float *r = job->out[0] + row;
+        float *g = job->out[1] + row;
+        float *b = job->out[2] + row;
+        float *a = job->out[3] + row;
+
+        apply_luts(opts, &rowbands[0], nbands, w);
+
+        /***** alpha *****/
+
+        for (i = 0; i < w; i++)
+            a[i] = 255;
+
+        if (opts.havenodata) {
+            for (i = 0; i < w; i++) {
+                for (ib = 0; ib < nbands; ib++) {
+                    if (rowbands[ib][i] != opts.nodata)
+                        break;
+                }
+                if (ib == nbands)
+                    a[i] = 0;
+            }
+        }
+
+        for (int im = 0; im < job->nmasks; im++) {
+            float *m = job->masks[im] + row;
+            for (i = 0; i < w; i++) {
+                if (m[i] == 0.0f)
+                    a[i] = 0;
+            }
+        }
+
+        if (opts.washout) {
+            for (i = 0; i < w; i++) {
+                if (job->collar->incollar(job->x + i, job->y + j))
+                    a[i] = 0;
+            }
+        }
+
+        /***** color *****/
+
+        float *src = NULL;
+        if (opts.havecalc) {
+            opts.calc.eval(&rowbands[0], w, &stack[0], &value[0]);
+            src = &value[0];
+        }
+        else if (opts.havegradient) {
+            src = rowbands[0];
+        }
+
+        if (opts.havegradient) {
+            for (i = 0; i < w; i++) {
+                r[i] = to_byte(opts.gradient.lut[0].lookup(src[i]));
+                g[i] = to_byte(opts.gradient.lut[1].lookup(src[i]));
+                b[i] = to_byte(opts.gradient.lut[2].lookup(src[i]));
+            }
+        }
+        else if (src) {
+            for (i = 0; i < w; i++)
+                r[i] = g[i] = b[i] = to_byte(src[i]);
+        }
+        else {
+            memcpy(r, rowbands[0], w * sizeof(float));
+            memcpy(g, rowbands[nbands > 1 ? 1 : 0], w * sizeof(float));
+            memcpy(b, rowbands[nbands > 2 ? 2 : 0], w * sizeof(float));
+        }
+
+        /***** rescale *****/
+
+        float *rgb[3] = { r, g, b };
+        for (c = 0; c < 3; c++) {
+            float *v = rgb[c];
+            if (opts.havescale) {
+                for (i = 0; i < w; i++)
+                    v[i] = v[i] * opts.scale + opts.offset;
+            }
+            else if (opts.haveoutlut) {
+                for (i = 0; i < w; i++)
+                    v[i] = to_byte(opts.outlut.lookup(v[i]));
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ a pool of threads that composite the rows of each tile
+
+ the threads are started once; for each tile run() hands thread t job t
+ and waits for all of them
+*******************************************************************************/
+
+struct Pool {
+    std::vector<pthread_t> threads;
+    std::vector<TileJob> *jobs;
+    int njobs;                  /* jobs of the current tile */
+    int tile;                   /* number of the current tile */
+    int pending;                /* threads still on the current tile */
+    int quit;
+    pthread_mutex_t lock;
+    pthread_cond_t start;       /* signaled when a tile is handed out */
+    pthread_cond_t done;        /* signaled when the last thread is done */
+
+    int init(int nthreads, std::vector<TileJob> *jobs);
+    void run(int njobs);
+    void finish();
+};
+
+struct PoolThread {
+    Pool *pool;
+    int t;
+};
+
+static void *pool_thread(void *arg) {
+
+    PoolThread *pt = (PoolThread *) arg;
+    Pool *pool = pt->pool;
+    int t = pt->t;
+    int tile = 0;
+
+    delete pt;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->tile == tile && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        tile = pool->tile;
+        int njobs = pool->njobs;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (t < njobs)
+            composite_rows(&(*pool->jobs)[t]);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int Pool::init(int nthreads, std::vector<TileJob> *jobs) {
+
+    this->jobs = jobs;
+    njobs = 0;
+    tile = 0;
+    pending = 0;
+    quit = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&start, NULL);
+    pthread_cond_init(&done, NULL);
+
+    for (int t = 0; t < nthreads; t++) {
+        pthread_t thread;
+        PoolThread *pt = new PoolThread;
+        pt->pool = this;
+        pt->t = t;
+        if (pthread_create(&thread, NULL, pool_thread, pt)) {
+            delete pt;
+            fprintf(stderr, "Unable to start a thread\n");
+            return -1;
+        }
+        threads.push_back(thread);
+    }
+
+    return 0;
+}
+
+void Pool::run(int njobs) {
+
+    pthread_mutex_lock(&lock);
+    this->njobs = njobs;
+    pending = threads.size();
+    tile++;
+    pthread_cond_broadcast(&start);
+    while (pending > 0)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+/***** stop and join the threads, also after init() failed part way *****/
+
+void Pool::finish() {
+
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t t = 0; t < threads.size(); t++)
+        pthread_join(threads[t], NULL);
+    threads.clear();
+
+    pthread_cond_destroy(&done);
+    pthread_cond_destroy(&start);
+    pthread_mutex_destroy(&lock);
+}
+
+/*******************************************************************************
+ usage
+*******************************************************************************/
+
+void usage(char *arg0) {
+
+    fprintf(stderr, "Usage: %s [options] <band file>... <output file>\n", arg0);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "    -lut=<band>,<in:out,...>  preprocess a band with a lut\n");
+    fprintf(stderr, "    -calc=<expression>        band math over the bands b1, b2, ...\n");
+    fprintf(stderr, "    -gradient=<gradient>      colorize the calc result or band 1,\n");
+    fprintf(stderr, "                              lines of \"r g b value\"\n");
+    fprintf(stderr, "    -scale=<src_min> <src_max> [<dst_min> <dst_max>]\n");
+    fprintf(stderr, "                              rescale the output\n");
+    fprintf(stderr, "    -outlut=<in:out,...>      rescale the output with a lut\n");
+    fprintf(stderr, "    -mask=<file>              mask band, 0 is masked\n");
+    fprintf(stderr, "    -srcnodata=<value>        mask pixels with all bands value\n");
+    fprintf(stderr, "    -washout                  mask the 0 / 255 collar along the edges\n");
+    fprintf(stderr, "    -ot=<type>                output type (default Byte if a byte\n");
+    fprintf(stderr, "                              step is done, else the type of band 1)\n");
+    fprintf(stderr, "    -co=<NAME=VALUE>          geotiff creation option\n");
+    fprintf(stderr, "    -tile=<pixels>            size of the output tiles, a multiple\n");
+    fprintf(stderr, "                              of 16 (default %i)\n", DEFAULT_TILE_SIZE);
+    fprintf(stderr, "    -threads=<n>              number of threads (default the number\n");
+    fprintf(stderr, "                              of cpus)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "    the output is a rgba geotiff, the first 3 bands (or band 1) are\n");
+    fprintf(stderr, "    rgb when there is no calc or gradient\n");
+
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    opts.tilesize = DEFAULT_TILE_SIZE;
+    opts.threads = CPLGetNumCPUs();
+    opts.type = GDT_Unknown;
+    opts.co = NULL;
+    opts.havecalc = 0;
+    opts.havegradient = 0;
+    opts.havescale = 0;
+    opts.haveoutlut = 0;
+    opts.havenodata = 0;
+    opts.washout = 0;
+
+    const char *calc = NULL;
+    std::vector<std::pair<int, const char *> > luts;
+    std::vector<const char *> maskfiles;
+
+    GDALAllRegister();
+
+    /***** options *****/
+
+    int iarg;
+    for (iarg = 1; iarg < argc && argv[iarg][0] == '-'; iarg++) {
+        char *arg = argv[iarg];
+
+        if (!strncmp(arg, "-tile=", 6)) {
+            int n = atoi(arg + 6);
+            if (n < 16 || n % 16) {
+                fprintf(stderr, "Invalid tile size %s\n", arg + 6);
+                exit(EXIT_FAILURE);
+            }
+            opts.tilesize = n;
+        }
+        else if (!strncmp(arg, "-threads=", 9)) {
+            opts.threads = atoi(arg + 9);
+            if (opts.threads < 1) {
+                fprintf(stderr, "Invalid thread count %s\n", arg + 9);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strncmp(arg, "-ot=", 4)) {
+            opts.type = GDALGetDataTypeByName(arg + 4);
+            if (opts.type == GDT_Unknown) {
+                fprintf(stderr, "Invalid type %s\n", arg + 4);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strncmp(arg, "-co=", 4)) {
+            opts.co = CSLAddString(opts.co, arg + 4);
+        }
+        else if (!strncmp(arg, "-lut=", 5)) {
+            char *comma = strchr(arg + 5, ',');
+            if (!comma || atoi(arg + 5) < 1) {
+                fprintf(stderr, "Invalid lut %s\n", arg + 5);
+                exit(EXIT_FAILURE);
+            }
+            luts.push_back(std::make_pair(atoi(arg + 5), comma + 1));
+        }
+        else if (!strncmp(arg, "-calc=", 6)) {
+            calc = arg + 6;
+        }
+        else if (!strncmp(arg, "-gradient=", 10)) {
+            if (opts.gradient.parse(arg + 10)) {
+                fprintf(stderr, "Invalid gradient %s\n", arg + 10);
+                exit(EXIT_FAILURE);
+            }
+            opts.havegradient = 1;
+        }
+        else if (!strncmp(arg, "-scale=", 7)) {
+            double s[4] = { 0.0, 0.0, 0.0, 255.0 };
+            char **vals = CSLTokenizeString2(arg + 7, " \t,", 0);
+            int n = CSLCount(vals);
+            for (int i = 0; i < n && i < 4; i++)
+                s[i] = atof(vals[i]);
+            CSLDestroy(vals);
+            if ((n != 2 && n != 4) || s[0] == s[1]) {
+                fprintf(stderr, "Invalid scale %s\n", arg + 7);
+                exit(EXIT_FAILURE);
+            }
+            opts.havescale = 1;
+            opts.scale = (s[3] - s[2]) / (s[1] - s[0]);
+            opts.offset = s[2] - s[0] * opts.scale;
+        }
+        else if (!strncmp(arg, "-outlut=", 8)) {
+            if (opts.outlut.parse(arg + 8)) {
+                fprintf(stderr, "Invalid lut %s\n", arg + 8);
+                exit(EXIT_FAILURE);
+            }
+            opts.haveoutlut = 1;
+        }
+        else if (!strncmp(arg, "-mask=", 6)) {
+            maskfiles.push_back(arg + 6);
+        }
+        else if (!strncmp(arg, "-srcnodata=", 11)) {
+            opts.havenodata = 1;
+            opts.nodata = atof(arg + 11);
+        }
+        else if (!strcmp(arg, "-washout")) {
+            opts.washout = 1;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - iarg < 2)
+        usage(argv[0]);
+
+    int nbands = argc - iarg - 1;
+    const char *outfile = argv[argc - 1];
+
+    /***** open the inputs *****/
+
+    std::vector<Source> srcs(nbands), masks(maskfiles.size());
+    int ib, im;
+
+    for (ib = 0; ib < nbands; ib++) {
+        if (srcs[ib].open(argv[iarg + ib]))
+            exit(EXIT_FAILURE);
+    }
+    for (im = 0; im < (int) masks.size(); im++) {
+        if (masks[im].open(maskfiles[im]))
+            exit(EXIT_FAILURE);
+    }
+
+    /***** the output grid is the union of the band extents at the finest *****/
+    /***** resolution, as gdalbuildvrt -resolution highest makes it        *****/
+
+    int ref = -1;
+    double minx = 0.0, maxx = 0.0, miny = 0.0, maxy = 0.0;
+    double xres = 0.0, yres = 0.0;
+
+    for (ib = 0; ib < nbands; ib++) {
+        const Source &src = srcs[ib];
+        if (!src.hasgt)
+            continue;
+        double x0 = src.gt[0];
+        double x1 = src.gt[0] + src.nx * src.gt[1];
+        double y0 = src.gt[3] + src.ny * src.gt[5];
+        double y1 = src.gt[3];
+        if (ref < 0 || x0 < minx) minx = x0;
+        if (ref < 0 || x1 > maxx) maxx = x1;
+        if (ref < 0 || y0 < miny) miny = y0;
+        if (ref < 0 || y1 > maxy) maxy = y1;
+        if (ref < 0 || fabs(src.gt[1]) < xres) xres = fabs(src.gt[1]);
+        if (ref < 0 || fabs(src.gt[5]) < yres) yres = fabs(src.gt[5]);
+        if (ref < 0)
+            ref = ib;
+    }
+
+    int nx, ny;
+    double gt[6];
+    if (ref < 0) {
+        nx = srcs[0].nx;
+        ny = srcs[0].ny;
+        memcpy(gt, srcs[0].gt, sizeof(gt));
+    }
+    else {
+        nx = (int) ((maxx - minx) / xres + 0.5);
+        ny = (int) ((maxy - miny) / yres + 0.5);
+        gt[0] = minx; gt[1] = xres; gt[2] = 0.0;
+        gt[3] = maxy; gt[4] = 0.0; gt[5] = -yres;
+    }
+
+    for (ib = 0; ib < nbands; ib++)
+        srcs[ib].setgrid(gt, nx, ny);
+    for (im = 0; im < (int) masks.size(); im++)
+        masks[im].setgrid(gt, nx, ny);
+
+    /***** band luts and expression *****/
+
+    opts.luts.resize(nbands);
+    for (size_t i = 0; i < luts.size(); i++) {
+        if (luts[i].first > nbands ||
+            opts.luts[luts[i].first - 1].parse(luts[i].second))
+        {
+            fprintf(stderr, "Invalid lut %i,%s\n", luts[i].first, luts[i].second);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (calc) {
+        if (opts.calc.parse(calc, nbands))
+            exit(EXIT_FAILURE);
+        opts.havecalc = 1;
+    }
+
+    /***** output type *****/
+
+    if (opts.type == GDT_Unknown) {
+        int allluts = 1;
+        for (ib = 0; ib < nbands; ib++) {
+            if (opts.luts[ib].in.empty())
+                allluts = 0;
+        }
+        if (opts.havecalc || opts.havegradient || opts.havescale ||
+            opts.haveoutlut || allluts)
+            opts.type = GDT_Byte;
+        else
+            opts.type = GDALGetRasterDataType(srcs[0].hBand);
+    }
+
+    /***** the bands the color is made of; all of them for the masks *****/
+
+    std::vector<int> need(nbands, 1);
+    if (!opts.washout && !opts.havenodata) {
+        for (ib = 0; ib < nbands; ib++) {
+            if (opts.havecalc)
+                need[ib] = opts.calc.used[ib];
+            else if (opts.havegradient)
+                need[ib] = (ib == 0);
+            else
+                need[ib] = (ib < 3);
+        }
+    }
+
+    /***** washout collar *****/
+
+    Collar collar;
+    if (opts.washout && find_collar(opts, srcs, gt, nx, ny, collar))
+        exit(EXIT_FAILURE);
+
+    /***** create the output *****/
+
+    char tilestr[32];
+    snprintf(tilestr, sizeof(tilestr), "%u", opts.tilesize);
+
+    char **co = CSLDuplicate(opts.co);
+    co = CSLSetNameValue(co, "TILED", "YES");
+    co = CSLSetNameValue(co, "BLOCKXSIZE", tilestr);
+    co = CSLSetNameValue(co, "BLOCKYSIZE", tilestr);
+    co = CSLSetNameValue(co, "PHOTOMETRIC", "RGB");
+    co = CSLSetNameValue(co, "ALPHA", "YES");
+
+    GDALDatasetH hDst = GDALCreate(GDALGetDriverByName("GTiff"), outfile,
+                                   nx, ny, 4, opts.type, co);
+    CSLDestroy(co);
+    if (!hDst) {
+        fprintf(stderr, "Unable to create %s\n", outfile);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ref >= 0) {
+        GDALSetGeoTransform(hDst, gt);
+        GDALSetProjection(hDst, GDALGetProjectionRef(srcs[ref].hDS));
+    }
+
+    GDALSetRasterColorInterpretation(GDALGetRasterBand(hDst, 1), GCI_RedBand);
+    GDALSetRasterColorInterpretation(GDALGetRasterBand(hDst, 2), GCI_GreenBand);
+    GDALSetRasterColorInterpretation(GDALGetRasterBand(hDst, 3), GCI_BlueBand);
+    GDALSetRasterColorInterpretation(GDALGetRasterBand(hDst, 4), GCI_AlphaBand);
+
+    /***** tile buffers *****/
+
+    size_t tilepix = (size_t) opts.tilesize * opts.tilesize;
+    std::vector<float> banddata(nbands * tilepix);
+    std::vector<float> maskdata(masks.size() * tilepix);
+    std::vector<float> outdata(4 * tilepix);
+    std::vector<float *> bands(nbands), maskbufs(masks.size() + 1), out(4);
+    std::vector<float> tmp;
+
+    for (ib = 0; ib < nbands; ib++)
+        bands[ib] = &banddata[0] + ib * tilepix;
+    for (im = 0; im < (int) masks.size(); im++)
+        maskbufs[im] = &maskdata[0] + im * tilepix;
+    for (int c = 0; c < 4; c++)
+        out[c] = &outdata[0] + c * tilepix;
+
+    std::vector<TileJob> jobs(opts.threads);
+    int bandmap[4] = { 1, 2, 3, 4 };
+    int status = EXIT_SUCCESS;
+
+    Pool pool;
+    if (opts.threads > 1 && pool.init(opts.threads, &jobs))
+        status = EXIT_FAILURE;
+
+    /***** composite a tile at a time *****/
+
+    for (int y = 0; y < ny && status == EXIT_SUCCESS; y += opts.tilesize) {
+        for (int x = 0; x < nx && status == EXIT_SUCCESS; x += opts.tilesize) {
+            int w = (x + (int) opts.tilesize > nx) ? nx - x : opts.tilesize;
+            int h = (y + (int) opts.tilesize > ny) ? ny - y : opts.tilesize;
+
+            /***** read the tile, gdal is not thread safe *****/
+
+            for (ib = 0; ib < nbands && status == EXIT_SUCCESS; ib++) {
+                if (need[ib] &&
+                    srcs[ib].read(gt, x, y, w, h, bands[ib], 0.0f, tmp))
+                {
+                    fprintf(stderr, "Unable to read %s\n", srcs[ib].filename);
+                    status = EXIT_FAILURE;
+                }
+            }
+            for (im = 0; im < (int) masks.size() && status == EXIT_SUCCESS; im++) {
+                if (masks[im].read(gt, x, y, w, h, maskbufs[im], 0.0f, tmp)) {
+                    fprintf(stderr, "Unable to read %s\n", masks[im].filename);
+                    status = EXIT_FAILURE;
+                }
+            }
+            if (status != EXIT_SUCCESS)
+                break;
+
+            /***** composite the rows of the tile on the threads *****/
+
+            int nthreads = (opts.threads < h) ? opts.threads : h;
+            int t;
+            for (t = 0; t < nthreads; t++) {
+                TileJob &job = jobs[t];
+                job.opts = &opts;
+                job.collar = &collar;
+                job.nbands = nbands;
+                job.nmasks = masks.size();
+                job.bands = &bands[0];
+                job.masks = &maskbufs[0];
+                job.out = &out[0];
+                job.x = x;
+                job.y = y;
+                job.w = w;
+                job.row0 = h * t / nthreads;
+                job.row1 = h * (t + 1) / nthreads;
+            }
+
+            if (opts.threads == 1)
+                composite_rows(&jobs[0]);
+            else
+                pool.run(nthreads);
+
+            /***** write the tile *****/
+
+            for (int c = 0; c < 4 && status == EXIT_SUCCESS; c++) {
+                if (GDALRasterIO(GDALGetRasterBand(hDst, bandmap[c]), GF_Write,
+                                 x, y, w, h, out[c], w, h, GDT_Float32,
+                                 0, 0) != CE_None)
+                {
+                    fprintf(stderr, "Unable to write %s\n", outfile);
+                    status = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    if (opts.threads > 1)
+        pool.finish();
+
+    GDALClose(hDst);
+    for (ib = 0; ib < nbands; ib++)
+        GDALClose(srcs[ib].hDS);
+    for (im = 0; im < (int) masks.size(); im++)
+        GDALClose(masks[im].hDS);
+    CSLDestroy(opts.co);
+
+    return status;
+}
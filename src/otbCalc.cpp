@@ -9,71 +9,303 @@
 #endif
 
 
-#include <stdio.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <set>
+#include <string>
+#include <sstream>
+#include <vector>
 
 #include "otbBandMathImageFilter.h"
 
 
 #include "itkExceptionObject.h"
+#include "itkMultiThreader.h"
 #include "otbImage.h"
 #include "otbImageList.h"
-//#include "otbImageToImageListFilter.h"
 #include "otbVectorImage.h"
 #include "otbVectorImageToImageListFilter.h"
 #include "otbImageFileReader.h"
-#include "otbImageFileWriter.h"
-#include "itkRescaleIntensityImageFilter.h"
-#include "otbVectorRescaleIntensityImageFilter.h"
-#include "otbMultiChannelExtractROI.h"
+#include "otbStreamingImageFileWriter.h"
 
+#include "gdal.h"
+#include "gdal_vrt.h"
 
+/***** default size of the tiles the output is streamed in, in pixels *****/
 
-typedef double                                      PixelType; 
-typedef otb::VectorImage<PixelType, 2>              InputImageType; 
-typedef otb::Image<PixelType, 2>                    OutputImageType; 
-typedef otb::ImageList<OutputImageType>             ImageListType; 
-typedef OutputImageType::PixelType                  VPixelType; 
-typedef otb::VectorImageToImageListFilter<InputImageType,ImageListType> 
-                                                    VectorImageToImageListType; 
-typedef otb::ImageFileReader<InputImageType>        ReaderType; 
-typedef otb::ImageFileWriter<OutputImageType>       WriterType;
+#define DEFAULT_TILE_SIZE 512
 
+struct CalcOptions {
+    char *infile;
+    char *outfile;
+    char *expression;
+    unsigned int tilesize;
+};
 
-typedef otb::BandMathImageFilter<OutputImageType>   FilterType;
+/*******************************************************************************
+ find the bands an expression uses
 
-int main (int argc, char *argv[])
-{
+ the bands are the variables b1, b2, ... of the expression.  returns the
+ band numbers in order, or an empty list if a band is not in the image
+*******************************************************************************/
+
+int isnamechar(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+std::vector<int> expression_bands(const char *expression, int nbands) {
+
+    std::set<int> bands;
+    
+    for (const char *p = expression; *p; p++) {
+        if (*p != 'b' || (p > expression && isnamechar(p[-1])))
+            continue;
+        
+        const char *q = p + 1;
+        while (isdigit((unsigned char) *q))
+            q++;
+        if (q == p + 1 || isnamechar(*q))
+            continue;
+        
+        int band = atoi(p + 1);
+        if (band < 1 || band > nbands) {
+            std::cerr << "Expression uses band " << band << ", the image has "
+                      << nbands << " bands" << std::endl;
+            return std::vector<int>();
+        }
+        bands.insert(band);
+        p = q - 1;
+    }
+    
+    /***** the filter needs an input even for a constant expression *****/
 
-    ReaderType::Pointer reader = ReaderType::New(); 
-    WriterType::Pointer writer = WriterType::New(); 
+    if (bands.empty())
+        bands.insert(1);
 
-    FilterType::Pointer filter = FilterType::New(); 
+    return std::vector<int>(bands.begin(), bands.end());
+}
+
+/*******************************************************************************
+ write a vrt of some bands of an image
+
+ the vrt converts the bands to type, so they are read from the image and
+ converted by gdal, and the other bands are never read.  each band keeps the
+ nodata value of its source band
+*******************************************************************************/
+
+int mk_bands_vrt(const char *infile, const char *vrtfile,
+                 const std::vector<int> &bands, GDALDataType type) {
+    
+    GDALDatasetH hSrc = GDALOpen(infile, GA_ReadOnly);
+    if (!hSrc)
+        return -1;
+
+    int nx = GDALGetRasterXSize(hSrc);
+    int ny = GDALGetRasterYSize(hSrc);
+
+    GDALDatasetH hVRT = GDALCreate(GDALGetDriverByName("VRT"), vrtfile,
+                                   nx, ny, 0, type, NULL);
+    if (!hVRT) {
+        GDALClose(hSrc);
+        return -1;
+    }
+
+    double geotransform[6];
+    if (GDALGetGeoTransform(hSrc, geotransform) == CE_None)
+        GDALSetGeoTransform(hVRT, geotransform);
+    GDALSetProjection(hVRT, GDALGetProjectionRef(hSrc));
+
+    for (size_t i = 0; i < bands.size(); i++) {
+        GDALAddBand(hVRT, type, NULL);
+        GDALRasterBandH hSrcBand = GDALGetRasterBand(hSrc, bands[i]);
+        GDALRasterBandH hBand = GDALGetRasterBand(hVRT, i + 1);
+        VRTAddSimpleSource((VRTSourcedRasterBandH) hBand, hSrcBand,
+                           0, 0, nx, ny, 0, 0, nx, ny,
+                           NULL, VRT_NODATA_UNSET);
+
+        int hasnodata = FALSE;
+        double nodata = GDALGetRasterNoDataValue(hSrcBand, &hasnodata);
+        if (hasnodata)
+            GDALSetRasterNoDataValue(hBand, nodata);
+    }
+
+    /***** the vrt is written when it is closed *****/
+
+    GDALClose(hVRT);
+    GDALClose(hSrc);
+
+    return 0;
+}
+
+/*******************************************************************************
+ run the expression over the bands of the vrt and write the result
+
+ the output is written in tiles of tilesize x tilesize pixels, each band of
+ the vrt is input b<band number in the image>
+*******************************************************************************/
+
+template <class TPixel>
+int calc(const CalcOptions &opts, const char *vrtfile,
+         const std::vector<int> &bands) {
+
+    typedef otb::VectorImage<TPixel, 2>                 InputImageType; 
+    typedef otb::Image<TPixel, 2>                       OutputImageType; 
+    typedef otb::ImageList<OutputImageType>             ImageListType; 
+    typedef otb::VectorImageToImageListFilter<InputImageType,ImageListType> 
+                                                        VectorImageToImageListType; 
+    typedef otb::ImageFileReader<InputImageType>        ReaderType; 
+    typedef otb::StreamingImageFileWriter<OutputImageType> WriterType;
+    typedef otb::BandMathImageFilter<OutputImageType>   FilterType;
+
+    typename ReaderType::Pointer reader = ReaderType::New(); 
+    typename WriterType::Pointer writer = WriterType::New(); 
+
+    typename FilterType::Pointer filter = FilterType::New(); 
 
     writer->SetInput(filter->GetOutput()); 
-    reader->SetFileName(argv[1]); 
-    writer->SetFileName(argv[2]);
+    reader->SetFileName(vrtfile); 
+    writer->SetFileName(opts.outfile);
+    writer->SetTileDimensionTiledStreaming(opts.tilesize);
 
-    /***** We need now to extract now each band from the input   *****/
-    /***** otb::VectorImage, it illustrates the use of the       *****/
-    /***** otb::VectorImageToImageList. Each extracted layer are *****/
-    /***** inputs of the otb::BandMathImageFilter:               *****/
+    /***** extract each band from the input otb::VectorImage, *****/
+    /***** each band is an input of the otb::BandMathImageFilter *****/
 
-    VectorImageToImageListType::Pointer imageList = VectorImageToImageListType::New(); 
+    typename VectorImageToImageListType::Pointer imageList =
+        VectorImageToImageListType::New(); 
     imageList->SetInput(reader->GetOutput()); 
 
-    imageList->UpdateOutputInformation(); 
-
-    const unsigned int nbBands = reader->GetOutput()->GetNumberOfComponentsPerPixel(); 
+    try {
+        imageList->UpdateOutputInformation(); 
+    }
+    catch (itk::ExceptionObject &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    for(unsigned int j = 0; j < nbBands; ++j) { 
-        filter->SetNthInput(j, imageList->GetOutput()->GetNthElement(j)); 
+    for (unsigned int j = 0; j < bands.size(); ++j) { 
+        std::ostringstream name;
+        name << "b" << bands[j];
+        filter->SetNthInput(j, imageList->GetOutput()->GetNthElement(j),
+                            name.str());
     }
 
-    filter->SetExpression(argv[3]);
+    filter->SetExpression(opts.expression);
 
     /***** We can now plug the pipeline and run it. *****/
     
-    writer->Update();
+    try {
+        writer->Update();
+    }
+    catch (itk::ExceptionObject &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+void usage(char *arg0) {
+    std::cerr << "Missing Parameters " << std::endl;
+    std::cerr << "Usage: " << arg0;
+    std::cerr << " [-tile=<pixels>] [-threads=<n>] [-double]"
+                 " <inputImage> <outputImage> <expression>" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "    the bands of the input are b1, b2, ... in the expression"
+              << std::endl;
+    std::cerr << "    -tile     size of the tiles the output is streamed in"
+                 " (default " << DEFAULT_TILE_SIZE << ")" << std::endl;
+    std::cerr << "    -threads  number of threads (default the number of cpus)"
+              << std::endl;
+    std::cerr << "    -double   compute in and write float64 instead of float32"
+              << std::endl;
+    exit( EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+    CalcOptions opts;
+    opts.tilesize = DEFAULT_TILE_SIZE;
+    int threads = 0;
+    int usedouble = 0;
+
+    /***** options *****/
+
+    int iarg;
+    for (iarg = 1; iarg < argc && argv[iarg][0] == '-'; iarg++) {
+        if (!strncmp(argv[iarg], "-tile=", 6)) {
+            int tilesize = atoi(argv[iarg] + 6);
+            if (tilesize < 16) {
+                std::cerr << "Invalid tile size " << argv[iarg] + 6 << std::endl;
+                exit( EXIT_FAILURE);
+            }
+            opts.tilesize = tilesize;
+        }
+        else if (!strncmp(argv[iarg], "-threads=", 9)) {
+            threads = atoi(argv[iarg] + 9);
+            if (threads < 1) {
+                std::cerr << "Invalid thread count " << argv[iarg] + 9 << std::endl;
+                exit( EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[iarg], "-double")) {
+            usedouble = 1;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - iarg < 3)
+    {
+        usage(argv[0]);
+    }
+
+    opts.infile = argv[iarg];
+    opts.outfile = argv[iarg + 1];
+    opts.expression = argv[iarg + 2];
+
+    /***** find the bands the expression uses *****/
+
+    GDALAllRegister();
+
+    GDALDatasetH hDS = GDALOpen(opts.infile, GA_ReadOnly);
+    if (!hDS) {
+        std::cerr << "Unable to open " << opts.infile << std::endl;
+        exit( EXIT_FAILURE);
+    }
+    int nbands = GDALGetRasterCount(hDS);
+    GDALClose(hDS);
+
+    std::vector<int> bands = expression_bands(opts.expression, nbands);
+    if (bands.empty())
+        exit( EXIT_FAILURE);
+
+    /***** make a vrt of just those bands in the type to compute in *****/
+
+    std::string vrtfile = std::string(opts.outfile) + ".bands.vrt";
+
+    if (0 > mk_bands_vrt(opts.infile, vrtfile.c_str(), bands,
+                         usedouble ? GDT_Float64 : GDT_Float32)) {
+        std::cerr << "Unable to write " << vrtfile << std::endl;
+        exit( EXIT_FAILURE);
+    }
+
+    /***** the filters take the thread count when they are made *****/
+
+    if (threads > 0) {
+        itk::MultiThreader::SetGlobalMaximumNumberOfThreads(threads);
+        itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
+    }
+
+    int status;
+    if (usedouble)
+        status = calc<double>(opts, vrtfile.c_str(), bands);
+    else
+        status = calc<float>(opts, vrtfile.c_str(), bands);
+
+    remove(vrtfile.c_str());
+
+    return status;
+}
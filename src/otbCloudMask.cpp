@@ -25,27 +25,42 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 #include "otbCloudDetectionFunctor.h"
 #include "otbCloudDetectionFilter.h"
 // Software Guide : EndCodeSnippet
 
 #include "itkExceptionObject.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkMultiThreader.h"
 #include "otbImage.h"
 #include "otbVectorImage.h"
 #include "otbImageFileReader.h"
-#include "otbImageFileWriter.h"
-#include "itkRescaleIntensityImageFilter.h"
-#include "otbVectorRescaleIntensityImageFilter.h"
-#include "otbMultiChannelExtractROI.h"
+
+#include "gdal.h"
+#include "cpl_string.h"
 
 //otbCloudMask RRGlobal_r09c21.2011098.terra.250m.jpg RRGlobal_r09c21.2011098.terra.250m_mask.tif 3 214 214 214 1 .8 1
 
+/***** default size of the tiles the mask is written in, in pixels *****/
+
+#define DEFAULT_TILE_SIZE 512
+
 void usage(char *app) {
 
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr,"    %s <input File> <output File> <nbands>\n", app);
+    fprintf(stderr,"    %s [-tile=<pixels>] [-threads=<n>] [-nbits=<1|8>]\n", app);
+    fprintf(stderr,"        [-compress=<DEFLATE|LZW|PACKBITS|...>] [-v]\n");
+    fprintf(stderr,"        <input File> <output File> <nbands>\n");
     fprintf(stderr,"        <band 1 Pixel Component>... <variance>\n");
     fprintf(stderr,"        <min Threshold 0-1> <maxThreshold 0-1>\n");
+    fprintf(stderr,"\n");
+    fprintf(stderr,"    the output is a GeoTIFF mask, 0 for cloud, 255 (1 with -nbits=1)\n");
+    fprintf(stderr,"    for clear, in tiles of -tile pixels (default %i, a multiple of 16)\n",
+            DEFAULT_TILE_SIZE);
+    fprintf(stderr,"    -v prints the settings to stderr\n");
 
 
 }
@@ -54,17 +69,76 @@ void usage(char *app) {
 int main(int argc, char * argv[])
 {
 
-    if (argc < 7) {
+    char *app = argv[0];
+    unsigned int tilesize = DEFAULT_TILE_SIZE;
+    int threads = 0;
+    int nbits = 8;
+    const char *compress = NULL;
+    int verbose = 0;
+
+    /***** options *****/
+
+    int iarg;
+    for (iarg = 1; iarg < argc && argv[iarg][0] == '-'; iarg++) {
+        if (!strncmp(argv[iarg], "-tile=", 6)) {
+            int n = atoi(argv[iarg] + 6);
+            if (n < 16 || n % 16) {
+                fprintf(stderr, "Invalid tile size %s\n", argv[iarg] + 6);
+                return EXIT_FAILURE;
+            }
+            tilesize = n;
+        }
+        else if (!strncmp(argv[iarg], "-threads=", 9)) {
+            threads = atoi(argv[iarg] + 9);
+            if (threads < 1) {
+                fprintf(stderr, "Invalid thread count %s\n", argv[iarg] + 9);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strncmp(argv[iarg], "-nbits=", 7)) {
+            nbits = atoi(argv[iarg] + 7);
+            if (nbits != 1 && nbits != 8) {
+                fprintf(stderr, "Invalid nbits %s\n", argv[iarg] + 7);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strncmp(argv[iarg], "-compress=", 10)) {
+            compress = argv[iarg] + 10;
+        }
+        else if (!strcmp(argv[iarg], "-v")) {
+            verbose = 1;
+        }
+        else {
+            usage(app);
+            return EXIT_FAILURE;
+        }
+    }
 
-        usage(argv[0]);
+    argc -= iarg - 1;
+    argv += iarg - 1;
+
+    if (argc < 7 || argc < 7 + atoi(argv[3])) {
+
+        usage(app);
         return EXIT_FAILURE;
     }
 
-    const unsigned int Dimension = 2;
-    // Then we must decide what pixel type to use for the images. We choose to do
-    // all the computations in double precision.
+    /***** the filters take the thread count when they are made *****/
 
-    typedef double InputPixelType;
+    if (threads > 0) {
+        itk::MultiThreader::SetGlobalMaximumNumberOfThreads(threads);
+        itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
+    }
+
+    const unsigned int Dimension = 2;
+    // Then we must decide what pixel type to use for the images. The
+    // input is read in float. The functor computes the cloud estimate in
+    // its output type, which must stay double so the estimate is not
+    // truncated before it is compared with the thresholds; the detector
+    // gives 1 for a cloud and 0 otherwise, and is converted to the byte
+    // mask a tile at a time.
+
+    typedef float InputPixelType;
     typedef double OutputPixelType;
 
     //  The images are defined using the pixel type and the
@@ -88,11 +162,10 @@ int main(int argc, char * argv[])
     FunctorType> CloudDetectionFilterType;
 
     //  An ImageFileReader class is also instantiated in order to read
-    //  image data from a file. Then, an ImageFileWriter is instantiated
-    //  in order to write the output image to a file.
+    //  image data from a file. The mask is pulled through the pipeline
+    //  a tile at a time and written with gdal.
 
     typedef otb::ImageFileReader<VectorImageType> ReaderType;
-    typedef otb::ImageFileWriter<OutputImageType> WriterType;
 
     // The different filters composing our pipeline are created by invoking their
     // New() methods, assigning the results to smart pointers.
@@ -100,12 +173,10 @@ int main(int argc, char * argv[])
     ReaderType::Pointer               reader = ReaderType::New();
     CloudDetectionFilterType::Pointer cloudDetection =
         CloudDetectionFilterType::New();
-    WriterType::Pointer writer = WriterType::New();
 
     /***** input file *****/
 
     reader->SetFileName(argv[1]);
-    printf("infile = %s\n", argv[1]);
     cloudDetection->SetInput(reader->GetOutput());
 
 
@@ -116,12 +187,10 @@ int main(int argc, char * argv[])
 
     VectorPixelType referencePixel;
     referencePixel.SetSize(atoi(argv[3]));
-    printf("nbands = %i\n", atoi(argv[3]));
     referencePixel.Fill(0.);
 
     int i;
     for (i = 0; i < atoi(argv[3]) ; i++) {
-        printf ("referencePixel[%i] = %lg\n", i, atof(argv[4 + i]));
         referencePixel[i] = (atof(argv[4 + i]));
     }
 
@@ -132,21 +201,119 @@ int main(int argc, char * argv[])
     // more tolerant the detector will be.
 
     cloudDetection->SetVariance(atof(argv[4 + i]));
-    printf("variance = %lg\n", atof(argv[4 + i]));
     // The minimum and maximum thresholds are set to binarise the final result.
     // These values have to be between 0 and 1.
 
     cloudDetection->SetMinThreshold(atof(argv[5 + i]));
-    printf("MinThreshold = %lg\n", atof(argv[5 + i]));
 
     cloudDetection->SetMaxThreshold(atof(argv[6 + i]));
-    printf("MaxThreshold = %lg\n", atof(argv[6 + i]));
 
-    writer->SetFileName(argv[2]);
-    printf("outfile = %s\n", argv[2]);
-    writer->SetInput(cloudDetection->GetOutput());
-    writer->Update();
+    if (verbose) {
+        fprintf(stderr, "infile = %s\n", argv[1]);
+        fprintf(stderr, "outfile = %s\n", argv[2]);
+        fprintf(stderr, "nbands = %i\n", atoi(argv[3]));
+        for (int ib = 0; ib < atoi(argv[3]); ib++)
+            fprintf(stderr, "referencePixel[%i] = %lg\n", ib, atof(argv[4 + ib]));
+        fprintf(stderr, "variance = %lg\n", atof(argv[4 + i]));
+        fprintf(stderr, "MinThreshold = %lg\n", atof(argv[5 + i]));
+        fprintf(stderr, "MaxThreshold = %lg\n", atof(argv[6 + i]));
+    }
+
+    OutputImageType *mask = cloudDetection->GetOutput();
+
+    try {
+        mask->UpdateOutputInformation();
+    }
+    catch (itk::ExceptionObject &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /***** create the output, with the georeference of the input *****/
+
+    OutputImageType::RegionType largest = mask->GetLargestPossibleRegion();
+    int nx = largest.GetSize()[0];
+    int ny = largest.GetSize()[1];
+
+    GDALAllRegister();
+
+    GDALDatasetH hSrc = GDALOpen(argv[1], GA_ReadOnly);
+    if (!hSrc) {
+        fprintf(stderr, "Unable to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    char tilestr[32];
+    snprintf(tilestr, sizeof(tilestr), "%u", tilesize);
+
+    char **options = NULL;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", tilestr);
+    options = CSLSetNameValue(options, "BLOCKYSIZE", tilestr);
+    if (nbits == 1)
+        options = CSLSetNameValue(options, "NBITS", "1");
+    if (compress)
+        options = CSLSetNameValue(options, "COMPRESS", compress);
+
+    GDALDatasetH hDst = GDALCreate(GDALGetDriverByName("GTiff"), argv[2],
+                                   nx, ny, 1, GDT_Byte, options);
+    CSLDestroy(options);
+    if (!hDst) {
+        fprintf(stderr, "Unable to create %s\n", argv[2]);
+        GDALClose(hSrc);
+        return EXIT_FAILURE;
+    }
+
+    double geotransform[6];
+    if (GDALGetGeoTransform(hSrc, geotransform) == CE_None)
+        GDALSetGeoTransform(hDst, geotransform);
+    GDALSetProjection(hDst, GDALGetProjectionRef(hSrc));
+    GDALClose(hSrc);
+
+    GDALRasterBandH hBand = GDALGetRasterBand(hDst, 1);
+
+    /***** pull the mask through the pipeline a tile at a time *****/
+
+    const GByte clear = (nbits == 1) ? 1 : 255;
+    std::vector<GByte> buf((size_t) tilesize * tilesize);
+    int status = EXIT_SUCCESS;
+
+    for (int y = 0; y < ny && status == EXIT_SUCCESS; y += tilesize) {
+        for (int x = 0; x < nx && status == EXIT_SUCCESS; x += tilesize) {
+            int w = (x + (int) tilesize > nx) ? nx - x : tilesize;
+            int h = (y + (int) tilesize > ny) ? ny - y : tilesize;
+
+            OutputImageType::IndexType index;
+            OutputImageType::SizeType size;
+            index[0] = largest.GetIndex()[0] + x;
+            index[1] = largest.GetIndex()[1] + y;
+            size[0] = w;
+            size[1] = h;
+            OutputImageType::RegionType region(index, size);
+
+            try {
+                mask->SetRequestedRegion(region);
+                mask->PropagateRequestedRegion();
+                mask->UpdateOutputData();
+            }
+            catch (itk::ExceptionObject &err) {
+                std::cerr << err << std::endl;
+                status = EXIT_FAILURE;
+                break;
+            }
+
+            itk::ImageRegionConstIterator<OutputImageType> it(mask, region);
+            GByte *p = &buf[0];
+            for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+                *p++ = (it.Get() != 0.) ? 0 : clear;
+
+            if (GDALRasterIO(hBand, GF_Write, x, y, w, h, &buf[0], w, h,
+                             GDT_Byte, 0, 0) != CE_None)
+                status = EXIT_FAILURE;
+        }
+    }
 
+    GDALClose(hDst);
 
-    return EXIT_SUCCESS;
+    return status;
 }
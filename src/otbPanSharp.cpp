@@ -27,254 +27,191 @@
 #define ITK_LEAN_AND_MEAN
 #endif
 
+#include <cstdlib>
+#include <cstring>
+
 #include "otbImage.h"
 #include "otbVectorImage.h"
 #include "otbImageFileReader.h"
 #include "otbStreamingImageFileWriter.h"
 #include "otbSimpleRcsPanSharpeningFusionImageFilter.h"
+#include "otbStreamingResampleImageFilter.h"
 
-#include "otbPrintableImageFilter.h"
-#include "itkRescaleIntensityImageFilter.h"
-#include "otbImageToVectorImageCastFilter.h"
-#include "otbVectorRescaleIntensityImageFilter.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkMultiThreader.h"
+#include "itkExceptionObject.h"
 
 #include "gdal.h"
 
-void pansharp_byte(char *panfile, char *msfile, char *outfile) {
-    std::cerr << panfile << std::endl;
-    std::cerr << msfile << std::endl;
-    std::cerr << outfile << std::endl;
-    
-    typedef otb::Image<double, 2>                   ImageType;
-    typedef otb::VectorImage<double, 2>             VectorImageType;
-    typedef otb::ImageFileReader<ImageType>         ReaderType;
-    typedef otb::ImageFileReader<VectorImageType>   ReaderVectorType;
-    typedef otb::VectorImage<GByte, 2> VectorIntImageType;
-
-    /***** setup reader for pan band *****/
-
-    ReaderType::Pointer       readerPAN = ReaderType::New();
-    readerPAN->SetFileName(panfile);
-
-    /***** setup reader for ms band *****/
-
-    ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
-    readerXS->SetFileName(msfile);
-
-    /***** setup the filter *****/
+/***** default size of the tiles the output is streamed in, in pixels *****/
 
-    typedef otb::SimpleRcsPanSharpeningFusionImageFilter
-        <ImageType, VectorImageType, VectorIntImageType> FusionFilterType;
-
-    FusionFilterType::Pointer fusion = FusionFilterType::New();
+#define DEFAULT_TILE_SIZE 512
 
-    /***** tie the inputs to the filter *****/
+struct PanSharpOptions {
+    char *panfile;
+    char *msfile;
+    char *outfile;
+    unsigned int tilesize;
+};
 
-    fusion->SetPanInput(readerPAN->GetOutput());
-    fusion->SetXsInput(readerXS->GetOutput());
+/*******************************************************************************
+ pansharpen an ms image with a pan image
 
-    /***** setup output *****/
+ the ms image is resampled to the pan image grid (bilinear) inside the
+ pipeline, and the output is written in tiles of tilesize x tilesize pixels.
+ the streaming resampler asks the ms reader for the part of the ms image
+ under the output tile only, so only a tile of each image is in memory at a
+ time.  the pipeline works in float, the output is cast to TOutputPixel.
+*******************************************************************************/
 
-    typedef otb::StreamingImageFileWriter<VectorIntImageType> WriterType;
-
-    WriterType::Pointer writer = WriterType::New();
-
-    writer->SetFileName(outfile);
-    writer->SetInput(fusion->GetOutput());
-    writer->Update();
-
-}
-
-void pansharp_uint16(char *panfile, char *msfile, char *outfile) {
+template <class TOutputPixel>
+int pansharp(const PanSharpOptions &opts) {
     
-    typedef otb::Image<double, 2>                   ImageType;
-    typedef otb::VectorImage<double, 2>             VectorImageType;
+    typedef float                                   InternalPixelType;
+    typedef otb::Image<InternalPixelType, 2>        ImageType;
+    typedef otb::VectorImage<InternalPixelType, 2>  VectorImageType;
     typedef otb::ImageFileReader<ImageType>         ReaderType;
     typedef otb::ImageFileReader<VectorImageType>   ReaderVectorType;
-    typedef otb::VectorImage<GUInt16, 2> VectorIntImageType;
+    typedef otb::VectorImage<TOutputPixel, 2>       OutputImageType;
 
     /***** setup reader for pan band *****/
 
-    ReaderType::Pointer       readerPAN = ReaderType::New();
-    readerPAN->SetFileName(panfile);
+    typename ReaderType::Pointer readerPAN = ReaderType::New();
+    readerPAN->SetFileName(opts.panfile);
 
     /***** setup reader for ms band *****/
 
-    ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
-    readerXS->SetFileName(msfile);
-
-    /***** setup the filter *****/
+    typename ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
+    readerXS->SetFileName(opts.msfile);
 
-    typedef otb::SimpleRcsPanSharpeningFusionImageFilter
-        <ImageType, VectorImageType, VectorIntImageType> FusionFilterType;
-
-    FusionFilterType::Pointer fusion = FusionFilterType::New();
-
-    /***** tie the inputs to the filter *****/
-
-    fusion->SetPanInput(readerPAN->GetOutput());
-    fusion->SetXsInput(readerXS->GetOutput());
-
-    /***** setup output *****/
-
-    typedef otb::StreamingImageFileWriter<VectorIntImageType> WriterType;
-
-    WriterType::Pointer writer = WriterType::New();
-
-    writer->SetFileName(outfile);
-    writer->SetInput(fusion->GetOutput());
-    writer->Update();
-
-}
-
-void pansharp_int16(char *panfile, char *msfile, char *outfile) {
-    
-    typedef otb::Image<double, 2>                   ImageType;
-    typedef otb::VectorImage<double, 2>             VectorImageType;
-    typedef otb::ImageFileReader<ImageType>         ReaderType;
-    typedef otb::ImageFileReader<VectorImageType>   ReaderVectorType;
-    typedef otb::VectorImage<GInt16, 2> VectorIntImageType;
-
-    /***** setup reader for pan band *****/
-
-    ReaderType::Pointer       readerPAN = ReaderType::New();
-    readerPAN->SetFileName(panfile);
-
-    /***** setup reader for ms band *****/
-
-    ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
-    readerXS->SetFileName(msfile);
-
-    /***** setup the filter *****/
-
-    typedef otb::SimpleRcsPanSharpeningFusionImageFilter
-        <ImageType, VectorImageType, VectorIntImageType> FusionFilterType;
-
-    FusionFilterType::Pointer fusion = FusionFilterType::New();
-
-    /***** tie the inputs to the filter *****/
-
-    fusion->SetPanInput(readerPAN->GetOutput());
-    fusion->SetXsInput(readerXS->GetOutput());
-
-    /***** setup output *****/
-
-    typedef otb::StreamingImageFileWriter<VectorIntImageType> WriterType;
-
-    WriterType::Pointer writer = WriterType::New();
-
-    writer->SetFileName(outfile);
-    writer->SetInput(fusion->GetOutput());
-    writer->Update();
+    try {
+        readerPAN->UpdateOutputInformation();
+        readerXS->UpdateOutputInformation();
+    }
+    catch (itk::ExceptionObject &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
 
-}
+    /***** resample the ms image to the pan grid *****/
 
+    typedef otb::StreamingResampleImageFilter
+        <VectorImageType, VectorImageType, double> ResampleType;
+    typedef itk::LinearInterpolateImageFunction<VectorImageType, double>
+        InterpolatorType;
 
-void pansharp_uint32(char *panfile, char *msfile, char *outfile) {
-    
-    typedef otb::Image<double, 2>                   ImageType;
-    typedef otb::VectorImage<double, 2>             VectorImageType;
-    typedef otb::ImageFileReader<ImageType>         ReaderType;
-    typedef otb::ImageFileReader<VectorImageType>   ReaderVectorType;
-    typedef otb::VectorImage<GUInt32, 2> VectorIntImageType;
+    ImageType *pan = readerPAN->GetOutput();
 
-    /***** setup reader for pan band *****/
+    typename ResampleType::Pointer resampleXS = ResampleType::New();
+    resampleXS->SetInput(readerXS->GetOutput());
+    resampleXS->SetInterpolator(InterpolatorType::New());
+    resampleXS->SetOutputParametersFromImage(pan);
 
-    ReaderType::Pointer       readerPAN = ReaderType::New();
-    readerPAN->SetFileName(panfile);
-
-    /***** setup reader for ms band *****/
-
-    ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
-    readerXS->SetFileName(msfile);
+    typename VectorImageType::PixelType padding;
+    padding.SetSize(readerXS->GetOutput()->GetNumberOfComponentsPerPixel());
+    padding.Fill(0);
+    resampleXS->SetEdgePaddingValue(padding);
 
     /***** setup the filter *****/
 
     typedef otb::SimpleRcsPanSharpeningFusionImageFilter
-        <ImageType, VectorImageType, VectorIntImageType> FusionFilterType;
+        <ImageType, VectorImageType, OutputImageType> FusionFilterType;
 
-    FusionFilterType::Pointer fusion = FusionFilterType::New();
+    typename FusionFilterType::Pointer fusion = FusionFilterType::New();
 
     /***** tie the inputs to the filter *****/
 
-    fusion->SetPanInput(readerPAN->GetOutput());
-    fusion->SetXsInput(readerXS->GetOutput());
+    fusion->SetPanInput(pan);
+    fusion->SetXsInput(resampleXS->GetOutput());
 
     /***** setup output *****/
 
-    typedef otb::StreamingImageFileWriter<VectorIntImageType> WriterType;
+    typedef otb::StreamingImageFileWriter<OutputImageType> WriterType;
 
-    WriterType::Pointer writer = WriterType::New();
+    typename WriterType::Pointer writer = WriterType::New();
 
-    writer->SetFileName(outfile);
+    writer->SetFileName(opts.outfile);
     writer->SetInput(fusion->GetOutput());
-    writer->Update();
-
-}
-
-void pansharp_int32(char *panfile, char *msfile, char *outfile) {
-    
-    typedef otb::Image<double, 2>                   ImageType;
-    typedef otb::VectorImage<double, 2>             VectorImageType;
-    typedef otb::ImageFileReader<ImageType>         ReaderType;
-    typedef otb::ImageFileReader<VectorImageType>   ReaderVectorType;
-    typedef otb::VectorImage<GInt32, 2> VectorIntImageType;
-
-    /***** setup reader for pan band *****/
-
-    ReaderType::Pointer       readerPAN = ReaderType::New();
-    readerPAN->SetFileName(panfile);
-
-    /***** setup reader for ms band *****/
-
-    ReaderVectorType::Pointer readerXS = ReaderVectorType::New();
-    readerXS->SetFileName(msfile);
-
-    /***** setup the filter *****/
-
-    typedef otb::SimpleRcsPanSharpeningFusionImageFilter
-        <ImageType, VectorImageType, VectorIntImageType> FusionFilterType;
-
-    FusionFilterType::Pointer fusion = FusionFilterType::New();
-
-    /***** tie the inputs to the filter *****/
-
-    fusion->SetPanInput(readerPAN->GetOutput());
-    fusion->SetXsInput(readerXS->GetOutput());
+    writer->SetTileDimensionTiledStreaming(opts.tilesize);
 
-    /***** setup output *****/
-
-    typedef otb::StreamingImageFileWriter<VectorIntImageType> WriterType;
-
-    WriterType::Pointer writer = WriterType::New();
-
-    writer->SetFileName(outfile);
-    writer->SetInput(fusion->GetOutput());
-    writer->Update();
+    try {
+        writer->Update();
+    }
+    catch (itk::ExceptionObject &err) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
 
+    return EXIT_SUCCESS;
 }
 
 void usage(char *arg0) {
     std::cerr << "Missing Parameters " << std::endl;
     std::cerr << "Usage: " << arg0;
     std::cerr <<
-        " < byte || uint16 || int16 || uint32 || int32 > <inputPanchromatiqueImage> <inputMultiSpectralImage> <outputImage>"
+        " [-tile=<pixels>] [-threads=<n>]"
+        " < byte || uint16 || int16 || uint32 || int32 || float32 >"
+        " <inputPanchromatiqueImage> <inputMultiSpectralImage> <outputImage>"
          << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "    -tile     size of the tiles the output is streamed in"
+                 " (default " << DEFAULT_TILE_SIZE << ")" << std::endl;
+    std::cerr << "    -threads  number of threads (default the number of cpus)"
+              << std::endl;
     exit( EXIT_FAILURE);
 }
     
 int main(int argc, char* argv[]) {
     
-    if (argc < 5)
+    PanSharpOptions opts;
+    opts.tilesize = DEFAULT_TILE_SIZE;
+    int threads = 0;
+
+    /***** options *****/
+
+    int iarg;
+    for (iarg = 1; iarg < argc && argv[iarg][0] == '-'; iarg++) {
+        if (!strncmp(argv[iarg], "-tile=", 6)) {
+            int tilesize = atoi(argv[iarg] + 6);
+            if (tilesize < 16) {
+                std::cerr << "Invalid tile size " << argv[iarg] + 6 << std::endl;
+                exit( EXIT_FAILURE);
+            }
+            opts.tilesize = tilesize;
+        }
+        else if (!strncmp(argv[iarg], "-threads=", 9)) {
+            threads = atoi(argv[iarg] + 9);
+            if (threads < 1) {
+                std::cerr << "Invalid thread count " << argv[iarg] + 9 << std::endl;
+                exit( EXIT_FAILURE);
+            }
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - iarg < 4)
     {
         usage(argv[0]);
     }    
 
+    opts.panfile = argv[iarg + 1];
+    opts.msfile = argv[iarg + 2];
+    opts.outfile = argv[iarg + 3];
+
+    /***** the filters take the thread count when they are made *****/
+
+    if (threads > 0) {
+        itk::MultiThreader::SetGlobalMaximumNumberOfThreads(threads);
+        itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
+    }
+
     int type;
     for( type = 0; type < GDT_TypeCount; type++ ) {
 
         if ( GDALGetDataTypeName( (GDALDataType) type ) &&
-             EQUAL(GDALGetDataTypeName((GDALDataType) type), argv[1])
+             EQUAL(GDALGetDataTypeName((GDALDataType) type), argv[iarg])
            ) {
             break;
         }
@@ -285,41 +222,37 @@ int main(int argc, char* argv[]) {
         /***** byte *****/
 
         case GDT_Byte:
-            pansharp_byte(argv[2], argv[3], argv[4]);
-            break;
+            return pansharp<GByte>(opts);
 
         /***** uint16 *****/
         
         case GDT_UInt16:
-            pansharp_uint16(argv[2], argv[3], argv[4]);
-            break;
+            return pansharp<GUInt16>(opts);
 
         /***** int16 *****/
 
         case GDT_Int16:
-            pansharp_int16(argv[2], argv[3], argv[4]);
-            break;
+            return pansharp<GInt16>(opts);
 
         /***** uint32 *****/
 
         case GDT_UInt32:
-            pansharp_uint32(argv[2], argv[3], argv[4]);
-            break;
+            return pansharp<GUInt32>(opts);
 
         /***** int32 *****/
 
         case GDT_Int32:
-            pansharp_int32(argv[2], argv[3], argv[4]);
-            break;
+            return pansharp<GInt32>(opts);
+
+        /***** float32 *****/
+
+        case GDT_Float32:
+            return pansharp<float>(opts);
         
         default:
             usage(argv[0]);
             break;
     }
 
-
-    
-
-
-    return EXIT_SUCCESS;
+    return EXIT_FAILURE;
 }